@@ -0,0 +1,101 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#include "bench.h"
+
+#include "cl-jcr-parser/parser.h"
+#include "dsl-pa/dsl-pa.h"
+#include "cl-utils/str-args.h"
+
+#include <cstdio>
+
+using namespace cljcr;
+
+namespace {
+
+std::string make_many_rules_grammar( size_t n_rules )
+{
+    std::string grammar( "#jcr-version 0.9\n#ruleset-id bench_arena\n; Root rule\n@{root} [ $r0 * ]\n" );
+    for( size_t i = 0; i < n_rules; ++i )
+        clutils::expand_append( &grammar, "$r%0 = { \"a%0\" : integer, \"b%0\" : [ string * ] }\n", i );
+    return grammar;
+}
+
+} // End of Anonymous namespace
+
+BENCHMARK( "Arena - build and tear down a large grammar" )
+{
+    const size_t n_rules = 20000;
+    std::string input( make_many_rules_grammar( n_rules ) );
+
+    double build_seconds = 0.0;
+    double teardown_seconds = 0.0;
+    size_t n_blocks = 0;
+    size_t n_rules_created = 0;
+    for( size_t i = 0; i < 5; ++i )
+    {
+        GrammarSet * p_grammar_set = new GrammarSet;
+        {
+            bench::Timer timer;
+            JCRParser jcr_parser( p_grammar_set );
+            cl::reader_mem_buf reader( input.data(), input.size() );
+            if( jcr_parser.add_grammar( reader, "bench" ) != JCRParser::S_OK )
+            {
+                printf( "    Error: benchmark grammar failed to parse\n" );
+                delete p_grammar_set;
+                return;
+            }
+            build_seconds += timer.seconds();
+        }
+        n_blocks = (*p_grammar_set)[0].arena.block_count();
+        n_rules_created = (*p_grammar_set)[0].arena.bytes_allocated() / sizeof( Rule );
+        bench::Timer timer;
+        delete p_grammar_set;
+        teardown_seconds += timer.seconds();
+    }
+    bench::report( "Build", build_seconds, input.size() * 5 );
+    bench::report_items( "Tear down", teardown_seconds, n_rules * 5, "top-level rules" );
+    bench::report_count( "Arena blocks", n_blocks );
+    bench::report_count( "Approximate Rule objects in arena", n_rules_created );
+}
+
+namespace {
+
+size_t count_rules( const Rule & r_rule )
+{
+    size_t n_rules = 1;
+    for( size_t i = 0; i < r_rule.children.size(); ++i )
+        n_rules += count_rules( r_rule.children[i] );
+    return n_rules;
+}
+
+} // End of Anonymous namespace
+
+BENCHMARK( "Rule layout - memory footprint of a 50k rule grammar" )
+{
+    const size_t n_rules = 50000;
+    std::string input( make_many_rules_grammar( n_rules ) );
+
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    cl::reader_mem_buf reader( input.data(), input.size() );
+    if( jcr_parser.add_grammar( reader, "bench" ) != JCRParser::S_OK )
+    {
+        printf( "    Error: benchmark grammar failed to parse\n" );
+        return;
+    }
+
+    size_t n_rule_objects = 0;
+    for( size_t i = 0; i < grammar_set[0].rules.size(); ++i )
+        n_rule_objects += count_rules( grammar_set[0].rules[i] );
+
+    bench::report_count( "sizeof( Rule )", sizeof( Rule ) );
+    bench::report_count( "Rule objects", n_rule_objects );
+    bench::report_count( "Arena bytes", grammar_set[0].arena.bytes_allocated() );
+    bench::report_count( "Arena bytes per Rule object", grammar_set[0].arena.bytes_allocated() / n_rule_objects );
+}
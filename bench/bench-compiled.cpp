@@ -0,0 +1,172 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#include "bench.h"
+
+#include "cl-jcr-parser/parser.h"
+#include "cl-jcr-parser/compiled-grammar.h"
+#include "cl-utils/str-args.h"
+
+#include <cstdio>
+
+using namespace cljcr;
+
+namespace {
+
+// Both walks visit each global rule and its descendants, following the
+// links to the type rules, in the way that a validator would, and sum
+// some of each rule's properties so that the walk can't be optimised away
+
+size_t walk_rule( const Rule & r_rule, int depth )
+{
+    size_t sum = r_rule.get_type() + r_rule.get_repetition().min + (r_rule.is_member_rule() ? 1 : 0);
+    if( depth > 0 )
+    {
+        const Rule::children_container_t & r_children = r_rule.get_children();
+        for( size_t i = 0; i < r_children.size(); ++i )
+            sum += walk_rule( r_children[i], depth - 1 );
+    }
+    return sum;
+}
+
+size_t walk_rules( const GrammarSet & r_grammar_set, int depth )
+{
+    size_t sum = 0;
+    for( size_t i = 0; i < r_grammar_set.size(); ++i )
+        for( size_t j = 0; j < r_grammar_set[i].rules.size(); ++j )
+            sum += walk_rule( r_grammar_set[i].rules[j], depth );
+    return sum;
+}
+
+size_t walk_node( const CompiledGrammar & r_compiled, CompiledGrammar::Node node, int depth )
+{
+    size_t sum = r_compiled.type( node ) + r_compiled.repetition( node ).min + (r_compiled.is_member_rule( node ) ? 1 : 0);
+    if( depth > 0 )
+    {
+        CompiledGrammar::Node end = r_compiled.first_child( node ) + static_cast< CompiledGrammar::Node >( r_compiled.child_count( node ) );
+        for( CompiledGrammar::Node child = r_compiled.first_child( node ); child != end; ++child )
+            sum += walk_node( r_compiled, child, depth - 1 );
+    }
+    return sum;
+}
+
+size_t walk_nodes( const CompiledGrammar & r_compiled, int depth )
+{
+    size_t sum = 0;
+    for( size_t i = 0; i < r_compiled.grammar_count(); ++i )
+    {
+        const CompiledGrammar::GrammarEntry & r_entry = r_compiled.grammar( i );
+        for( CompiledGrammar::Node node = r_entry.first_rule; node != r_entry.first_rule + r_entry.n_rules; ++node )
+            sum += walk_node( r_compiled, node, depth );
+    }
+    return sum;
+}
+
+void traverse( size_t n_rule_groups )
+{
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    if( jcr_parser.add_grammar( bench::make_grammar( n_rule_groups ) ) != JCRParser::S_OK ||
+            jcr_parser.link() != JCRParser::S_OK )
+    {
+        printf( "    Error: benchmark grammar failed to parse or link\n" );
+        return;
+    }
+
+    bench::Timer compile_timer;
+    CompiledGrammar compiled( grammar_set );
+    double compile_seconds = compile_timer.seconds();
+    std::string what( clutils::expand( "Compile %0 rules", compiled.size() ) );
+    bench::report_items( what.c_str(), compile_seconds, compiled.size(), "rules" );
+
+    const size_t n_walks = 20;
+    const int depth = 4;
+
+    size_t rule_sum = 0;
+    bench::Timer rule_timer;
+    for( size_t i = 0; i < n_walks; ++i )
+        rule_sum += walk_rules( grammar_set, depth );
+    double rule_seconds = rule_timer.seconds();
+    bench::keep( rule_sum );
+
+    size_t node_sum = 0;
+    bench::Timer node_timer;
+    for( size_t i = 0; i < n_walks; ++i )
+        node_sum += walk_nodes( compiled, depth );
+    double node_seconds = node_timer.seconds();
+    bench::keep( node_sum );
+
+    if( node_sum != rule_sum )
+        printf( "    Error: the walks of the Rule graph and the CompiledGrammar differ\n" );
+
+    what = clutils::expand( "Walk Rule graph, %0 global rules x %1", clutils::str_args( grammar_set[0].rules.size() ) << n_walks );
+    bench::report_items( what.c_str(), rule_seconds, n_walks * grammar_set[0].rules.size(), "global rules" );
+    what = clutils::expand( "Walk CompiledGrammar, %0 global rules x %1", clutils::str_args( grammar_set[0].rules.size() ) << n_walks );
+    bench::report_items( what.c_str(), node_seconds, n_walks * grammar_set[0].rules.size(), "global rules" );
+}
+
+void start_up( size_t n_rule_groups )
+{
+    const char * p_file_name = "bench-compiled.jcrb";
+    std::string jcr( bench::make_grammar( n_rule_groups ) );
+
+    bench::Timer link_timer;
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    if( jcr_parser.add_grammar( jcr ) != JCRParser::S_OK || jcr_parser.link() != JCRParser::S_OK )
+    {
+        printf( "    Error: benchmark grammar failed to parse or link\n" );
+        return;
+    }
+    double link_seconds = link_timer.seconds();
+
+    if( CompiledGrammar( grammar_set ).save( p_file_name ) != CompiledGrammar::S_OK )
+    {
+        printf( "    Error: unable to save %s\n", p_file_name );
+        return;
+    }
+
+    CompiledGrammar loaded;
+    bench::Timer load_timer;
+    CompiledGrammar::Status status = loaded.load( p_file_name );
+    double load_seconds = load_timer.seconds();
+
+    CompiledGrammar checked;
+    bench::Timer check_timer;
+    checked.load( p_file_name, true );
+    double check_seconds = check_timer.seconds();
+    remove( p_file_name );
+
+    if( status != CompiledGrammar::S_OK )
+    {
+        printf( "    Error: unable to load %s\n", p_file_name );
+        return;
+    }
+    std::string what( clutils::expand( "Parse and link %0 bytes of JCR", jcr.size() ) );
+    bench::report( what.c_str(), link_seconds, jcr.size() );
+    what = clutils::expand( "Load %0 byte .jcrb, checking header", loaded.bytes_used() );
+    bench::report( what.c_str(), load_seconds, loaded.bytes_used() );
+    what = clutils::expand( "Load %0 byte .jcrb, checking block", checked.bytes_used() );
+    bench::report( what.c_str(), check_seconds, checked.bytes_used() );
+}
+
+} // End of Anonymous namespace
+
+BENCHMARK( "Traversal - Rule graph versus CompiledGrammar" )
+{
+    traverse( 1000 );
+    traverse( 10000 );
+    traverse( 50000 );
+}
+
+BENCHMARK( "Start up - parse and link versus loading a .jcrb file" )
+{
+    start_up( 1000 );
+    start_up( 10000 );
+    start_up( 50000 );
+}
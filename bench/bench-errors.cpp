@@ -0,0 +1,170 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#include "bench.h"
+
+#include "cl-jcr-parser/parser.h"
+#include "cl-utils/str-args.h"
+
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#if ! defined( _WIN32 )
+    #include <glob.h>
+#endif
+
+using namespace cljcr;
+
+namespace {
+
+// The benchmark is run from the top-level directory of the repository
+const char * const bad_grammars_pattern = "execution-tests/*/bad-*.jcr";
+
+std::vector< std::string > load_bad_grammars()
+{
+    std::vector< std::string > grammars;
+#if ! defined( _WIN32 )
+    glob_t found;
+    if( glob( bad_grammars_pattern, 0, 0, &found ) == 0 )
+    {
+        for( size_t i = 0; i < found.gl_pathc; ++i )
+        {
+            std::ifstream fin( found.gl_pathv[i], std::ios::binary );
+            std::ostringstream contents;
+            contents << fin.rdbuf();
+            grammars.push_back( contents.str() );
+        }
+        globfree( &found );
+    }
+#endif
+    return grammars;
+}
+
+class FatalCounter : public JCRParser
+{
+private:
+    size_t n_fatals;
+
+public:
+    FatalCounter( GrammarSet * p_grammar_set ) : JCRParser( p_grammar_set ), n_fatals( 0 ) {}
+    virtual void report( const std::string &, size_t, size_t, Severity severity, const char * )
+    {
+        if( severity == Severity::FATAL )
+            ++n_fatals;
+    }
+    size_t fatal_count() const { return n_fatals; }
+};
+
+size_t parse_all( const std::vector< std::string > & r_grammars, bool is_exception_free, size_t * p_n_fatals )
+{
+    size_t n_bytes = 0;
+    for( size_t i = 0; i < r_grammars.size(); ++i )
+    {
+        GrammarSet grammar_set;
+        FatalCounter jcr_parser( &grammar_set );
+        jcr_parser.set_exception_free( is_exception_free );
+        jcr_parser.add_grammar( r_grammars[i].data(), r_grammars[i].size() );
+        *p_n_fatals += jcr_parser.fatal_count();
+        n_bytes += r_grammars[i].size();
+    }
+    return n_bytes;
+}
+
+const size_t n_repeats = 2000;
+
+// Formats and de-duplicates each message as text, as JCRParserWithReporter
+// used to, without printing it
+class TextReporter : public JCRParser
+{
+private:
+    std::set< std::string > reported_messages;
+
+public:
+    TextReporter( GrammarSet * p_grammar_set ) : JCRParser( p_grammar_set ) {}
+    virtual void report( const std::string & source, size_t line, size_t column, Severity severity, const char * p_message )
+    {
+        std::ostringstream oss;
+        oss << severity << ": " << source;
+        if( line != ~0U )
+        {
+            oss << " (line: " << line;
+            if( column != ~0U )
+                oss << ", char: " << column;
+            oss << ")";
+        }
+        oss << ":\n      " << p_message << "\n";
+        reported_messages.insert( oss.str() );
+    }
+    size_t size() const { return reported_messages.size(); }
+};
+
+// Every rule refers to a missing rule, and every other rule name is repeated
+std::string make_error_heavy_grammar( size_t n_rules )
+{
+    std::string grammar( "#jcr-version 0.9\n#ruleset-id bench_errors\n" );
+    for( size_t i = 0; i < n_rules; ++i )
+        clutils::expand_append( &grammar, "$r%0 = { \"m\" : $missing%1 }\n", clutils::str_args( i / 2 ) << i );
+    return grammar;
+}
+
+template< typename TParser >
+void link_error_heavy_grammar( const char * p_what, const std::string & r_grammar, size_t n_rules )
+{
+    GrammarSet grammar_set;
+    TParser jcr_parser( &grammar_set );
+    jcr_parser.add_grammar( r_grammar );
+    bench::Timer timer;
+    jcr_parser.link();
+    bench::report_items( p_what, timer.seconds(), n_rules, "rules" );
+}
+
+} // End of Anonymous namespace
+
+BENCHMARK( "Errors - parse the bad-*.jcr execution tests" )
+{
+    std::vector< std::string > grammars( load_bad_grammars() );
+    if( grammars.empty() )
+    {
+        printf( "    Error: no grammars matching %s. Run from the top-level directory\n", bad_grammars_pattern );
+        return;
+    }
+
+    bench::report_count( "Grammars", grammars.size() );
+
+    {
+    size_t n_bytes = 0, n_fatals = 0;
+    bench::Timer timer;
+    for( size_t i = 0; i < n_repeats; ++i )
+        n_bytes += parse_all( grammars, false, &n_fatals );
+    bench::report_items( "Fatal errors unwound by exception", timer.seconds(), grammars.size() * n_repeats, "grammars" );
+    bench::report_count( "Fatal errors per pass", n_fatals / n_repeats );
+    bench::keep( n_bytes );
+    }
+
+    {
+    size_t n_bytes = 0, n_fatals = 0;
+    bench::Timer timer;
+    for( size_t i = 0; i < n_repeats; ++i )
+        n_bytes += parse_all( grammars, true, &n_fatals );
+    bench::report_items( "Fatal errors unwound exception free", timer.seconds(), grammars.size() * n_repeats, "grammars" );
+    bench::report_count( "Fatal errors per pass", n_fatals / n_repeats );
+    bench::keep( n_bytes );
+    }
+}
+
+BENCHMARK( "Errors - collecting the messages of an error heavy grammar" )
+{
+    const size_t n_rules = 50000;
+    std::string grammar( make_error_heavy_grammar( n_rules ) );
+
+    link_error_heavy_grammar< TextReporter >( "Messages formatted as text", grammar, n_rules );
+    link_error_heavy_grammar< JCRParserWithDiagnostics >( "Messages recorded as Diagnostics", grammar, n_rules );
+}
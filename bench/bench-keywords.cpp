@@ -0,0 +1,68 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#include "bench.h"
+
+#include "cl-jcr-parser/parser.h"
+#include "dsl-pa/dsl-pa.h"
+#include "cl-utils/str-args.h"
+
+#include <cstdio>
+
+using namespace cljcr;
+
+namespace {
+
+// Primitive types towards the end of primitive-def's list of alternatives
+// are the most costly to reach by trying each alternative in turn
+const char * const primitive_defs[] = {
+    "null", "boolean", "true", "false", "string", "/^[a-z]+$/", "\"value\"",
+    "double", "float", "0.0..1.5", "3.25", "integer", "-10..10", "42",
+    "int16", "uint32", "ipv4", "ipv6", "ipaddr", "fqdn", "idn", "uri",
+    "uri..https", "phone", "email", "datetime", "date", "time", "hex",
+    "base32hex", "base32", "base64url", "base64", "any" };
+
+const size_t n_primitive_defs = sizeof( primitive_defs ) / sizeof( primitive_defs[0] );
+
+std::string make_primitive_grammar( size_t n_rule_groups )
+{
+    std::string grammar( "#jcr-version 0.9\n#ruleset-id bench_keywords\n; Root rule\n[ $p_0_0 * ]\n" );
+    for( size_t i = 0; i < n_rule_groups; ++i )
+        for( size_t j = 0; j < n_primitive_defs; ++j )
+            clutils::expand_append( &grammar, "$p_%0_%1 = %2\n", clutils::str_args( i ) << j << primitive_defs[j] );
+    return grammar;
+}
+
+const size_t n_repeats = 10;
+
+} // End of Anonymous namespace
+
+BENCHMARK( "Keywords - parse primitive type heavy grammar" )
+{
+    std::string input( make_primitive_grammar( 500 ) );
+
+    size_t n_rewinds = 0;
+
+    bench::Timer timer;
+    for( size_t i = 0; i < n_repeats; ++i )
+    {
+        GrammarSet grammar_set;
+        JCRParser jcr_parser( &grammar_set );
+        cl::reader_mem_buf reader( input.data(), input.size() );
+        if( jcr_parser.add_grammar( reader, "bench" ) != JCRParser::S_OK )
+        {
+            printf( "    Error: benchmark grammar failed to parse\n" );
+            return;
+        }
+        n_rewinds = reader.get_rewind_count();
+        bench::keep( grammar_set[0].rules.size() );
+    }
+    bench::report( "add_grammar( cl::reader &, const std::string & )", timer.seconds(), input.size() * n_repeats );
+    bench::report_count( "Rewinds per parse", n_rewinds );
+    bench::report_count( "Rewinds per primitive def", n_rewinds / (500 * n_primitive_defs) );
+}
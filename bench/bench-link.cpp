@@ -0,0 +1,239 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#include "bench.h"
+
+#include "cl-jcr-parser/parser.h"
+#include "cl-utils/str-args.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace cljcr;
+
+namespace {
+
+// A grammar whose rules refer to each other, and an importing grammar whose
+// rules refer to rules in the first, so that linking looks up rules both
+// locally and via unaliased imports
+void make_linked_grammars( size_t n_rules, std::string * p_base, std::string * p_importer )
+{
+    *p_base = "#jcr-version 0.9\n#ruleset-id bench_link_base\n";
+    for( size_t i = 0; i < n_rules; ++i )
+        clutils::expand_append( p_base, "$b%0 = { \"m\" : $b%1, \"n\" : integer }\n",
+                clutils::str_args( i ) << (i + 1) % n_rules );
+
+    *p_importer = "#jcr-version 0.9\n#ruleset-id bench_link_importer\n#import bench_link_base\n[ $i0 * ]\n";
+    for( size_t i = 0; i < n_rules; ++i )
+        clutils::expand_append( p_importer, "$i%0 = [ $b%0, $i%1 * ]\n",
+                clutils::str_args( i ) << (i + 1) % n_rules );
+}
+
+// Rules that each alias the next, so that every rule's target chain runs to
+// the end of the grammar
+void make_alias_chains( size_t n_rules, std::string * p_grammar )
+{
+    *p_grammar = "#jcr-version 0.9\n#ruleset-id bench_link_chains\n";
+    for( size_t i = 0; i < n_rules; ++i )
+        clutils::expand_append( p_grammar, "$a%0 = $a%1\n", clutils::str_args( i ) << i + 1 );
+    clutils::expand_append( p_grammar, "$a%0 = integer\n", n_rules );
+}
+
+void link( const char * p_description, size_t n_rules, const std::string & r_first, const std::string & r_second )
+{
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    if( jcr_parser.add_grammar( r_first ) != JCRParser::S_OK ||
+            (! r_second.empty() && jcr_parser.add_grammar( r_second ) != JCRParser::S_OK) )
+    {
+        printf( "    Error: benchmark grammars failed to parse\n" );
+        return;
+    }
+
+    bench::Timer timer;
+    JCRParser::Status status = jcr_parser.link();
+    double seconds = timer.seconds();
+    if( status != JCRParser::S_OK )
+    {
+        printf( "    Error: benchmark grammars failed to link\n" );
+        return;
+    }
+
+    std::string what( clutils::expand( p_description, n_rules ) );
+    bench::report_items( what.c_str(), seconds, r_second.empty() ? n_rules : n_rules * 2, "rules" );
+}
+
+void link( size_t n_rules )
+{
+    std::string base, importer;
+    make_linked_grammars( n_rules, &base, &importer );
+    link( "Link %0 + %0 rules", n_rules, base, importer );
+}
+
+void link_alias_chains( size_t n_rules )
+{
+    std::string grammar;
+    make_alias_chains( n_rules, &grammar );
+    link( "Link %0 chained aliases", n_rules, grammar, std::string() );
+}
+
+void link_in_parallel( const std::vector< std::string > & r_grammars, size_t n_rules, unsigned n_threads )
+{
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    for( size_t i = 0; i < r_grammars.size(); ++i )
+        if( jcr_parser.add_grammar( r_grammars[i] ) != JCRParser::S_OK )
+        {
+            printf( "    Error: benchmark grammars failed to parse\n" );
+            return;
+        }
+
+    bench::Timer timer;
+    JCRParser::Status status = jcr_parser.link_in_parallel( n_threads );
+    double seconds = timer.seconds();
+    if( status != JCRParser::S_OK )
+    {
+        printf( "    Error: benchmark grammars failed to link\n" );
+        return;
+    }
+
+    std::string what( clutils::expand( "Link %0 grammars using %1 thread(s)", clutils::str_args( r_grammars.size() ) << n_threads ) );
+    bench::report_items( what.c_str(), seconds, n_rules, "rules" );
+}
+
+// Pairs of grammars, each pair being independent of the others
+std::vector< std::string > make_grammar_pairs( size_t n_pairs, size_t n_rules_per_grammar )
+{
+    std::vector< std::string > grammars;
+    for( size_t i = 0; i < n_pairs; ++i )
+    {
+        std::string base, importer;
+        make_linked_grammars( n_rules_per_grammar, &base, &importer );
+        std::string pair_id( clutils::expand( "_%0", i ) );
+        grammars.push_back( base.replace( base.find( "bench_link_base" ), 15, "bench_link_base" + pair_id ) );
+        importer.replace( importer.find( "bench_link_importer" ), 19, "bench_link_importer" + pair_id );
+        grammars.push_back( importer.replace( importer.find( "bench_link_base" ), 15, "bench_link_base" + pair_id ) );
+    }
+    return grammars;
+}
+
+void replace_grammar( size_t n_pairs, size_t n_rules_per_grammar )
+{
+    std::vector< std::string > grammars( make_grammar_pairs( n_pairs, n_rules_per_grammar ) );
+
+    bench::Timer all_timer;
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    for( size_t i = 0; i < grammars.size(); ++i )
+        jcr_parser.add_grammar( grammars[i] );
+    if( jcr_parser.link() != JCRParser::S_OK )
+    {
+        printf( "    Error: benchmark grammars failed to link\n" );
+        return;
+    }
+    double all_seconds = all_timer.seconds();
+
+    // The first base grammar is edited, so it and its importer are relinked
+    const std::string & r_edited = grammars[0];
+    bench::Timer replace_timer;
+    JCRParser::Status status = jcr_parser.replace_grammar( &grammar_set[0], r_edited.data(), r_edited.size() );
+    double replace_seconds = replace_timer.seconds();
+    if( status != JCRParser::S_OK )
+    {
+        printf( "    Error: benchmark grammar failed to be replaced\n" );
+        return;
+    }
+
+    std::string what( clutils::expand( "Parse and link %0 grammars of %1 rules", clutils::str_args( grammars.size() ) << n_rules_per_grammar ) );
+    bench::report_items( what.c_str(), all_seconds, grammars.size() * n_rules_per_grammar, "rules" );
+    what = clutils::expand( "Replace 1 of %0 grammars of %1 rules", clutils::str_args( grammars.size() ) << n_rules_per_grammar );
+    bench::report_items( what.c_str(), replace_seconds, n_rules_per_grammar, "rules" );
+}
+
+// Grammars that an importing grammar imports without aliases, the importer
+// referring to rules in each of them, so that linking looks up names that
+// are hidden behind those of earlier imports
+void link_wide_imports( size_t n_imports, size_t n_rules_per_import )
+{
+    std::vector< std::string > grammars;
+    std::string importer( "#jcr-version 0.9\n#ruleset-id bench_link_wide\n" );
+    for( size_t i = 0; i < n_imports; ++i )
+    {
+        std::string grammar( clutils::expand( "#jcr-version 0.9\n#ruleset-id bench_link_wide_%0\n", i ) );
+        for( size_t j = 0; j < n_rules_per_import; ++j )
+            clutils::expand_append( &grammar, "$w%0_%1 = integer\n", clutils::str_args( i ) << j );
+        grammars.push_back( grammar );
+        clutils::expand_append( &importer, "#import bench_link_wide_%0\n", i );
+    }
+    for( size_t i = 0; i < n_imports; ++i )
+        for( size_t j = 0; j < n_rules_per_import; ++j )
+            clutils::expand_append( &importer, "$r%0_%1 = [ $w%0_%1, $w%0_%1 * ]\n", clutils::str_args( i ) << j );
+    grammars.push_back( importer );
+
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    for( size_t i = 0; i < grammars.size(); ++i )
+        if( jcr_parser.add_grammar( grammars[i] ) != JCRParser::S_OK )
+        {
+            printf( "    Error: benchmark grammars failed to parse\n" );
+            return;
+        }
+
+    bench::Timer timer;
+    JCRParser::Status status = jcr_parser.link();
+    double seconds = timer.seconds();
+    if( status != JCRParser::S_OK )
+    {
+        printf( "    Error: benchmark grammars failed to link\n" );
+        return;
+    }
+
+    std::string what( clutils::expand( "Link 1 grammar importing %0 grammars of %1 rules", clutils::str_args( n_imports ) << n_rules_per_import ) );
+    bench::report_items( what.c_str(), seconds, 2 * n_imports * n_rules_per_import, "rules" );
+}
+
+} // End of Anonymous namespace
+
+BENCHMARK( "Linking - scaling with rule count" )
+{
+    link( 1000 );
+    link( 10000 );
+    link( 100000 );
+}
+
+BENCHMARK( "Linking - long target rule chains" )
+{
+    link_alias_chains( 1000 );
+    link_alias_chains( 10000 );
+    link_alias_chains( 100000 );
+}
+
+BENCHMARK( "Linking - grammars in parallel" )
+{
+    const size_t n_rules_per_grammar = 10000;
+    std::vector< std::string > grammars( make_grammar_pairs( 8, n_rules_per_grammar ) );
+
+    link_in_parallel( grammars, grammars.size() * n_rules_per_grammar, 1 );
+    link_in_parallel( grammars, grammars.size() * n_rules_per_grammar, 2 );
+    link_in_parallel( grammars, grammars.size() * n_rules_per_grammar, 4 );
+    link_in_parallel( grammars, grammars.size() * n_rules_per_grammar, 8 );
+}
+
+BENCHMARK( "Linking - replacing one grammar of many" )
+{
+    replace_grammar( 10, 1000 );
+    replace_grammar( 100, 1000 );
+    replace_grammar( 50, 10000 );
+}
+
+BENCHMARK( "Linking - many unaliased imports" )
+{
+    link_wide_imports( 10, 1000 );
+    link_wide_imports( 50, 1000 );
+    link_wide_imports( 200, 100 );
+}
@@ -0,0 +1,111 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#include "bench.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sstream>
+
+namespace bench {
+
+volatile size_t sink = 0;
+
+namespace {
+
+struct Benchmark
+{
+    const char * p_description;
+    benchmark_function p_function;
+    Benchmark( const char * p_description_in, benchmark_function p_function_in )
+        : p_description( p_description_in ), p_function( p_function_in )
+    {}
+};
+
+std::vector< Benchmark > & benchmarks()
+{
+    static std::vector< Benchmark > benchmarks;    // Function static avoids static initialisation order problems
+    return benchmarks;
+}
+
+} // End of Anonymous namespace
+
+Registrar::Registrar( const char * p_description, benchmark_function p_function )
+{
+    benchmarks().push_back( Benchmark( p_description, p_function ) );
+}
+
+void report( const char * p_what, double seconds, size_t bytes )
+{
+    double mb = bytes / (1024.0 * 1024.0);
+    printf( "    %-52s %10.2f ms %10.1f MB/s\n", p_what, seconds * 1000.0, seconds > 0.0 ? mb / seconds : 0.0 );
+}
+
+void report_items( const char * p_what, double seconds, size_t items, const char * p_item_name )
+{
+    printf( "    %-52s %10.2f ms %10.0f %s/s\n", p_what, seconds * 1000.0, seconds > 0.0 ? items / seconds : 0.0, p_item_name );
+}
+
+void report_count( const char * p_what, size_t count )
+{
+    printf( "    %-52s %10lu\n", p_what, static_cast< unsigned long >( count ) );
+}
+
+std::string make_grammar( size_t n_rule_groups )
+{
+    std::ostringstream grammar;
+
+    grammar << "#jcr-version 0.9\n"
+                "#ruleset-id bench_rules\n\n"
+                "; Root rule\n"
+                "[ $image_0 * ]\n\n";
+
+    for( size_t i = 0; i < n_rule_groups; ++i )
+    {
+        grammar <<
+            "; Definition of image " << i << "\n"
+            "$image_" << i << " = {\n"
+            "    $dimensions_" << i << ",\n"
+            "    \"Title\" : string,\n"
+            "    \"Thumbnail\" : {\n"
+            "        \"Url\" : uri,\n"
+            "        $dimensions_" << i << "\n"
+            "    },\n"
+            "    \"Animated\" : boolean,\n"
+            "    \"Ratio\" : 0.5..2.5,\n"
+            "    /^tag[0-9]+$/ : string,\n"
+            "    \"IDs\" : [ integer * ]\n"
+            "}\n"
+            "$dimensions_" << i << " = ( $width_" << i << ", $height_" << i << " )\n"
+            "$width_" << i << " = \"Width\" : 0..1280  ; Pixels\n"
+            "$height_" << i << " = \"Height\" : 0..1024\n"
+            "$kind_" << i << " = \"Kind\" : ( \"photo\" | \"drawing \\\"sketch\\\"\" | null )\n\n";
+    }
+
+    return grammar.str();
+}
+
+} // End of namespace bench
+
+int main( int argc, char * argv[] )
+{
+    const char * p_filter = argc > 1 ? argv[1] : "";
+
+    std::vector< bench::Benchmark > & r_benchmarks = bench::benchmarks();
+    for( size_t i = 0; i < r_benchmarks.size(); ++i )
+    {
+        if( strstr( r_benchmarks[i].p_description, p_filter ) )
+        {
+            printf( "%s\n", r_benchmarks[i].p_description );
+            r_benchmarks[i].p_function();
+        }
+    }
+
+    return 0;
+}
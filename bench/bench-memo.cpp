@@ -0,0 +1,66 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#include "bench.h"
+
+#include "cl-jcr-parser/parser.h"
+#include "dsl-pa/dsl-pa.h"
+#include "cl-utils/str-args.h"
+
+#include <cstdio>
+
+using namespace cljcr;
+
+namespace {
+
+// Rules whose definitions are reached late in the list of alternatives, and
+// so have their annotations parsed several times when not memoising
+std::string make_annotated_grammar( size_t n_rule_groups )
+{
+    std::string grammar( "#jcr-version 0.9\n#ruleset-id bench_memo\n; Root rule\n@{root} [ $target_0 * ]\n" );
+    for( size_t i = 0; i < n_rule_groups; ++i )
+        clutils::expand_append( &grammar,
+                "$target_%0 = @{not} @{augments $group_%0} @{format date-time} $group_%0\n"
+                "$group_%0 = @{not} @{unordered} @{augments $object_%0} ( $object_%0 | @{not} @{root} ( string | integer ) )\n"
+                "$object_%0 = @{unordered} @{default 12} { \"name\" : @{not} @{exclude-min} @{exclude-max} 0..100, @{choice} ( \"a\" : string | \"b\" : integer ) }\n",
+                i );
+    return grammar;
+}
+
+void parse( const std::string & r_input, bool is_memoising, const char * p_what )
+{
+    size_t n_rewinds = 0;
+
+    bench::Timer timer;
+    for( size_t i = 0; i < 10; ++i )
+    {
+        GrammarSet grammar_set;
+        JCRParser jcr_parser( &grammar_set );
+        jcr_parser.set_memoising( is_memoising );
+        cl::reader_mem_buf reader( r_input.data(), r_input.size() );
+        if( jcr_parser.add_grammar( reader, "bench" ) != JCRParser::S_OK )
+        {
+            printf( "    Error: benchmark grammar failed to parse\n" );
+            return;
+        }
+        n_rewinds = reader.get_rewind_count();
+        bench::keep( grammar_set[0].rules.size() );
+    }
+    bench::report( p_what, timer.seconds(), r_input.size() * 10 );
+    bench::report_count( "Rewinds per parse", n_rewinds );
+}
+
+} // End of Anonymous namespace
+
+BENCHMARK( "Memoising - parse annotation heavy grammar" )
+{
+    std::string input( make_annotated_grammar( 1000 ) );
+
+    parse( input, false, "Annotations reparsed per alternative" );
+    parse( input, true, "Annotations memoised" );
+}
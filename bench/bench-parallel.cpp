@@ -0,0 +1,65 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#include "bench.h"
+
+#include "cl-jcr-parser/parser.h"
+#include "cl-utils/str-args.h"
+
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+using namespace cljcr;
+
+namespace {
+
+void add_grammars( const std::vector< std::string > & r_file_names, size_t n_bytes, unsigned n_threads )
+{
+    double seconds = 0.0;
+    for( size_t i = 0; i < 5; ++i )
+    {
+        GrammarSet grammar_set;
+        JCRParser jcr_parser( &grammar_set );
+        bench::Timer timer;
+        if( jcr_parser.add_grammars( r_file_names, n_threads ) != JCRParser::S_OK )
+        {
+            printf( "    Error: benchmark grammars failed to parse\n" );
+            return;
+        }
+        seconds += timer.seconds();
+    }
+
+    std::string what( clutils::expand( "%0 files using %1 thread(s)", clutils::str_args( r_file_names.size() ) << n_threads ) );
+    bench::report( what.c_str(), seconds / 5, n_bytes );
+}
+
+} // End of Anonymous namespace
+
+BENCHMARK( "Parallel parsing - add_grammars() with a number of files" )
+{
+    const size_t n_files = 16;
+    std::vector< std::string > file_names;
+    size_t n_bytes = 0;
+    for( size_t i = 0; i < n_files; ++i )
+    {
+        std::string grammar( bench::make_grammar( 500 ) );
+        n_bytes += grammar.size();
+        file_names.push_back( clutils::expand( "bench-parallel-%0.jcr", i ) );
+        std::ofstream fout( file_names.back().c_str(), std::ios::binary );
+        fout << grammar;
+    }
+
+    add_grammars( file_names, n_bytes, 1 );
+    add_grammars( file_names, n_bytes, 2 );
+    add_grammars( file_names, n_bytes, 4 );
+    add_grammars( file_names, n_bytes, 8 );
+
+    for( size_t i = 0; i < n_files; ++i )
+        remove( file_names[i].c_str() );
+}
@@ -0,0 +1,173 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#include "bench.h"
+
+#include "cl-jcr-parser/parser.h"
+#include "dsl-pa/dsl-pa.h"
+#include "cl-utils/history-buffer.h"
+
+#include <cstdio>
+#include <stack>
+
+using namespace cljcr;
+
+namespace {
+
+// A reader that fetches each character via a virtual call and updates a
+// history of line and column positions for every character, as cl::reader
+// did before it was given a contiguous input window and a lazily built
+// line_index.  It allows the gain of the current reader::get() path to be
+// measured.
+class virtual_reader
+{
+private:
+    struct position
+    {
+        int line_number;
+        int column_number;
+        position( int line_number_in, int column_number_in )
+            : line_number( line_number_in ), column_number( column_number_in )
+        {}
+    };
+    clutils::HistoryBuffer< position, 10 > positions;
+    char last_nl_char;
+    std::stack< char > unget_buffer;
+    char current_char;
+
+    virtual char get_next_input() = 0;
+
+    void got_char( char c )
+    {
+        int line_number = positions.get().line_number;
+        int column_number = positions.get().column_number;
+        if( c == '\r' || c == '\n' )
+        {
+            column_number = 0;
+            if( last_nl_char == '\0' || last_nl_char == c )
+                ++line_number;
+            last_nl_char = (last_nl_char != '\0') ? '\0' : c;
+        }
+        else
+        {
+            ++column_number;
+            last_nl_char = '\0';
+        }
+        positions.push( position( line_number, column_number ) );
+    }
+
+public:
+    virtual_reader() : last_nl_char( '\0' ), current_char( cl::reader::R_EOI )
+    {
+        positions.push( position( 1, 0 ) );
+    }
+    virtual ~virtual_reader() {}
+
+    char get()
+    {
+        if( ! unget_buffer.empty() )
+        {
+            current_char = unget_buffer.top();
+            unget_buffer.pop();
+            if( positions.has_frwd() )
+                positions.go_frwd();
+        }
+        else
+        {
+            current_char = get_next_input();
+            got_char( current_char );
+        }
+        return current_char;
+    }
+};
+
+class virtual_reader_mem_buf : public virtual_reader
+{
+private:
+    const char * p_current, * p_end;
+
+    virtual char get_next_input()
+    {
+        if( p_current != p_end )
+            return *p_current++;
+        return cl::reader::R_EOI;
+    }
+
+public:
+    virtual_reader_mem_buf( const char * p_begin, size_t size )
+        : p_current( p_begin ), p_end( p_begin + size )
+    {}
+};
+
+size_t count_newlines_via_virtual( virtual_reader & r_reader )
+{
+    size_t n_newlines = 0;
+    char c;
+    while( (c = r_reader.get()) != cl::reader::R_EOI )
+        if( c == '\n' )
+            ++n_newlines;
+    return n_newlines;
+}
+
+size_t count_newlines_via_reader( cl::reader & r_reader )
+{
+    size_t n_newlines = 0;
+    char c;
+    while( (c = r_reader.get()) != cl::reader::R_EOI )
+        if( c == '\n' )
+            ++n_newlines;
+    return n_newlines;
+}
+
+const size_t n_repeats = 10;
+
+} // End of Anonymous namespace
+
+BENCHMARK( "Reader - per-character access" )
+{
+    std::string input( bench::make_grammar( 500 ) );
+
+    {
+    bench::Timer timer;
+    for( size_t i = 0; i < n_repeats; ++i )
+    {
+        virtual_reader_mem_buf reader( input.data(), input.size() );
+        bench::keep( count_newlines_via_virtual( reader ) );
+    }
+    bench::report( "virtual get_next_input() with position tracking", timer.seconds(), input.size() * n_repeats );
+    }
+
+    {
+    bench::Timer timer;
+    for( size_t i = 0; i < n_repeats; ++i )
+    {
+        cl::reader_mem_buf reader( input.data(), input.size() );
+        bench::keep( count_newlines_via_reader( reader ) );
+    }
+    bench::report( "reader::get()", timer.seconds(), input.size() * n_repeats );
+    }
+}
+
+BENCHMARK( "GrammarParser - parse throughput" )
+{
+    std::string input( bench::make_grammar( 500 ) );
+
+    bench::Timer timer;
+    for( size_t i = 0; i < n_repeats; ++i )
+    {
+        GrammarSet grammar_set;
+        JCRParser jcr_parser( &grammar_set );
+        if( jcr_parser.add_grammar( input.data(), input.size() ) != JCRParser::S_OK )
+        {
+            printf( "    Error: benchmark grammar failed to parse\n" );
+            return;
+        }
+        bench::keep( grammar_set[0].rules.size() );
+    }
+    bench::report( "add_grammar( const char *, size_t )", timer.seconds(), input.size() * n_repeats );
+}
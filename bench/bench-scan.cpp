@@ -0,0 +1,112 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#include "bench.h"
+
+#include "cl-jcr-parser/parser.h"
+#include "dsl-pa/dsl-pa.h"
+
+#include <cstdio>
+
+using namespace cljcr;
+
+namespace {
+
+bool is_comment_char( char c )
+{
+    return c == '\t' || c >= 0x20 || ((c & 0x80) != 0);
+}
+
+// Skips each run of comment chars a char at a time using a virtual
+// alphabet::is_sought() call per char, as the parser used to
+size_t skip_runs_char_by_char( const std::string & r_input )
+{
+    cl::reader_mem_buf reader( r_input.data(), r_input.size() );
+    cl::dsl_pa parser( reader );
+    cl::alphabet_function comment_chars( is_comment_char );
+    size_t n_runs = 0;
+    while( ! parser.is_peek_at_end() )
+    {
+        while( parser.is_get_char_in( comment_chars ) )
+        {}
+        parser.get();
+        ++n_runs;
+    }
+    return n_runs;
+}
+
+size_t skip_runs_in_bulk( const std::string & r_input )
+{
+    cl::reader_mem_buf reader( r_input.data(), r_input.size() );
+    cl::dsl_pa parser( reader );
+    cl::alphabet_char_class comment_chars( "\t\x20-\xff" );
+    size_t n_runs = 0;
+    while( ! parser.is_peek_at_end() )
+    {
+        parser.skip_run( comment_chars );
+        parser.get();
+        ++n_runs;
+    }
+    return n_runs;
+}
+
+std::string make_commented_grammar( size_t n_rules )
+{
+    std::string grammar;
+    for( size_t i = 0; i < n_rules; ++i )
+    {
+        grammar += "; This is a long comment line that describes the rule that follows it in some detail\n"
+                    ";           and which has been indented using a good deal of white space\n"
+                    "$rule = \"A quoted string member name of some length\" : \"a string value\"\n"
+                    "                                                                        \n"
+                    "$re = /^[a-z][a-z0-9]*-long-and-repetitive-regular-expression-to-scan$/\n\n";
+    }
+    return grammar;
+}
+
+const size_t n_repeats = 10;
+
+} // End of Anonymous namespace
+
+BENCHMARK( "Scanning - runs of comment chars" )
+{
+    std::string input( make_commented_grammar( 2000 ) );
+
+    {
+    bench::Timer timer;
+    for( size_t i = 0; i < n_repeats; ++i )
+        bench::keep( skip_runs_char_by_char( input ) );
+    bench::report( "alphabet::is_sought() per char", timer.seconds(), input.size() * n_repeats );
+    }
+
+    {
+    bench::Timer timer;
+    for( size_t i = 0; i < n_repeats; ++i )
+        bench::keep( skip_runs_in_bulk( input ) );
+    bench::report( "alphabet_char_class::span() via skip_run()", timer.seconds(), input.size() * n_repeats );
+    }
+}
+
+BENCHMARK( "Scanning - parse comment, space, string and regex heavy grammar" )
+{
+    std::string input( make_commented_grammar( 2000 ) );
+
+    bench::Timer timer;
+    for( size_t i = 0; i < n_repeats; ++i )
+    {
+        GrammarSet grammar_set;
+        JCRParser jcr_parser( &grammar_set );
+        if( jcr_parser.add_grammar( input.data(), input.size() ) != JCRParser::S_OK )
+        {
+            printf( "    Error: benchmark grammar failed to parse\n" );
+            return;
+        }
+        bench::keep( grammar_set[0].rules.size() );
+    }
+    bench::report( "add_grammar( const char *, size_t )", timer.seconds(), input.size() * n_repeats );
+}
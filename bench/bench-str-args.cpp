@@ -0,0 +1,125 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#include "bench.h"
+
+#include "cl-utils/str-args.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+// Messages shaped like those of the parser and linker
+const char * const duplicate_format = "Duplicate <rule-name> '$%0' found at (line: '%1', char: '%2')";
+const char * const target_format = "Unable to find Target rule '$%0' for global rule '$%1'";
+const char * const line_format = "Error: %0 (line: %1, char: %2):";
+
+std::vector< std::string > make_rule_names( size_t n_names )
+{
+    std::vector< std::string > names;
+    for( size_t i = 0; i < n_names; ++i )
+        names.push_back( clutils::expand( "rule_%0", i ) );
+    return names;
+}
+
+} // End of Anonymous namespace
+
+BENCHMARK( "Formatting - str_args versus str_arg_refs" )
+{
+    const size_t n_messages = 200000;
+    const std::vector< std::string > names( make_rule_names( 1000 ) );
+
+    size_t n_bytes = 0;
+    {
+        bench::Timer timer;
+        for( size_t i = 0; i < n_messages; ++i )
+        {
+            const std::string & r_name = names[i % names.size()];
+            std::string message( clutils::expand( duplicate_format, clutils::str_args( r_name ) << i << i % 80 ) );
+            n_bytes += message.size();
+            message = clutils::expand( target_format, clutils::str_args( r_name ) << names[(i + 1) % names.size()] );
+            n_bytes += message.size();
+            message = clutils::expand( line_format, clutils::str_args( r_name ) << i << i % 80 );
+            n_bytes += message.size();
+        }
+        bench::report_items( "str_args, new string per message", timer.seconds(), 3 * n_messages, "messages" );
+    }
+    bench::keep( n_bytes );
+
+    n_bytes = 0;
+    {
+        bench::Timer timer;
+        for( size_t i = 0; i < n_messages; ++i )
+        {
+            const std::string & r_name = names[i % names.size()];
+            std::string message( clutils::expand( duplicate_format, clutils::str_arg_refs( r_name ) << i << i % 80 ) );
+            n_bytes += message.size();
+            message = clutils::expand( target_format, clutils::str_arg_refs( r_name ) << names[(i + 1) % names.size()] );
+            n_bytes += message.size();
+            message = clutils::expand( line_format, clutils::str_arg_refs( r_name ) << i << i % 80 );
+            n_bytes += message.size();
+        }
+        bench::report_items( "str_arg_refs, new string per message", timer.seconds(), 3 * n_messages, "messages" );
+    }
+    bench::keep( n_bytes );
+
+    n_bytes = 0;
+    {
+        bench::Timer timer;
+        std::string buffer;
+        for( size_t i = 0; i < n_messages; ++i )
+        {
+            const std::string & r_name = names[i % names.size()];
+            buffer.clear();
+            clutils::expand_append( &buffer, duplicate_format, clutils::str_arg_refs( r_name ) << i << i % 80 );
+            n_bytes += buffer.size();
+            buffer.clear();
+            clutils::expand_append( &buffer, target_format, clutils::str_arg_refs( r_name ) << names[(i + 1) % names.size()] );
+            n_bytes += buffer.size();
+            buffer.clear();
+            clutils::expand_append( &buffer, line_format, clutils::str_arg_refs( r_name ) << i << i % 80 );
+            n_bytes += buffer.size();
+        }
+        bench::report_items( "str_arg_refs, reused buffer", timer.seconds(), 3 * n_messages, "messages" );
+    }
+    bench::keep( n_bytes );
+}
+
+BENCHMARK( "Formatting - integers" )
+{
+    const size_t n_integers = 1000000;
+
+    size_t n_bytes = 0;
+    {
+        bench::Timer timer;
+        std::string buffer;
+        for( size_t i = 0; i < n_integers; ++i )
+        {
+            buffer.clear();
+            clutils::str_args( i * 7919 ).expand_append( &buffer, "%0" );
+            n_bytes += buffer.size();
+        }
+        bench::report_items( "str_args (ostringstream)", timer.seconds(), n_integers, "integers" );
+    }
+    bench::keep( n_bytes );
+
+    n_bytes = 0;
+    {
+        bench::Timer timer;
+        std::string buffer;
+        for( size_t i = 0; i < n_integers; ++i )
+        {
+            buffer.clear();
+            clutils::str_arg( i * 7919 ).append_to( &buffer );
+            n_bytes += buffer.size();
+        }
+        bench::report_items( "str_arg", timer.seconds(), n_integers, "integers" );
+    }
+    bench::keep( n_bytes );
+}
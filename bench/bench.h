@@ -0,0 +1,87 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+//----------------------------------------------------------------------------
+// A minimal benchmarking harness for jcrbench.  A benchmark is created
+// using BENCHMARK( "A descriptive string" ) { ... } in the same way that a
+// test is created using TFEATURE in clunit.h.  Benchmarks time their own
+// loops using bench::Timer and report the results via bench::report().
+//
+// Run "jcrbench" to run all the benchmarks, or "jcrbench <text>" to run
+// only those whose description contains <text>.
+//----------------------------------------------------------------------------
+
+#ifndef CL_JCR_PARSER_BENCH
+#define CL_JCR_PARSER_BENCH
+
+#include <cstddef>
+#include <string>
+
+#if __cplusplus >= 201103L
+    #include <chrono>
+#else
+    #include <ctime>
+#endif
+
+namespace bench {
+
+typedef void (*benchmark_function)();
+
+struct Registrar
+{
+    Registrar( const char * p_description, benchmark_function p_function );
+};
+
+class Timer
+{
+private:
+#if __cplusplus >= 201103L
+    std::chrono::steady_clock::time_point start;
+#else
+    std::clock_t start;
+#endif
+
+public:
+    Timer() { restart(); }
+#if __cplusplus >= 201103L
+    void restart() { start = std::chrono::steady_clock::now(); }
+    double seconds() const
+    {
+        return std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+    }
+#else
+    void restart() { start = std::clock(); }
+    double seconds() const { return double( std::clock() - start ) / CLOCKS_PER_SEC; }
+#endif
+};
+
+// Prevents the compiler optimising away the work being timed
+extern volatile size_t sink;
+inline void keep( size_t value ) { sink = sink + value; }
+
+// Reports the time taken to process the given number of bytes
+void report( const char * p_what, double seconds, size_t bytes );
+// Reports the time taken to process the given number of items
+void report_items( const char * p_what, double seconds, size_t items, const char * p_item_name );
+// Reports a plain count, such as the number of backtracks performed
+void report_count( const char * p_what, size_t count );
+
+// Generates a syntactically valid grammar of the given number of groups of
+// rules that exercises the common productions of the JCR syntax.
+std::string make_grammar( size_t n_rule_groups );
+
+} // End of namespace bench
+
+#define BENCH_CONCAT2( a, b ) a##b
+#define BENCH_CONCAT( a, b ) BENCH_CONCAT2( a, b )
+#define BENCHMARK( description ) \
+    static void BENCH_CONCAT( bench_function_, __LINE__ )(); \
+    static bench::Registrar BENCH_CONCAT( bench_registrar_, __LINE__ )( description, BENCH_CONCAT( bench_function_, __LINE__ ) ); \
+    static void BENCH_CONCAT( bench_function_, __LINE__ )()
+
+#endif // CL_JCR_PARSER_BENCH
@@ -11,5 +11,6 @@
 
 #include "cl-jcr-parser/parser.h"
 #include "cl-jcr-parser/config.h"
+#include "cl-jcr-parser/compiled-grammar.h"
 
 #endif  // CL_JCR_PARSER__ALL
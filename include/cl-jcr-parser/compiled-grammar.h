@@ -0,0 +1,204 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#ifndef CL_JCR_PARSER__COMPILED_GRAMMAR
+#define CL_JCR_PARSER__COMPILED_GRAMMAR
+
+#include "cl-jcr-parser/parser.h"
+
+#include <vector>
+
+namespace cl { class mapped_file; }
+
+namespace cljcr {
+
+// CompiledGrammar is a read-only, flattened copy of a linked GrammarSet.
+// Each Rule becomes a node, identified by its index, and the properties of
+// the nodes are held in arrays, one per property, so that walking the rules
+// doesn't involve following pointers.  The links made by JCRParser::link()
+// are already resolved, so a node's type, constraints, child combiner and
+// children are those of the Rule's p_type, and its member name is that of
+// its p_rule, as returned by the Rule::get_...() methods.
+//
+// The global rules of each Grammar are numbered first, in GrammarSet order,
+// followed by their descendants.  The children of a Rule are numbered
+// consecutively, so a node's children are the range of nodes starting at
+// first_child().  Strings, such as rule names, are held in a single pool
+// and referred to by their offset in it.  Offset 0 is the empty string.
+//
+// All the arrays are held in one block of memory and refer to each other by
+// index, so the block can be copied as it is.  save() writes the block to a
+// binary file (conventionally with a .jcrb extension) after a header that
+// records the sizes of the arrays, and load() memory maps such a file and
+// uses the block where it lies, so that a set of grammars can be used
+// without parsing or linking them.  The file is only intended to be loaded
+// on platforms with the same byte order and type sizes as the one that
+// saved it.
+class CompiledGrammar : private detail::NonCopyable
+{
+public:
+    typedef uint32 Node;
+
+    enum Status { S_OK, S_UNABLE_TO_OPEN_FILE, S_UNABLE_TO_WRITE_FILE, S_WRONG_FORMAT, S_CORRUPTED };
+
+    enum Flags {
+            IS_NOT = 0x01, IS_UNORDERED = 0x02, IS_ROOT = 0x04,
+            IS_EXCLUDE_MIN = 0x08, IS_EXCLUDE_MAX = 0x10, IS_DEFAULTED = 0x20, IS_CHOICE = 0x40,
+            IS_MEMBER_LITERAL = 0x100, IS_MEMBER_REGEX = 0x200 };
+
+    struct GrammarEntry
+    {
+        uint32 ruleset_id;      // String offset
+        uint32 jcr_source;      // String offset
+        Node first_rule;        // The Grammar's global rules are nodes first_rule to first_rule + n_rules - 1
+        uint32 n_rules;
+    };
+
+    struct Constraint
+    {
+        enum Form { UNSET, STRING, BOOL, INT, UINT, FLOAT };
+        uint32 form;
+        uint32 string_value;    // String offset
+        union {
+            int64 int_value;
+            uint64 uint_value;  // Also holds bool values
+            double float_value;
+        };
+
+        bool is_set() const { return form != UNSET; }
+        bool is_string() const { return form == STRING; }
+        bool is_bool() const { return form == BOOL; }
+        bool is_int() const { return form == INT; }
+        bool is_uint() const { return form == UINT; }
+        bool is_float() const { return form == FLOAT; }
+        bool as_bool() const { assert( form == BOOL ); return uint_value != 0; }
+        int64 as_int() const { assert( form == INT ); return int_value; }
+        uint64 as_uint() const { assert( form == UINT ); return uint_value; }
+        double as_float() const { assert( form == FLOAT ); return float_value; }
+    };
+
+    struct Detail    // The less common annotations, held out of line as in Annotations
+    {
+        uint32 default_value;   // String offset
+        uint32 format;          // String offset
+        uint32 first_augment;
+        uint32 n_augments;
+    };
+
+    struct Augment
+    {
+        uint32 ruleset_id;      // String offset
+        uint32 rule_name;       // String offset
+    };
+
+    // The number of entries in each of the arrays.  The layout of the block
+    // follows from these alone.
+    struct Counts
+    {
+        uint32 n_nodes;
+        uint32 n_grammars;
+        uint32 n_constraints;   // Pairs of min and max Constraints, the first pair being unset
+        uint32 n_details;       // The first Detail is empty
+        uint32 n_augments;
+        uint32 n_string_bytes;
+    };
+
+private:
+    struct Members {
+        Counts counts;
+        const char * p_block;
+        size_t block_size;
+        std::vector< uint64 > storage;  // The block, when it has been compiled
+        cl::mapped_file * p_mapped_file;    // Owned.  The file holding the block, when it has been loaded
+
+        // Indexed by Node
+        const uint8 * p_types;
+        const uint8 * p_child_combiners;
+        const uint16 * p_flags;
+        const Repetition * p_repetitions;
+        const Node * p_first_children;
+        const uint32 * p_child_counts;
+        const Node * p_rule_nodes;
+        const Node * p_type_nodes;
+        const uint32 * p_rule_names;
+        const uint32 * p_member_names;
+        const uint32 * p_constraints;
+        const uint32 * p_details;
+        const uint32 * p_grammars;
+        const int32 * p_line_numbers;
+        const int32 * p_column_numbers;
+
+        const GrammarEntry * p_grammar_entries;
+        const Constraint * p_constraint_pairs;
+        const Detail * p_detail_entries;
+        const Augment * p_augment_entries;
+        const char * p_strings;
+
+        Members();
+    } m;
+
+    static size_t lay_out( const Counts & r_counts, const char * p_block, Members * p_members );
+
+public:
+    CompiledGrammar() {}
+    explicit CompiledGrammar( const GrammarSet & r_grammar_set ) { compile( r_grammar_set ); }
+    ~CompiledGrammar() { clear(); }
+
+    // Replaces the contents with a copy of r_grammar_set, which should have
+    // been linked without error.  The CompiledGrammar doesn't refer to
+    // r_grammar_set afterwards.
+    void compile( const GrammarSet & r_grammar_set );
+    void clear();
+
+    Status save( const char * p_file_name ) const;
+    // Only the header is checked by default, so that loading doesn't read
+    // the whole file.  If is_checking_block is true the checksum of the
+    // block is checked as well, which guards against a damaged file.  The
+    // CompiledGrammar is left empty if the file can't be loaded.
+    Status load( const char * p_file_name, bool is_checking_block = false );
+    bool is_memory_mapped() const;
+
+    size_t size() const { return m.counts.n_nodes; }
+    bool empty() const { return m.counts.n_nodes == 0; }
+    size_t grammar_count() const { return m.counts.n_grammars; }
+    const GrammarEntry & grammar( size_t i ) const { return m.p_grammar_entries[i]; }
+
+    const char * str( uint32 offset ) const { return m.p_strings + offset; }
+
+    Rule::Type type( Node node ) const { return static_cast< Rule::Type >( m.p_types[node] ); }
+    Rule::ChildCombiner child_combiner( Node node ) const { return static_cast< Rule::ChildCombiner >( m.p_child_combiners[node] ); }
+    unsigned flags( Node node ) const { return m.p_flags[node]; }
+    bool is_not( Node node ) const { return (m.p_flags[node] & IS_NOT) != 0; }
+    bool is_unordered( Node node ) const { return (m.p_flags[node] & IS_UNORDERED) != 0; }
+    bool is_root( Node node ) const { return (m.p_flags[node] & IS_ROOT) != 0; }
+    bool is_member_rule( Node node ) const { return (m.p_flags[node] & (IS_MEMBER_LITERAL | IS_MEMBER_REGEX)) != 0; }
+    bool is_type_rule( Node node ) const { return ! is_member_rule( node ); }
+    const Repetition & repetition( Node node ) const { return m.p_repetitions[node]; }
+    Node first_child( Node node ) const { return m.p_first_children[node]; }
+    size_t child_count( Node node ) const { return m.p_child_counts[node]; }
+    Node rule_node( Node node ) const { return m.p_rule_nodes[node]; }     // The Rule's p_rule
+    Node type_node( Node node ) const { return m.p_type_nodes[node]; }     // The Rule's p_type
+    const char * rule_name( Node node ) const { return str( m.p_rule_names[node] ); }
+    const char * member_name( Node node ) const { return str( m.p_member_names[node] ); }
+    const Constraint & min( Node node ) const { return m.p_constraint_pairs[2 * m.p_constraints[node]]; }
+    const Constraint & max( Node node ) const { return m.p_constraint_pairs[2 * m.p_constraints[node] + 1]; }
+    const char * default_value( Node node ) const { return str( m.p_detail_entries[m.p_details[node]].default_value ); }
+    const char * format( Node node ) const { return str( m.p_detail_entries[m.p_details[node]].format ); }
+    size_t augment_count( Node node ) const { return m.p_detail_entries[m.p_details[node]].n_augments; }
+    const Augment & augment( Node node, size_t i ) const { return m.p_augment_entries[m.p_detail_entries[m.p_details[node]].first_augment + i]; }
+    size_t grammar_of( Node node ) const { return m.p_grammars[node]; }
+    int line_number( Node node ) const { return m.p_line_numbers[node]; }
+    int column_number( Node node ) const { return m.p_column_numbers[node]; }
+
+    const Counts & counts() const { return m.counts; }
+    size_t bytes_used() const { return m.block_size; }
+};
+
+}   // namespace cljcr
+
+#endif  // CL_JCR_PARSER__COMPILED_GRAMMAR
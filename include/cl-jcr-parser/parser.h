@@ -16,14 +16,21 @@
 #include <map>
 #include <set>
 #include <string>
+#include <utility>
+#include <vector>
 #include <cstdlib>
+#include <cstring>
+#include <new>
 #include <iostream>
 
 #if __cplusplus >= 201103L
+    #include <atomic>
     #include <cstdint>
+    #include <unordered_map>
 #endif
 
 namespace cl { class reader; }
+namespace clutils { class str_arg_refs; }
 
 namespace cljcr {
 
@@ -53,12 +60,119 @@ struct uniq_ptr
 #endif
 };
 
+// MonotonicArena hands out memory from a few large blocks by bumping a
+// pointer.  Memory is never returned to the arena individually.  Instead all
+// the blocks are released in one go when the arena is destroyed.
+class MonotonicArena : private detail::NonCopyable
+{
+private:
+    struct Block
+    {
+        Block * p_next;
+        size_t size;
+    };
+    union MaxAlign { long double ld; double d; long long ll; void * p; void (*pf)(); };
+    enum { alignment = sizeof( MaxAlign ), block_header_size = (sizeof( Block ) + alignment - 1) / alignment * alignment };
+
+    struct Members {
+        Block * p_blocks;   // The first is the current block
+        char * p_next;
+        char * p_end;
+        size_t first_block_size;
+        size_t next_block_size;
+        size_t n_blocks;
+        size_t bytes_allocated;
+
+        Members( size_t first_block_size_in )
+            :
+            p_blocks( 0 ), p_next( 0 ), p_end( 0 ),
+            first_block_size( first_block_size_in ), next_block_size( first_block_size_in ),
+            n_blocks( 0 ), bytes_allocated( 0 )
+        {}
+    } m;
+
+    void * allocate_from_new_block( size_t size );
+    void add_behind_current_block( Block * p_first, Block * p_last );
+
+public:
+    // Block sizes start at first_block_size and double, so an arena that is
+    // expected to hold little, such as that of a small Grammar, can start small
+    explicit MonotonicArena( size_t first_block_size = 16 * 1024 ) : m( first_block_size ) {}
+    ~MonotonicArena();
+
+    void * allocate( size_t size )
+    {
+        size = (size + alignment - 1) / alignment * alignment;
+        if( static_cast< size_t >( m.p_end - m.p_next ) < size )
+            return allocate_from_new_block( size );
+        void * p = m.p_next;
+        m.p_next += size;
+        m.bytes_allocated += size;
+        return p;
+    }
+
+    void splice( MonotonicArena & r_other );    // Take ownership of r_other's blocks, e.g. when merging work done in parallel
+
+    size_t block_count() const { return m.n_blocks; }
+    size_t bytes_allocated() const { return m.bytes_allocated; }
+};
+
+// Objects of classes derived from ArenaAllocated can be created either on the
+// heap, using a plain new expression, or in a MonotonicArena, using
+// new( arena ) T( ... ).  Either can be deleted with a delete expression,
+// so containers that own their objects can hold a mixture of both.  Deleting
+// an object created in an arena runs its destructor, but its memory is only
+// released when the arena is destroyed.
+class ArenaAllocated
+{
+private:
+    enum Origin { FROM_HEAP, FROM_ARENA };
+    union Header { Origin origin; long double ld; double d; long long ll; void * p; };   // Padded to keep objects aligned
+
+    static void * mark( void * p_memory, Origin origin )
+    {
+        static_cast< Header * >( p_memory )->origin = origin;
+        return static_cast< Header * >( p_memory ) + 1;
+    }
+
+public:
+    static void * operator new( size_t size )
+    {
+        void * p_memory = std::malloc( sizeof( Header ) + size );
+        if( ! p_memory )
+            throw std::bad_alloc();
+        return mark( p_memory, FROM_HEAP );
+    }
+    static void * operator new( size_t size, MonotonicArena & r_arena )
+    {
+        return mark( r_arena.allocate( sizeof( Header ) + size ), FROM_ARENA );
+    }
+    static void operator delete( void * p )
+    {
+        if( p )
+        {
+            Header * p_header = static_cast< Header * >( p ) - 1;
+            if( p_header->origin == FROM_HEAP )
+                std::free( p_header );
+        }
+    }
+    static void operator delete( void * /*p*/, MonotonicArena & /*r_arena*/ ) {}   // Only used if a constructor throws
+};
+
 #if __cplusplus < 201103L
     typedef long long int64;
     typedef unsigned long long uint64;
+    typedef int int32;
+    typedef unsigned int uint32;
+    typedef unsigned short uint16;
+    typedef unsigned char uint8;
 #else
     typedef std::int64_t int64;
     typedef std::uint64_t uint64;
+    typedef std::int32_t int32;
+    typedef std::uint32_t uint32;
+    typedef std::uint16_t uint16;
+    typedef std::uint8_t uint8;
 #endif
 
 class Severity
@@ -100,6 +214,64 @@ public:
 
 inline std::ostream & operator << ( std::ostream & r_os, const Severity & r_v ) { r_os << r_v.to_s(); return r_os; }
 
+// A Symbol refers to an identifier, such as a rule name or ruleset id, that
+// has been interned in a SymbolTable.  Each distinct identifier is stored
+// once per table and given a 32-bit id, so Symbols from the same table are
+// compared without comparing strings.  The empty identifier has id 0 in
+// every table, and is the value of a default constructed Symbol.
+class Symbol
+{
+private:
+    friend class SymbolTable;
+    typedef std::pair< const std::string, uint32 > Entry;
+    static const Entry empty_entry;
+    const Entry * p_entry;
+
+    explicit Symbol( const Entry * p_entry_in ) : p_entry( p_entry_in ) {}
+
+public:
+    Symbol() : p_entry( &empty_entry ) {}
+
+    uint32 id() const { return p_entry->second; }
+    bool empty() const { return p_entry->second == 0; }
+    const std::string & str() const { return p_entry->first; }
+    const char * c_str() const { return p_entry->first.c_str(); }
+    operator const std::string & () const { return str(); }
+
+    bool operator == ( const Symbol & r_rhs ) const { return p_entry == r_rhs.p_entry; }
+    bool operator != ( const Symbol & r_rhs ) const { return p_entry != r_rhs.p_entry; }
+    bool operator == ( const std::string & r_rhs ) const { return str() == r_rhs; }
+    bool operator != ( const std::string & r_rhs ) const { return str() != r_rhs; }
+    bool operator == ( const char * p_rhs ) const { return str() == p_rhs; }
+    bool operator != ( const char * p_rhs ) const { return str() != p_rhs; }
+};
+
+inline std::ostream & operator << ( std::ostream & r_os, const Symbol & r_s ) { r_os << r_s.str(); return r_os; }
+inline void str_arg_append( std::string * p_out, const Symbol & r_s ) { p_out->append( r_s.str() ); }  // Found by clutils::str_arg
+
+class SymbolTable : private detail::NonCopyable
+{
+private:
+#if __cplusplus >= 201103L
+    typedef std::unordered_map< std::string, uint32 > index_t;  // Nodes don't move on rehashing, so Symbols can point into them
+#else
+    typedef std::map< std::string, uint32 > index_t;    // Map nodes don't move, so Symbols can point into them
+#endif
+    struct Members {
+        index_t index;
+        std::vector< const Symbol::Entry * > entries;   // Indexed by id
+        Members() : entries( 1, &Symbol::empty_entry ) {}
+    } m;
+
+public:
+    Symbol intern( const std::string & r_name );
+    Symbol intern( const char * p_name, size_t size ) { return intern( std::string( p_name, size ) ); }
+    Symbol find( const std::string & r_name ) const;   // Returns the empty Symbol if r_name has not been interned
+    bool is_interned( const std::string & r_name ) const { return r_name.empty() || m.index.find( r_name ) != m.index.end(); }
+    Symbol operator [] ( uint32 id ) const { return Symbol( m.entries[id] ); }
+    size_t size() const { return m.entries.size(); }
+};
+
 //----------------------------------------------------------------------------
 //                   Classes representing JCR constructs
 //----------------------------------------------------------------------------
@@ -108,12 +280,12 @@ struct Rule;
 
 struct TargetRule
 {
-    std::string ruleset_id;
-    std::string rule_name;
+    Symbol ruleset_id;
+    Symbol rule_name;
     Rule * p_rule;      // Filled in when 'compiled'
 
     TargetRule() : p_rule( 0 ) {}
-    void clear() { ruleset_id.empty(); rule_name.empty(); }
+    void clear() { ruleset_id = Symbol(); rule_name = Symbol(); }
 };
 
 struct Repetition
@@ -127,18 +299,36 @@ struct Repetition
 
 struct Annotations
 {
+private:
+    // The data for the less common annotations is held out of line, and
+    // only created when one of them is present, so that Rules stay compact
+    struct Detail
+    {
+        std::string default_value;
+        std::string format;
+        std::vector<TargetRule> augments;
+    };
+    static const Detail empty_detail;
+    Detail * p_detail;
+
+    Detail & detail() { if( ! p_detail ) p_detail = new Detail; return *p_detail; }
+    const Detail & detail() const { return p_detail ? *p_detail : empty_detail; }
+
+public:
     bool is_not;
     bool is_unordered;
     bool is_root;
     bool is_exclude_min;
     bool is_exclude_max;
     bool is_defaulted;
-    std::string default_value;
-    std::string format;
     bool is_choice;
-    std::vector<TargetRule> augments;
 
-    Annotations() { clear(); }
+    Annotations() : p_detail( 0 ), is_choice( false ) { clear(); }
+    Annotations( const Annotations & r_rhs );
+    Annotations & operator = ( const Annotations & r_rhs );
+    ~Annotations() { delete p_detail; }
+    void swap( Annotations & r_rhs );
+
     void clear() { is_not = is_unordered = is_root = is_exclude_min = is_exclude_max = is_defaulted = false; }
     bool merge( const Annotations & r_rhs )
     {
@@ -149,13 +339,21 @@ struct Annotations
         is_exclude_max = ( is_exclude_max || r_rhs.is_exclude_max );
         is_defaulted = ( is_defaulted || r_rhs.is_defaulted );
         if( r_rhs.is_defaulted )
-            default_value = r_rhs.default_value;
-        if( format.empty() && ! r_rhs.format.empty() )
-            format = r_rhs.format;
-        if( augments.empty() && ! r_rhs.augments.empty() )
-            augments = r_rhs.augments;
+            set_default_value( r_rhs.default_value() );
+        if( format().empty() && ! r_rhs.format().empty() )
+            set_format( r_rhs.format() );
+        if( augments().empty() && ! r_rhs.augments().empty() )
+            detail().augments = r_rhs.augments();
         return true;
     }
+
+    const std::string & default_value() const { return detail().default_value; }
+    void set_default_value( const std::string & r_default_value ) { detail().default_value = r_default_value; }
+    const std::string & format() const { return detail().format; }
+    void set_format( const std::string & r_format ) { detail().format = r_format; }
+    const std::vector<TargetRule> & augments() const { return detail().augments; }
+    void add_augments( const TargetRule & r_target_rule ) { detail().augments.push_back( r_target_rule ); }
+    void set_augments( const std::vector<TargetRule> & r_augments ) { detail().augments = r_augments; }
 };
 
 class MemberName
@@ -163,7 +361,7 @@ class MemberName
 private:
     enum Form { Absent, Literal, Regex };
     struct Members {
-        std::string name;
+        Symbol name;
         Form form;
 
         Members() : form( Absent ) {}
@@ -171,14 +369,15 @@ private:
 
 public:
     void clear() { m = Members(); }
-    void set_absent() { m.form = Absent; m.name.clear(); }
-    void set_literal( const std::string & name ) { m.form = Literal; m.name = name; }
-    void set_regex( const std::string & name ) { m.form = Regex; m.name = name; }
+    void set_absent() { m.form = Absent; m.name = Symbol(); }
+    void set_literal( Symbol name ) { m.form = Literal; m.name = name; }
+    void set_regex( Symbol name ) { m.form = Regex; m.name = name; }
 
     bool is_absent() const { return m.form == Absent; }
     bool is_literal() const { return m.form == Literal; }
     bool is_regex() const { return m.form == Regex; }
-    const std::string & name() const { return m.name; } // For regex form, name() will include full pattern, e.g. /p\d+/i
+    const std::string & name() const { return m.name.str(); } // For regex form, name() will include full pattern, e.g. /p\d+/i
+    Symbol name_symbol() const { return m.name; }
     std::string pattern() const;
     std::string modifiers() const;
 };
@@ -188,51 +387,88 @@ std::ostream & operator << ( std::ostream & r_os, const MemberName & r_mn );
 class ValueConstraint
 {
 private:
+    // Numeric constraints are held inline.  String constraints, such as
+    // regex text, are less common and so are held out of line.
     struct Members {
         enum Form { unset, string_form, bool_form, int_form, uint_form, float_form } form;
-        std::string string_value;
-        bool bool_value;
-        int64 int_value;
-        uint64 uint_value;
-        double float_value;
+        union {
+            std::string * p_string_value;
+            bool bool_value;
+            int64 int_value;
+            uint64 uint_value;
+            double float_value;
+        };
 
         Members() : form( unset ) {}
     } m;
 
+    void set_string( const char * p_constraint, size_t size )
+    {
+        if( m.form == Members::string_form )
+            m.p_string_value->assign( p_constraint, size );
+        else
+        {
+            m.p_string_value = new std::string( p_constraint, size );
+            m.form = Members::string_form;
+        }
+    }
+
 public:
-    void clear() { m.form = Members::unset; m.string_value.clear(); }
+    ValueConstraint() {}
+    ValueConstraint( const ValueConstraint & r_rhs ) { *this = r_rhs; }
+    ValueConstraint & operator = ( const ValueConstraint & r_rhs )
+    {
+        if( r_rhs.m.form == Members::string_form )
+            set_string( r_rhs.m.p_string_value->data(), r_rhs.m.p_string_value->size() );
+        else if( this != &r_rhs )
+        {
+            clear();
+            m = r_rhs.m;
+        }
+        return *this;
+    }
+    ~ValueConstraint() { clear(); }
+
+    void clear()
+    {
+        if( m.form == Members::string_form )
+            delete m.p_string_value;
+        m.form = Members::unset;
+    }
     ValueConstraint & operator = ( const std::string & r_constraint )
     {
-        m.form = Members::string_form;
-        m.string_value = r_constraint;
+        set_string( r_constraint.data(), r_constraint.size() );
         return *this;
     }
     ValueConstraint & operator = ( const char * p_constraint )
     {
-        m.form = Members::string_form;
-        m.string_value = p_constraint;
+        set_string( p_constraint, std::strlen( p_constraint ) );
         return *this;
     }
     ValueConstraint & operator = ( bool constraint )
     {
+        clear();
         m.form = Members::bool_form;
         m.bool_value = constraint;
         return *this;
     }
     ValueConstraint & operator = ( int64 constraint )
     {
+        clear();
         m.form = Members::int_form;
         m.int_value = constraint;
         return *this;
     }
     ValueConstraint & operator = ( uint64 constraint )
     {
+        clear();
         m.form = Members::uint_form;
         m.uint_value = constraint;
         return *this;
     }
     ValueConstraint & operator = ( double constraint )
     {
+        clear();
         m.form = Members::float_form;
         m.float_value = constraint;
         return *this;
@@ -243,7 +479,7 @@ public:
     bool is_int() const { return m.form == Members::int_form; }
     bool is_uint() const { return m.form == Members::uint_form; }
     bool is_float() const { return m.form == Members::float_form; }
-    const std::string & as_string() const { assert( m.form == Members::string_form ); return m.string_value; }
+    const std::string & as_string() const { assert( m.form == Members::string_form ); return *m.p_string_value; }
     std::string as_pattern() const;
     std::string as_modifiers() const;
     bool as_bool() const { assert( m.form == Members::bool_form ); return m.bool_value; }
@@ -256,7 +492,7 @@ std::ostream & operator << ( std::ostream & r_os, const TargetRule & r_tr );
 
 struct Grammar;
 
-struct Rule : private detail::NonCopyable
+struct Rule : private detail::NonCopyable, public ArenaAllocated
 {
     typedef uniq_ptr< Rule >::type uniq_ptr;
 
@@ -272,32 +508,36 @@ struct Rule : private detail::NonCopyable
             OBJECT, OBJECT_GROUP, ARRAY, ARRAY_GROUP, GROUP, GROUP_GROUP,
             TARGET_RULE };
 
-    Grammar * p_grammar;
-    Rule * p_parent;
-    int line_number;
-    int column_number;
-    std::string rule_name;
+    // The fields consulted while linking and validating come first, so
+    // that they share as few cache lines as possible
+    Rule * p_rule;
+    Rule * p_type;
+    Type type;
+    enum ChildCombiner { None, Sequence, Choice } child_combiner;
     Repetition repetition;
     Annotations annotations;
-    MemberName member_name;
-    Type type;
     ValueConstraint min;
     ValueConstraint max;
     typedef clutils::ptr_vector< Rule > children_container_t;
     children_container_t children;
-    enum ChildCombiner { None, Sequence, Choice } child_combiner;
+    Rule * p_parent;
+    Grammar * p_grammar;
+
+    // Fields mostly used while parsing and reporting errors
+    Symbol rule_name;
+    MemberName member_name;
     TargetRule target_rule;
-    Rule * p_rule;
-    Rule * p_type;
+    int line_number;
+    int column_number;
 
     Rule( Grammar * p_grammar_in, int line_number_in, int column_number_in )
         :
-        p_grammar( p_grammar_in ),
+        type( NONE ),
+        child_combiner( None ),
         p_parent( 0 ),
+        p_grammar( p_grammar_in ),
         line_number( line_number_in ),
-        column_number( column_number_in ),
-        type( NONE ),
-        child_combiner( None )
+        column_number( column_number_in )
     {
         p_rule = p_type = this;
     }
@@ -365,16 +605,34 @@ struct Grammar : private detail::NonCopyable
 
     GrammarSet * p_grammar_set;
     std::string jcr_source;
-    std::string ruleset_id;
+    Symbol ruleset_id;
     std::vector< std::string > unaliased_imports;
     typedef std::string ruleset_id_alias_t;
     typedef std::string ruleset_id_t;
     typedef std::map< ruleset_id_alias_t, ruleset_id_t > aliased_imports_t;   // Alias -> Ruleset_id
     aliased_imports_t aliased_imports;
+    // The Rules created by the parser are allocated from the Grammar's
+    // arena, so their memory is released along with the Grammar, e.g. when
+    // it is replaced
+    MonotonicArena arena;   // Must be declared before the containers of arena allocated objects
     rule_container_t rules;
 
+    enum { first_arena_block_size = 1024 };     // Many imported Grammars have only a few rules
+
+private:
+#if __cplusplus >= 201103L
+    typedef std::unordered_map< uint32, const Rule * > rule_index_t;
+#else
+    typedef std::map< uint32, const Rule * > rule_index_t;
+#endif
+    mutable rule_index_t rule_index;    // Rule name Symbol id -> first Rule with that name
+    mutable size_t n_indexed_rules;
+
+    void index_new_rules() const;
+
+public:
     Grammar( GrammarSet * p_grammar_set_in, std::string jcr_source_in )
-        : p_grammar_set( p_grammar_set_in ), jcr_source( jcr_source_in )
+        : p_grammar_set( p_grammar_set_in ), jcr_source( jcr_source_in ), arena( first_arena_block_size ), n_indexed_rules( 0 )
     {}
 
     void add_unaliased_import( const std::string & r_import )
@@ -405,43 +663,102 @@ struct Grammar : private detail::NonCopyable
         rules.push_back( ru_rule.get() );
         return ru_rule.release();
     }
-    const Rule * find_rule( const std::string & r_sought_rule_name ) const
+    // Rules are found using an index of their names.  Rules appended since
+    // the last look up are added to the index by the next look up, so a
+    // Rule's name must be set before it is looked up.  If rule names are
+    // changed after that, call reindex_rules().
+    const Rule * find_rule( Symbol sought_rule_name ) const
+    {
+        if( n_indexed_rules != rules.size() )
+            index_new_rules();
+        rule_index_t::const_iterator i_rule = rule_index.find( sought_rule_name.id() );
+        return i_rule != rule_index.end() ? i_rule->second : 0;
+    }
+    Rule * find_rule( Symbol sought_rule_name )
     {
-        for( size_t i=0; i<rules.size(); ++i )
-            if( rules[i].rule_name == r_sought_rule_name )
-                return & rules[i];
-        return 0;
+        return const_cast< Rule * >( static_cast< const Grammar & >(*this).find_rule( sought_rule_name ) );
     }
+    const Rule * find_rule( const std::string & r_sought_rule_name ) const;
     Rule * find_rule( const std::string & r_sought_rule_name )
     {
         return const_cast< Rule * >( static_cast< const Grammar & >(*this).find_rule( r_sought_rule_name ) );
     }
+
+    void reindex_rules() const { rule_index.clear(); n_indexed_rules = 0; index_new_rules(); }
+    // Brings the index up to date, so that look ups don't modify the Grammar,
+    // e.g. before it is shared between threads
+    void index_rules() const { if( n_indexed_rules != rules.size() ) index_new_rules(); }
+
+    // Names are interned in the GrammarSet's SymbolTable
+    Symbol intern( const std::string & r_name );
+    Symbol intern( const char * p_name, size_t size );
 };
 
 struct GrammarSet : private detail::NonCopyable
 {
 public:
     typedef uniq_ptr< GrammarSet >::type uniq_ptr;
+    typedef std::vector< const Grammar * > importers_t;
 
 private:
     typedef clutils::ptr_vector< Grammar > container_t;
+#if __cplusplus >= 201103L
+    typedef std::unordered_map< uint32, const Grammar * > grammar_index_t;
+    typedef std::unordered_map< std::string, importers_t > importer_index_t;
+#else
+    typedef std::map< uint32, const Grammar * > grammar_index_t;
+    typedef std::map< std::string, importers_t > importer_index_t;
+#endif
     struct Members {
+        MonotonicArena arena;   // Must be declared before the containers of arena allocated objects
+        SymbolTable symbols;
         container_t grammars;
+        mutable grammar_index_t grammar_index;  // Ruleset id Symbol id -> first Grammar with that ruleset id
+        mutable importer_index_t importer_index;    // Imported ruleset id -> Grammars that import it, in order
+        mutable size_t n_indexed_grammars;
         size_t error_count;
         size_t warning_count;
-        Members() : error_count( 0 ), warning_count( 0 ) {}
+        Members() : n_indexed_grammars( 0 ), error_count( 0 ), warning_count( 0 ) {}
     } m;
 
+    void index_new_grammars() const;
+    void reset_indexes() const { m.grammar_index.clear(); m.importer_index.clear(); m.n_indexed_grammars = 0; }
+
 public:
     Grammar * append( Grammar::uniq_ptr pu_grammar )
     {
-        m.grammars.push_back( pu_grammar.get() );
-        return pu_grammar.release();
+        Grammar * p_grammar = pu_grammar.release();
+        m.grammars.push_back( p_grammar );  // Takes ownership, even if it throws
+        return p_grammar;
     }
     Grammar * append_grammar( const std::string & jcr_source )
     {
         return append( Grammar::uniq_ptr( new Grammar( this, jcr_source ) ) );
     }
+    Grammar::uniq_ptr release_back()
+    {
+        Grammar::uniq_ptr pu_grammar( m.grammars.release_back() );
+        reset_indexes();
+        return pu_grammar;
+    }
+    // Puts pu_replacement in the place of p_grammar, which is destroyed
+    // along with its arena.  Rules linked to p_grammar's rules must be
+    // linked again.  p_grammar must be in the GrammarSet.  If it isn't, 0 is
+    // returned and pu_replacement is destroyed.
+    Grammar * replace( Grammar * p_grammar, Grammar::uniq_ptr pu_replacement );
+
+    // Grammars are allocated from the heap, and the Rules that the parser
+    // creates from each Grammar's arena.  The GrammarSet's arena is for
+    // other objects that are to be released along with the GrammarSet, such
+    // as Rules that are added to its Grammars by hand.
+    MonotonicArena & arena() { return m.arena; }
+    const MonotonicArena & arena() const { return m.arena; }
+
+    // Rule names, member names and ruleset ids are interned in the
+    // GrammarSet's SymbolTable, so are compared as Symbols
+    SymbolTable & symbols() { return m.symbols; }
+    const SymbolTable & symbols() const { return m.symbols; }
+    Symbol intern( const std::string & r_name ) { return m.symbols.intern( r_name ); }
 
     void inc_error_count() { ++m.error_count; }
     void inc_warning_count() { ++m.warning_count; }
@@ -458,21 +775,164 @@ public:
     size_t size() const { return m.grammars.size(); }
     const Grammar & operator [] ( size_t i ) const { return m.grammars[i]; }
     Grammar & operator [] ( size_t i ) { return m.grammars[i]; }
+    size_t position( const Grammar * p_grammar ) const;     // size() if p_grammar is not in the GrammarSet
 
+    // As with Grammar::find_rule(), Grammars appended since the last look
+    // up are added to the index by the next look up.  If ruleset ids are
+    // changed after that, call reindex_grammars().
+    const Grammar * find_grammar( Symbol sought_ruleset_id ) const
+    {
+        if( m.n_indexed_grammars != m.grammars.size() )
+            index_new_grammars();
+        grammar_index_t::const_iterator i_grammar = m.grammar_index.find( sought_ruleset_id.id() );
+        return i_grammar != m.grammar_index.end() ? i_grammar->second : 0;
+    }
+    Grammar * find_grammar( Symbol sought_ruleset_id )
+    {
+        return const_cast< Grammar * >( static_cast< const GrammarSet & >(*this).find_grammar( sought_ruleset_id ) );
+    }
     const Grammar * find_grammar( const std::string & r_sought_ruleset_id ) const
     {
-        for( size_t i=0; i<m.grammars.size(); ++i )
-            if( ! m.grammars[i].ruleset_id.empty() &&      // Can't find an unnamed grammar
-                    m.grammars[i].ruleset_id == r_sought_ruleset_id )
-                return & m.grammars[i];
-        return 0;
+        return find_grammar( m.symbols.find( r_sought_ruleset_id ) );
     }
     Grammar * find_grammar( const std::string & r_sought_ruleset_id )
     {
-        return const_cast< Grammar * >( static_cast< const GrammarSet & >(*this).find_grammar( r_sought_ruleset_id ) );
+        return find_grammar( m.symbols.find( r_sought_ruleset_id ) );
     }
+    void reindex_grammars() const { reset_indexes(); index_new_grammars(); }
+    void index_grammars() const { if( m.n_indexed_grammars != m.grammars.size() ) index_new_grammars(); }
+
+    // The Grammars that import the ruleset id, with or without an alias, in
+    // GrammarSet order.  These are the Grammars whose rules may be linked to
+    // the rules of a Grammar with that ruleset id.  They are indexed along
+    // with the ruleset ids, so call reindex_grammars() if imports are added
+    // to Grammars that have been looked up.
+    const importers_t & find_importers( const std::string & r_imported_ruleset_id ) const;
+
+    // Moves r_other's Grammars, and r_other's arena, to the end of this
+    // GrammarSet, e.g. when they have been parsed in parallel.
+    // Their names are re-interned in this GrammarSet's SymbolTable in the
+    // order that r_other interned them, so each name gets the same Symbol id
+    // as it would have had if the Grammars had been parsed here directly.
+    void splice( GrammarSet & r_other );
+};
+
+inline Symbol Grammar::intern( const std::string & r_name ) { return p_grammar_set->symbols().intern( r_name ); }
+inline Symbol Grammar::intern( const char * p_name, size_t size ) { return p_grammar_set->symbols().intern( p_name, size ); }
+
+
+// A Diagnostic is a message reported while parsing or linking, recorded in
+// parts rather than as formatted text.  Its code is the message's format,
+// e.g. "Unable to find Target rule '%0'", which identifies the kind of
+// message.  Its arguments are held by the Diagnostics that recorded it.
+// Messages that are only available as text are recorded with the code "%0"
+// and the text as the argument.
+struct Diagnostic
+{
+    const char * p_code;
+    uint32 source_id;
+    uint32 line;    // ~0U if not known
+    uint32 column;  // ~0U if not known
+    Severity severity;
+    uint32 first_arg;
+    uint32 n_args;
+};
+
+// Diagnostics records messages compactly, without formatting them, and
+// only formats them when asked.  Unless told to keep duplicates, a
+// message that matches one already recorded is not recorded again.
+class Diagnostics : private detail::NonCopyable
+{
+private:
+#if __cplusplus >= 201103L
+    typedef std::unordered_map< std::string, uint32 > source_index_t;
+    typedef std::unordered_multimap< uint64, uint32 > diagnostic_index_t;
+#else
+    typedef std::map< std::string, uint32 > source_index_t;
+    typedef std::multimap< uint64, uint32 > diagnostic_index_t;
+#endif
+    struct Members {
+        bool is_keeping_duplicates;
+        std::vector< Diagnostic > diagnostics;
+        std::vector< std::string > sources;     // Indexed by source_id
+        source_index_t source_index;
+        std::string arg_text;   // The text of all the arguments, one after the other
+        std::vector< uint32 > arg_ends;     // Offset in arg_text of the end of each argument
+        diagnostic_index_t diagnostic_index;    // Hash -> Index of Diagnostic
+
+        Members( bool is_keeping_duplicates_in ) : is_keeping_duplicates( is_keeping_duplicates_in ) {}
+    } m;
+
+    uint32 source_id( const std::string & r_source );
+    uint64 hash( const Diagnostic & r_diagnostic ) const;
+    bool is_same( const Diagnostic & r_lhs, const Diagnostic & r_rhs ) const;
+    bool add( Diagnostic * p_diagnostic );
+
+public:
+    explicit Diagnostics( bool is_keeping_duplicates = false ) : m( is_keeping_duplicates ) {}
+
+    // p_format must remain valid for the life of the Diagnostics, as it is
+    // recorded as the Diagnostic's code.  Messages that are already
+    // formatted are copied.  Each returns false if the message is a
+    // duplicate that has not been recorded.
+    bool add( const std::string & r_source, size_t line, size_t column, Severity severity, const char * p_format, const clutils::str_arg_refs & r_args );
+    bool add( const std::string & r_source, size_t line, size_t column, Severity severity, const char * p_format );
+    bool add_text( const std::string & r_source, size_t line, size_t column, Severity severity, const std::string & r_message );
+
+    size_t size() const { return m.diagnostics.size(); }
+    bool empty() const { return m.diagnostics.empty(); }
+    const Diagnostic & operator [] ( size_t i ) const { return m.diagnostics[i]; }
+    const Diagnostic & back() const { return m.diagnostics.back(); }
+    void clear();
+
+    const std::string & source( const Diagnostic & r_diagnostic ) const { return m.sources[r_diagnostic.source_id]; }
+    std::string arg( const Diagnostic & r_diagnostic, size_t i ) const;
+    void arg_refs( clutils::str_arg_refs * p_args, const Diagnostic & r_diagnostic ) const;   // References the recorded arguments
+    std::string message( const Diagnostic & r_diagnostic ) const;     // Formats the message
+    std::string * message_append( std::string * p_out, const Diagnostic & r_diagnostic ) const;
 };
 
+// ParseCache keeps the Grammars parsed from JCR sources as files in a
+// directory, named by a hash of the source's bytes and the version of the
+// parser.  When a JCRParser that uses the ParseCache is given the same
+// bytes again, it loads the Grammar from the directory instead of parsing
+// it.  Only Grammars that are parsed without any messages are kept, so the
+// messages for a source are always reported.  Grammars that are added from
+// a cl::reader or fed in chunks are not cached.  A ParseCache can be shared
+// by several JCRParsers, including those parsing in parallel.
+class ParseCache : private detail::NonCopyable
+{
+private:
+#if __cplusplus >= 201103L
+    typedef std::atomic< size_t > count_t;
+#else
+    typedef size_t count_t;
+#endif
+    struct Members {
+        std::string directory;
+        count_t n_hits;
+        count_t n_misses;
+
+        Members( const std::string & r_directory ) : directory( r_directory ), n_hits( 0 ), n_misses( 0 ) {}
+    } m;
+
+public:
+    explicit ParseCache( const std::string & r_directory );    // The directory is created if need be
+
+    const std::string & directory() const { return m.directory; }
+    // The name of the file that holds, or would hold, the Grammar parsed from the source
+    std::string file_name( const char * p_rules, size_t size ) const;
+    size_t hits() const { return m.n_hits; }
+    size_t misses() const { return m.n_misses; }
+
+    // Used by JCRParser.  load() appends the Grammar to the GrammarSet and
+    // returns true if the source is in the cache.
+    bool load( const char * p_rules, size_t size, GrammarSet * p_grammar_set, const std::string & jcr_source );
+    void store( const char * p_rules, size_t size, const Grammar & r_grammar );
+};
+
+class GrammarFeed;
+
 class JCRParser : private detail::NonCopyable
 {
 public:
@@ -481,26 +941,101 @@ public:
 private:
     struct Members {
         GrammarSet * p_grammar_set;
+        bool is_exception_free;
+        bool is_memoising;
+        std::string message_buffer;     // Reused by diagnose() to format each message
+        GrammarFeed * p_grammar_feed;   // Owned.  Set between begin_grammar() and end_grammar()
+        ParseCache * p_parse_cache;     // Not owned
 
         Members( GrammarSet * p_grammar_set_in )
             :
-            p_grammar_set( p_grammar_set_in )
+            p_grammar_set( p_grammar_set_in ),
+            is_exception_free( false ),
+            is_memoising( false ),
+            p_grammar_feed( 0 ),
+            p_parse_cache( 0 )
         {}
     } m;
 
 public:
     JCRParser( GrammarSet * p_grammar_set ) : m( p_grammar_set ) {}
+    virtual ~JCRParser();
     GrammarSet * grammar_set() const { return m.p_grammar_set; }
+    // By default a fatal error in a grammar stops its parsing by throwing an
+    // exception internally.  In exception free mode the parse is instead
+    // unwound by making each of the remaining parse steps fail.  The reported
+    // errors and returned status are the same in both modes.
+    void set_exception_free( bool is_exception_free ) { m.is_exception_free = is_exception_free; }
+    bool is_exception_free() const { return m.is_exception_free; }
+    // The alternatives in <rule-def>, <type-rule> and similar productions
+    // each start with <annotations>, so the annotations are parsed again for
+    // each alternative that is tried.  When memoising, the result of parsing
+    // annotations at a location is recorded and reused by later alternatives.
+    // Warnings and errors in memoised annotations are only reported once.
+    void set_memoising( bool is_memoising ) { m.is_memoising = is_memoising; }
+    bool is_memoising() const { return m.is_memoising; }
+    // Grammars are loaded from, and kept in, the ParseCache, if one is set.
+    // The ParseCache records the numbers of hits and misses.
+    void set_parse_cache( ParseCache * p_parse_cache ) { m.p_parse_cache = p_parse_cache; }
+    ParseCache * parse_cache() const { return m.p_parse_cache; }
     Status add_grammar( const char * p_file_name );
     Status add_grammar( const std::string & rules );
     Status add_grammar( const char * p_rules, size_t size );
+    Status add_grammar( cl::reader & reader, const std::string & jcr_source );  // jcr_source is used when reporting errors
+    // Parses a grammar whose input arrives in chunks, such as from a pipe,
+    // without waiting for all of it.  Each chunk is passed to feed() after
+    // begin_grammar(), and end_grammar() marks the end of the input and
+    // returns the status of the parse.  Where threads are supported the
+    // grammar is parsed in a thread of its own as the chunks arrive, keeping
+    // only the input that the parser can still rewind to, and feed() waits
+    // if the parser falls too far behind.  The GrammarSet must not be used
+    // until end_grammar() has returned, and the messages for the grammar
+    // are reported by end_grammar().
+    void begin_grammar( const std::string & jcr_source );
+    void feed( const char * p_chunk, size_t size );
+    Status end_grammar();
+    // Parses each of the named files into its own Grammar, using up to
+    // n_threads threads (0 means one per hardware thread), and appends the
+    // Grammars to the GrammarSet in the order the files are named.  The
+    // messages for each file are held back and then reported file by file, so
+    // they are the same whatever the number of threads.  The status of each
+    // file is stored in *p_statuses if it is not null, and the first failure
+    // is returned.
+    Status add_grammars( const std::vector< std::string > & r_file_names, unsigned n_threads, std::vector< Status > * p_statuses = 0 );
     Status link();
     Status link( Grammar * p_grammar );
+    // Links the Grammars using up to n_threads threads (0 means one per
+    // hardware thread).  Each Grammar sees the others as link() would, and
+    // the messages for each Grammar are held back and then reported in
+    // GrammarSet order, so the outcome is the same as calling link() on a
+    // GrammarSet whose Grammars have not been linked before.
+    Status link_in_parallel( unsigned n_threads );
+    // Parses the named file again, e.g. after it has been edited, and puts
+    // the new Grammar in the place of the Grammar whose jcr_source is the
+    // file name, or appends it if there is none.  The new Grammar is then
+    // linked, along with the Grammars that import its ruleset id, or the
+    // replaced Grammar's, directly or through other Grammars.  The other
+    // Grammars are left as they are.  The links are the same as if the whole
+    // GrammarSet had been parsed and linked afresh, but only the messages for
+    // the Grammars that are linked are reported.  The replaced Grammar, and
+    // the memory of its rules, is released.
+    Status replace_grammar( const char * p_file_name );
+    // As above, but replaces p_grammar with the Grammar parsed from the
+    // rules, e.g. from an editor's buffer, keeping p_grammar's jcr_source.
+    // Returns S_ERROR, without parsing, if p_grammar is null or is not in
+    // the GrammarSet.
+    Status replace_grammar( Grammar * p_grammar, const char * p_rules, size_t size );
 
     virtual void report( const std::string & source, size_t line, size_t column, Severity severity, const char * p_message )  // Inherit this class to get error message fed back to you
     {
         (void)source; (void)line; (void)column; (void)severity; (void)p_message; // Mark parameters as unused
     }
+    // Messages are first passed to diagnose() as their format and arguments
+    // (p_args is null for messages without arguments).  By default they are
+    // then formatted and passed to report().  Override diagnose() to get
+    // messages without them being formatted, e.g. to record them in
+    // Diagnostics.
+    virtual void diagnose( const std::string & source, size_t line, size_t column, Severity severity, const char * p_format, const clutils::str_arg_refs * p_args );
     void report( const std::string & source, size_t line, Severity severity, const char * p_message )  // Inherit this class to get error message fed back to you
     {
         report( source, line, ~0U, severity, p_message );
@@ -511,17 +1046,37 @@ public:
     }
 
 private:
+    Status parse_grammar( const char * p_rules, size_t size, const std::string & jcr_source );
     Status parse_grammar( cl::reader & reader, const std::string & jcr_source );
+    Status replace_grammar( Grammar * p_grammar, const char * p_rules, size_t size, const std::string & jcr_source );
+};
+
+// JCRParserWithDiagnostics records the messages in Diagnostics, counting
+// the errors and warnings in the GrammarSet.  Duplicate messages are only
+// recorded and counted once.
+class JCRParserWithDiagnostics : public JCRParser
+{
+private:
+    Diagnostics recorded_diagnostics;
+
+    void count( Severity severity );
+
+public:
+    JCRParserWithDiagnostics( GrammarSet * p_grammar_set ) : JCRParser( p_grammar_set ) {}
+    virtual void report( const std::string & source, size_t line, size_t column, Severity severity, const char * p_message );
+    virtual void diagnose( const std::string & source, size_t line, size_t column, Severity severity, const char * p_format, const clutils::str_arg_refs * p_args );
+    const Diagnostics & diagnostics() const { return recorded_diagnostics; }
 };
 
-class JCRParserWithReporter : public JCRParser
+class JCRParserWithReporter : public JCRParserWithDiagnostics
 {
 private:
-    std::set< std::string > reported_messages;
+    void print( const Diagnostic & r_diagnostic ) const;
 
 public:
-    JCRParserWithReporter( GrammarSet * p_grammar_set ) : JCRParser( p_grammar_set ) {}
+    JCRParserWithReporter( GrammarSet * p_grammar_set ) : JCRParserWithDiagnostics( p_grammar_set ) {}
     virtual void report( const std::string & source, size_t line, size_t column, Severity severity, const char * p_message );
+    virtual void diagnose( const std::string & source, size_t line, size_t column, Severity severity, const char * p_format, const clutils::str_arg_refs * p_args );
 };
 
 }   // namespace cljcr
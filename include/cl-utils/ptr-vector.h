@@ -137,6 +137,12 @@ public:
     }
 
     void swap( ptr_vector & rhs ) { container.swap( rhs.container ); }
+    void splice( ptr_vector & rhs )
+    {
+        // Takes ownership of rhs's elements, appending them to this ptr_vector
+        container.insert( container.end(), rhs.container.begin(), rhs.container.end() );
+        rhs.container.clear();
+    }
 
     size_t size() const { return container.size(); }
     bool empty() const { return container.empty(); }
@@ -151,6 +157,20 @@ public:
     {
         push_back( new T( r_in ) );
     }
+    T * release_back()
+    {
+        // Removes the last element, passing ownership of it to the caller
+        T * p_back = container.back();
+        container.pop_back();
+        return p_back;
+    }
+    T * replace( size_t i, T * p_in )
+    {
+        // Takes ownership of p_in, passing ownership of the element it replaces to the caller
+        T * p_replaced = container[i];
+        container[i] = p_in;
+        return p_replaced;
+    }
     const_iterator begin() const { return const_iterator( container.begin() ); }
     iterator begin() { return iterator( container.begin() ); }
     const_iterator end() const { return const_iterator( container.end() ); }
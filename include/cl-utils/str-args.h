@@ -37,6 +37,7 @@
 #include <vector>
 #include <string>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
 #include <stdexcept>
 #include <sstream>
@@ -50,6 +51,69 @@ public:
     {}
 };
 
+// Used by str_arg to format types other than strings and integers.
+// Overload it in the namespace of a type to avoid using an ostringstream.
+template< typename T >
+void str_arg_append( std::string * p_out, const T & r_v )
+{
+    std::ostringstream sos;
+    sos << r_v;
+    p_out->append( sos.str() );
+}
+
+class str_arg
+{
+    // A reference to a single argument that is only converted to text when
+    // it is appended.  Strings are not copied and integers are held by value.
+    // Other types are referenced and formatted using str_arg_append().
+private:
+    enum Kind { TEXT, CHAR, SIGNED, UNSIGNED, OTHER };
+    typedef void (*appender_t)( std::string * p_out, const void * p_v );
+    struct Text { const char * p_chars; size_t size; };
+    struct Other { const void * p_v; appender_t p_appender; };
+
+    Kind kind;
+    union {
+        Text text;
+        char c;
+        long long signed_value;
+        unsigned long long unsigned_value;
+        Other other;
+    } u;
+
+    void set_text( const char * p_chars, size_t size ) { kind = TEXT; u.text.p_chars = p_chars; u.text.size = size; }
+    void set_signed( long long v ) { kind = SIGNED; u.signed_value = v; }
+    void set_unsigned( unsigned long long v ) { kind = UNSIGNED; u.unsigned_value = v; }
+
+    template< typename T >
+    static void append_other( std::string * p_out, const void * p_v )
+    {
+        str_arg_append( p_out, *static_cast< const T * >( p_v ) );
+    }
+
+public:
+    str_arg() { set_text( "", 0 ); }
+    str_arg( const std::string & r_v ) { set_text( r_v.data(), r_v.size() ); }
+    str_arg( const char * p_v ) { set_text( p_v, strlen( p_v ) ); }
+    str_arg( const char * p_v, size_t size ) { set_text( p_v, size ); }
+    str_arg( char v ) : kind( CHAR ) { u.c = v; }
+    str_arg( int v ) { set_signed( v ); }
+    str_arg( long v ) { set_signed( v ); }
+    str_arg( long long v ) { set_signed( v ); }
+    str_arg( unsigned int v ) { set_unsigned( v ); }
+    str_arg( unsigned long v ) { set_unsigned( v ); }
+    str_arg( unsigned long long v ) { set_unsigned( v ); }
+    template< typename T >
+    str_arg( const T & r_v ) : kind( OTHER )
+    {
+        u.other.p_v = &r_v;
+        u.other.p_appender = &append_other< T >;
+    }
+
+    void append_to( std::string * p_out ) const;
+    bool is_equal( const std::string & r_rhs ) const;
+};
+
 class str_args
 {
 public:
@@ -121,6 +185,50 @@ public:
         args.push_back( sos.str() );
         return *this;
     }
+    size_t size() const { return args.size(); }
+    const std::string & operator [] ( size_t i ) const { return args[i]; }
+    std::string expand( const char * format ) const
+    {
+        std::string s;
+        return *expand_append( &s, format );
+    }
+    std::string * expand_append( std::string * p_out, const char * format ) const;
+};
+
+class str_arg_refs
+{
+    // Like str_args, but holds up to max_size str_arg references rather than
+    // copies of the arguments as strings, so nothing is converted or
+    // allocated until the format is expanded.  As the arguments are
+    // referenced, a str_arg_refs must not outlive them.  This is the case
+    // when it is created in a function call, such as:
+    //     expand_append( &buffer, "%0 at %1", str_arg_refs( name ) << line );
+public:
+    enum { max_size = 10 };
+
+private:
+    str_arg args[max_size];
+    size_t n_args;
+
+public:
+    str_arg_refs() : n_args( 0 ) {}
+    str_arg_refs( const str_arg & r_arg_1 ) : n_args( 0 )
+    {
+        *this << r_arg_1;
+    }
+    str_arg_refs( const str_arg & r_arg_1, const str_arg & r_arg_2 ) : n_args( 0 )
+    {
+        *this << r_arg_1 << r_arg_2;
+    }
+    str_arg_refs & operator << ( const str_arg & r_arg )
+    {
+        if( n_args == max_size )
+            throw str_argsOutOfRangeException( "str_arg_refs has too many args" );
+        args[n_args++] = r_arg;
+        return *this;
+    }
+    size_t size() const { return n_args; }
+    const str_arg & operator [] ( size_t i ) const { return args[i]; }
     std::string expand( const char * format ) const
     {
         std::string s;
@@ -150,6 +258,20 @@ inline std::string & expand_append( std::string * p_out, const char format[], co
     return expand_append( p_out, format, str_args( r_arg_1 ) << r_arg_2 );
 }
 
+// The str_arg_refs forms write into *p_out without first converting the
+// arguments to strings.  Reusing the same *p_out for each message, after
+// clearing it, also avoids allocating memory for each result.
+inline std::string expand( const char format[], const str_arg_refs & r_args )
+{
+    return r_args.expand( format );
+}
+
+inline std::string & expand_append( std::string * p_out, const char format[], const str_arg_refs & r_args )
+{
+    r_args.expand_append( p_out, format );
+    return *p_out;
+}
+
 }   // namespace clutils
 
 #endif // CLUTIL_STR_ARGS
@@ -42,6 +42,7 @@
 #define CL_DSL_PA_ALPHABET
 
 #include <cctype>
+#include <cstring>
 
 #include "dsl-pa-reader.h"
 
@@ -107,7 +108,33 @@ public:
     char_map & invert();
     void merge( const char_map & r_rhs );
 
-    bool is_set( char c ) const;
+    bool is_set( char c ) const { return index[ alphabet_helpers::char_to_size_t( c ) ] != 0; }
+};
+
+// char_ranges holds the contents of a char_map as a short list of byte
+// ranges so that runs of input can be matched 16 (SSE2) or 32 (AVX2) bytes
+// at a time.  Maps that need more than max_ranges ranges are matched a byte
+// at a time using the char_map.
+
+class char_ranges
+{
+public:
+    enum { max_ranges = 8 };
+
+private:
+    unsigned char range_starts[max_ranges];
+    unsigned char range_lengths[max_ranges];   // Length - 1, so a range can span all 256 values
+    size_t n_ranges;
+    bool is_vectorisable;
+
+public:
+    char_ranges() : n_ranges( 0 ), is_vectorisable( false ) {}
+    void set( const char_map & r_map );
+
+    // Return the number of leading chars in [p_begin, p_end) that are in
+    // (span) or not in (cspan) r_map, which must be the map given to set()
+    size_t span( const char_map & r_map, const char * p_begin, const char * p_end ) const;
+    size_t cspan( const char_map & r_map, const char * p_begin, const char * p_end ) const;
 };
 
 // Specialist char maps corresponding to the Perl \w, \d and \s expressions
@@ -140,6 +167,25 @@ class alphabet
 {
 public:
     virtual bool is_sought( char c ) const = 0;
+
+    // span() returns the number of leading chars in [p_begin, p_end) that are
+    // sought, and cspan() the number that are not sought, in the manner of
+    // strspn() and strcspn().  They allow runs of input to be consumed with
+    // a single call.  Derived classes can override them with faster versions.
+    virtual size_t span( const char * p_begin, const char * p_end ) const
+    {
+        const char * p = p_begin;
+        while( p != p_end && is_sought( *p ) )
+            ++p;
+        return p - p_begin;
+    }
+    virtual size_t cspan( const char * p_begin, const char * p_end ) const
+    {
+        const char * p = p_begin;
+        while( p != p_end && ! is_sought( *p ) )
+            ++p;
+        return p - p_begin;
+    }
 };
 
 class alphabet_char : public alphabet
@@ -155,6 +201,11 @@ public:
     {
         return c == sought;
     }
+    virtual size_t cspan( const char * p_begin, const char * p_end ) const
+    {
+        const void * p_found = memchr( p_begin, sought, p_end - p_begin );
+        return p_found ? static_cast< const char * >( p_found ) - p_begin : p_end - p_begin;
+    }
 };
 
 // This alphabet class takes a specification that mirrors a Perl character
@@ -180,6 +231,7 @@ class alphabet_char_class : public alphabet
 {
 private:
     char_map wanted_chars;
+    char_ranges wanted_ranges;
 
 public:
     alphabet_char_class( const char * p_char_class_spec );
@@ -187,8 +239,17 @@ public:
     {
         return wanted_chars.is_set( c );
     }
+    virtual size_t span( const char * p_begin, const char * p_end ) const
+    {
+        return wanted_ranges.span( wanted_chars, p_begin, p_end );
+    }
+    virtual size_t cspan( const char * p_begin, const char * p_end ) const
+    {
+        return wanted_ranges.cspan( wanted_chars, p_begin, p_end );
+    }
 
 private:
+    void parse( const char * p_char_class_spec );
     bool add_range( char start, char end );
     bool add_special_char_class( char key );
 };
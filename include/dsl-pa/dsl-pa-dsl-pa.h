@@ -123,6 +123,13 @@ private:
     size_t read_or_skip_handler( std::string * p_output, mutator & r_mutator );
     template< class Tcomparer >
     bool read_fixed_or_ifixed( std::string * p_output, const char * p_seeking );
+    void accumulate_current();
+    const char * bulk_input_end( size_t max_chars ) const  // End of the input that can be scanned in place, limited to max_chars
+    {
+        const char * p_current = r_reader.input_current();
+        const char * p_end = r_reader.input_end();
+        return static_cast< size_t >( p_end - p_current ) > max_chars ? p_current + max_chars : p_end;
+    }
 
 public:
     dsl_pa( reader & r_reader_in ) : r_reader( r_reader_in ), p_accumulator( 0 ) {}
@@ -210,6 +217,13 @@ public:
     size_t skip_until( const alphabet & r_alphabet, char escape_char, size_t max_chars );
     size_t skip( mutator & r_mutator );
 
+    // skip_run() and accumulate_run() consume the run of chars in r_alphabet
+    // that the reader has available, without reading beyond it.  Unlike
+    // skip() they never read the end of input.  They allow a run to be
+    // consumed in one go ahead of a char by char parsing loop.
+    size_t skip_run( const alphabet & r_alphabet );
+    size_t accumulate_run( const alphabet & r_alphabet );
+
     // fixed() ensures that the specified text is read from the input, or leave input location unchanged.
     // ifixed() ignores ASCII case.
     bool fixed( const char * p_seeking );
@@ -219,6 +233,17 @@ public:
     bool read_fixed( std::string * p_output, const char * p_seeking );
     bool read_ifixed( std::string * p_output, const char * p_seeking );
 
+    // is_fixed_ahead() and is_in_ahead() examine the input that the reader
+    // has available without reading it (for incremental input, first
+    // waiting for enough of it to arrive), so neither needs to rewind and,
+    // unlike peek(), neither counts as reading the end of input.  They
+    // allow a choice of path to be made before committing to parsing it.
+    bool is_fixed_ahead( const char * p_seeking ) const;
+    bool is_in_ahead( const alphabet & r_alphabet ) const
+    {
+        return r_reader.is_available( 1 ) && r_alphabet.is_sought( *r_reader.input_current() );
+    }
+
     friend class accumulator_deferred;      // Use an instance of the accumulator class to store accumulated input
     bool accumulate( char c );
     bool accumulate( const alphabet & r_alphabet ); // If next input character is in alphabet then add it to the active accumulator
@@ -383,13 +408,35 @@ class accumulator_deferred      // Control access to dsl_pa::p_accumulator so it
 private:
     dsl_pa * p_dsl_pa;
     accumulator_deferred * p_previous_accumulator;
-    std::string my_accumulator;
+    // While the accumulated chars are a single run of the reader's input they
+    // are recorded as a view of the input rather than being copied.  They are
+    // only copied to my_accumulator when something not contiguous with the
+    // view is appended (such as a decoded escape sequence), or get() is
+    // called.  When p_view is set, my_accumulator is empty.  Input that may
+    // move is always copied.
+    mutable const char * p_view;
+    mutable size_t view_size;
+    mutable std::string my_accumulator;
+    bool is_viewing_input;
+
+    void materialise() const
+    {
+        if( p_view )
+        {
+            my_accumulator.assign( p_view, view_size );
+            p_view = 0;
+            view_size = 0;
+        }
+    }
 
 public:
     accumulator_deferred( dsl_pa * p_dsl_pa_in )
         :
         p_dsl_pa( p_dsl_pa_in ),
-        p_previous_accumulator( p_dsl_pa_in->p_accumulator )
+        p_previous_accumulator( p_dsl_pa_in->p_accumulator ),
+        p_view( 0 ),
+        view_size( 0 ),
+        is_viewing_input( p_dsl_pa_in->r_reader.is_input_stable() )
     {
     }
     ~accumulator_deferred() { previous(); }
@@ -397,24 +444,52 @@ public:
     bool select() { p_dsl_pa->p_accumulator = this; return true; }
     bool previous() { p_dsl_pa->p_accumulator = p_previous_accumulator; return true; }
     bool none() { p_dsl_pa->p_accumulator = 0; return true; }
-    bool clear() { my_accumulator.clear(); return true; }
+    bool clear() { p_view = 0; view_size = 0; my_accumulator.clear(); return true; }
     bool select_and_clear() { select(); return clear(); }
 
-    bool append( char c ) { my_accumulator += c; return true; }
-    bool append( const char * s ) { my_accumulator += s; return true; }
-    bool append( const std::string & r_s ) { my_accumulator += r_s; return true; }
-    bool append( const accumulator_deferred & r_a ) { my_accumulator += r_a.my_accumulator; return true; }
-    bool append_to_previous() const { if( p_previous_accumulator ) p_previous_accumulator->append( my_accumulator ); return true; }
+    bool append( char c ) { materialise(); my_accumulator += c; return true; }
+    bool append( const char * s ) { materialise(); my_accumulator += s; return true; }
+    bool append( const char * p, size_t n ) { materialise(); my_accumulator.append( p, n ); return true; }
+    bool append( const std::string & r_s ) { materialise(); my_accumulator += r_s; return true; }
+    bool append( const accumulator_deferred & r_a )
+    {
+        if( r_a.p_view )
+            return append_input( r_a.p_view, r_a.view_size );
+        return append( r_a.my_accumulator );
+    }
+    bool append_input( const char * p, size_t n )   // p must point into the reader's input
+    {
+        if( p_view && p_view + view_size == p )
+            view_size += n;
+        else if( ! p_view && my_accumulator.empty() && is_viewing_input )
+        {
+            if( n > 0 )
+            {
+                p_view = p;
+                view_size = n;
+            }
+        }
+        else
+            append( p, n );
+        return true;
+    }
+    bool append_to_previous() const { if( p_previous_accumulator ) p_previous_accumulator->append( *this ); return true; }
+
+    // empty(), size() and data() give access to the accumulated chars without
+    // copying them.  data() is not NUL terminated.
+    bool empty() const { return p_view ? view_size == 0 : my_accumulator.empty(); }
+    size_t size() const { return p_view ? view_size : my_accumulator.size(); }
+    const char * data() const { return p_view ? p_view : my_accumulator.data(); }
 
-    const std::string & get() const { return my_accumulator; }
-    int to_int() const { return atoi( my_accumulator.c_str() ); }
-    unsigned int  to_uint() const { return static_cast<unsigned int>( strtoul( my_accumulator.c_str(), 0, 10 ) ); }
+    const std::string & get() const { materialise(); return my_accumulator; }
+    int to_int() const { return atoi( get().c_str() ); }
+    unsigned int  to_uint() const { return static_cast<unsigned int>( strtoul( get().c_str(), 0, 10 ) ); }
     int64 to_int64() const;
     uint64 to_uint64() const;
-    double to_float() const { return atof( my_accumulator.c_str() ); }
+    double to_float() const { return atof( get().c_str() ); }
     // bool to_bool() const = delete - Textual definitions of Boolean are very application specific so not supported here
 
-    bool put_in( std::string & r_place_where ) const { r_place_where = get(); return true; }
+    bool put_in( std::string & r_place_where ) const { r_place_where.assign( data(), size() ); return true; }
     bool put_in( int & r_place_where ) const { r_place_where = to_int(); return true; }
     bool put_in( unsigned int & r_place_where ) const { r_place_where = to_uint(); return true; }
     bool put_in( int64 & r_place_where ) const { r_place_where = to_int64(); return true; }
@@ -41,136 +41,208 @@
 #ifndef CL_DSL_PA_READER
 #define CL_DSL_PA_READER
 
+#include <cassert>
 #include <string>
+#include <cstring>
 #include <vector>
-#include <stack>
 #include <fstream>
 
-#include "cl-utils/history-buffer.h"
-
 namespace cl {
 
-class unget_buffer_with_stack
+// line_index maps offsets in a block of input to line and column numbers.
+// The index is built by scanning the input for newlines the first time it
+// is needed, and thereafter a position is found by binary search, so the
+// per-character reading path does no position bookkeeping.  For input that
+// arrives incrementally, only the input that has arrived since the last
+// scan is scanned, and the newlines before input that has been released are
+// dropped from the index.
+//
+// Line numbers start at 1 and column numbers at 0.  The column number is the
+// number of characters read since the start of the line.  A '\r\n' or '\n\r'
+// pair counts as a single newline, whereas '\r\r' and '\n\n' count as two.
+// Offsets beyond the end of the input count as extra columns on the last
+// line (see reader::get()).
+class line_index
 {
 private:
-    typedef std::stack< char > unget_buffer_t;
+    struct newline
+    {
+        size_t line_increment_offset;   // The line number increases at this offset...
+        size_t line_start_offset;       // ...and the next line starts here (after any '\r\n' pair)
+    };
+    typedef std::vector< newline > newlines_t;
 
-    unget_buffer_t unget_buffer;
-    std::stack< unget_buffer_t > stack;
+    const char * p_begin;
+    const char * p_end;
+    size_t begin_offset;        // The offset of p_begin in the input
+    size_t indexed_offset;      // The input before this offset has been scanned
+    char pair_start_char;       // Allows a '\r\n' pair to be split between scans
+    newlines_t newlines;
+    size_t n_released_newlines; // Newlines dropped from the front of newlines
+
+    void index();
+    const newline * find( size_t offset );  // Returns the last newline at or before offset, or 0
 
 public:
-    void unget( char c ) { unget_buffer.push( c ); }
-    char reget() { char c = unget_buffer.top(); unget_buffer.pop(); return c; }
-    bool empty() const { return unget_buffer.empty(); }
+    line_index() : p_begin( 0 ), p_end( 0 ), begin_offset( 0 ), indexed_offset( 0 ), pair_start_char( '\0' ), n_released_newlines( 0 ) {}
 
-    void push()
+    void set_input( const char * p_begin_in, const char * p_end_in )
     {
-        // Push empty object to avoid multiple copies of unget_buffer
-        stack.push( unget_buffer_t() );
-        stack.top() = unget_buffer;
+        p_begin = p_begin_in;
+        p_end = p_end_in;
+        begin_offset = indexed_offset = 0;
+        pair_start_char = '\0';
+        newlines.clear();
+        n_released_newlines = 0;
+    }
+    // For incremental input.  release() indexes the input so far, as the
+    // input before offset may then be discarded, and offsets before it will
+    // not be asked about.  move_input() gives the new location of the input,
+    // which now starts at begin_offset_in.
+    void release( size_t offset );
+    void move_input( const char * p_begin_in, const char * p_end_in, size_t begin_offset_in )
+    {
+        p_begin = p_begin_in;
+        p_end = p_end_in;
+        begin_offset = begin_offset_in;
     }
-    void revise() { if( ! stack.empty() ) stack.top() = unget_buffer; }
-    void top() { if( ! stack.empty() ) unget_buffer = stack.top(); }
-    void pop() { if( ! stack.empty() ) stack.pop(); }
+
+    int get_line_number( size_t offset );
+    int get_column_number( size_t offset );
 };
 
-class line_counter_with_stack
+// reader presents its input as a single contiguous block of memory, which
+// derived classes supply via set_input().  This allows the per-character
+// get() path to be non-virtual and inlined into the parsing code.  It also
+// means that ungetting a character just steps the cursor back, and a
+// recorded location is simply an offset into the input, so recording and
+// restoring locations costs no heap allocation.  Line and column numbers
+// are only worked out, by line_index, when they are asked for.
+//
+// Input that arrives incrementally is also presented as a contiguous block,
+// which grows as the input arrives and loses the input at its front that
+// can no longer be returned to.  Offsets are from the start of the input as
+// a whole, so they are not affected by the block moving.  See
+// reader_incremental.
+class reader
 {
-public:
-    static const int UNKNOWN = -1;
-
 private:
-    struct position
-    {
-        int line_number;
-        int column_number;
-
-        position() : line_number( 0 ), column_number( 0 ) {}
-        position( int line_number_in, int column_number_in )
-            : line_number( line_number_in ), column_number( column_number_in )
-        {}
-    };
-
-    struct stack_item
-    {
-        clutils::HistoryBuffer< position, 10 > history_buffer;
-        char last_nl_char;
-        stack_item() : last_nl_char( '\0' ) {}
-        // stack_item & operator = ( const stack_item & rhs ) = default;
-    };
-    stack_item current;
-    std::stack< stack_item > stack;
+    const char * p_begin, * p_current, * p_end;
+    size_t begin_offset;    // The offset of p_begin in the input, which is only non-zero for incremental input
+    size_t n_reads_at_end;  // get() at the end of input counts as reading a character
+    std::vector< size_t > locations;    // Capacity is retained when popped, so pushing rarely allocates
+    size_t n_rewinds;   // Number of times a recorded location has been returned to
+    mutable line_index lines;
+    char current_char;
+    bool is_more_input_possible;    // Only true for incremental input that has not yet ended
 
-    void set_position( int line_number, int column_number )
+    char get_at_end()
     {
-        current.history_buffer.push( position( line_number, column_number ) );
+        if( is_more_input_possible && get_more_input() )
+            return get();
+        ++n_reads_at_end;
+        return current_char = R_EOI;
     }
+    bool get_more_input();
 
-public:
-    line_counter_with_stack()
+    size_t offset() const { return begin_offset + (p_current - p_begin) + n_reads_at_end; }
+    void set_offset( size_t offset )
     {
-        set_position( 1, 0 );
+        size_t relative_offset = offset - begin_offset;
+        size_t size = p_end - p_begin;
+        p_current = p_begin + (relative_offset < size ? relative_offset : size);
+        n_reads_at_end = relative_offset < size ? 0 : relative_offset - size;
     }
 
-    void got_char( char c );
-    void ungot_char( char /*c*/ )
-    {
-        if( current.history_buffer.has_back() )
-            current.history_buffer.go_back();
-    }
-    void retrieved_ungot_char( char /*c*/ )
+protected:
+    reader() : p_begin( 0 ), p_current( 0 ), p_end( 0 ), begin_offset( 0 ), n_reads_at_end( 0 ), n_rewinds( 0 ), current_char( R_EOI ), is_more_input_possible( false ) {}
+
+    void set_input( const char * p_begin_in, size_t size )
     {
-        if( current.history_buffer.has_frwd() )
-            current.history_buffer.go_frwd();
+        p_begin = p_current = p_begin_in;
+        p_end = p_begin_in + size;
+        begin_offset = 0;
+        n_reads_at_end = 0;
+        is_more_input_possible = false;
+        lines.set_input( p_begin, p_end );
     }
 
-    int get_line_number() const
-    {
-        return current.history_buffer.get().line_number;
+    // A reader with incremental input calls set_input_incremental() in
+    // place of set_input().  more_input() is then called each time the end of
+    // the input so far is reached.  It returns false if the input has ended.
+    // Otherwise it makes more input available by calling move_input(), which
+    // may only be called from more_input().  Any input before the offset
+    // returned by release_input() can no longer be returned to, so can be
+    // discarded.
+    void set_input_incremental()
+    {
+        set_input( 0, 0 );
+        is_more_input_possible = true;
     }
-    int get_column_number() const
-    {
-        // Tracking column numbers not implemented by this class
-        return current.history_buffer.get().column_number;
+    virtual bool more_input() { return false; }
+    size_t release_input();
+    void move_input( const char * p_begin_in, size_t size, size_t begin_offset_in )
+    {
+        p_begin = p_current = p_begin_in;
+        p_end = p_begin_in + size;
+        begin_offset = begin_offset_in;
+        lines.move_input( p_begin, p_end, begin_offset );
     }
 
-    void push() { stack.push( current ); }
-    void revise() { if( ! stack.empty() ) stack.top() = current; }
-    void top() { if( ! stack.empty() ) current = stack.top(); }
-    void pop() { if( ! stack.empty() ) stack.pop(); }
-};
-
-class reader
-{
-private:
-    line_counter_with_stack line_counter;
-    unget_buffer_with_stack unget_buffer;
-    char current_char;
-
-    virtual char get_next_input() = 0;
-
-    virtual void source_location_push() = 0;
-    virtual void source_location_revise() = 0;
-    virtual void source_location_top() = 0;
-    virtual void source_location_pop() = 0;
-
 public:
     enum { R_EOI = 0 }; // Constant for "Reader End Of Input"
 
-    reader() : current_char( R_EOI ) {}
     virtual ~reader() {}
 
     virtual bool is_open() const { return true; }
 
-    char get();
+    char get()
+    {
+        if( p_current != p_end )
+            return current_char = *p_current++;
+        return get_at_end();
+    }
     char current() const { return current_char; }
+
+    // Bulk access allows runs of input to be scanned in place.  The chars in
+    // [input_current(), input_end()) are those that get() will return next.
+    // skip_ahead( n ) is equivalent to calling get() n times, where n must
+    // not exceed input_end() - input_current().  For incremental input, the
+    // chars are those that have arrived so far, and is_available( n ) makes
+    // at least n chars available, if the input has that many.
+    const char * input_current() const { return p_current; }
+    const char * input_end() const { return p_end; }
+    bool is_available( size_t n )
+    {
+        while( static_cast< size_t >( p_end - p_current ) < n )
+            if( ! is_more_input_possible || ! get_more_input() )
+                return false;
+        return true;
+    }
+    // current_input() is where in the input the char most recently returned
+    // by get() came from, or 0 if get() reached the end of input.  It is only
+    // valid straight after a call to get().
+    const char * current_input() const { return n_reads_at_end == 0 && p_current != p_begin ? p_current - 1 : 0; }
+    // Whether the input will remain at the same location for the life of the
+    // reader, so that pointers into it can be kept.  Incremental input may
+    // be moved until it ends.
+    bool is_input_stable() const { return ! is_more_input_possible; }
+    void skip_ahead( size_t n )
+    {
+        if( n > 0 )
+        {
+            p_current += n;
+            current_char = p_current[-1];
+        }
+    }
+
     void unget() { unget( current() ); }    // Unget with argument ungets current char
-    void unget( char c )
+    void unget( char c )    // c must be the most recently got character that hasn't already been ungot
     {
-        if( c != R_EOI )
+        if( c != R_EOI && p_current != p_begin )
         {
-            line_counter.ungot_char( c );
-            unget_buffer.unget( c );
+            assert( c == p_current[-1] );   // Only the position is stepped back, so c can't be a different char
+            --p_current;
         }
     }
     char peek() { get(); unget(); return current(); }
@@ -196,172 +268,172 @@ public:
     // do location_pop().  See also class location_logger.
     void location_push()
     {
-        unget_buffer.push();
-        line_counter.push();
-        source_location_push();
+        locations.push_back( offset() );
     }
 
     void location_revise()
     {
-        unget_buffer.revise();
-        line_counter.revise();
-        source_location_revise();
+        if( ! locations.empty() )
+            locations.back() = offset();
     }
 
     bool location_top()
     {
-        source_location_top();
-        unget_buffer.top();
-        line_counter.top();
+        if( ! locations.empty() )
+        {
+            set_offset( locations.back() );
+            ++n_rewinds;
+        }
         return true;
     }
 
     void location_pop()
     {
-        source_location_pop();
-        unget_buffer.pop();
-        line_counter.pop();
+        if( ! locations.empty() )
+            locations.pop_back();
+    }
+
+    // abandon() makes the reader behave as if the input ended at the current
+    // location, and discards the recorded locations so that parsing can't
+    // rewind to earlier input.  This allows a parser to unwind after an
+    // unrecoverable error without throwing an exception, because each of the
+    // remaining parse steps then fails.
+    void abandon()
+    {
+        p_end = p_current;
+        locations.clear();
+        is_more_input_possible = false;
     }
 
-    int get_line_number() const { return line_counter.get_line_number(); }
-    int get_column_number() const { return line_counter.get_column_number(); }
+    int get_line_number() const { return lines.get_line_number( offset() ); }
+    int get_column_number() const { return lines.get_column_number( offset() ); }
+
+    // get_location() and set_location() allow a location to be recorded and
+    // returned to without using the location stack.  A location can only be
+    // returned to by the reader it was got from, and, for incremental input,
+    // only while it is not before the input released by release_input().
+    size_t get_location() const { return offset(); }
+    void set_location( size_t location ) { set_offset( location ); }
+
+    // The number of location_top() calls made so far.  This is a measure of
+    // how much speculative parsing has been backtracked.
+    size_t get_rewind_count() const { return n_rewinds; }
 };
 
 class reader_string : public reader
 {
-private:
-    const char * p_input;
-    std::stack< const char * > location_buffer;
-
 public:
     reader_string( const char * p_input_in )
-        :
-        p_input( p_input_in )
-    {}
-    reader_string( const std::string & r_input_in )
-        :
-        p_input( r_input_in.c_str() )
-    {}
-
-    virtual char get_next_input()
     {
-        if( *p_input )
-            return *p_input++;
-
-        return reader::R_EOI;
-    }
-
-    virtual void source_location_push()
-    {
-        location_buffer.push( p_input );
+        set_input( p_input_in, strlen( p_input_in ) );
     }
-    virtual void source_location_revise()
+    reader_string( const std::string & r_input_in )
     {
-        location_buffer.top() = p_input;
+        set_input( r_input_in.c_str(), strlen( r_input_in.c_str() ) );  // Like a C string, input ends at any embedded NUL
     }
-    virtual void source_location_top()
+};
+
+class reader_mem_buf : public reader
+{
+public:
+    reader_mem_buf( const char * p_begin_in, size_t size )
     {
-        if( ! location_buffer.empty() )
-            p_input = location_buffer.top();
+        set_input( p_begin_in, size );
     }
-    virtual void source_location_pop()
+    reader_mem_buf( const std::vector< char > & r_in )  // A vector seems a good place to collect data from a socket etc.
     {
-        location_buffer.pop();
+        if( ! r_in.empty() )
+            set_input( &r_in[0], r_in.size() );
     }
 };
 
-class reader_mem_buf : public reader
+class reader_file : public reader
 {
 private:
-    const char * p_begin, * p_current, * p_end;
-    std::stack< const char * > location_buffer;
+    std::vector< char > contents;
+    bool is_opened;
 
 public:
-    reader_mem_buf( const char * p_begin_in, size_t size )
-        :
-        p_begin( p_begin_in ),
-        p_current( p_begin_in ),
-        p_end( p_begin_in + size )
-    {}
-    reader_mem_buf( const std::vector< char > & r_in )  // A vector seems a good place to collect data from a socket etc.
-        :
-        p_begin( &r_in[0] ),
-        p_current( &r_in[0] ),
-        p_end( &r_in[0] + r_in.size() )
-    {}
+    reader_file( const char * p_input_in );
 
-    virtual char get_next_input()
-    {
-        if( p_current != p_end )
-            return *p_current++;
+    virtual bool is_open() const { return is_opened; }
+};
 
-        return reader::R_EOI;
-    }
+// reader_incremental is a base for readers whose input arrives in chunks,
+// such as from a pipe.  A derived class implements read_chunk(), which
+// appends the next chunk of input to *p_buffer, waiting for it if need be,
+// and returns false at the end of the input.  The input that can no longer
+// be returned to is removed from the front of the buffer before each
+// chunk is read, so the buffer only holds the input from the earliest
+// recorded location onwards, plus the latest chunk.
+class reader_incremental : public reader
+{
+private:
+    std::vector< char > buffer;
+    size_t buffer_offset;   // The offset of buffer[0] in the input
 
-    virtual void source_location_push()
-    {
-        location_buffer.push( p_current );
-    }
-    virtual void source_location_revise()
-    {
-        location_buffer.top() = p_current;
-    }
-    virtual void source_location_top()
-    {
-        if( ! location_buffer.empty() )
-            p_current = location_buffer.top();
-    }
-    virtual void source_location_pop()
-    {
-        location_buffer.pop();
-    }
+    virtual bool more_input();
+
+protected:
+    reader_incremental() : buffer_offset( 0 ) { set_input_incremental(); }
+
+    virtual bool read_chunk( std::vector< char > * p_buffer ) = 0;
+
+public:
+    size_t buffer_size() const { return buffer.size(); }
 };
 
-class reader_file : public reader
+// mapped_file presents the contents of a file as a single contiguous block
+// of memory.  Where possible the file is memory mapped so that the OS can
+// page it in on demand without any extra copying.  If the file can't be
+// mapped (e.g. it's a pipe or some other special file) its contents are
+// read into a heap buffer instead.  An empty file yields a valid, zero
+// length, block.
+class mapped_file
 {
 private:
-    std::ifstream fin;
-    std::stack< std::ifstream::pos_type > location_buffer;
+    const char * p_data;
+    size_t data_size;
+    bool is_opened;
+    bool is_mapped;
+    std::vector< char > fallback_buffer;
+#if defined( _WIN32 )
+    void * h_file;
+    void * h_mapping;
+#endif
+
+    // Not copyable
+    mapped_file( const mapped_file & );
+    mapped_file & operator = ( const mapped_file & );
+
+    bool map( const char * p_file_name );
+    void read( const char * p_file_name );
+    void unmap();
 
 public:
-    reader_file( const char * p_input_in )
-        :
-        fin( p_input_in, std::ios::binary )
-    {}
+    mapped_file( const char * p_file_name );
+    ~mapped_file();
 
-    virtual bool is_open() const { return fin.is_open(); }
+    bool is_open() const { return is_opened; }
+    bool is_memory_mapped() const { return is_mapped; }
+    const char * data() const { return p_data; }
+    size_t size() const { return data_size; }
+};
 
-    virtual char get_next_input()
-    {
-        int c = fin.get();
-        if( c == -1 )
-            return reader::R_EOI;
-        return static_cast<char>( c );
-    }
+// reader_mapped_file reads a file via mapped_file.  mapped_file is a base
+// class, rather than a member, so that it is constructed before the
+// reader_mem_buf that refers to its contents.
+class reader_mapped_file : private mapped_file, public reader_mem_buf
+{
+public:
+    reader_mapped_file( const char * p_file_name )
+        :
+        mapped_file( p_file_name ),
+        reader_mem_buf( mapped_file::data(), mapped_file::size() )
+    {}
 
-    virtual void source_location_push()
-    {
-        if( fin.eof() )
-            fin.clear();
-        location_buffer.push( fin.tellg() );
-    }
-    virtual void source_location_revise()
-    {
-        location_buffer.top() = fin.tellg();
-    }
-    virtual void source_location_top()
-    {
-        if( ! location_buffer.empty() )
-        {
-            if( fin.eof() )
-                fin.clear();
-            fin.seekg( location_buffer.top() );
-        }
-    }
-    virtual void source_location_pop()
-    {
-        location_buffer.pop();
-    }
+    virtual bool is_open() const { return mapped_file::is_open(); }
+    bool is_memory_mapped() const { return mapped_file::is_memory_mapped(); }
 };
 
 } // End of namespace cl
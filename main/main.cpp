@@ -11,12 +11,21 @@
 #include "cl-utils/command-line-args.h"
 
 #include <iostream>
+#include <cstdlib>
+#include <cstdio>
 
 struct TestConfig
 {
     bool is_parse_only;
+    bool is_exception_free;
+    bool is_memoising;
+    unsigned n_threads;
+    bool is_reading_stdin;
+    std::string binary_to_save;
+    std::string binary_to_load;
+    std::string parse_cache_directory;
 
-    TestConfig() : is_parse_only( false ) {}
+    TestConfig() : is_parse_only( false ), is_exception_free( false ), is_memoising( false ), n_threads( 1 ), is_reading_stdin( false ) {}
 };
 
 void help()
@@ -34,10 +43,25 @@ void help()
             "\n"
             "    -parse-only:\n"
             "        Only do the parse phase\n"
+            "    -exception-free:\n"
+            "        Unwind fatal parse errors without using exceptions\n"
+            "    -memoise:\n"
+            "        Memoise parsed annotations to avoid reparsing them\n"
+            "    -j <n>:\n"
+            "        Parse and link the JCR files using up to <n> threads (0 = one per CPU)\n"
+            "    -cache <dir>:\n"
+            "        Keep the parsed JCR files in the directory <dir>, and reuse them if unchanged\n"
+            "    -stdin:\n"
+            "        Parse a JCR grammar from standard input, as it arrives, after the JCR files\n"
+            "    -save-binary <file>:\n"
+            "        Save the linked grammars to a precompiled binary file (e.g. rules.jcrb).\n"
+            "        Can not be used with -parse-only\n"
+            "    -load-binary <file>:\n"
+            "        Load and check a precompiled binary file instead of parsing JCR files\n"
             "    -json <file>:\n"
             "        Specify JSON file to be validated against specified JCR files\n"
             "\n"
-            "<jcr-file-list> - One or more JCR files to verify.\n"
+            "<jcr-file-list> - One or more JCR files to verify (optional with -stdin or -load-binary).\n"
             ;
 }
 
@@ -64,6 +88,41 @@ bool capture_command_line( TestConfig * p_test_config, cljcr::Config * p_config,
             p_test_config->is_parse_only = true;
         }
 
+        else if( cla.is_flag( "exception-free" ) )
+        {
+            p_test_config->is_exception_free = true;
+        }
+
+        else if( cla.is_flag( "memoise" ) )
+        {
+            p_test_config->is_memoising = true;
+        }
+
+        else if( cla.is_flag( "j", 1, "-j flag must include number of threads" ) )
+        {
+            p_test_config->n_threads = static_cast< unsigned >( std::atoi( cla.next() ) );
+        }
+
+        else if( cla.is_flag( "cache", 1, "-cache flag must include name of cache directory" ) )
+        {
+            p_test_config->parse_cache_directory = cla.next();
+        }
+
+        else if( cla.is_flag( "stdin" ) )
+        {
+            p_test_config->is_reading_stdin = true;
+        }
+
+        else if( cla.is_flag( "save-binary", 1, "-save-binary flag must include name of file to save" ) )
+        {
+            p_test_config->binary_to_save = cla.next();
+        }
+
+        else if( cla.is_flag( "load-binary", 1, "-load-binary flag must include name of file to load" ) )
+        {
+            p_test_config->binary_to_load = cla.next();
+        }
+
         else if( cla.is_flag( "json", 1, "-json flag must include name of JSON file to validate" ) )
         {
             p_config->set_json( cla.next() );
@@ -77,24 +136,61 @@ bool capture_command_line( TestConfig * p_test_config, cljcr::Config * p_config,
             p_config->add_jcr( cla.current() );
     }
 
-    if( ! p_config->has_jcr() )
+    if( ! p_config->has_jcr() && ! p_test_config->is_reading_stdin && p_test_config->binary_to_load.empty() )
     {
         std::cerr << "Error: No JCR files specified\n";
         help();
         return false;
     }
 
+    if( p_test_config->is_parse_only && ! p_test_config->binary_to_save.empty() )
+    {
+        std::cerr << "Error: -save-binary can not be used with -parse-only, as the grammars must be linked to be saved\n";
+        help();
+        return false;
+    }
+
     return true;
 }
 
+bool parse_stdin( cljcr::JCRParser * p_jcr_parser )
+{
+    p_jcr_parser->begin_grammar( "<stdin>" );
+    char chunk[4096];
+    size_t size;
+    while( (size = std::fread( chunk, 1, sizeof( chunk ), stdin )) > 0 )
+        p_jcr_parser->feed( chunk, size );
+    cljcr::JCRParser::Status result = p_jcr_parser->end_grammar();
+
+    if( result == cljcr::JCRParser::S_INTERNAL_ERROR )
+        std::cout << "An internal error occurred while processing JCR from standard input\n";
+
+    return result == cljcr::JCRParser::S_OK;
+}
+
 bool parse_config_jcrs( cljcr::GrammarSet * p_grammar_set, const TestConfig & r_test_config, const cljcr::Config & r_config )
 {
     cljcr::JCRParserWithReporter jcr_parser( p_grammar_set );
+    jcr_parser.set_exception_free( r_test_config.is_exception_free );
+    jcr_parser.set_memoising( r_test_config.is_memoising );
+    cljcr::ParseCache parse_cache( r_test_config.parse_cache_directory );
+    if( ! r_test_config.parse_cache_directory.empty() )
+        jcr_parser.set_parse_cache( &parse_cache );
     bool is_errored = false;
 
+    std::vector< std::string > jcr_files;
     for( size_t i = 0; i < r_config.jcr_size(); ++i )
+        jcr_files.push_back( r_config.jcr( i ) );
+
+    std::vector< cljcr::JCRParser::Status > results;
+    jcr_parser.add_grammars( jcr_files, r_test_config.n_threads, &results );
+
+    if( jcr_parser.parse_cache() )
+        std::cout << "Parse cache: " << parse_cache.hits() << " hit(s), " << parse_cache.misses() << " miss(es)\n";
+
+    for( size_t i = 0; i < results.size(); ++i )
     {
-        cljcr::JCRParser::Status result = jcr_parser.add_grammar( r_config.jcr( i ).c_str() );
+        cljcr::JCRParser::Status result = results[i];
 
         if( result != cljcr::JCRParser::S_OK )
         {
@@ -107,11 +203,14 @@ bool parse_config_jcrs( cljcr::GrammarSet * p_grammar_set, const TestConfig & r_
                 std::cout << "An internal error occurred while processing JCR file: " << r_config.jcr( i ) << "\n";
         }
     }
+
+    if( r_test_config.is_reading_stdin && ! parse_stdin( &jcr_parser ) )
+        is_errored = true;
     
     if( is_errored || r_test_config.is_parse_only )
         return ! is_errored;
 
-    is_errored = (jcr_parser.link() != cljcr::JCRParser::S_OK);
+    is_errored = (jcr_parser.link_in_parallel( r_test_config.n_threads ) != cljcr::JCRParser::S_OK);
 
     return ! is_errored;
 }
@@ -125,6 +224,44 @@ bool parse_grammar_set( cljcr::GrammarSet * p_grammar_set, const TestConfig & r_
     return result;
 }
 
+const char * describe( cljcr::CompiledGrammar::Status status )
+{
+    switch( status )
+    {
+        case cljcr::CompiledGrammar::S_OK: return "OK";
+        case cljcr::CompiledGrammar::S_UNABLE_TO_OPEN_FILE: return "Unable to open file";
+        case cljcr::CompiledGrammar::S_UNABLE_TO_WRITE_FILE: return "Unable to write file";
+        case cljcr::CompiledGrammar::S_WRONG_FORMAT: return "Not a precompiled binary file of this version";
+        case cljcr::CompiledGrammar::S_CORRUPTED: return "File is corrupted";
+    }
+    return "Unknown error";
+}
+
+bool save_binary( const cljcr::GrammarSet & r_grammar_set, const std::string & r_file_name )
+{
+    cljcr::CompiledGrammar compiled( r_grammar_set );
+    cljcr::CompiledGrammar::Status status = compiled.save( r_file_name.c_str() );
+    if( status != cljcr::CompiledGrammar::S_OK )
+    {
+        std::cout << "Unable to save precompiled binary file: " << r_file_name << ": " << describe( status ) << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool load_binary( const std::string & r_file_name )
+{
+    cljcr::CompiledGrammar compiled;
+    cljcr::CompiledGrammar::Status status = compiled.load( r_file_name.c_str(), true );
+    if( status != cljcr::CompiledGrammar::S_OK )
+    {
+        std::cout << "Unable to load precompiled binary file: " << r_file_name << ": " << describe( status ) << "\n";
+        return false;
+    }
+    std::cout << "Loaded " << compiled.grammar_count() << " grammar(s), " << compiled.size() << " rule(s) from " << r_file_name << "\n";
+    return true;
+}
+
 int main( int argc, char * argv[] )
 {
     TestConfig test_config;
@@ -133,10 +270,19 @@ int main( int argc, char * argv[] )
     if( ! capture_command_line( &test_config, &config, argc, argv ) )
         return -1;
 
+    if( ! test_config.binary_to_load.empty() && ! load_binary( test_config.binary_to_load ) )
+        return -1;
+
+    if( ! config.has_jcr() && ! test_config.is_reading_stdin )
+        return 0;
+
     cljcr::GrammarSet grammar_set;
 
     if( ! parse_grammar_set( &grammar_set, test_config, config ) )
         return -1;
 
+    if( ! test_config.binary_to_save.empty() && ! save_binary( grammar_set, test_config.binary_to_save ) )
+        return -1;
+
     return 0;
 }
@@ -0,0 +1,530 @@
+//----------------------------------------------------------------------------
+// Copyright (c) 2015-2017, Codalogic Ltd (http://www.codalogic.com)
+//
+// This Source Code is subject to the terms of the GNU LESSER GENERAL PUBLIC
+// LICENSE version 3. If a copy of the LGPLv3 was not distributed with
+// this file, you can obtain one at http://opensource.org/licenses/LGPL-3.0.
+//----------------------------------------------------------------------------
+
+#include "cl-jcr-parser/compiled-grammar.h"
+
+#include "dsl-pa/dsl-pa-reader.h"
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+
+namespace cljcr {
+
+namespace { // Anonymous namespace
+
+//----------------------------------------------------------------------------
+//                        Internal class BlockLayout
+//----------------------------------------------------------------------------
+
+// BlockLayout places the arrays of a CompiledGrammar one after the other,
+// each starting on an 8 byte boundary.  With a null block it only measures
+// the size of the block.
+class BlockLayout
+{
+private:
+    const char * p_block;
+    size_t offset;
+
+public:
+    BlockLayout( const char * p_block_in ) : p_block( p_block_in ), offset( 0 ) {}
+
+    template< typename T >
+    void place( const T ** pp_array, size_t count )
+    {
+        *pp_array = p_block ? reinterpret_cast< const T * >( p_block + offset ) : 0;
+        offset += (count * sizeof( T ) + 7) / 8 * 8;
+    }
+    size_t size() const { return offset; }
+};
+
+template< typename T >
+void copy_to( const T * p_array, const std::vector< T > & r_source )
+{
+    if( ! r_source.empty() )
+        std::memcpy( const_cast< T * >( p_array ), &r_source[0], r_source.size() * sizeof( T ) );
+}
+
+//----------------------------------------------------------------------------
+//                        Internal struct FileHeader
+//----------------------------------------------------------------------------
+
+// The header at the start of a saved CompiledGrammar.  The block follows
+// immediately after it.  The format version must be incremented whenever
+// the layout of the header or block changes, including the values of the
+// Rule::Type and Rule::ChildCombiner enums.
+struct FileHeader
+{
+    char magic[8];
+    uint32 format_version;
+    uint32 byte_order;      // byte_order_mark, as written by the saving platform
+    uint32 header_size;
+    uint32 reserved;
+    CompiledGrammar::Counts counts;
+    uint64 block_size;
+    uint64 block_checksum;
+    uint64 header_checksum; // Of the preceding members of the header
+};
+
+const char file_magic[8] = { '\x89', 'J', 'C', 'R', 'B', '\r', '\n', '\x1a' };
+const uint32 file_format_version = 1;
+const uint32 byte_order_mark = 0x01020304;
+
+// FNV-1a, as used to hash Diagnostics
+uint64 checksum( const char * p_data, size_t size )
+{
+    uint64 hash = 14695981039346656037ULL;
+    for( size_t i = 0; i < size; ++i )
+    {
+        hash ^= static_cast< unsigned char >( p_data[i] );
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64 header_checksum( const FileHeader & r_header )
+{
+    return checksum( reinterpret_cast< const char * >( &r_header ), offsetof( FileHeader, header_checksum ) );
+}
+
+//----------------------------------------------------------------------------
+//                        Internal class Compiler
+//----------------------------------------------------------------------------
+
+// Compiler numbers the Rules of a GrammarSet and collects their properties
+// into arrays, ready to be copied into a CompiledGrammar's block
+class Compiler
+{
+public:
+    std::vector< const Rule * > rules;  // Indexed by Node
+
+    std::vector< uint8 > types;
+    std::vector< uint8 > child_combiners;
+    std::vector< uint16 > flags;
+    std::vector< Repetition > repetitions;
+    std::vector< CompiledGrammar::Node > first_children;
+    std::vector< uint32 > child_counts;
+    std::vector< CompiledGrammar::Node > rule_nodes;
+    std::vector< CompiledGrammar::Node > type_nodes;
+    std::vector< uint32 > rule_names;
+    std::vector< uint32 > member_names;
+    std::vector< uint32 > constraints;
+    std::vector< uint32 > details;
+    std::vector< uint32 > grammars;
+    std::vector< int32 > line_numbers;
+    std::vector< int32 > column_numbers;
+
+    std::vector< CompiledGrammar::GrammarEntry > grammar_entries;
+    std::vector< CompiledGrammar::Constraint > constraint_pairs;
+    std::vector< CompiledGrammar::Detail > detail_entries;
+    std::vector< CompiledGrammar::Augment > augment_entries;
+    std::vector< char > strings;
+
+private:
+#if __cplusplus >= 201103L
+    typedef std::unordered_map< const Rule *, CompiledGrammar::Node > node_index_t;
+    typedef std::unordered_map< std::string, uint32 > string_index_t;
+#else
+    typedef std::map< const Rule *, CompiledGrammar::Node > node_index_t;
+    typedef std::map< std::string, uint32 > string_index_t;
+#endif
+    node_index_t node_index;
+    string_index_t string_index;
+
+public:
+    Compiler() : strings( 1, '\0' ) {}
+
+    void compile( const GrammarSet & r_grammar_set );
+
+private:
+    CompiledGrammar::Node number( const Rule * p_rule, uint32 grammar );
+    CompiledGrammar::Node node_of( const Rule * p_rule ) const;
+    void compile_node( CompiledGrammar::Node node );
+    uint32 string( const std::string & r_string );
+    uint32 constraint_pair( const Rule * p_rule );
+    CompiledGrammar::Constraint constraint( const ValueConstraint & r_value_constraint );
+    uint32 detail( const Annotations & r_annotations );
+};
+
+void Compiler::compile( const GrammarSet & r_grammar_set )
+{
+    // Number the global rules first, and then the children of each
+    // numbered rule, so that the children of each rule are consecutive
+    for( size_t i = 0; i < r_grammar_set.size(); ++i )
+    {
+        const Grammar & r_grammar = r_grammar_set[i];
+        CompiledGrammar::GrammarEntry entry;
+        entry.ruleset_id = string( r_grammar.ruleset_id );
+        entry.jcr_source = string( r_grammar.jcr_source );
+        entry.first_rule = static_cast< CompiledGrammar::Node >( rules.size() );
+        entry.n_rules = static_cast< uint32 >( r_grammar.rules.size() );
+        grammar_entries.push_back( entry );
+        for( size_t j = 0; j < r_grammar.rules.size(); ++j )
+            number( &r_grammar.rules[j], static_cast< uint32 >( i ) );
+    }
+    std::vector< CompiledGrammar::Node > own_first_children;
+    std::vector< uint32 > own_child_counts;
+    for( size_t node = 0; node < rules.size(); ++node )
+    {
+        const Rule * p_rule = rules[node];
+        own_first_children.push_back( static_cast< CompiledGrammar::Node >( rules.size() ) );
+        own_child_counts.push_back( static_cast< uint32 >( p_rule->children.size() ) );
+        for( size_t i = 0; i < p_rule->children.size(); ++i )
+            number( &p_rule->children[i], grammars[node] );
+    }
+
+    CompiledGrammar::Constraint unset_constraint = constraint( ValueConstraint() );
+    constraint_pairs.push_back( unset_constraint );
+    constraint_pairs.push_back( unset_constraint );
+    CompiledGrammar::Detail empty_detail = { 0, 0, 0, 0 };
+    detail_entries.push_back( empty_detail );
+
+    // Each node takes the properties that the Rule::get_...() methods
+    // return, so its children are those of its p_type's node
+    for( size_t node = 0; node < rules.size(); ++node )
+    {
+        compile_node( static_cast< CompiledGrammar::Node >( node ) );
+        first_children.push_back( own_first_children[type_nodes.back()] );
+        child_counts.push_back( own_child_counts[type_nodes.back()] );
+    }
+}
+
+CompiledGrammar::Node Compiler::number( const Rule * p_rule, uint32 grammar )
+{
+    CompiledGrammar::Node node = static_cast< CompiledGrammar::Node >( rules.size() );
+    rules.push_back( p_rule );
+    grammars.push_back( grammar );
+    node_index[p_rule] = node;
+    return node;
+}
+
+CompiledGrammar::Node Compiler::node_of( const Rule * p_rule ) const
+{
+    node_index_t::const_iterator i_node = node_index.find( p_rule );
+    assert( i_node != node_index.end() );   // Links only lead to Rules in the same GrammarSet
+    return i_node->second;
+}
+
+void Compiler::compile_node( CompiledGrammar::Node node )
+{
+    const Rule * p_rule = rules[node];
+    const Annotations & r_annotations = p_rule->get_annotations();
+    const MemberName & r_member_name = p_rule->get_member_name();
+
+    types.push_back( static_cast< uint8 >( p_rule->get_type() ) );
+    child_combiners.push_back( static_cast< uint8 >( p_rule->get_child_combiner() ) );
+    flags.push_back( static_cast< uint16 >(
+            (r_annotations.is_not ? CompiledGrammar::IS_NOT : 0) |
+            (r_annotations.is_unordered ? CompiledGrammar::IS_UNORDERED : 0) |
+            (r_annotations.is_root ? CompiledGrammar::IS_ROOT : 0) |
+            (r_annotations.is_exclude_min ? CompiledGrammar::IS_EXCLUDE_MIN : 0) |
+            (r_annotations.is_exclude_max ? CompiledGrammar::IS_EXCLUDE_MAX : 0) |
+            (r_annotations.is_defaulted ? CompiledGrammar::IS_DEFAULTED : 0) |
+            (r_annotations.is_choice ? CompiledGrammar::IS_CHOICE : 0) |
+            (r_member_name.is_literal() ? CompiledGrammar::IS_MEMBER_LITERAL : 0) |
+            (r_member_name.is_regex() ? CompiledGrammar::IS_MEMBER_REGEX : 0) ) );
+    repetitions.push_back( p_rule->get_repetition() );
+    rule_nodes.push_back( node_of( p_rule->p_rule ) );
+    type_nodes.push_back( node_of( p_rule->p_type ) );
+    rule_names.push_back( string( p_rule->rule_name ) );
+    member_names.push_back( string( r_member_name.name() ) );
+    constraints.push_back( constraint_pair( p_rule ) );
+    details.push_back( detail( r_annotations ) );
+    line_numbers.push_back( p_rule->line_number );
+    column_numbers.push_back( p_rule->column_number );
+}
+
+uint32 Compiler::string( const std::string & r_string )
+{
+    if( r_string.empty() )
+        return 0;
+    std::pair< string_index_t::iterator, bool > insertion =
+            string_index.insert( string_index_t::value_type( r_string, static_cast< uint32 >( strings.size() ) ) );
+    if( insertion.second )
+    {
+        strings.insert( strings.end(), r_string.begin(), r_string.end() );
+        strings.push_back( '\0' );
+    }
+    return insertion.first->second;
+}
+
+uint32 Compiler::constraint_pair( const Rule * p_rule )
+{
+    if( ! p_rule->get_min().is_set() && ! p_rule->get_max().is_set() )
+        return 0;
+    constraint_pairs.push_back( constraint( p_rule->get_min() ) );
+    constraint_pairs.push_back( constraint( p_rule->get_max() ) );
+    return static_cast< uint32 >( constraint_pairs.size() / 2 - 1 );
+}
+
+CompiledGrammar::Constraint Compiler::constraint( const ValueConstraint & r_value_constraint )
+{
+    CompiledGrammar::Constraint compiled;
+    compiled.form = CompiledGrammar::Constraint::UNSET;
+    compiled.string_value = 0;
+    compiled.uint_value = 0;
+    if( r_value_constraint.is_string() )
+    {
+        compiled.form = CompiledGrammar::Constraint::STRING;
+        compiled.string_value = string( r_value_constraint.as_string() );
+    }
+    else if( r_value_constraint.is_bool() )
+    {
+        compiled.form = CompiledGrammar::Constraint::BOOL;
+        compiled.uint_value = r_value_constraint.as_bool() ? 1 : 0;
+    }
+    else if( r_value_constraint.is_int() )
+    {
+        compiled.form = CompiledGrammar::Constraint::INT;
+        compiled.int_value = r_value_constraint.as_int();
+    }
+    else if( r_value_constraint.is_uint() )
+    {
+        compiled.form = CompiledGrammar::Constraint::UINT;
+        compiled.uint_value = r_value_constraint.as_uint();
+    }
+    else if( r_value_constraint.is_float() )
+    {
+        compiled.form = CompiledGrammar::Constraint::FLOAT;
+        compiled.float_value = r_value_constraint.as_float();
+    }
+    return compiled;
+}
+
+uint32 Compiler::detail( const Annotations & r_annotations )
+{
+    if( r_annotations.default_value().empty() && r_annotations.format().empty() && r_annotations.augments().empty() )
+        return 0;
+    CompiledGrammar::Detail compiled;
+    compiled.default_value = string( r_annotations.default_value() );
+    compiled.format = string( r_annotations.format() );
+    compiled.first_augment = static_cast< uint32 >( augment_entries.size() );
+    compiled.n_augments = static_cast< uint32 >( r_annotations.augments().size() );
+    for( size_t i = 0; i < r_annotations.augments().size(); ++i )
+    {
+        CompiledGrammar::Augment augment;
+        augment.ruleset_id = string( r_annotations.augments()[i].ruleset_id );
+        augment.rule_name = string( r_annotations.augments()[i].rule_name );
+        augment_entries.push_back( augment );
+    }
+    detail_entries.push_back( compiled );
+    return static_cast< uint32 >( detail_entries.size() - 1 );
+}
+
+} // End of Anonymous namespace
+
+//----------------------------------------------------------------------------
+//                           class CompiledGrammar
+//----------------------------------------------------------------------------
+
+CompiledGrammar::Members::Members()
+    :
+    p_block( 0 ),
+    block_size( 0 ),
+    p_mapped_file( 0 ),
+    p_types( 0 ),
+    p_child_combiners( 0 ),
+    p_flags( 0 ),
+    p_repetitions( 0 ),
+    p_first_children( 0 ),
+    p_child_counts( 0 ),
+    p_rule_nodes( 0 ),
+    p_type_nodes( 0 ),
+    p_rule_names( 0 ),
+    p_member_names( 0 ),
+    p_constraints( 0 ),
+    p_details( 0 ),
+    p_grammars( 0 ),
+    p_line_numbers( 0 ),
+    p_column_numbers( 0 ),
+    p_grammar_entries( 0 ),
+    p_constraint_pairs( 0 ),
+    p_detail_entries( 0 ),
+    p_augment_entries( 0 ),
+    p_strings( "" )
+{
+    std::memset( &counts, 0, sizeof( counts ) );
+}
+
+size_t CompiledGrammar::lay_out( const Counts & r_counts, const char * p_block, Members * p_members )
+{
+    // The 8 byte members are placed first, although each array is aligned
+    // to 8 bytes anyway
+    BlockLayout layout( p_block );
+    layout.place( &p_members->p_constraint_pairs, 2 * r_counts.n_constraints );
+    layout.place( &p_members->p_grammar_entries, r_counts.n_grammars );
+    layout.place( &p_members->p_detail_entries, r_counts.n_details );
+    layout.place( &p_members->p_augment_entries, r_counts.n_augments );
+    layout.place( &p_members->p_repetitions, r_counts.n_nodes );
+    layout.place( &p_members->p_first_children, r_counts.n_nodes );
+    layout.place( &p_members->p_child_counts, r_counts.n_nodes );
+    layout.place( &p_members->p_rule_nodes, r_counts.n_nodes );
+    layout.place( &p_members->p_type_nodes, r_counts.n_nodes );
+    layout.place( &p_members->p_rule_names, r_counts.n_nodes );
+    layout.place( &p_members->p_member_names, r_counts.n_nodes );
+    layout.place( &p_members->p_constraints, r_counts.n_nodes );
+    layout.place( &p_members->p_details, r_counts.n_nodes );
+    layout.place( &p_members->p_grammars, r_counts.n_nodes );
+    layout.place( &p_members->p_line_numbers, r_counts.n_nodes );
+    layout.place( &p_members->p_column_numbers, r_counts.n_nodes );
+    layout.place( &p_members->p_flags, r_counts.n_nodes );
+    layout.place( &p_members->p_types, r_counts.n_nodes );
+    layout.place( &p_members->p_child_combiners, r_counts.n_nodes );
+    layout.place( &p_members->p_strings, r_counts.n_string_bytes );
+    return layout.size();
+}
+
+void CompiledGrammar::compile( const GrammarSet & r_grammar_set )
+{
+    Compiler compiler;
+    compiler.compile( r_grammar_set );
+
+    Counts counts;
+    counts.n_nodes = static_cast< uint32 >( compiler.rules.size() );
+    counts.n_grammars = static_cast< uint32 >( compiler.grammar_entries.size() );
+    counts.n_constraints = static_cast< uint32 >( compiler.constraint_pairs.size() / 2 );
+    counts.n_details = static_cast< uint32 >( compiler.detail_entries.size() );
+    counts.n_augments = static_cast< uint32 >( compiler.augment_entries.size() );
+    counts.n_string_bytes = static_cast< uint32 >( compiler.strings.size() );
+    std::vector< uint64 > storage( lay_out( counts, 0, &m ) / sizeof( uint64 ) );
+
+    clear();
+    m.counts = counts;
+    m.storage.swap( storage );
+    m.p_block = reinterpret_cast< const char * >( &m.storage[0] );
+    m.block_size = m.storage.size() * sizeof( uint64 );
+    lay_out( m.counts, m.p_block, &m );
+
+    copy_to( m.p_types, compiler.types );
+    copy_to( m.p_child_combiners, compiler.child_combiners );
+    copy_to( m.p_flags, compiler.flags );
+    copy_to( m.p_repetitions, compiler.repetitions );
+    copy_to( m.p_first_children, compiler.first_children );
+    copy_to( m.p_child_counts, compiler.child_counts );
+    copy_to( m.p_rule_nodes, compiler.rule_nodes );
+    copy_to( m.p_type_nodes, compiler.type_nodes );
+    copy_to( m.p_rule_names, compiler.rule_names );
+    copy_to( m.p_member_names, compiler.member_names );
+    copy_to( m.p_constraints, compiler.constraints );
+    copy_to( m.p_details, compiler.details );
+    copy_to( m.p_grammars, compiler.grammars );
+    copy_to( m.p_line_numbers, compiler.line_numbers );
+    copy_to( m.p_column_numbers, compiler.column_numbers );
+    copy_to( m.p_grammar_entries, compiler.grammar_entries );
+    copy_to( m.p_constraint_pairs, compiler.constraint_pairs );
+    copy_to( m.p_detail_entries, compiler.detail_entries );
+    copy_to( m.p_augment_entries, compiler.augment_entries );
+    copy_to( m.p_strings, compiler.strings );
+}
+
+void CompiledGrammar::clear()
+{
+    delete m.p_mapped_file;
+    m = Members();
+}
+
+CompiledGrammar::Status CompiledGrammar::save( const char * p_file_name ) const
+{
+    FileHeader header;
+    std::memset( &header, 0, sizeof( header ) );
+    std::memcpy( header.magic, file_magic, sizeof( header.magic ) );
+    header.format_version = file_format_version;
+    header.byte_order = byte_order_mark;
+    header.header_size = sizeof( FileHeader );
+    header.counts = m.counts;
+    header.block_size = m.block_size;
+    header.block_checksum = checksum( m.p_block, m.block_size );
+    header.header_checksum = header_checksum( header );
+
+    std::ofstream fout( p_file_name, std::ios::binary );
+    if( ! fout.is_open() )
+        return S_UNABLE_TO_OPEN_FILE;
+    fout.write( reinterpret_cast< const char * >( &header ), sizeof( header ) );
+    if( m.block_size > 0 )
+        fout.write( m.p_block, m.block_size );
+    fout.close();
+    return fout.fail() ? S_UNABLE_TO_WRITE_FILE : S_OK;
+}
+
+CompiledGrammar::Status CompiledGrammar::load( const char * p_file_name, bool is_checking_block )
+{
+    clear();
+
+    m.p_mapped_file = new cl::mapped_file( p_file_name );
+    if( ! m.p_mapped_file->is_open() )
+    {
+        clear();
+        return S_UNABLE_TO_OPEN_FILE;
+    }
+
+    FileHeader header;
+    if( m.p_mapped_file->size() < sizeof( header ) )
+    {
+        clear();
+        return S_WRONG_FORMAT;
+    }
+    std::memcpy( &header, m.p_mapped_file->data(), sizeof( header ) );
+    if( std::memcmp( header.magic, file_magic, sizeof( header.magic ) ) != 0 )
+    {
+        clear();
+        return S_WRONG_FORMAT;
+    }
+    if( header.header_checksum != header_checksum( header ) )
+    {
+        clear();
+        return S_CORRUPTED;
+    }
+    if( header.format_version != file_format_version ||
+            header.byte_order != byte_order_mark ||
+            header.header_size != sizeof( FileHeader ) )
+    {
+        clear();
+        return S_WRONG_FORMAT;
+    }
+
+    const char * p_block = m.p_mapped_file->data() + header.header_size;
+    if( header.block_size != lay_out( header.counts, 0, &m ) ||
+            m.p_mapped_file->size() - header.header_size < header.block_size ||
+            header.counts.n_constraints == 0 ||     // The unset pair and empty Detail are always present
+            header.counts.n_details == 0 ||
+            header.counts.n_string_bytes == 0 ||
+            (is_checking_block && header.block_checksum != checksum( p_block, header.block_size )) )
+    {
+        clear();
+        return S_CORRUPTED;
+    }
+
+    if( reinterpret_cast< size_t >( p_block ) % sizeof( uint64 ) != 0 )
+    {
+        // Only a file that has been read into memory, rather than mapped,
+        // may not be suitably aligned
+        m.storage.resize( header.block_size / sizeof( uint64 ) );
+        std::memcpy( &m.storage[0], p_block, header.block_size );
+        p_block = reinterpret_cast< const char * >( &m.storage[0] );
+        delete m.p_mapped_file;
+        m.p_mapped_file = 0;
+    }
+
+    m.counts = header.counts;
+    m.p_block = p_block;
+    m.block_size = header.block_size;
+    lay_out( m.counts, m.p_block, &m );
+    if( m.p_strings[m.counts.n_string_bytes - 1] != '\0' )  // So that reading a string can't run off the end
+    {
+        clear();
+        return S_CORRUPTED;
+    }
+    return S_OK;
+}
+
+bool CompiledGrammar::is_memory_mapped() const
+{
+    return m.p_mapped_file && m.p_mapped_file->is_memory_mapped();
+}
+
+}   // namespace cljcr
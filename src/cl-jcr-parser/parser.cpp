@@ -29,9 +29,28 @@
 #endif
 
 #include <iostream>
+#include <fstream>
 #include <cassert>
+#include <cstdio>
 #include <algorithm>
 
+#if defined( _WIN32 )
+    #include <direct.h>
+    #include <process.h>
+#else
+    #include <sys/stat.h>
+    #include <sys/types.h>
+    #include <unistd.h>
+#endif
+
+#if __cplusplus >= 201103L
+    #include <atomic>
+    #include <condition_variable>
+    #include <exception>
+    #include <mutex>
+    #include <thread>
+#endif
+
 namespace cljcr {
 
 //----------------------------------------------------------------------------
@@ -63,14 +82,33 @@ class GrammarParserFatalError : public std::exception {};
 class GrammarParser : public cl::dsl_pa
 {
 private:
+    struct AnnotationsMemo
+    {
+        // Records the outcome of parsing annotations at a location for a rule.
+        // Entries only remain valid while the rule stack is unchanged, because
+        // once a Rule has been popped its address may be reused.
+        size_t location;
+        size_t end_location;
+        const Rule * p_rule;
+        size_t generation;
+        Annotations annotations;
+
+        AnnotationsMemo() : location( 0 ), end_location( 0 ), p_rule( 0 ), generation( 0 ) {}
+    };
+    enum { n_annotations_memos = 4 };  // Alternatives are tried at nearby locations, so a small direct mapped table suffices
+
     struct Members {
         JCRParser * p_jcr_parser;
         GrammarSet * p_grammar_set;
         Grammar * p_grammar;
         cl::reader & r_reader;
         bool is_errored;
+        bool is_abandoned;
+        size_t n_reports;
         JCRParser::Status status;
         bool is_infer_types;
+        size_t memo_generation;
+        AnnotationsMemo annotations_memos[n_annotations_memos];
 
         Rule * p_rule;
 
@@ -85,8 +123,11 @@ private:
             p_grammar( p_grammar_in ),
             r_reader( r_reader_in ),
             is_errored( false ),
+            is_abandoned( false ),
+            n_reports( 0 ),
             status( JCRParser::S_OK ),
             is_infer_types( false ),
+            memo_generation( 1 ),
             p_rule( 0 )
         {}
     } m;
@@ -109,6 +150,7 @@ private:
         ~RuleStackLogger()
         {
             p_grammar_parser->m.p_rule = p_prev_rule;
+            ++p_grammar_parser->m.memo_generation;    // Invalidates the memos
         }
     };
 
@@ -116,6 +158,7 @@ public:
     GrammarParser( JCRParser * p_jcr_parser, cl::reader & r_reader, GrammarSet * p_grammar_set, Grammar * p_grammar );
     bool parse();
     JCRParser::Status status() const { return m.status; }
+    bool is_reported() const { return m.n_reports > 0; }    // Whether any messages have been reported
 
 private:
     #define STAR( what ) bool star_ ## what() { while( what() ) {} return true; }
@@ -175,6 +218,8 @@ private:
     bool type_choice();
     bool type_choice_items();
     bool annotations( Annotations & );
+    bool memoised_annotations( Annotations & );
+    bool parse_annotations( Annotations & );
     bool annotation_set( Annotations & );
     bool not_annotation( Annotations & );
     bool unordered_annotation( Annotations & );
@@ -277,6 +322,7 @@ private:
     bool e();
     bool zero();
     bool q_string_as_utf8();
+    bool unescaped_q_string_as_utf8();
     bool q_string();
     bool qs_char();
     STAR( qs_char )
@@ -347,56 +393,92 @@ private:
     STAR( WSP )
     ONE_STAR( WSP )
 
-    Rule * new_rule() { return new Rule( m.p_grammar, m.r_reader.get_line_number(), m.r_reader.get_column_number() ); }
+    Symbol intern( const cl::accumulator_deferred & r_accumulator )
+    {
+        return m.p_grammar_set->symbols().intern( r_accumulator.data(), r_accumulator.size() );
+    }
+    Rule * new_rule() { return new( m.p_grammar->arena ) Rule( m.p_grammar, m.r_reader.get_line_number(), m.r_reader.get_column_number() ); }
 
     std::string error_token();
 
+    // Messages are passed on as their format and arguments, so are only
+    // formatted if the JCRParser needs them as text
     bool warning( const char * p_message )
     {
-        report( Severity::WARNING, p_message );
-        return true;
+        return report_warning( p_message, 0 );
+    }
+    bool warning( const char * p_format, const clutils::str_arg & r_arg_1 )
+    {
+        clutils::str_arg_refs args( r_arg_1 );
+        return report_warning( p_format, &args );
     }
-    bool warning( const char * p_format, const clutils::str_args & r_arg_1 )
+    bool warning( const char * p_format, const clutils::str_arg & r_arg_1, const clutils::str_arg & r_arg_2 )
     {
-        return warning( expand( p_format, r_arg_1 ).c_str() );
+        clutils::str_arg_refs args( r_arg_1, r_arg_2 );
+        return report_warning( p_format, &args );
     }
-    bool warning( const char * p_format, const clutils::str_args & r_arg_1, const clutils::str_args & r_arg_2 )
+    bool report_warning( const char * p_format, const clutils::str_arg_refs * p_args )
     {
-        return warning( expand( p_format, r_arg_1, r_arg_2 ).c_str() );
+        report( Severity::WARNING, p_format, p_args );
+        return true;
     }
     bool error( const char * p_message )
     {
-        report( Severity::ERROR, p_message );
+        return report_error( p_message, 0 );
+    }
+    bool error( const char * p_format, const clutils::str_arg & r_arg_1 )
+    {
+        clutils::str_arg_refs args( r_arg_1 );
+        return report_error( p_format, &args );
+    }
+    bool error( const char * p_format, const clutils::str_arg & r_arg_1, const clutils::str_arg & r_arg_2 )
+    {
+        clutils::str_arg_refs args( r_arg_1, r_arg_2 );
+        return report_error( p_format, &args );
+    }
+    bool report_error( const char * p_format, const clutils::str_arg_refs * p_args )
+    {
+        report( Severity::ERROR, p_format, p_args );
         m.is_errored = true;
         return true;    // Return 'true', because if we are throwing an error it suggests we're on the right parse path, but have an invalid token.  And we'd usually want to recover from this with an && clause.
     }
-    bool error( const char * p_format, const clutils::str_args & r_arg_1 )
+    bool fatal( const char * p_message )
+    {
+        return report_fatal( p_message, 0 );
+    }
+    bool fatal( const char * p_format, const clutils::str_arg & r_arg_1 )
     {
-        return error( expand( p_format, r_arg_1 ).c_str() );
+        clutils::str_arg_refs args( r_arg_1 );
+        return report_fatal( p_format, &args );
     }
-    bool error( const char * p_format, const clutils::str_args & r_arg_1, const clutils::str_args & r_arg_2 )
+    bool fatal( const char * p_format, const clutils::str_arg & r_arg_1, const clutils::str_arg & r_arg_2 )
     {
-        return error( expand( p_format, r_arg_1, r_arg_2 ).c_str() );
+        clutils::str_arg_refs args( r_arg_1, r_arg_2 );
+        return report_fatal( p_format, &args );
     }
-    bool fatal( const char * p_message )
+    bool report_fatal( const char * p_format, const clutils::str_arg_refs * p_args )
     {
-        report( Severity::FATAL, p_message );
+        report( Severity::FATAL, p_format, p_args );
         m.is_errored = true;
+        if( m.p_jcr_parser->is_exception_free() )
+            return abandon();
         throw GrammarParserFatalError();
         return false;
     }
-    bool fatal( const char * p_format, const clutils::str_args & r_arg_1 )
-    {
-        return fatal( expand( p_format, r_arg_1 ).c_str() );
-    }
-    bool fatal( const char * p_format, const clutils::str_args & r_arg_1, const clutils::str_args & r_arg_2 )
+
+    bool abandon()  // Unwind the parse, without an exception, by making all remaining parse steps fail
     {
-        return fatal( expand( p_format, r_arg_1, r_arg_2 ).c_str() );
+        m.is_abandoned = true;
+        m.r_reader.abandon();
+        return false;
     }
 
-    void report( Severity severity, const char * p_message )
+    void report( Severity severity, const char * p_format, const clutils::str_arg_refs * p_args )
     {
-        m.p_jcr_parser->report( m.p_grammar->jcr_source, m.r_reader.get_line_number(), m.r_reader.get_column_number(), severity, p_message );
+        if( m.is_abandoned )    // Only the first fatal error is reported, as when unwinding by exception
+            return;
+        ++m.n_reports;
+        m.p_jcr_parser->diagnose( m.p_grammar->jcr_source, m.r_reader.get_line_number(), m.r_reader.get_column_number(), severity, p_format, p_args );
     }
 
     bool recover_to_eol()
@@ -477,6 +559,8 @@ bool GrammarParser::sp_cmt()
     return spaces() || comment();
 }
 
+cl::alphabet_char_class spaces_alphabet( " \t\r\n" );
+
 bool GrammarParser::spaces()
 {
     /* ABNF:
@@ -484,12 +568,14 @@ bool GrammarParser::spaces()
     */
     // 1*( WSP() || CR() || LF() )
 
-    int i = 0;
+    size_t i = skip_run( spaces_alphabet );
     while( WSP() || CR() || LF() )
         ++i;
     return i > 0;
 }
 
+cl::alphabet_char_class comment_char_alphabet( "\t\x20-\xff" );    // UTF-8 encoding means %x80-10FFFF are all bytes >= %x80
+
 bool GrammarParser::comment()
 {
     /* ABNF:
@@ -499,6 +585,7 @@ bool GrammarParser::comment()
 
     if( is_get_char( ';' ) )
     {
+        skip_run( comment_char_alphabet );
         while( comment_char() )
         {}
         return comment_end_char();
@@ -506,13 +593,6 @@ bool GrammarParser::comment()
     return false;
 }
 
-bool is_jcr_comment_char( char c )
-{
-    // comment_char() = HTAB() / %x20-10FFFF
-
-    return c == '\t' || c >= 0x20 || ((c & 0x80) != 0);
-}
-
 bool GrammarParser::comment_char()
 {
     /* ABNF:
@@ -520,9 +600,11 @@ bool GrammarParser::comment_char()
     */
     // HTAB() / %x20-10FFFF
 
-    return is_get_char_in( cl::alphabet_function( is_jcr_comment_char ) );
+    return is_get_char_in( comment_char_alphabet );
 }
 
+cl::alphabet_char_class comment_end_char_alphabet( "\r\n" );
+
 bool GrammarParser::comment_end_char()
 {
     /* ABNF:
@@ -530,7 +612,7 @@ bool GrammarParser::comment_end_char()
     */
     // CR() || LF()
 
-    return is_get_char_in( cl::alphabet_char_class( "\r\n" ) ) || is_peek_at_end();
+    return is_get_char_in( comment_end_char_alphabet ) || is_peek_at_end();
 }
 
 bool GrammarParser::directive()
@@ -731,7 +813,7 @@ bool GrammarParser::ruleset_id_d( DirectiveForm::Enum form )
         if( (DSPs( form ) && ruleset_id() )
             || fatal( "Unable to read <ruleset-id> in #ruleset-id directive. Got '%0'", error_token() ) )
         {
-            m.p_grammar->ruleset_id = ruleset_id_accumulator.get();
+            m.p_grammar->ruleset_id = intern( ruleset_id_accumulator );
         }
 
         return true;
@@ -954,6 +1036,9 @@ bool GrammarParser::root_rule()
 
     if( rewind_on_reject( value_rule() ) || rewind_on_reject( group_rule() ) )
     {
+        if( m.is_abandoned )    // The partial rule is discarded, as when unwinding by exception
+            return false;
+
         m.p_rule->annotations.is_root = true;
 
         m.p_grammar->append_rule( pu_rule );
@@ -986,7 +1071,10 @@ bool GrammarParser::rule()
             star_sp_cmt() &&
             (rule_def() || fatal( "Expected <rule-def> after '=' in rule definition. Got: '%0'", error_token() ));
 
-        m.p_rule->rule_name = name_accumulator.get();
+        if( m.is_abandoned )    // The partial rule is discarded, as when unwinding by exception
+            return false;
+
+        m.p_rule->rule_name = intern( name_accumulator );
         m.p_rule->annotations.merge( rule_annotations );
 
         m.p_grammar->append_rule( pu_rule );
@@ -1052,15 +1140,15 @@ bool GrammarParser::target_rule_name_reader( TargetRule & r_target_rule )
 
             if( rule_name() )
             {
-                r_target_rule.ruleset_id = alias_lookup_result;
-                r_target_rule.rule_name = name_accumulator.get();
+                r_target_rule.ruleset_id = m.p_grammar_set->symbols().intern( alias_lookup_result );
+                r_target_rule.rule_name = intern( name_accumulator );
             }
             else
                 return fatal( "Expected <rule_name> in <target_rule_name> with format \"$<ruleset_id_alias>.<rule-name>\". Got '$%0.%1'", alias_name, error_token() );
         }
         else
         {
-            r_target_rule.rule_name = name_accumulator.get();
+            r_target_rule.rule_name = intern( name_accumulator );
         }
 
         return true;
@@ -1221,14 +1309,14 @@ bool GrammarParser::member_name_spec()
 
     if( regex() )
     {
-        m.p_rule->member_name.set_regex( member_name_accumulator.get() );
+        m.p_rule->member_name.set_regex( intern( member_name_accumulator ) );
 
         return true;
     }
 
     else if( member_name_accumulator.clear() && q_string_as_utf8() )
     {
-        m.p_rule->member_name.set_literal( member_name_accumulator.get() );
+        m.p_rule->member_name.set_literal( intern( member_name_accumulator ) );
 
         return true;
     }
@@ -1319,6 +1407,8 @@ bool GrammarParser::type_choice_items()
     if( ( rewind_on_reject( type_choice() ) || rewind_on_reject( type_rule() ) ) &&
             star_sp_cmt() )
     {
+        if( m.is_abandoned )
+            return false;
         p_parent->append_child_rule( pu_rule );
         return true;
     }
@@ -1335,6 +1425,42 @@ bool GrammarParser::annotations( Annotations & r_annotations )
     */
     // *( "@{" && *sp_cmt() && annotation_set() && *sp_cmt() && "}" && *sp_cmt() )
 
+    if( m.p_jcr_parser->is_memoising() )
+        return memoised_annotations( r_annotations );
+
+    return parse_annotations( r_annotations );
+}
+
+bool GrammarParser::memoised_annotations( Annotations & r_annotations )
+{
+    if( ! is_fixed_ahead( "@{" ) )
+        return true;    // No annotations, so nothing to parse or memoise
+
+    size_t location = m.r_reader.get_location();
+    AnnotationsMemo & r_memo = m.annotations_memos[location % n_annotations_memos];
+
+    // Callers always collect annotations in a new Annotations object, so the
+    // memoised annotations can simply be copied to it
+    if( r_memo.generation == m.memo_generation && r_memo.location == location && r_memo.p_rule == m.p_rule )
+    {
+        r_annotations = r_memo.annotations;
+        m.r_reader.set_location( r_memo.end_location );
+        return true;
+    }
+
+    parse_annotations( r_annotations );
+
+    r_memo.location = location;
+    r_memo.end_location = m.r_reader.get_location();
+    r_memo.p_rule = m.p_rule;
+    r_memo.generation = m.memo_generation;
+    r_memo.annotations = r_annotations;
+
+    return true;
+}
+
+bool GrammarParser::parse_annotations( Annotations & r_annotations )
+{
     while( fixed( "@{" ) )
     {
         star_sp_cmt() &&
@@ -1440,7 +1566,7 @@ bool GrammarParser::default_annotation( Annotations & r_annotations )
                  (primitive_value() || fatal( "Expected <primitive-value> in @{default} <annotation>. Got '%0'", error_token() )) )
         {
             r_annotations.is_defaulted = true;
-            r_annotations.default_value = default_accumulator.get();
+            r_annotations.set_default_value( default_accumulator.get() );
         }
 
         return true;
@@ -1482,7 +1608,7 @@ bool GrammarParser::format_annotation( Annotations & r_annotations )
         if( (spaces() || fatal( "Expected <spaces> after 'format' keyword in @{format} <annotation>. Got '%0'", error_token() )) &&
                  (id() || fatal( "Expected <id> in @{format} <annotation>. Got '%0'", error_token() )) )
         {
-            r_annotations.format = id_accumulator.get();
+            r_annotations.set_format( id_accumulator.get() );
         }
 
         return true;
@@ -1521,7 +1647,7 @@ bool GrammarParser::augments_annotation( Annotations & r_annotations )
         
         while( spaces() && target_rule_name_reader( target_rule_name ) )
         {
-            r_annotations.augments.push_back( target_rule_name );
+            r_annotations.add_augments( target_rule_name );
             target_rule_name.clear();
         }
 
@@ -1545,7 +1671,7 @@ bool GrammarParser::tbd_annotation()
     // Report errors relating to the annotation name, near where the name is specified
     if( name_accumulator.get() == "id" || name_accumulator.get() == "assert" || name_accumulator.get() == "when" || name_accumulator.get() == "doc" )
         warning( "Unimplemented <annotation>: '%0'", name_accumulator.get() ); // See Leave_as_warning
-    else if( ! name_accumulator.get().empty() )
+    else if( ! name_accumulator.empty() )
         error( "Unknown <annotation>: '%0'", name_accumulator.get() );
     else
         fatal( "Expected <annotation> name. Got: '%0'", error_token() );
@@ -1593,6 +1719,8 @@ bool GrammarParser::primitive_rule()
     return false;
 }
 
+cl::alphabet_char_class keyword_start_alphabet( "a-z" );
+
 bool GrammarParser::primitive_def()
 {
     /* ABNF:
@@ -1618,41 +1746,61 @@ bool GrammarParser::primitive_def()
     //      hex_type() || base32hex_type() || base32_type() || base64url_type() || base64_type() ||
     //      any()
 
+    // The alternatives that start with a keyword are tried via a dispatch
+    // table, and only if their keyword is next in the input.  This saves
+    // reading and rewinding each keyword in turn.  The keyword alternatives
+    // and the other alternatives can't start with the same char, and the
+    // relative order of the alternatives within each group is unchanged.
+
+    typedef bool (GrammarParser::*keyword_choice)();
+    struct keyword_dispatch { const char * p_keyword; keyword_choice p_choice; };
+    static const keyword_dispatch keyword_dispatch_table[] = {
+            { "null", &GrammarParser::null_type },
+            { "boolean", &GrammarParser::boolean_type },
+            { "true", &GrammarParser::true_value },
+            { "false", &GrammarParser::false_value },
+            { "string", &GrammarParser::string_type },
+            { "double", &GrammarParser::double_type },
+            { "float", &GrammarParser::float_type },
+            { "integer", &GrammarParser::integer_type },
+            { "int", &GrammarParser::sized_int_type },
+            { "uint", &GrammarParser::sized_uint_type },
+            { "ipv4", &GrammarParser::ipv4_type },
+            { "ipv6", &GrammarParser::ipv6_type },
+            { "ipaddr", &GrammarParser::ipaddr_type },
+            { "fqdn", &GrammarParser::fqdn_type },
+            { "idn", &GrammarParser::idn_type },
+            { "uri", &GrammarParser::uri_type },
+            { "phone", &GrammarParser::phone_type },
+            { "email", &GrammarParser::email_type },
+            { "datetime", &GrammarParser::datetime_type },
+            { "date", &GrammarParser::date_type },
+            { "time", &GrammarParser::time_type },
+            { "hex", &GrammarParser::hex_type },
+            { "base32hex", &GrammarParser::base32hex_type },
+            { "base32", &GrammarParser::base32_type },
+            { "base64url", &GrammarParser::base64url_type },
+            { "base64", &GrammarParser::base64_type },
+            { "any", &GrammarParser::any } };
+    static const size_t n_keyword_dispatches = sizeof( keyword_dispatch_table ) / sizeof( keyword_dispatch_table[0] );
+
     cl::locator loc( this );
 
-     return rewind_on_reject( null_type() ) ||
-            rewind_on_reject( boolean_type() ) ||
-            rewind_on_reject( true_value() ) ||
-            rewind_on_reject( false_value() ) ||
-            rewind_on_reject( string_type() ) ||
-            rewind_on_reject( string_range() ) ||
+    if( is_in_ahead( keyword_start_alphabet ) )
+    {
+        for( size_t i = 0; i < n_keyword_dispatches; ++i )
+            if( is_fixed_ahead( keyword_dispatch_table[i].p_keyword ) &&
+                    rewind_on_reject( (this->*keyword_dispatch_table[i].p_choice)() ) )
+                return true;
+        return false;
+    }
+
+    return rewind_on_reject( string_range() ) ||
             rewind_on_reject( string_value() ) ||
-            rewind_on_reject( double_type() ) ||
-            rewind_on_reject( float_type() ) ||
             rewind_on_reject( float_range() ) ||
             rewind_on_reject( float_value() ) ||
-            rewind_on_reject( integer_type() ) ||
             rewind_on_reject( integer_range() ) ||
-            rewind_on_reject( integer_value() ) ||
-            rewind_on_reject( sized_int_type() ) ||
-            rewind_on_reject( sized_uint_type() ) ||
-            rewind_on_reject( ipv4_type() ) ||
-            rewind_on_reject( ipv6_type() ) ||
-            rewind_on_reject( ipaddr_type() ) ||
-            rewind_on_reject( fqdn_type() ) ||
-            rewind_on_reject( idn_type() ) ||
-            rewind_on_reject( uri_type() ) ||
-            rewind_on_reject( phone_type() ) ||
-            rewind_on_reject( email_type() ) ||
-            rewind_on_reject( datetime_type() ) ||
-            rewind_on_reject( date_type() ) ||
-            rewind_on_reject( time_type() ) ||
-            rewind_on_reject( hex_type() ) ||
-            rewind_on_reject( base32hex_type() ) ||
-            rewind_on_reject( base32_type() ) ||
-            rewind_on_reject( base64url_type() ) ||
-            rewind_on_reject( base64_type() ) ||
-            rewind_on_reject( any() );
+            rewind_on_reject( integer_value() );
 }
 
 bool GrammarParser::null_type()
@@ -1812,18 +1960,18 @@ bool GrammarParser::float_range()
     {
         m.p_rule->type = Rule::DOUBLE;
 
-        if( ! float_max_accumulator.get().empty() && ! is_float_max_complete )
+        if( ! float_max_accumulator.empty() && ! is_float_max_complete )
             error( "Incomplete <float-max> value in <float-range>. Got: '%0'", float_max_accumulator.get() );
 
-        if( ! float_min_accumulator.get().empty() && ! float_max_accumulator.get().empty() )
+        if( ! float_min_accumulator.empty() && ! float_max_accumulator.empty() )
         {
             if( float_min_accumulator.to_float() > float_max_accumulator.to_float() )
                 error( "Float range minimum ('%0') greater than maximum ('%1')", float_min_accumulator.get(), float_max_accumulator.get() );
         }
 
-        if( ! float_min_accumulator.get().empty() )
+        if( ! float_min_accumulator.empty() )
             m.p_rule->min = float_min_accumulator.to_float();
-        if( ! float_max_accumulator.get().empty() )
+        if( ! float_max_accumulator.empty() )
             m.p_rule->max = float_max_accumulator.to_float();
 
         return true;
@@ -1908,30 +2056,30 @@ bool GrammarParser::integer_range()
     if( rewind_on_reject( integer_min() && fixed( ".." ) && optional( integer_max_accumulator.select() && integer_max() ) ) ||
             rewind_on_reject( fixed( ".." ) && integer_max_accumulator.select() && integer_max() ) )
     {
-        if( integer_min_accumulator.get().empty() || integer_min_accumulator.get()[0] == '-' )
+        if( integer_min_accumulator.empty() || integer_min_accumulator.data()[0] == '-' )
         {
             m.p_rule->type = Rule::INTEGER;
-            if( ! integer_min_accumulator.get().empty() && ! integer_max_accumulator.get().empty() )
+            if( ! integer_min_accumulator.empty() && ! integer_max_accumulator.empty() )
             {
                 if( integer_min_accumulator.to_int64() > integer_max_accumulator.to_int64() )
                     error( "Integer range minimum ('%0') greater than maximum ('%1')", integer_min_accumulator.get(), integer_max_accumulator.get() );
             }
-            if( ! integer_min_accumulator.get().empty() )
+            if( ! integer_min_accumulator.empty() )
                 m.p_rule->min = integer_min_accumulator.to_int64();
-            if( ! integer_max_accumulator.get().empty() )
+            if( ! integer_max_accumulator.empty() )
                 m.p_rule->max = integer_max_accumulator.to_int64();
         }
         else
         {
             m.p_rule->type = Rule::UINTEGER;
-            if( ! integer_min_accumulator.get().empty() && ! integer_max_accumulator.get().empty() )
+            if( ! integer_min_accumulator.empty() && ! integer_max_accumulator.empty() )
             {
                 if( integer_min_accumulator.to_uint64() > integer_max_accumulator.to_uint64() )
                     error( "Integer range minimum ('%0') greater than maximum ('%1')", integer_min_accumulator.get(), integer_max_accumulator.get() );
             }
-            if( ! integer_min_accumulator.get().empty() )
+            if( ! integer_min_accumulator.empty() )
                 m.p_rule->min = integer_min_accumulator.to_uint64();
-            if( ! integer_max_accumulator.get().empty() )
+            if( ! integer_max_accumulator.empty() )
                 m.p_rule->max = integer_max_accumulator.to_uint64();
         }
 
@@ -1976,7 +2124,7 @@ bool GrammarParser::integer_value()
         {
             m.p_rule->type = Rule::INTEGER;
         }
-        else if( integer_accumulator.get()[0] == '-' )
+        else if( integer_accumulator.data()[0] == '-' )
         {
             m.p_rule->type = Rule::INTEGER;
             m.p_rule->min = m.p_rule->max = integer_accumulator.to_int64();
@@ -2339,6 +2487,8 @@ bool GrammarParser::object_item()
 
     if( object_item_types() && star_sp_cmt() && optional( repetition() && star_sp_cmt() ) )
     {
+        if( m.is_abandoned )
+            return false;
         p_parent->append_child_rule( pu_rule );
 
         return true;
@@ -2486,6 +2636,8 @@ bool GrammarParser::array_item()
 
     if( array_item_types() && star_sp_cmt() && optional( repetition() && star_sp_cmt() ) )
     {
+        if( m.is_abandoned )
+            return false;
         p_parent->append_child_rule( pu_rule );
 
         return true;
@@ -2632,6 +2784,8 @@ bool GrammarParser::group_item()
 
     if( group_item_types() && star_sp_cmt() && optional( repetition() && star_sp_cmt() ) )
     {
+        if( m.is_abandoned )
+            return false;
         p_parent->append_child_rule( pu_rule );
 
         return true;
@@ -2989,10 +3143,15 @@ bool GrammarParser::zero()
     return accumulate( '0' );
 }
 
+cl::alphabet_char_class ascii_unescaped_alphabet( "\x01-\x21\x23-\x5b\x5d-\x7f" );  // Chars that get_qstring_contents() passes through unchanged
+
 bool GrammarParser::q_string_as_utf8()  // Doesn't collect wrapping quotation marks
 {
     if( is_get_char( '"' ) )    // Don't accumulate quotation_mark()
     {
+        if( unescaped_q_string_as_utf8() )
+            return true;
+
         std::string utf8_string;
 
         return get_qstring_contents( &utf8_string ) && is_get_char( '"' ) &&
@@ -3002,6 +3161,19 @@ bool GrammarParser::q_string_as_utf8()  // Doesn't collect wrapping quotation ma
     return false;
 }
 
+bool GrammarParser::unescaped_q_string_as_utf8()   // Called after the opening quotation mark
+{
+    // Most strings have no escapes or non-ASCII chars.  Their UTF-8 is the
+    // same as their source, so it can be accumulated without decoding.  If
+    // the string has others, the input is left as it was.
+    cl::locator loc( this );
+    cl::accumulator unescaped_accumulator( this );
+    if( optional( accumulate_run( ascii_unescaped_alphabet ) ) && is_get_char( '"' ) )
+        return unescaped_accumulator.append_to_previous();
+    location_top();
+    return false;
+}
+
 bool GrammarParser::q_string()  // Collects wrapping quotation marks
 {
     /* ABNF:
@@ -3095,12 +3267,7 @@ bool GrammarParser::quotation_mark()
     return accumulate( '"' );
 }
 
-bool is_qstring_unescaped( char c )
-{
-    // unescaped        = %x20-21 / %x23-5B / %x5D-10FFFF
-
-    return c >= 0x20 && c <= 0x21 || c >= 0x23 && c <= 0x5b || c >= 0x5d || ((c & 0x80) != 0);
-}
+cl::alphabet_char_class unescaped_alphabet( "\x20-\x21\x23-\x5b\x5d-\xff" );
 
 bool GrammarParser::unescaped()
 {
@@ -3109,7 +3276,7 @@ bool GrammarParser::unescaped()
     */
     // %x20-21 / %x23-5B / %x5D-10FFFF
 
-    return accumulate( cl::alphabet_function( is_qstring_unescaped ) );
+    return accumulate_run( unescaped_alphabet ) > 0 || accumulate( unescaped_alphabet );
 }
 
 bool GrammarParser::regex()
@@ -3119,12 +3286,10 @@ bool GrammarParser::regex()
     */
     // "/" && *( escape() re_escape_code() || not_slash() ) "/" [ regex_modifiers() ]
 
-    if( is_get_char( '/' ) )
-    {
-        cl::accumulator re_accumulator( this );
-
-        re_accumulator.append( '/' );
+    cl::accumulator re_accumulator( this );
 
+    if( accumulate( '/' ) )
+    {
         while( escape() ? re_escape_code() : not_slash() )
         {}
 
@@ -3153,13 +3318,8 @@ bool GrammarParser::re_escape_code()
     return accumulate( cl::alphabet_function( is_re_escape_code ) );
 }
 
-bool is_not_slash( char c )
-{
-    // not_slash() = HTAB() || CR() || LF() / %x20-2E / %x30-10FFFF
-
-    return c == '\t' || c == '\r' || c == '\n' ||
-            c >= 0x20 && c <= 0x2e || c >= 0x30 || ((c & 0x80) != 0);
-}
+cl::alphabet_char_class not_slash_alphabet( "\t\r\n\x20-\x2e\x30-\xff" );
+cl::alphabet_char_class not_slash_or_escape_alphabet( "\t\r\n\x20-\x2e\x30-\x5b\x5d-\xff" );
 
 bool GrammarParser::not_slash()
 {
@@ -3168,7 +3328,9 @@ bool GrammarParser::not_slash()
     */
     // HTAB() || CR() || LF() / %x20-2E / %x30-10FFFF
 
-    return accumulate( cl::alphabet_function( is_not_slash ) );
+    // regex() checks for an escape before calling not_slash(), so a run must
+    // stop at any escape char
+    return accumulate_run( not_slash_or_escape_alphabet ) > 0 || accumulate( not_slash_alphabet );
 }
 
 cl::alphabet_char_class regex_modifiers_alphabet( "isx" );
@@ -3738,6 +3900,185 @@ std::string GrammarParser::error_token()    // Attempts to extract the token tha
     return token;
 }
 
+//----------------------------------------------------------------------------
+//                        Internal class DuplicateChain
+//----------------------------------------------------------------------------
+
+// DuplicateChain links each of a sequence of Symbols to the next occurrence
+// of the same Symbol, so that every duplicate can be visited in the same
+// order as comparing each Symbol with all those after it, but without the
+// O(n^2) cost.
+class DuplicateChain
+{
+private:
+#if __cplusplus >= 201103L
+    typedef std::unordered_map< uint32, size_t > last_seen_t;
+#else
+    typedef std::map< uint32, size_t > last_seen_t;
+#endif
+    struct Members {
+        std::vector< size_t > next;
+        last_seen_t last_seen;  // Symbol id -> Index of its latest occurrence
+    } m;
+
+public:
+    static const size_t npos = ~static_cast< size_t >( 0 );
+
+    DuplicateChain( size_t expected_size ) { m.next.reserve( expected_size ); }
+    void append( Symbol symbol )
+    {
+        size_t index = m.next.size();
+        m.next.push_back( npos );
+        std::pair< last_seen_t::iterator, bool > insertion = m.last_seen.insert( last_seen_t::value_type( symbol.id(), index ) );
+        if( ! insertion.second )
+        {
+            m.next[insertion.first->second] = index;
+            insertion.first->second = index;
+        }
+    }
+    size_t next( size_t index ) const { return m.next[index]; }
+};
+
+const size_t DuplicateChain::npos;
+
+//----------------------------------------------------------------------------
+//                        Internal class ReportRecorder
+//----------------------------------------------------------------------------
+
+class ReportRecorder : public JCRParser
+{
+    // Holds on to messages so that they can be passed on in a set order
+private:
+    Diagnostics diagnostics;
+
+public:
+    ReportRecorder( GrammarSet * p_grammar_set ) : JCRParser( p_grammar_set ), diagnostics( true ) {}
+
+    virtual void diagnose( const std::string & source, size_t line, size_t column, Severity severity, const char * p_format, const clutils::str_arg_refs * p_args )
+    {
+        if( p_args )
+            diagnostics.add( source, line, column, severity, p_format, *p_args );
+        else
+            diagnostics.add( source, line, column, severity, p_format );
+    }
+    void replay( JCRParser * p_jcr_parser ) const
+    {
+        for( size_t i=0; i<diagnostics.size(); ++i )
+        {
+            const Diagnostic & r_diagnostic = diagnostics[i];
+            const std::string & r_source = diagnostics.source( r_diagnostic );
+            if( r_diagnostic.n_args == 0 )
+                p_jcr_parser->diagnose( r_source, r_diagnostic.line, r_diagnostic.column, r_diagnostic.severity, r_diagnostic.p_code, 0 );
+            else
+            {
+                clutils::str_arg_refs args;
+                diagnostics.arg_refs( &args, r_diagnostic );
+                p_jcr_parser->diagnose( r_source, r_diagnostic.line, r_diagnostic.column, r_diagnostic.severity, r_diagnostic.p_code, &args );
+            }
+        }
+    }
+};
+
+//----------------------------------------------------------------------------
+//                        Internal class JobRunner
+//----------------------------------------------------------------------------
+
+#if __cplusplus >= 201103L
+template< typename TJob >
+class JobRunner
+{
+    // Each thread takes the next job that has not yet been started until
+    // all the jobs have been taken.  Jobs are therefore started in order,
+    // so a job may wait for an earlier job without risking deadlock.
+private:
+    typedef void (TJob::*job_step_t)();
+    struct Members {
+        clutils::ptr_vector< TJob > & r_jobs;
+        job_step_t p_step;
+        std::atomic< size_t > next_job;
+
+        Members( clutils::ptr_vector< TJob > & r_jobs_in ) : r_jobs( r_jobs_in ), p_step( 0 ), next_job( 0 ) {}
+    } m;
+
+    void run_jobs()
+    {
+        for( size_t i = m.next_job++; i < m.r_jobs.size(); i = m.next_job++ )
+            (m.r_jobs[i].*m.p_step)();
+    }
+
+public:
+    JobRunner( clutils::ptr_vector< TJob > & r_jobs ) : m( r_jobs ) {}
+
+    void run( unsigned n_threads, job_step_t p_step )
+    {
+        // Runs p_step on every job, returning once all the jobs have done so
+        m.p_step = p_step;
+        m.next_job = 0;
+        std::vector< std::thread > threads;
+        for( unsigned i = 1; i < n_threads; ++i )    // The calling thread is also used
+            threads.push_back( std::thread( &JobRunner::run_jobs, this ) );
+        run_jobs();
+        for( size_t i = 0; i < threads.size(); ++i )
+            threads[i].join();
+    }
+};
+
+//----------------------------------------------------------------------------
+//                        Internal class LinkSchedule
+//----------------------------------------------------------------------------
+
+// When Grammars are linked at the same time, LinkSchedule lets each of them
+// see the others as they would be seen if the Grammars were linked one
+// after the other in GrammarSet order.  The global rules of an earlier
+// Grammar are seen once they have been linked, which may mean waiting for
+// them, and those of a later Grammar are seen as not yet linked.
+class LinkSchedule
+{
+private:
+    struct Members {
+        std::unordered_map< const Grammar *, size_t > positions;
+        std::vector< std::atomic< bool > > are_global_rules_linked;     // Indexed by position
+        std::mutex mutex;
+        std::condition_variable global_rules_linked;
+
+        Members( size_t n_grammars ) : are_global_rules_linked( n_grammars ) {}
+    } m;
+
+    size_t position( const Grammar * p_grammar ) const { return m.positions.find( p_grammar )->second; }
+
+public:
+    LinkSchedule( const GrammarSet & r_grammar_set )
+        : m( r_grammar_set.size() )
+    {
+        for( size_t i=0; i<r_grammar_set.size(); ++i )
+            m.positions[&r_grammar_set[i]] = i;
+    }
+
+    bool is_linked_before( const Grammar * p_grammar, const Grammar * p_linking_grammar )
+    {
+        size_t grammar_position = position( p_grammar );
+        if( grammar_position > position( p_linking_grammar ) )
+            return false;
+        if( ! m.are_global_rules_linked[grammar_position].load( std::memory_order_acquire ) )
+        {
+            std::unique_lock< std::mutex > lock( m.mutex );
+            while( ! m.are_global_rules_linked[grammar_position].load( std::memory_order_acquire ) )
+                m.global_rules_linked.wait( lock );
+        }
+        return true;
+    }
+
+    void mark_global_rules_linked( const Grammar * p_grammar )
+    {
+        {
+        std::lock_guard< std::mutex > lock( m.mutex );
+        m.are_global_rules_linked[position( p_grammar )].store( true, std::memory_order_release );
+        }
+        m.global_rules_linked.notify_all();
+    }
+};
+#endif
+
 //----------------------------------------------------------------------------
 //                        Internal class Linker
 //----------------------------------------------------------------------------
@@ -3745,41 +4086,71 @@ std::string GrammarParser::error_token()    // Attempts to extract the token tha
 class Linker
 {
 private:
+    // The memoised result of following a global rule's chain of target
+    // rules.  A chain is plain if it doesn't include member rules, missing
+    // targets or loops, so that linking through it can't report anything.
+    struct Resolution
+    {
+        enum Colour { WHITE, GREY, BLACK } colour;   // Unvisited, being followed, resolved
+        bool is_plain;
+        Rule * p_end;       // The last rule in the chain, for plain chains
+        size_t walk;        // The most recent walk that visited the rule, for loop detection
+
+        Resolution() : colour( WHITE ), is_plain( false ), p_end( 0 ), walk( 0 ) {}
+    };
+
+    // A Grammar's scope maps each name that its target rules can refer to
+    // onto the rule that the name resolves to, as Rule::find_target_rule()
+    // would resolve it, so that each target rule is found with one look up.
+    // Unqualified names are keyed by the rule name's Symbol id alone, and
+    // cover the Grammar's own rules followed by those of its unaliased
+    // imports, the first of any duplicates being visible.  Names qualified
+    // by an alias are keyed by the ruleset id's Symbol id as well, and cover
+    // the rules of the aliased imports.
+#if __cplusplus >= 201103L
+    typedef std::unordered_map< const Rule *, Resolution > resolutions_t;
+    typedef std::unordered_map< const Grammar *, size_t > positions_t;
+    typedef std::unordered_map< uint64, Rule * > scope_t;
+    typedef std::unordered_map< const Grammar *, scope_t > scopes_t;
+#else
+    typedef std::map< const Rule *, Resolution > resolutions_t;
+    typedef std::map< const Grammar *, size_t > positions_t;
+    typedef std::map< uint64, Rule * > scope_t;
+    typedef std::map< const Grammar *, scope_t > scopes_t;
+#endif
+
     struct Members {
         JCRParser * p_jcr_parser;
         GrammarSet * p_grammar_set;
+        const Grammar * p_grammar;      // The Grammar being linked
+#if __cplusplus >= 201103L
+        LinkSchedule * p_schedule;      // Set when Grammars are linked at the same time
+#endif
         bool is_errored;
+        resolutions_t resolutions;
+        std::vector< std::pair< Rule *, Resolution * > > resolution_stack;
+        size_t n_walks;
+        positions_t positions;          // Set when relinking some of the Grammars
+        scopes_t scopes;                // Built as each Grammar's rules are first looked up
+        const Grammar * p_scope_grammar;    // The Grammar whose scope was last used
+        const scope_t * p_scope;
         Members(
             JCRParser * p_jcr_parser_in,
             GrammarSet * p_grammar_set_in )
             :
             p_jcr_parser( p_jcr_parser_in ),
             p_grammar_set( p_grammar_set_in ),
-            is_errored( false )
+            p_grammar( 0 ),
+#if __cplusplus >= 201103L
+            p_schedule( 0 ),
+#endif
+            is_errored( false ),
+            n_walks( 0 ),
+            p_scope_grammar( 0 ),
+            p_scope( 0 )
         {}
     } m;
 
-    struct LoopDetector
-    {
-        LoopDetector * p_prev;
-        Rule * p_rule;
-
-        LoopDetector( Rule * p_rule_in )
-            : p_prev( 0 ), p_rule( p_rule_in )
-        {}
-        LoopDetector( LoopDetector * p_prev_in, Rule * p_rule_in )
-            : p_prev( p_prev_in ), p_rule( p_rule_in )
-        {}
-
-        bool is_looped() const
-        {
-            for( LoopDetector * p_loop_detector = p_prev; p_loop_detector; p_loop_detector = p_loop_detector->p_prev )
-                if( p_loop_detector->p_rule == p_rule )
-                    return true;
-            return false;
-        }
-    };
-
     struct LinkResult
     {
         Rule * p_initial_rule;
@@ -3793,52 +4164,113 @@ public:
     Linker( JCRParser * p_jcr_parser, GrammarSet * p_grammar_set )
         : m( p_jcr_parser, p_grammar_set )
     {}
+#if __cplusplus >= 201103L
+    Linker( JCRParser * p_jcr_parser, GrammarSet * p_grammar_set, LinkSchedule * p_schedule )
+        : m( p_jcr_parser, p_grammar_set )
+    {
+        m.p_schedule = p_schedule;
+    }
+#endif
     bool link();
     bool link( Grammar * p_grammar );
+    bool relink( Grammar * p_grammar, Symbol replaced_ruleset_id );
+#if __cplusplus >= 201103L
+    bool link_in_parallel( unsigned n_threads );
+    void find_global_target_rules( Grammar * p_grammar );
+#endif
 
 private:
+    // Rules in other Grammars are looked at through these so that, when
+    // Grammars are linked at the same time, they are seen as they would be
+    // when linking one Grammar after another
+    bool is_linked( const Rule * p_rule )
+    {
+#if __cplusplus >= 201103L
+        if( m.p_schedule && p_rule->p_grammar != m.p_grammar )
+            return m.p_schedule->is_linked_before( p_rule->p_grammar, m.p_grammar );
+#endif
+        if( ! m.positions.empty() && p_rule->p_grammar != m.p_grammar )
+            return m.positions.find( p_rule->p_grammar )->second < m.positions.find( m.p_grammar )->second;
+        return true;
+    }
+    Rule * linked_rule( Rule * p_rule ) { return is_linked( p_rule ) ? p_rule->p_rule : p_rule; }
+    Rule * linked_type( Rule * p_rule ) { return is_linked( p_rule ) ? p_rule->p_type : p_rule; }
+    bool is_member_rule( Rule * p_rule ) { return ! linked_rule( p_rule )->member_name.is_absent(); }
+    Rule * find_target_rule( Rule * p_rule )
+    {
+#if __cplusplus >= 201103L
+        // The targets of global rules are found before Grammars are linked
+        // at the same time, so they can be read but mustn't be written
+        if( m.p_schedule && ! p_rule->p_parent )
+            return look_up_target_rule( p_rule );
+#endif
+        p_rule->target_rule.p_rule = look_up_target_rule( p_rule );
+        return p_rule->target_rule.p_rule;
+    }
+    Rule * look_up_target_rule( Rule * p_rule );
+    const scope_t & scope( const Grammar * p_grammar );
+    void build_scope( scope_t * p_scope, const Grammar * p_grammar );
+    static uint64 scope_key( Symbol ruleset_id, Symbol rule_name )
+    {
+        return (static_cast< uint64 >( ruleset_id.id() ) << 32) | rule_name.id();
+    }
+
     void check_for_duplicate_ruleset_ids();
+    void check_for_duplicate_ruleset_ids( const Grammar * p_grammar );
     void check_for_duplicate_rule_names( Grammar * p_grammar );
+    void find_relinked_grammars( std::vector< const Grammar * > * p_relinked, std::vector< bool > * p_is_relinked, Symbol ruleset_id );
+    void unlink_rule( Rule * p_rule );
     void link_global_rules( Grammar * p_grammar );
     void link_global_rule( Rule * p_global_rule );
-    void do_link( LinkResult * p_link_result, LoopDetector * p_loop_detector, Rule * p_global_rule );
+    const Resolution & resolve( Rule * p_rule );
+    void do_link( LinkResult * p_link_result, Rule * p_global_rule );
     void link_child_rules( Rule * p_rule );
     void link_child_rule( Rule * p_rule );
 
     void error( const Rule * p_rule, const char * p_message )
     {
-        report( p_rule, Severity::ERROR, p_message );
+        report( p_rule, Severity::ERROR, p_message, 0 );
         m.is_errored = true;
     }
-    void error( const Rule * p_rule, const char * p_format, const clutils::str_args & r_arg_1 )
+    void error( const Rule * p_rule, const char * p_format, const clutils::str_arg_refs & r_args )
     {
-        error( p_rule, expand( p_format, r_arg_1 ).c_str() );
+        report( p_rule, Severity::ERROR, p_format, &r_args );
+        m.is_errored = true;
+    }
+    void error( const Rule * p_rule, const char * p_format, const clutils::str_arg & r_arg_1 )
+    {
+        error( p_rule, p_format, clutils::str_arg_refs( r_arg_1 ) );
     }
-    void error( const Rule * p_rule, const char * p_format, const clutils::str_args & r_arg_1, const clutils::str_args & r_arg_2 )
+    void error( const Rule * p_rule, const char * p_format, const clutils::str_arg & r_arg_1, const clutils::str_arg & r_arg_2 )
     {
-        error( p_rule, expand( p_format, r_arg_1, r_arg_2 ).c_str() );
+        error( p_rule, p_format, clutils::str_arg_refs( r_arg_1, r_arg_2 ) );
     }
-    void report( const Rule * p_rule, Severity severity, const char * p_message )
+    void report( const Rule * p_rule, Severity severity, const char * p_format, const clutils::str_arg_refs * p_args )
     {
-        m.p_jcr_parser->report( p_rule->p_grammar->jcr_source, p_rule->line_number, p_rule->column_number, severity, p_message );
+        m.p_jcr_parser->diagnose( p_rule->p_grammar->jcr_source, p_rule->line_number, p_rule->column_number, severity, p_format, p_args );
     }
 
     void error( const Grammar * p_grammar, const char * p_message )
     {
-        report( p_grammar, Severity::ERROR, p_message );
+        report( p_grammar, Severity::ERROR, p_message, 0 );
+        m.is_errored = true;
+    }
+    void error( const Grammar * p_grammar, const char * p_format, const clutils::str_arg_refs & r_args )
+    {
+        report( p_grammar, Severity::ERROR, p_format, &r_args );
         m.is_errored = true;
     }
-    void error( const Grammar * p_grammar, const char * p_format, const clutils::str_args & r_arg_1 )
+    void error( const Grammar * p_grammar, const char * p_format, const clutils::str_arg & r_arg_1 )
     {
-        error( p_grammar, expand( p_format, r_arg_1 ).c_str() );
+        error( p_grammar, p_format, clutils::str_arg_refs( r_arg_1 ) );
     }
-    void error( const Grammar * p_grammar, const char * p_format, const clutils::str_args & r_arg_1, const clutils::str_args & r_arg_2 )
+    void error( const Grammar * p_grammar, const char * p_format, const clutils::str_arg & r_arg_1, const clutils::str_arg & r_arg_2 )
     {
-        error( p_grammar, expand( p_format, r_arg_1, r_arg_2 ).c_str() );
+        error( p_grammar, p_format, clutils::str_arg_refs( r_arg_1, r_arg_2 ) );
     }
-    void report( const Grammar * p_grammar, Severity severity, const char * p_message )
+    void report( const Grammar * p_grammar, Severity severity, const char * p_format, const clutils::str_arg_refs * p_args )
     {
-        m.p_jcr_parser->report( p_grammar->jcr_source, severity, p_message );
+        m.p_jcr_parser->diagnose( p_grammar->jcr_source, ~0U, ~0U, severity, p_format, p_args );
     }
 };
 
@@ -3852,26 +4284,111 @@ bool Linker::link()
 
 void Linker::check_for_duplicate_ruleset_ids()
 {
+    DuplicateChain duplicate_chain( m.p_grammar_set->size() );
+    for( size_t i=0; i<m.p_grammar_set->size(); ++i )
+        duplicate_chain.append( (*m.p_grammar_set)[i].ruleset_id );
+
     for( size_t i=0; i<m.p_grammar_set->size(); ++i )
     {
         Grammar * p_grammar_under_test = &(*m.p_grammar_set)[i];
         if( ! p_grammar_under_test->ruleset_id.empty() )
         {
-            for( size_t j=i+1; j<m.p_grammar_set->size(); ++j )
+            for( size_t j=duplicate_chain.next( i ); j!=DuplicateChain::npos; j=duplicate_chain.next( j ) )
             {
                 Grammar * p_possible_duplicate = &(*m.p_grammar_set)[j];
-                if( p_grammar_under_test->ruleset_id == p_possible_duplicate->ruleset_id )
-                    error( p_grammar_under_test,
-                            "Duplicate <ruleset-id> '%0' found in source '%1'",
-                            p_grammar_under_test->ruleset_id,
-                            p_possible_duplicate->jcr_source );
+                error( p_grammar_under_test,
+                        "Duplicate <ruleset-id> '%0' found in source '%1'",
+                        p_grammar_under_test->ruleset_id,
+                        p_possible_duplicate->jcr_source );
             }
         }
     }
 }
 
+bool Linker::relink( Grammar * p_grammar, Symbol replaced_ruleset_id )
+{
+    // Relinks p_grammar, which has replaced a Grammar with the ruleset id
+    // replaced_ruleset_id, along with the Grammars that could be linked to
+    // either of them, directly or through other Grammars.  The others can't
+    // be linked to them, so their links are left as they are.  The relinked
+    // Grammars are linked in GrammarSet order, seeing later Grammars as not
+    // yet linked, so that the outcome is the same as linking the whole
+    // GrammarSet afresh.
+    for( size_t i=0; i<m.p_grammar_set->size(); ++i )
+        m.positions[&(*m.p_grammar_set)[i]] = i;
+
+    std::vector< bool > is_relinked( m.p_grammar_set->size(), false );
+    std::vector< const Grammar * > relinked( 1, p_grammar );
+    is_relinked[m.positions[p_grammar]] = true;
+    find_relinked_grammars( &relinked, &is_relinked, replaced_ruleset_id );
+    for( size_t i=0; i<relinked.size(); ++i )
+        find_relinked_grammars( &relinked, &is_relinked, relinked[i]->ruleset_id );
+
+    check_for_duplicate_ruleset_ids( p_grammar );
+
+    for( size_t i=0; i<m.p_grammar_set->size(); ++i )
+        if( is_relinked[i] )
+        {
+            Grammar * p_relinked = &(*m.p_grammar_set)[i];
+            for( size_t j=0; j<p_relinked->rules.size(); ++j )
+                unlink_rule( &p_relinked->rules[j] );
+        }
+    for( size_t i=0; i<m.p_grammar_set->size(); ++i )
+        if( is_relinked[i] )
+            link( &(*m.p_grammar_set)[i] );
+
+    m.positions.clear();
+    return ! m.is_errored;
+}
+
+void Linker::find_relinked_grammars( std::vector< const Grammar * > * p_relinked, std::vector< bool > * p_is_relinked, Symbol ruleset_id )
+{
+    if( ruleset_id.empty() )
+        return;
+    const GrammarSet::importers_t & r_importers = m.p_grammar_set->find_importers( ruleset_id );
+    for( size_t i=0; i<r_importers.size(); ++i )
+    {
+        size_t position = m.positions[r_importers[i]];
+        if( ! (*p_is_relinked)[position] )
+        {
+            (*p_is_relinked)[position] = true;
+            p_relinked->push_back( r_importers[i] );
+        }
+    }
+}
+
+void Linker::unlink_rule( Rule * p_rule )
+{
+    p_rule->p_rule = p_rule->p_type = p_rule;
+    p_rule->target_rule.p_rule = 0;
+    for( size_t i=0; i<p_rule->children.size(); ++i )
+        unlink_rule( &p_rule->children[i] );
+}
+
+void Linker::check_for_duplicate_ruleset_ids( const Grammar * p_grammar )
+{
+    // Reports the duplicates that check_for_duplicate_ruleset_ids() would
+    // report that involve p_grammar, in the same order
+    if( p_grammar->ruleset_id.empty() )
+        return;
+
+    std::vector< const Grammar * > same_ruleset_id;
+    for( size_t i=0; i<m.p_grammar_set->size(); ++i )
+        if( (*m.p_grammar_set)[i].ruleset_id == p_grammar->ruleset_id )
+            same_ruleset_id.push_back( &(*m.p_grammar_set)[i] );
+
+    for( size_t i=0; i<same_ruleset_id.size(); ++i )
+        for( size_t j=i+1; j<same_ruleset_id.size(); ++j )
+            if( same_ruleset_id[i] == p_grammar || same_ruleset_id[j] == p_grammar )
+                error( same_ruleset_id[i],
+                        "Duplicate <ruleset-id> '%0' found in source '%1'",
+                        same_ruleset_id[i]->ruleset_id,
+                        same_ruleset_id[j]->jcr_source );
+}
+
 bool Linker::link( Grammar * p_grammar )
 {
+    m.p_grammar = p_grammar;
     check_for_duplicate_rule_names( p_grammar );
     link_global_rules( p_grammar );
     return ! m.is_errored;
@@ -3879,18 +4396,21 @@ bool Linker::link( Grammar * p_grammar )
 
 void Linker::check_for_duplicate_rule_names( Grammar * p_grammar )
 {
+    DuplicateChain duplicate_chain( p_grammar->rules.size() );
+    for( size_t i=0; i<p_grammar->rules.size(); ++i )
+        duplicate_chain.append( p_grammar->rules[i].rule_name );
+
     for( size_t i=0; i<p_grammar->rules.size(); ++i )
     {
         Rule * p_rule_under_test = &(p_grammar->rules[i]);
-        for( size_t j=i+1; j<p_grammar->rules.size(); ++j )
+        for( size_t j=duplicate_chain.next( i ); j!=DuplicateChain::npos; j=duplicate_chain.next( j ) )
         {
             Rule * p_possible_duplicate = &(p_grammar->rules[j]);
-            if( p_rule_under_test->rule_name == p_possible_duplicate->rule_name )
-                error( p_rule_under_test,
-                        "Duplicate <rule-name> '$%0' found at (line: '%1', char: '%2')",
-                        clutils::str_args( p_rule_under_test->rule_name ) <<
-                            p_possible_duplicate->line_number <<
-                            p_possible_duplicate->column_number );
+            error( p_rule_under_test,
+                    "Duplicate <rule-name> '$%0' found at (line: '%1', char: '%2')",
+                    clutils::str_arg_refs( p_rule_under_test->rule_name ) <<
+                        p_possible_duplicate->line_number <<
+                        p_possible_duplicate->column_number );
         }
     }
 }
@@ -3904,6 +4424,10 @@ void Linker::link_global_rules( Grammar * p_grammar )
     {
         link_global_rule( &p_grammar->rules[i] );
     }
+#if __cplusplus >= 201103L
+    if( m.p_schedule )
+        m.p_schedule->mark_global_rules_linked( p_grammar );
+#endif
     for( size_t i=0; i<p_grammar->rules.size(); ++i )
     {
         link_child_rules( &p_grammar->rules[i] );
@@ -3912,168 +4436,1608 @@ void Linker::link_global_rules( Grammar * p_grammar )
 
 void Linker::link_global_rule( Rule * p_global_rule )
 {
+    // A global rule that targets a plain chain, such as a chain of type rule
+    // aliases, links to the chain's end without the chain being followed
+    // again.  Other chains are walked a step at a time, because whether a
+    // rule counts as a member rule changes as rules are linked, and what is
+    // reported depends on it.
+    if( ! p_global_rule->target_rule.rule_name.empty() )
+    {
+        Rule * p_target_rule = find_target_rule( p_global_rule );
+        if( p_target_rule )
+        {
+            const Resolution & r_target_resolution = resolve( p_target_rule );
+            if( r_target_resolution.is_plain )
+            {
+                p_global_rule->p_rule = p_global_rule;
+                p_global_rule->p_type = r_target_resolution.p_end;
+                return;
+            }
+        }
+    }
+
     LinkResult link_result( p_global_rule );
-    LoopDetector loop_detector( p_global_rule );
-    do_link( &link_result, &loop_detector, p_global_rule );
+    do_link( &link_result, p_global_rule );
     p_global_rule->p_rule = link_result.p_member_rule;
     p_global_rule->p_type = link_result.p_type_rule;
 }
 
-void Linker::do_link( LinkResult * p_link_result, LoopDetector * p_loop_detector, Rule * p_global_rule )
+const Linker::Resolution & Linker::resolve( Rule * p_rule )
 {
-    if( ! p_global_rule->target_rule.rule_name.empty() )
+    // Follow the chain until reaching a resolved rule, the end of the chain,
+    // a missing target or a loop (a rule that is still being followed), and
+    // then resolve the followed rules in reverse order.  Each rule's chain
+    // is therefore only followed once per link.
+    static const Resolution not_plain;
+    const Resolution * p_tail = &not_plain;
+    m.resolution_stack.clear();
+    for( Rule * p_next = p_rule; ; )
     {
-        Rule * p_target_rule = p_global_rule->find_target_rule();
-        if( ! p_target_rule )
+        Resolution & r_resolution = m.resolutions[p_next];
+        if( r_resolution.colour == Resolution::BLACK )
         {
-            error( p_global_rule, "Unable to find Target rule '$%0' for global rule '$%1'",
-                    p_global_rule->target_rule,
-                    p_global_rule->get_rule_name() );
+            p_tail = &r_resolution;
+            break;
         }
-        else
+        if( r_resolution.colour == Resolution::GREY )
+            break;      // Loop
+        r_resolution.colour = Resolution::GREY;
+        m.resolution_stack.push_back( std::make_pair( p_next, &r_resolution ) );
+        if( p_next->target_rule.rule_name.empty() )
         {
-            LoopDetector loop_detector( p_loop_detector, p_target_rule );
-            if( loop_detector.is_looped() )
-            {
-                error( p_target_rule, "Target rule '$%0' loops back to itself when linking global rule '$%1'",
-                        p_target_rule->rule_name,
-                        p_global_rule->get_rule_name() );
-            }
-            else
-            {
-                p_link_result->p_type_rule = p_target_rule;
-                if( p_target_rule->is_member_rule() )
-                {
-                    if( p_link_result->p_member_rule->is_member_rule() )
-                        error( p_link_result->p_member_rule, "Global member rule '$%0' links to another Member rule: '%1'",
-                                p_global_rule->get_rule_name(),
-                                p_link_result->p_member_rule->target_rule );
-                    else
-                        p_link_result->p_member_rule = p_target_rule;
-                }
-                do_link( p_link_result, &loop_detector, p_target_rule );
+            p_tail = 0;     // End of chain
+            break;
+        }
+        p_next = find_target_rule( p_next );
+        if( ! p_next )
+            break;      // Missing target
+    }
+
+    while( ! m.resolution_stack.empty() )
+    {
+        Rule * p_followed_rule = m.resolution_stack.back().first;
+        Resolution * p_resolution = m.resolution_stack.back().second;
+        m.resolution_stack.pop_back();
+
+        // A rule linked in an earlier link may have been resolved to a member rule
+        bool is_possible_member_rule = ! p_followed_rule->member_name.is_absent() || linked_rule( p_followed_rule ) != p_followed_rule;
+        p_resolution->colour = Resolution::BLACK;
+        p_resolution->is_plain = ! is_possible_member_rule && (! p_tail || p_tail->is_plain);
+        p_resolution->p_end = p_tail ? p_tail->p_end : p_followed_rule;
+        p_tail = p_resolution;
+    }
+
+    return *p_tail;
+}
+
+void Linker::do_link( LinkResult * p_link_result, Rule * p_global_rule )
+{
+    size_t walk = ++m.n_walks;
+    m.resolutions[p_global_rule].walk = walk;
+
+    for( Rule * p_rule = p_global_rule; ! p_rule->target_rule.rule_name.empty(); )
+    {
+        Rule * p_target_rule = find_target_rule( p_rule );
+        if( ! p_target_rule )
+        {
+            error( p_rule, "Unable to find Target rule '$%0' for global rule '$%1'",
+                    p_rule->target_rule,
+                    p_rule->get_rule_name() );
+            return;
+        }
+
+        Resolution & r_target_resolution = m.resolutions[p_target_rule];
+        if( r_target_resolution.walk == walk )
+        {
+            error( p_target_rule, "Target rule '$%0' loops back to itself when linking global rule '$%1'",
+                    p_target_rule->rule_name,
+                    p_rule->get_rule_name() );
+            return;
+        }
+        r_target_resolution.walk = walk;
+
+        p_link_result->p_type_rule = p_target_rule;
+        if( is_member_rule( p_target_rule ) )
+        {
+            if( is_member_rule( p_link_result->p_member_rule ) )
+                error( p_link_result->p_member_rule, "Global member rule '$%0' links to another Member rule: '%1'",
+                        p_rule->get_rule_name(),
+                        p_link_result->p_member_rule->target_rule );
+            else
+                p_link_result->p_member_rule = p_target_rule;
+        }
+        p_rule = p_target_rule;
+    }
+}
+
+Rule * Linker::look_up_target_rule( Rule * p_rule )
+{
+    if( p_rule->target_rule.p_rule )
+        return p_rule->target_rule.p_rule;
+    if( p_rule->target_rule.rule_name.empty() )
+        return p_rule;  // Resolve to self in the absence of a link
+
+    const scope_t & r_scope = scope( p_rule->p_grammar );
+    scope_t::const_iterator i_target = r_scope.find( scope_key( p_rule->target_rule.ruleset_id, p_rule->target_rule.rule_name ) );
+    if( i_target != r_scope.end() )
+        return i_target->second;
+
+    // A qualified name whose ruleset id isn't that of an aliased import can
+    // only come from a Grammar that wasn't made by the parser
+    if( ! p_rule->target_rule.ruleset_id.empty() )
+        return const_cast< Rule * >( static_cast< const Rule * >( p_rule )->find_target_rule() );
+    return 0;
+}
+
+const Linker::scope_t & Linker::scope( const Grammar * p_grammar )
+{
+    // Consecutive look ups are mostly made from the same Grammar
+    if( p_grammar != m.p_scope_grammar )
+    {
+        scopes_t::iterator i_scope = m.scopes.find( p_grammar );
+        if( i_scope == m.scopes.end() )
+        {
+            i_scope = m.scopes.insert( scopes_t::value_type( p_grammar, scope_t() ) ).first;
+            build_scope( &i_scope->second, p_grammar );
+        }
+        m.p_scope_grammar = p_grammar;
+        m.p_scope = &i_scope->second;
+    }
+    return *m.p_scope;
+}
+
+void Linker::build_scope( scope_t * p_scope, const Grammar * p_grammar )
+{
+    // Inserting doesn't replace a name that is already present, so the
+    // first of any duplicates remains visible
+    Grammar * p_own_grammar = const_cast< Grammar * >( p_grammar );
+    for( size_t i=0; i<p_own_grammar->rules.size(); ++i )
+    {
+        Rule * p_rule = &p_own_grammar->rules[i];
+        if( ! p_rule->rule_name.empty() )
+            p_scope->insert( scope_t::value_type( scope_key( Symbol(), p_rule->rule_name ), p_rule ) );
+    }
+
+    for( size_t i=0; i<p_grammar->unaliased_imports.size(); ++i )
+    {
+        Grammar * p_import = m.p_grammar_set->find_grammar( p_grammar->unaliased_imports[i] );
+        if( p_import )
+            for( size_t j=0; j<p_import->rules.size(); ++j )
+            {
+                Rule * p_rule = &p_import->rules[j];
+                if( ! p_rule->rule_name.empty() )
+                    p_scope->insert( scope_t::value_type( scope_key( Symbol(), p_rule->rule_name ), p_rule ) );
+            }
+    }
+
+    for( Grammar::aliased_imports_t::const_iterator i_import = p_grammar->aliased_imports.begin();
+            i_import != p_grammar->aliased_imports.end();
+            ++i_import )
+    {
+        Grammar * p_import = m.p_grammar_set->find_grammar( i_import->second );
+        if( p_import )
+            for( size_t j=0; j<p_import->rules.size(); ++j )
+            {
+                Rule * p_rule = &p_import->rules[j];
+                if( ! p_rule->rule_name.empty() )
+                    p_scope->insert( scope_t::value_type( scope_key( p_import->ruleset_id, p_rule->rule_name ), p_rule ) );
+            }
+    }
+}
+
+void Linker::link_child_rules( Rule * p_rule )
+{
+    for( size_t i=0; i<p_rule->children.size(); ++i )
+    {
+        link_child_rule( &p_rule->children[i] );
+        link_child_rules( &p_rule->children[i] );
+    }
+}
+
+void Linker::link_child_rule( Rule * p_rule )
+{
+    if( ! p_rule->target_rule.rule_name.empty() )
+    {
+        Rule * p_target_rule = find_target_rule( p_rule );
+        if( ! p_target_rule )
+        {
+            error( p_rule, "Unable to find Target rule '%0'", p_rule->target_rule );
+        }
+        else
+        {
+            p_rule->p_type = linked_type( p_target_rule );
+            if( is_member_rule( p_target_rule ) )
+            {
+                if( p_rule->is_member_rule() )
+                    error( p_rule, "Member rule links to another Member rule: '$%0'",
+                            linked_rule( p_target_rule )->rule_name );
+                else
+            p_rule->p_rule = linked_rule( p_target_rule );
             }
         }
     }
 }
 
-void Linker::link_child_rules( Rule * p_rule )
+#if __cplusplus >= 201103L
+//----------------------------------------------------------------------------
+//                        Internal class LinkJob
+//----------------------------------------------------------------------------
+
+class LinkJob
+{
+    // Links one Grammar of a GrammarSet whose Grammars are being linked at
+    // the same time, holding on to what is reported
+private:
+    struct Members {
+        Grammar * p_grammar;
+        LinkSchedule * p_schedule;
+        ReportRecorder report_recorder;
+        Linker linker;
+        bool is_linked;
+        std::exception_ptr p_exception;
+
+        Members( Grammar * p_grammar_in, LinkSchedule * p_schedule_in )
+            :
+            p_grammar( p_grammar_in ),
+            p_schedule( p_schedule_in ),
+            report_recorder( p_grammar_in->p_grammar_set ),
+            linker( &report_recorder, p_grammar_in->p_grammar_set, p_schedule_in ),
+            is_linked( false )
+        {}
+    } m;
+
+public:
+    LinkJob( Grammar * p_grammar, LinkSchedule * p_schedule ) : m( p_grammar, p_schedule ) {}
+
+    void find_target_rules()
+    {
+        m.linker.find_global_target_rules( m.p_grammar );
+    }
+
+    void link()
+    {
+        try
+        {
+            m.is_linked = m.linker.link( m.p_grammar );
+        }
+        catch( ... )    // Mustn't escape a thread, so is rethrown by merge_into()
+        {
+            m.p_exception = std::current_exception();
+            m.p_schedule->mark_global_rules_linked( m.p_grammar );  // Don't leave later Grammars waiting
+        }
+    }
+
+    bool merge_into( JCRParser * p_jcr_parser )
+    {
+        if( m.p_exception )
+            std::rethrow_exception( m.p_exception );
+        m.report_recorder.replay( p_jcr_parser );
+        return m.is_linked;
+    }
+};
+
+void Linker::find_global_target_rules( Grammar * p_grammar )
+{
+    // Done before Grammars are linked at the same time, after which the
+    // targets of global rules are only read
+    for( size_t i=0; i<p_grammar->rules.size(); ++i )
+        p_grammar->rules[i].target_rule.p_rule = look_up_target_rule( &p_grammar->rules[i] );
+}
+
+bool Linker::link_in_parallel( unsigned n_threads )
+{
+    check_for_duplicate_ruleset_ids();
+
+    // Look ups must not modify what's shared between the threads
+    m.p_grammar_set->index_grammars();
+    for( size_t i=0; i<m.p_grammar_set->size(); ++i )
+        (*m.p_grammar_set)[i].index_rules();
+
+    LinkSchedule schedule( *m.p_grammar_set );
+    clutils::ptr_vector< LinkJob > jobs;
+    for( size_t i=0; i<m.p_grammar_set->size(); ++i )
+        jobs.push_back( new LinkJob( &(*m.p_grammar_set)[i], &schedule ) );
+
+    JobRunner< LinkJob > job_runner( jobs );
+    job_runner.run( n_threads, &LinkJob::find_target_rules );
+    job_runner.run( n_threads, &LinkJob::link );
+
+    for( size_t i=0; i<jobs.size(); ++i )
+        if( ! jobs[i].merge_into( m.p_jcr_parser ) )
+            m.is_errored = true;
+
+    return ! m.is_errored;
+}
+#endif
+
+//----------------------------------------------------------------------------
+//                           class ParseJob
+//----------------------------------------------------------------------------
+
+class ParseJob
+{
+    // Parses a file into a GrammarSet of its own, so that jobs can be run
+    // at the same time without sharing any state
+private:
+    struct Members {
+        std::string file_name;
+        GrammarSet grammar_set;
+        ReportRecorder report_recorder;
+        JCRParser::Status status;
+
+        Members( const std::string & r_file_name )
+            : file_name( r_file_name ), report_recorder( &grammar_set ), status( JCRParser::S_OK )
+        {}
+    } m;
+
+public:
+    ParseJob( const std::string & r_file_name, const JCRParser & r_settings )
+        : m( r_file_name )
+    {
+        m.report_recorder.set_exception_free( r_settings.is_exception_free() );
+        m.report_recorder.set_memoising( r_settings.is_memoising() );
+        m.report_recorder.set_parse_cache( r_settings.parse_cache() );
+    }
+
+    void parse()
+    {
+        try
+        {
+            m.status = m.report_recorder.add_grammar( m.file_name.c_str() );
+        }
+        catch( std::exception & )   // Mustn't escape a thread
+        {
+            m.status = JCRParser::S_INTERNAL_ERROR;
+        }
+    }
+
+    JCRParser::Status merge_into( JCRParser * p_jcr_parser )
+    {
+        m.report_recorder.replay( p_jcr_parser );
+        p_jcr_parser->grammar_set()->splice( m.grammar_set );
+        return m.status;
+    }
+};
+
+} // End of Anonymous namespace
+
+//----------------------------------------------------------------------------
+//                        Internal class GrammarFeed
+//----------------------------------------------------------------------------
+
+#if __cplusplus >= 201103L
+class GrammarFeed
+{
+    // Parses a grammar in a thread of its own as the chunks of its input are
+    // fed to it.  The messages are held back until the input has ended, so
+    // that they are reported in the thread of the JCRParser.
+private:
+    class FeedReader : public cl::reader_incremental
+    {
+        // Passes the chunks fed in one thread to the parser in another.  At
+        // most max_waiting_size bytes are held waiting for the parser,
+        // unless a single chunk is larger than that.
+    private:
+        static const size_t max_waiting_size = 64 * 1024;
+
+        struct Members {
+            std::mutex mutex;
+            std::condition_variable changed;
+            std::vector< char > waiting;
+            bool is_ended;      // No more chunks will be fed
+            bool is_finished;   // The parser won't read any more
+
+            Members() : is_ended( false ), is_finished( false ) {}
+        } m;
+
+        virtual bool read_chunk( std::vector< char > * p_buffer )
+        {
+            std::unique_lock< std::mutex > lock( m.mutex );
+            while( m.waiting.empty() && ! m.is_ended )
+                m.changed.wait( lock );
+            if( m.waiting.empty() )
+                return false;
+            p_buffer->insert( p_buffer->end(), m.waiting.begin(), m.waiting.end() );
+            m.waiting.clear();
+            m.changed.notify_all();
+            return true;
+        }
+
+    public:
+        void feed( const char * p_chunk, size_t size )
+        {
+            std::unique_lock< std::mutex > lock( m.mutex );
+            while( m.waiting.size() >= max_waiting_size && ! m.is_finished )
+                m.changed.wait( lock );
+            if( ! m.is_finished )
+                m.waiting.insert( m.waiting.end(), p_chunk, p_chunk + size );
+            m.changed.notify_all();
+        }
+        void end()
+        {
+            std::lock_guard< std::mutex > lock( m.mutex );
+            m.is_ended = true;
+            m.changed.notify_all();
+        }
+        void finish()
+        {
+            std::lock_guard< std::mutex > lock( m.mutex );
+            m.is_finished = true;
+            m.waiting.clear();
+            m.changed.notify_all();
+        }
+    };
+
+    struct Members {
+        JCRParser * p_jcr_parser;
+        std::string jcr_source;
+        FeedReader reader;
+        ReportRecorder report_recorder;
+        JCRParser::Status status;
+        std::thread parse_thread;
+
+        Members( JCRParser * p_jcr_parser_in, const std::string & r_jcr_source )
+            :
+            p_jcr_parser( p_jcr_parser_in ),
+            jcr_source( r_jcr_source ),
+            report_recorder( p_jcr_parser_in->grammar_set() ),
+            status( JCRParser::S_OK )
+        {}
+    } m;
+
+    void parse()
+    {
+        try
+        {
+            m.status = m.report_recorder.add_grammar( m.reader, m.jcr_source );
+        }
+        catch( std::exception & )   // Mustn't escape a thread
+        {
+            m.status = JCRParser::S_INTERNAL_ERROR;
+        }
+        m.reader.finish();
+    }
+
+public:
+    GrammarFeed( JCRParser * p_jcr_parser, const std::string & r_jcr_source )
+        : m( p_jcr_parser, r_jcr_source )
+    {
+        m.report_recorder.set_exception_free( p_jcr_parser->is_exception_free() );
+        m.report_recorder.set_memoising( p_jcr_parser->is_memoising() );
+        m.parse_thread = std::thread( &GrammarFeed::parse, this );
+    }
+    ~GrammarFeed()
+    {
+        if( m.parse_thread.joinable() )
+        {
+            m.reader.end();
+            m.parse_thread.join();
+        }
+    }
+
+    void feed( const char * p_chunk, size_t size )
+    {
+        m.reader.feed( p_chunk, size );
+    }
+    JCRParser::Status end()
+    {
+        m.reader.end();
+        m.parse_thread.join();
+        m.report_recorder.replay( m.p_jcr_parser );
+        return m.status;
+    }
+};
+#else
+class GrammarFeed
+{
+    // Without threads, the chunks are collected and then parsed when the
+    // input has ended
+private:
+    struct Members {
+        JCRParser * p_jcr_parser;
+        std::string jcr_source;
+        std::vector< char > input;
+
+        Members( JCRParser * p_jcr_parser_in, const std::string & r_jcr_source )
+            : p_jcr_parser( p_jcr_parser_in ), jcr_source( r_jcr_source )
+        {}
+    } m;
+
+public:
+    GrammarFeed( JCRParser * p_jcr_parser, const std::string & r_jcr_source )
+        : m( p_jcr_parser, r_jcr_source )
+    {}
+
+    void feed( const char * p_chunk, size_t size )
+    {
+        m.input.insert( m.input.end(), p_chunk, p_chunk + size );
+    }
+    JCRParser::Status end()
+    {
+        cl::reader_mem_buf reader( m.input );
+        return m.p_jcr_parser->add_grammar( reader, m.jcr_source );
+    }
+};
+#endif
+
+//----------------------------------------------------------------------------
+//                           class JCRParser
+//----------------------------------------------------------------------------
+
+JCRParser::~JCRParser()
+{
+    delete m.p_grammar_feed;
+}
+
+JCRParser::Status JCRParser::add_grammar( const char * p_file_name )
+{
+    cl::mapped_file file( p_file_name );
+    if( ! file.is_open() )
+    {
+        m.p_grammar_set->inc_error_count();
+        return S_UNABLE_TO_OPEN_FILE;
+    }
+
+    return parse_grammar( file.data(), file.size(), p_file_name );
+}
+
+JCRParser::Status JCRParser::add_grammar( const std::string & rules )
+{
+    return parse_grammar( rules.data(), rules.size(), clutils::expand( "std::string @ ", (void *)&rules ) );
+}
+
+JCRParser::Status JCRParser::add_grammar( const char * p_rules, size_t size )
+{
+    return parse_grammar( p_rules, size, clutils::expand( "const char * ", (void *)p_rules ) );
+}
+
+JCRParser::Status JCRParser::add_grammar( cl::reader & reader, const std::string & jcr_source )
+{
+    return parse_grammar( reader, jcr_source );
+}
+
+void JCRParser::begin_grammar( const std::string & jcr_source )
+{
+    assert( ! m.p_grammar_feed );   // end_grammar() must be called for the previous grammar
+    delete m.p_grammar_feed;
+    m.p_grammar_feed = new GrammarFeed( this, jcr_source );
+}
+
+void JCRParser::feed( const char * p_chunk, size_t size )
+{
+    assert( m.p_grammar_feed );     // begin_grammar() must be called first
+    if( m.p_grammar_feed && size > 0 )
+        m.p_grammar_feed->feed( p_chunk, size );
+}
+
+JCRParser::Status JCRParser::end_grammar()
+{
+    assert( m.p_grammar_feed );     // begin_grammar() must be called first
+    if( ! m.p_grammar_feed )
+        return S_INTERNAL_ERROR;
+    Status status = m.p_grammar_feed->end();
+    delete m.p_grammar_feed;
+    m.p_grammar_feed = 0;
+    return status;
+}
+
+JCRParser::Status JCRParser::add_grammars( const std::vector< std::string > & r_file_names, unsigned n_threads, std::vector< Status > * p_statuses )
+{
+#if __cplusplus >= 201103L
+    if( n_threads == 0 )
+        n_threads = std::max( std::thread::hardware_concurrency(), 1U );
+#else
+    n_threads = 1;  // Threads not supported
+#endif
+    if( n_threads > r_file_names.size() )
+        n_threads = static_cast< unsigned >( r_file_names.size() );
+
+    Status overall_status = S_OK;
+    if( p_statuses )
+        p_statuses->clear();
+
+    if( n_threads <= 1 )
+    {
+        for( size_t i = 0; i < r_file_names.size(); ++i )
+        {
+            Status status = add_grammar( r_file_names[i].c_str() );
+            if( p_statuses )
+                p_statuses->push_back( status );
+            if( overall_status == S_OK )
+                overall_status = status;
+        }
+        return overall_status;
+    }
+
+#if __cplusplus >= 201103L
+    clutils::ptr_vector< ParseJob > jobs;
+    for( size_t i = 0; i < r_file_names.size(); ++i )
+        jobs.push_back( new ParseJob( r_file_names[i], *this ) );
+
+    JobRunner< ParseJob >( jobs ).run( n_threads, &ParseJob::parse );
+
+    for( size_t i = 0; i < jobs.size(); ++i )
+    {
+        Status status = jobs[i].merge_into( this );
+        if( p_statuses )
+            p_statuses->push_back( status );
+        if( overall_status == S_OK )
+            overall_status = status;
+    }
+#endif
+
+    return overall_status;
+}
+
+JCRParser::Status JCRParser::link()
+{
+    Linker linker( this, m.p_grammar_set );
+
+    return linker.link() ? S_OK : S_ERROR;
+}
+
+JCRParser::Status JCRParser::link_in_parallel( unsigned n_threads )
+{
+#if __cplusplus >= 201103L
+    if( n_threads == 0 )
+        n_threads = std::max( std::thread::hardware_concurrency(), 1U );
+    if( n_threads > m.p_grammar_set->size() )
+        n_threads = static_cast< unsigned >( m.p_grammar_set->size() );
+
+    if( n_threads > 1 )
+    {
+        Linker linker( this, m.p_grammar_set );
+
+        return linker.link_in_parallel( n_threads ) ? S_OK : S_ERROR;
+    }
+#else
+    (void)n_threads;    // Threads not supported
+#endif
+
+    return link();
+}
+
+JCRParser::Status JCRParser::link( Grammar * p_grammar )
+{
+    Linker linker( this, m.p_grammar_set );
+
+    return linker.link( p_grammar ) ? S_OK : S_ERROR;
+}
+
+JCRParser::Status JCRParser::replace_grammar( const char * p_file_name )
+{
+    cl::mapped_file file( p_file_name );
+    if( ! file.is_open() )
+    {
+        m.p_grammar_set->inc_error_count();
+        return S_UNABLE_TO_OPEN_FILE;
+    }
+
+    Grammar * p_grammar = 0;
+    for( size_t i=0; i<m.p_grammar_set->size() && ! p_grammar; ++i )
+        if( (*m.p_grammar_set)[i].jcr_source == p_file_name )
+            p_grammar = &(*m.p_grammar_set)[i];
+
+    return replace_grammar( p_grammar, file.data(), file.size(), p_file_name );
+}
+
+JCRParser::Status JCRParser::replace_grammar( Grammar * p_grammar, const char * p_rules, size_t size )
+{
+    if( ! p_grammar || m.p_grammar_set->position( p_grammar ) == m.p_grammar_set->size() )
+    {
+        m.p_grammar_set->inc_error_count();
+        return S_ERROR;
+    }
+
+    std::string jcr_source( p_grammar->jcr_source );    // p_grammar is destroyed when replaced
+
+    return replace_grammar( p_grammar, p_rules, size, jcr_source );
+}
+
+JCRParser::Status JCRParser::replace_grammar( Grammar * p_grammar, const char * p_rules, size_t size, const std::string & jcr_source )
+{
+    Symbol replaced_ruleset_id;
+    if( p_grammar )
+        replaced_ruleset_id = p_grammar->ruleset_id;
+
+    // The Grammar is parsed onto the end of the GrammarSet and then moved.
+    // It is linked even if there are errors, so that no rules are left
+    // linked to the replaced Grammar.
+    Status parse_status = parse_grammar( p_rules, size, jcr_source );
+    Grammar * p_replacement = &(*m.p_grammar_set)[m.p_grammar_set->size() - 1];
+    if( p_grammar )
+        p_replacement = m.p_grammar_set->replace( p_grammar, m.p_grammar_set->release_back() );
+    if( ! p_replacement )   // p_grammar wasn't in the GrammarSet
+    {
+        m.p_grammar_set->inc_error_count();
+        return S_INTERNAL_ERROR;
+    }
+
+    Linker linker( this, m.p_grammar_set );
+    bool is_linked = linker.relink( p_replacement, replaced_ruleset_id );
+
+    if( parse_status != S_OK )
+        return parse_status;
+    return is_linked ? S_OK : S_ERROR;
+}
+
+void JCRParser::diagnose( const std::string & source, size_t line, size_t column, Severity severity, const char * p_format, const clutils::str_arg_refs * p_args )
+{
+    if( p_args )
+    {
+        m.message_buffer.clear();
+        p_args->expand_append( &m.message_buffer, p_format );
+        report( source, line, column, severity, m.message_buffer.c_str() );
+    }
+    else
+        report( source, line, column, severity, p_format );
+}
+
+JCRParser::Status JCRParser::parse_grammar( const char * p_rules, size_t size, const std::string & jcr_source )
+{
+    if( m.p_parse_cache && m.p_parse_cache->load( p_rules, size, m.p_grammar_set, jcr_source ) )
+        return S_OK;
+
+    cl::reader_mem_buf reader( p_rules, size );
+    Grammar * p_grammar = m.p_grammar_set->append_grammar( jcr_source );
+    GrammarParser parser( this, reader, m.p_grammar_set, p_grammar );
+
+    parser.parse();
+
+    if( m.p_parse_cache && parser.status() == S_OK && ! parser.is_reported() )
+        m.p_parse_cache->store( p_rules, size, *p_grammar );
+
+    return parser.status();
+}
+
+JCRParser::Status JCRParser::parse_grammar( cl::reader & reader, const std::string & jcr_source )
+{
+    GrammarParser parser( this, reader, m.p_grammar_set, m.p_grammar_set->append_grammar( jcr_source ) );
+
+    parser.parse();
+
+    return parser.status();
+}
+
+//----------------------------------------------------------------------------
+//                           class JCRParserWithDiagnostics
+//----------------------------------------------------------------------------
+
+void JCRParserWithDiagnostics::report( const std::string & source, size_t line, size_t column, Severity severity, const char * p_message )
+{
+    if( recorded_diagnostics.add_text( source, line, column, severity, p_message ) )
+        count( severity );
+}
+
+void JCRParserWithDiagnostics::diagnose( const std::string & source, size_t line, size_t column, Severity severity, const char * p_format, const clutils::str_arg_refs * p_args )
+{
+    if( p_args ? recorded_diagnostics.add( source, line, column, severity, p_format, *p_args ) :
+                recorded_diagnostics.add( source, line, column, severity, p_format ) )
+        count( severity );
+}
+
+void JCRParserWithDiagnostics::count( Severity severity )
+{
+    if( severity == Severity::WARNING )
+        grammar_set()->inc_warning_count();
+    else
+        grammar_set()->inc_error_count();
+}
+
+//----------------------------------------------------------------------------
+//                           class JCRParserWithReporter
+//----------------------------------------------------------------------------
+
+void JCRParserWithReporter::report( const std::string & source, size_t line, size_t column, Severity severity, const char * p_message )
+{
+    size_t n_diagnostics = diagnostics().size();
+    JCRParserWithDiagnostics::report( source, line, column, severity, p_message );
+    if( diagnostics().size() != n_diagnostics )
+        print( diagnostics().back() );
+}
+
+void JCRParserWithReporter::diagnose( const std::string & source, size_t line, size_t column, Severity severity, const char * p_format, const clutils::str_arg_refs * p_args )
+{
+    size_t n_diagnostics = diagnostics().size();
+    JCRParserWithDiagnostics::diagnose( source, line, column, severity, p_format, p_args );
+    if( diagnostics().size() != n_diagnostics )
+        print( diagnostics().back() );
+}
+
+void JCRParserWithReporter::print( const Diagnostic & r_diagnostic ) const
+{
+    std::string text( r_diagnostic.severity.to_s() );
+    text += ": ";
+    text += diagnostics().source( r_diagnostic );
+    if( r_diagnostic.line != ~0U )
+    {
+        clutils::expand_append( &text, " (line: %0", clutils::str_arg_refs( r_diagnostic.line ) );
+        if( r_diagnostic.column != ~0U )
+            clutils::expand_append( &text, ", char: %0", clutils::str_arg_refs( r_diagnostic.column ) );
+        text += ")";
+    }
+    text += ":\n      ";
+    diagnostics().message_append( &text, r_diagnostic );
+    text += "\n";
+
+    std::cout << text;
+}
+
+//----------------------------------------------------------------------------
+//                           class Diagnostics
+//----------------------------------------------------------------------------
+
+namespace { // Anonymous namespace for detail
+
+// FNV-1a, which is quick for the short keys hashed here
+const uint64 fnv_offset_basis = 14695981039346656037ULL;
+
+uint64 fnv_hash( uint64 hash, const void * p_data, size_t size )
+{
+    const unsigned char * p_bytes = static_cast< const unsigned char * >( p_data );
+    for( size_t i=0; i<size; ++i )
+        hash = (hash ^ p_bytes[i]) * 1099511628211ULL;
+    return hash;
+}
+
+template< typename T >
+uint64 fnv_hash( uint64 hash, const T & r_value )
+{
+    return fnv_hash( hash, &r_value, sizeof( r_value ) );
+}
+
+} // End of Anonymous namespace
+
+bool Diagnostics::add( const std::string & r_source, size_t line, size_t column, Severity severity, const char * p_format, const clutils::str_arg_refs & r_args )
+{
+    Diagnostic diagnostic = { p_format, source_id( r_source ), static_cast< uint32 >( line ), static_cast< uint32 >( column ), severity,
+            static_cast< uint32 >( m.arg_ends.size() ), static_cast< uint32 >( r_args.size() ) };
+    for( size_t i=0; i<r_args.size(); ++i )
+    {
+        r_args[i].append_to( &m.arg_text );
+        m.arg_ends.push_back( static_cast< uint32 >( m.arg_text.size() ) );
+    }
+    return add( &diagnostic );
+}
+
+bool Diagnostics::add( const std::string & r_source, size_t line, size_t column, Severity severity, const char * p_format )
+{
+    Diagnostic diagnostic = { p_format, source_id( r_source ), static_cast< uint32 >( line ), static_cast< uint32 >( column ), severity,
+            static_cast< uint32 >( m.arg_ends.size() ), 0 };
+    return add( &diagnostic );
+}
+
+bool Diagnostics::add_text( const std::string & r_source, size_t line, size_t column, Severity severity, const std::string & r_message )
+{
+    Diagnostic diagnostic = { "%0", source_id( r_source ), static_cast< uint32 >( line ), static_cast< uint32 >( column ), severity,
+            static_cast< uint32 >( m.arg_ends.size() ), 1 };
+    m.arg_text += r_message;
+    m.arg_ends.push_back( static_cast< uint32 >( m.arg_text.size() ) );
+    return add( &diagnostic );
+}
+
+bool Diagnostics::add( Diagnostic * p_diagnostic )
+{
+    // The Diagnostic's arguments have already been added
+    if( ! m.is_keeping_duplicates )
+    {
+        uint64 diagnostic_hash = hash( *p_diagnostic );
+        std::pair< diagnostic_index_t::const_iterator, diagnostic_index_t::const_iterator > candidates = m.diagnostic_index.equal_range( diagnostic_hash );
+        for( diagnostic_index_t::const_iterator i_candidate = candidates.first; i_candidate != candidates.second; ++i_candidate )
+            if( is_same( m.diagnostics[i_candidate->second], *p_diagnostic ) )
+            {
+                m.arg_ends.resize( p_diagnostic->first_arg );
+                m.arg_text.resize( m.arg_ends.empty() ? 0 : m.arg_ends.back() );
+                return false;
+            }
+        m.diagnostic_index.insert( diagnostic_index_t::value_type( diagnostic_hash, static_cast< uint32 >( m.diagnostics.size() ) ) );
+    }
+    m.diagnostics.push_back( *p_diagnostic );
+    return true;
+}
+
+uint32 Diagnostics::source_id( const std::string & r_source )
+{
+    if( ! m.sources.empty() && m.sources.back() == r_source )  // Messages tend to come from the same source as the one before
+        return static_cast< uint32 >( m.sources.size() - 1 );
+    std::pair< source_index_t::iterator, bool > insertion = m.source_index.insert( source_index_t::value_type( r_source, static_cast< uint32 >( m.sources.size() ) ) );
+    if( insertion.second )
+        m.sources.push_back( r_source );
+    return insertion.first->second;
+}
+
+uint64 Diagnostics::hash( const Diagnostic & r_diagnostic ) const
+{
+    uint64 diagnostic_hash = fnv_hash( fnv_offset_basis, r_diagnostic.p_code, std::strlen( r_diagnostic.p_code ) );
+    diagnostic_hash = fnv_hash( diagnostic_hash, r_diagnostic.source_id );
+    diagnostic_hash = fnv_hash( diagnostic_hash, r_diagnostic.line );
+    diagnostic_hash = fnv_hash( diagnostic_hash, r_diagnostic.column );
+    diagnostic_hash = fnv_hash( diagnostic_hash, r_diagnostic.severity.to_enum() );
+    size_t args_begin = r_diagnostic.first_arg == 0 ? 0 : m.arg_ends[r_diagnostic.first_arg - 1];
+    size_t args_end = r_diagnostic.n_args == 0 ? args_begin : m.arg_ends[r_diagnostic.first_arg + r_diagnostic.n_args - 1];
+    diagnostic_hash = fnv_hash( diagnostic_hash, m.arg_text.data() + args_begin, args_end - args_begin );
+    return fnv_hash( diagnostic_hash, r_diagnostic.n_args );
+}
+
+bool Diagnostics::is_same( const Diagnostic & r_lhs, const Diagnostic & r_rhs ) const
+{
+    if( r_lhs.source_id != r_rhs.source_id || r_lhs.line != r_rhs.line || r_lhs.column != r_rhs.column ||
+            r_lhs.severity != r_rhs.severity || r_lhs.n_args != r_rhs.n_args ||
+            (r_lhs.p_code != r_rhs.p_code && std::strcmp( r_lhs.p_code, r_rhs.p_code ) != 0) )
+        return false;
+    for( size_t i=0; i<r_lhs.n_args; ++i )
+        if( arg( r_lhs, i ) != arg( r_rhs, i ) )
+            return false;
+    return true;
+}
+
+void Diagnostics::clear()
+{
+    bool is_keeping_duplicates = m.is_keeping_duplicates;
+    m = Members( is_keeping_duplicates );
+}
+
+std::string Diagnostics::arg( const Diagnostic & r_diagnostic, size_t i ) const
+{
+    size_t index = r_diagnostic.first_arg + i;
+    size_t begin = index == 0 ? 0 : m.arg_ends[index - 1];
+    return m.arg_text.substr( begin, m.arg_ends[index] - begin );
+}
+
+void Diagnostics::arg_refs( clutils::str_arg_refs * p_args, const Diagnostic & r_diagnostic ) const
+{
+    size_t begin = r_diagnostic.first_arg == 0 ? 0 : m.arg_ends[r_diagnostic.first_arg - 1];
+    for( size_t i=0; i<r_diagnostic.n_args; ++i )
+    {
+        size_t end = m.arg_ends[r_diagnostic.first_arg + i];
+        *p_args << clutils::str_arg( m.arg_text.data() + begin, end - begin );
+        begin = end;
+    }
+}
+
+std::string Diagnostics::message( const Diagnostic & r_diagnostic ) const
+{
+    std::string text;
+    return *message_append( &text, r_diagnostic );
+}
+
+std::string * Diagnostics::message_append( std::string * p_out, const Diagnostic & r_diagnostic ) const
+{
+    if( r_diagnostic.n_args == 0 )
+        p_out->append( r_diagnostic.p_code );
+    else
+    {
+        clutils::str_arg_refs args;
+        arg_refs( &args, r_diagnostic );
+        args.expand_append( p_out, r_diagnostic.p_code );
+    }
+    return p_out;
+}
+
+//----------------------------------------------------------------------------
+//                           class ParseCache
+//----------------------------------------------------------------------------
+
+namespace { // Anonymous namespace for detail
+
+// The version must be changed whenever the Grammars that the parser
+// produces, or the way they are written to the cache, change, so that
+// entries written by earlier versions are no longer found
+const char parse_cache_version[] = "cl-jcr-parser parse cache 1, jcr-abnf 2018-03-29";
+const char parse_cache_magic[4] = { 'J', 'C', 'R', 'C' };
+
+class CacheWriter
+{
+private:
+    std::string * p_out;
+
+public:
+    CacheWriter( std::string * p_out_in ) : p_out( p_out_in ) {}
+
+    void grammar( const Grammar & r_grammar );
+
+private:
+    template< typename T >
+    void value( T v ) { p_out->append( reinterpret_cast< const char * >( &v ), sizeof( v ) ); }
+    void string( const std::string & r_string )
+    {
+        value( static_cast< uint32 >( r_string.size() ) );
+        p_out->append( r_string );
+    }
+    void rule( const Rule & r_rule );
+    void annotations( const Annotations & r_annotations );
+    void constraint( const ValueConstraint & r_constraint );
+    void target_rule( const TargetRule & r_target_rule );
+};
+
+void CacheWriter::grammar( const Grammar & r_grammar )
+{
+    string( r_grammar.ruleset_id );
+    value( static_cast< uint32 >( r_grammar.unaliased_imports.size() ) );
+    for( size_t i = 0; i < r_grammar.unaliased_imports.size(); ++i )
+        string( r_grammar.unaliased_imports[i] );
+    value( static_cast< uint32 >( r_grammar.aliased_imports.size() ) );
+    for( Grammar::aliased_imports_t::const_iterator i_import = r_grammar.aliased_imports.begin();
+            i_import != r_grammar.aliased_imports.end();
+            ++i_import )
+    {
+        string( i_import->first );
+        string( i_import->second );
+    }
+    value( static_cast< uint32 >( r_grammar.rules.size() ) );
+    for( size_t i = 0; i < r_grammar.rules.size(); ++i )
+        rule( r_grammar.rules[i] );
+}
+
+void CacheWriter::rule( const Rule & r_rule )
+{
+    value( static_cast< int32 >( r_rule.line_number ) );
+    value( static_cast< int32 >( r_rule.column_number ) );
+    value( static_cast< uint8 >( r_rule.type ) );
+    value( static_cast< uint8 >( r_rule.child_combiner ) );
+    value( static_cast< int32 >( r_rule.repetition.min ) );
+    value( static_cast< int32 >( r_rule.repetition.max ) );
+    value( static_cast< int32 >( r_rule.repetition.step ) );
+    annotations( r_rule.annotations );
+    constraint( r_rule.min );
+    constraint( r_rule.max );
+    string( r_rule.rule_name );
+    value( static_cast< uint8 >( r_rule.member_name.is_literal() ? 1 : r_rule.member_name.is_regex() ? 2 : 0 ) );
+    string( r_rule.member_name.name() );
+    target_rule( r_rule.target_rule );
+    value( static_cast< uint32 >( r_rule.children.size() ) );
+    for( size_t i = 0; i < r_rule.children.size(); ++i )
+        rule( r_rule.children[i] );
+}
+
+void CacheWriter::annotations( const Annotations & r_annotations )
+{
+    value( static_cast< uint8 >(
+            (r_annotations.is_not ? 0x01 : 0) |
+            (r_annotations.is_unordered ? 0x02 : 0) |
+            (r_annotations.is_root ? 0x04 : 0) |
+            (r_annotations.is_exclude_min ? 0x08 : 0) |
+            (r_annotations.is_exclude_max ? 0x10 : 0) |
+            (r_annotations.is_defaulted ? 0x20 : 0) |
+            (r_annotations.is_choice ? 0x40 : 0) ) );
+    string( r_annotations.default_value() );
+    string( r_annotations.format() );
+    value( static_cast< uint32 >( r_annotations.augments().size() ) );
+    for( size_t i = 0; i < r_annotations.augments().size(); ++i )
+        target_rule( r_annotations.augments()[i] );
+}
+
+void CacheWriter::constraint( const ValueConstraint & r_constraint )
+{
+    if( r_constraint.is_string() )
+    {
+        value( static_cast< uint8 >( 1 ) );
+        string( r_constraint.as_string() );
+    }
+    else if( r_constraint.is_bool() )
+    {
+        value( static_cast< uint8 >( 2 ) );
+        value( static_cast< uint8 >( r_constraint.as_bool() ? 1 : 0 ) );
+    }
+    else if( r_constraint.is_int() )
+    {
+        value( static_cast< uint8 >( 3 ) );
+        value( r_constraint.as_int() );
+    }
+    else if( r_constraint.is_uint() )
+    {
+        value( static_cast< uint8 >( 4 ) );
+        value( r_constraint.as_uint() );
+    }
+    else if( r_constraint.is_float() )
+    {
+        value( static_cast< uint8 >( 5 ) );
+        value( r_constraint.as_float() );
+    }
+    else
+        value( static_cast< uint8 >( 0 ) );
+}
+
+void CacheWriter::target_rule( const TargetRule & r_target_rule )
 {
-    for( size_t i=0; i<p_rule->children.size(); ++i )
+    string( r_target_rule.ruleset_id );
+    string( r_target_rule.rule_name );
+}
+
+// CacheReader reads what CacheWriter writes.  Each method returns false if
+// the entry is truncated or malformed.
+class CacheReader
+{
+private:
+    const char * p_next;
+    const char * p_end;
+    GrammarSet * p_grammar_set;
+    Grammar * p_grammar;
+
+public:
+    CacheReader( const char * p_begin, const char * p_end_in, GrammarSet * p_grammar_set_in, Grammar * p_grammar_in )
+        : p_next( p_begin ), p_end( p_end_in ), p_grammar_set( p_grammar_set_in ), p_grammar( p_grammar_in )
+    {}
+
+    bool grammar();
+    bool is_at_end() const { return p_next == p_end; }
+
+private:
+    template< typename T >
+    bool value( T * p_value )
     {
-        link_child_rule( &p_rule->children[i] );
-        link_child_rules( &p_rule->children[i] );
+        if( static_cast< size_t >( p_end - p_next ) < sizeof( T ) )
+            return false;
+        std::memcpy( p_value, p_next, sizeof( T ) );
+        p_next += sizeof( T );
+        return true;
+    }
+    bool count( uint32 * p_count )     // A count of items that take at least a byte each
+    {
+        return value( p_count ) && *p_count <= static_cast< size_t >( p_end - p_next );
+    }
+    bool string( std::string * p_string )
+    {
+        uint32 size;
+        if( ! count( &size ) )
+            return false;
+        p_string->assign( p_next, size );
+        p_next += size;
+        return true;
+    }
+    bool symbol( Symbol * p_symbol )
+    {
+        std::string name;
+        if( ! string( &name ) )
+            return false;
+        *p_symbol = p_grammar->intern( name );
+        return true;
+    }
+    bool rule( Rule::uniq_ptr * p_rule );
+    bool annotations( Annotations * p_annotations );
+    bool constraint( ValueConstraint * p_constraint );
+    bool target_rule( TargetRule * p_target_rule );
+};
+
+bool CacheReader::grammar()
+{
+    uint32 n_imports;
+    if( ! symbol( &p_grammar->ruleset_id ) || ! count( &n_imports ) )
+        return false;
+    for( uint32 i = 0; i < n_imports; ++i )
+    {
+        std::string import;
+        if( ! string( &import ) )
+            return false;
+        p_grammar->add_unaliased_import( import );
+    }
+    if( ! count( &n_imports ) )
+        return false;
+    for( uint32 i = 0; i < n_imports; ++i )
+    {
+        std::string alias, import;
+        if( ! string( &alias ) || ! string( &import ) )
+            return false;
+        p_grammar->add_aliased_import( alias, import );
     }
+    uint32 n_rules;
+    if( ! count( &n_rules ) )
+        return false;
+    for( uint32 i = 0; i < n_rules; ++i )
+    {
+        Rule::uniq_ptr pu_rule;
+        if( ! rule( &pu_rule ) )
+            return false;
+        p_grammar->append_rule( pu_rule );
+    }
+    return true;
 }
 
-void Linker::link_child_rule( Rule * p_rule )
+bool CacheReader::rule( Rule::uniq_ptr * p_rule )
 {
-    if( ! p_rule->target_rule.rule_name.empty() )
+    int32 line_number, column_number;
+    if( ! value( &line_number ) || ! value( &column_number ) )
+        return false;
+    p_rule->reset( new( p_grammar->arena ) Rule( p_grammar, line_number, column_number ) );
+    Rule * p_new_rule = p_rule->get();
+
+    uint8 type, child_combiner, member_name_form;
+    int32 repetition_min, repetition_max, repetition_step;
+    std::string member_name;
+    uint32 n_children;
+    if( ! value( &type ) || type > Rule::TARGET_RULE ||
+            ! value( &child_combiner ) || child_combiner > Rule::Choice ||
+            ! value( &repetition_min ) || ! value( &repetition_max ) || ! value( &repetition_step ) ||
+            ! annotations( &p_new_rule->annotations ) ||
+            ! constraint( &p_new_rule->min ) ||
+            ! constraint( &p_new_rule->max ) ||
+            ! symbol( &p_new_rule->rule_name ) ||
+            ! value( &member_name_form ) ||
+            ! string( &member_name ) ||
+            ! target_rule( &p_new_rule->target_rule ) ||
+            ! count( &n_children ) )
+        return false;
+    p_new_rule->type = static_cast< Rule::Type >( type );
+    p_new_rule->child_combiner = static_cast< Rule::ChildCombiner >( child_combiner );
+    p_new_rule->repetition.min = repetition_min;
+    p_new_rule->repetition.max = repetition_max;
+    p_new_rule->repetition.step = repetition_step;
+    if( member_name_form == 1 )
+        p_new_rule->member_name.set_literal( p_grammar->intern( member_name ) );
+    else if( member_name_form == 2 )
+        p_new_rule->member_name.set_regex( p_grammar->intern( member_name ) );
+
+    for( uint32 i = 0; i < n_children; ++i )
     {
-        Rule * p_target_rule = p_rule->find_target_rule();
-        if( ! p_target_rule )
+        Rule::uniq_ptr pu_child;
+        if( ! rule( &pu_child ) )
+            return false;
+        p_new_rule->append_child_rule( pu_child );
+    }
+    return true;
+}
+
+bool CacheReader::annotations( Annotations * p_annotations )
+{
+    uint8 flags;
+    std::string default_value, format;
+    uint32 n_augments;
+    if( ! value( &flags ) || ! string( &default_value ) || ! string( &format ) || ! count( &n_augments ) )
+        return false;
+    p_annotations->is_not = (flags & 0x01) != 0;
+    p_annotations->is_unordered = (flags & 0x02) != 0;
+    p_annotations->is_root = (flags & 0x04) != 0;
+    p_annotations->is_exclude_min = (flags & 0x08) != 0;
+    p_annotations->is_exclude_max = (flags & 0x10) != 0;
+    p_annotations->is_defaulted = (flags & 0x20) != 0;
+    p_annotations->is_choice = (flags & 0x40) != 0;
+    if( ! default_value.empty() )
+        p_annotations->set_default_value( default_value );
+    if( ! format.empty() )
+        p_annotations->set_format( format );
+    for( uint32 i = 0; i < n_augments; ++i )
+    {
+        TargetRule augment;
+        if( ! target_rule( &augment ) )
+            return false;
+        p_annotations->add_augments( augment );
+    }
+    return true;
+}
+
+bool CacheReader::constraint( ValueConstraint * p_constraint )
+{
+    uint8 form;
+    if( ! value( &form ) )
+        return false;
+    switch( form )
+    {
+        case 0:
+            return true;
+        case 1:
         {
-            error( p_rule, "Unable to find Target rule '%0'", p_rule->target_rule );
+            std::string constraint;
+            if( ! string( &constraint ) )
+                return false;
+            *p_constraint = constraint;
+            return true;
         }
-        else
+        case 2:
         {
-            p_rule->p_type = p_target_rule->p_type;
-            if( p_target_rule->is_member_rule() )
-            {
-                if( p_rule->is_member_rule() )
-                    error( p_rule, "Member rule links to another Member rule: '$%0'",
-                            p_target_rule->p_rule->rule_name );
-                else
-            p_rule->p_rule = p_target_rule->p_rule;
-            }
+            uint8 constraint;
+            if( ! value( &constraint ) )
+                return false;
+            *p_constraint = constraint != 0;
+            return true;
+        }
+        case 3:
+        {
+            int64 constraint;
+            if( ! value( &constraint ) )
+                return false;
+            *p_constraint = constraint;
+            return true;
+        }
+        case 4:
+        {
+            uint64 constraint;
+            if( ! value( &constraint ) )
+                return false;
+            *p_constraint = constraint;
+            return true;
+        }
+        case 5:
+        {
+            double constraint;
+            if( ! value( &constraint ) )
+                return false;
+            *p_constraint = constraint;
+            return true;
         }
     }
+    return false;
 }
 
-} // End of Anonymous namespace
+bool CacheReader::target_rule( TargetRule * p_target_rule )
+{
+    return symbol( &p_target_rule->ruleset_id ) && symbol( &p_target_rule->rule_name );
+}
 
-//----------------------------------------------------------------------------
-//                           class JCRParser
-//----------------------------------------------------------------------------
+uint64 source_check( const char * p_rules, size_t size )
+{
+    // A second hash of the source, recorded in the entry, so that a clash
+    // of file names isn't mistaken for a hit
+    return fnv_hash( fnv_hash( fnv_offset_basis, &size, sizeof( size ) ), p_rules, size );
+}
 
-JCRParser::Status JCRParser::add_grammar( const char * p_file_name )
+// Processes sharing a cache directory have different process ids, and the
+// count distinguishes the entries stored by the threads of one process
+#if __cplusplus >= 201103L
+std::atomic< unsigned long > n_temporary_files( 0 );
+#else
+unsigned long n_temporary_files = 0;
+#endif
+
+std::string temporary_file_name( const std::string & r_entry_name )
+{
+#if defined( _WIN32 )
+    long process_id = _getpid();
+#else
+    long process_id = getpid();
+#endif
+    return clutils::expand( "%0.%1.%2.tmp", clutils::str_args( r_entry_name ) << process_id << n_temporary_files++ );
+}
+
+} // End of Anonymous namespace
+
+ParseCache::ParseCache( const std::string & r_directory )
+    : m( r_directory )
 {
-    cl::reader_file reader( p_file_name );
-    if( ! reader.is_open() )
+    if( ! m.directory.empty() )
     {
-        m.p_grammar_set->inc_error_count();
-        return S_UNABLE_TO_OPEN_FILE;
+#if defined( _WIN32 )
+        _mkdir( m.directory.c_str() );
+#else
+        mkdir( m.directory.c_str(), 0777 );
+#endif
+        if( *m.directory.rbegin() != '/' && *m.directory.rbegin() != '\\' )
+            m.directory += '/';
     }
-
-    return parse_grammar( reader, p_file_name );
 }
 
-JCRParser::Status JCRParser::add_grammar( const std::string & rules )
+std::string ParseCache::file_name( const char * p_rules, size_t size ) const
 {
-    cl::reader_string reader( rules );
-
-    return parse_grammar( reader, clutils::expand( "std::string @ ", (void *)&rules ) );
+    uint64 hash = fnv_hash( fnv_hash( fnv_offset_basis, parse_cache_version, sizeof( parse_cache_version ) ), p_rules, size );
+    char hex[17];
+    for( int i = 15; i >= 0; --i, hash >>= 4 )
+        hex[i] = "0123456789abcdef"[hash & 0xf];
+    hex[16] = '\0';
+    return m.directory + hex + ".jcrc";
 }
 
-JCRParser::Status JCRParser::add_grammar( const char * p_rules, size_t size )
+bool ParseCache::load( const char * p_rules, size_t size, GrammarSet * p_grammar_set, const std::string & jcr_source )
 {
-    cl::reader_mem_buf reader( p_rules, size );
+    cl::mapped_file entry( file_name( p_rules, size ).c_str() );
+    const char * p_entry = entry.data();
+    const char * p_entry_end = entry.data() + entry.size();
+    const size_t header_size = sizeof( parse_cache_magic ) + sizeof( parse_cache_version ) + 2 * sizeof( uint64 );
+    if( entry.size() < header_size ||
+            std::memcmp( p_entry, parse_cache_magic, sizeof( parse_cache_magic ) ) != 0 ||
+            std::memcmp( p_entry + sizeof( parse_cache_magic ), parse_cache_version, sizeof( parse_cache_version ) ) != 0 )
+    {
+        ++m.n_misses;   // A damaged entry is also a miss, and will be replaced
+        return false;
+    }
 
-    return parse_grammar( reader, clutils::expand( "const char * ", (void *)p_rules ) );
-}
+    uint64 checks[2];   // Of the source and of the rest of the entry
+    std::memcpy( checks, p_entry + header_size - sizeof( checks ), sizeof( checks ) );
+    if( checks[0] != source_check( p_rules, size ) ||
+            checks[1] != fnv_hash( fnv_offset_basis, p_entry + header_size, entry.size() - header_size ) )
+    {
+        ++m.n_misses;
+        return false;
+    }
 
-JCRParser::Status JCRParser::link()
-{
-    Linker linker( this, m.p_grammar_set );
+    Grammar::uniq_ptr pu_grammar( new Grammar( p_grammar_set, jcr_source ) );
+    CacheReader reader( p_entry + header_size, p_entry_end, p_grammar_set, pu_grammar.get() );
+    if( ! reader.grammar() || ! reader.is_at_end() )
+    {
+        ++m.n_misses;
+        return false;
+    }
 
-    return linker.link() ? S_OK : S_ERROR;
+    p_grammar_set->append( Grammar::uniq_ptr( pu_grammar.release() ) );
+    ++m.n_hits;
+    return true;
 }
 
-JCRParser::Status JCRParser::link( Grammar * p_grammar )
+void ParseCache::store( const char * p_rules, size_t size, const Grammar & r_grammar )
 {
-    Linker linker( this, m.p_grammar_set );
+    std::string body;
+    CacheWriter( &body ).grammar( r_grammar );
+    uint64 checks[2] = { source_check( p_rules, size ), fnv_hash( fnv_offset_basis, body.data(), body.size() ) };
+    std::string entry( parse_cache_magic, sizeof( parse_cache_magic ) );
+    entry.append( parse_cache_version, sizeof( parse_cache_version ) );
+    entry.append( reinterpret_cast< const char * >( checks ), sizeof( checks ) );
+    entry.append( body );
 
-    return linker.link( p_grammar ) ? S_OK : S_ERROR;
+    // The entry is written under a name of its own and then renamed, so
+    // that an entry is never seen partly written, even if the same source
+    // is being stored by another thread or process.  Failing to store an
+    // entry only means that the source will be parsed again next time.
+    std::string entry_name( file_name( p_rules, size ) );
+    std::string temporary_name( temporary_file_name( entry_name ) );
+    {
+        std::ofstream fout( temporary_name.c_str(), std::ios::binary );
+        fout.write( entry.data(), entry.size() );
+        fout.close();
+        if( fout.fail() )
+        {
+            std::remove( temporary_name.c_str() );
+            return;
+        }
+    }
+    if( std::rename( temporary_name.c_str(), entry_name.c_str() ) != 0 )
+    {
+#if defined( _WIN32 )
+        // rename() doesn't replace an existing file on Windows.  Elsewhere
+        // it does, so failing means the entry can't be stored, and removing
+        // the entry could remove one that another process has just stored.
+        std::remove( entry_name.c_str() );
+        if( std::rename( temporary_name.c_str(), entry_name.c_str() ) != 0 )
+#endif
+            std::remove( temporary_name.c_str() );
+    }
 }
 
-JCRParser::Status JCRParser::parse_grammar( cl::reader & reader, const std::string & jcr_source )
+//----------------------------------------------------------------------------
+//                           class Symbol
+//----------------------------------------------------------------------------
+
+const Symbol::Entry Symbol::empty_entry( std::string(), 0 );
+
+//----------------------------------------------------------------------------
+//                           class SymbolTable
+//----------------------------------------------------------------------------
+
+Symbol SymbolTable::intern( const std::string & r_name )
 {
-    GrammarParser parser( this, reader, m.p_grammar_set, m.p_grammar_set->append_grammar( jcr_source ) );
+    if( r_name.empty() )
+        return Symbol();
 
-    parser.parse();
+    std::pair< index_t::iterator, bool > insertion =
+            m.index.insert( index_t::value_type( r_name, static_cast< uint32 >( m.entries.size() ) ) );
+    if( insertion.second )
+        m.entries.push_back( &*insertion.first );
+    return Symbol( &*insertion.first );
+}
 
-    return parser.status();
+Symbol SymbolTable::find( const std::string & r_name ) const
+{
+    index_t::const_iterator i_entry = m.index.find( r_name );
+    if( i_entry == m.index.end() )
+        return Symbol();
+    return Symbol( &*i_entry );
 }
 
 //----------------------------------------------------------------------------
-//                           class JCRParserWithReporter
+//                           class MonotonicArena
 //----------------------------------------------------------------------------
 
-void JCRParserWithReporter::report( const std::string & source, size_t line, size_t column, Severity severity, const char * p_message )
+MonotonicArena::~MonotonicArena()
 {
-    std::ostringstream oss;
-    oss << severity << ": " << source;
-    if( line != ~0U )
+    while( m.p_blocks )
     {
-        oss << " (line: " << line;
-        if( column != ~0U )
-            oss << ", char: " << column;
-        oss << ")";
+        Block * p_next = m.p_blocks->p_next;
+        std::free( m.p_blocks );
+        m.p_blocks = p_next;
     }
-    oss << ":\n      " << p_message << "\n";
-    std::string constructed_message = oss.str();
+}
+
+void * MonotonicArena::allocate_from_new_block( size_t size )
+{
+    // Block sizes double, up to a limit, so that the number of blocks stays
+    // small however large the grammar set.  Oversized requests get a block
+    // of their own, which is put behind the current block so that the space
+    // remaining in the current block continues to be used.
+    bool is_oversized = size > m.next_block_size;
+    size_t block_size = is_oversized ? size : m.next_block_size;
 
-    if( reported_messages.find( constructed_message ) == reported_messages.end() )
+    Block * p_block = static_cast< Block * >( std::malloc( block_header_size + block_size ) );
+    if( ! p_block )
+        throw std::bad_alloc();
+    p_block->p_next = 0;
+    p_block->size = block_size;
+    ++m.n_blocks;
+
+    char * p_memory = reinterpret_cast< char * >( p_block ) + block_header_size;
+    m.bytes_allocated += size;
+    if( is_oversized )
     {
-        std::cout << constructed_message;
+        add_behind_current_block( p_block, p_block );
+        return p_memory;
+    }
 
-        if( severity == Severity::WARNING )
-            grammar_set()->inc_warning_count();
-        else
-            grammar_set()->inc_error_count();
+    if( m.next_block_size < 1024 * 1024 )
+        m.next_block_size *= 2;
+    p_block->p_next = m.p_blocks;
+    m.p_blocks = p_block;
+    m.p_next = p_memory + size;
+    m.p_end = p_memory + block_size;
+    return p_memory;
+}
+
+void MonotonicArena::add_behind_current_block( Block * p_first, Block * p_last )
+{
+    // Without a current block, the blocks are only kept for releasing, and
+    // the next allocation starts a new current block
+    if( m.p_blocks )
+    {
+        p_last->p_next = m.p_blocks->p_next;
+        m.p_blocks->p_next = p_first;
+    }
+    else
+        m.p_blocks = p_first;
+}
+
+void MonotonicArena::splice( MonotonicArena & r_other )
+{
+    if( ! r_other.m.p_blocks )
+        return;
 
-        reported_messages.insert( constructed_message );
+    // Other's blocks are added behind the current block so that the space
+    // remaining in the current block continues to be used.  Without a
+    // current block, other's current block becomes this one's.
+    Block * p_other_last = r_other.m.p_blocks;
+    while( p_other_last->p_next )
+        p_other_last = p_other_last->p_next;
+    if( ! m.p_blocks )
+    {
+        m.p_next = r_other.m.p_next;
+        m.p_end = r_other.m.p_end;
     }
+    add_behind_current_block( r_other.m.p_blocks, p_other_last );
+    m.n_blocks += r_other.m.n_blocks;
+    m.bytes_allocated += r_other.m.bytes_allocated;
+
+    r_other.m = Members( r_other.m.first_block_size );
+}
+
+//----------------------------------------------------------------------------
+//                           class Annotations
+//----------------------------------------------------------------------------
+
+const Annotations::Detail Annotations::empty_detail;
+
+Annotations::Annotations( const Annotations & r_rhs )
+    :
+    p_detail( r_rhs.p_detail ? new Detail( *r_rhs.p_detail ) : 0 ),
+    is_not( r_rhs.is_not ),
+    is_unordered( r_rhs.is_unordered ),
+    is_root( r_rhs.is_root ),
+    is_exclude_min( r_rhs.is_exclude_min ),
+    is_exclude_max( r_rhs.is_exclude_max ),
+    is_defaulted( r_rhs.is_defaulted ),
+    is_choice( r_rhs.is_choice )
+{}
+
+Annotations & Annotations::operator = ( const Annotations & r_rhs )
+{
+    Annotations copy( r_rhs );
+    swap( copy );
+    return *this;
+}
+
+void Annotations::swap( Annotations & r_rhs )
+{
+    std::swap( p_detail, r_rhs.p_detail );
+    std::swap( is_not, r_rhs.is_not );
+    std::swap( is_unordered, r_rhs.is_unordered );
+    std::swap( is_root, r_rhs.is_root );
+    std::swap( is_exclude_min, r_rhs.is_exclude_min );
+    std::swap( is_exclude_max, r_rhs.is_exclude_max );
+    std::swap( is_defaulted, r_rhs.is_defaulted );
+    std::swap( is_choice, r_rhs.is_choice );
 }
 
 //----------------------------------------------------------------------------
@@ -4082,19 +6046,19 @@ void JCRParserWithReporter::report( const std::string & source, size_t line, siz
 
 std::string MemberName::pattern() const
 {
-    size_t first = m.name.find_first_of( '/' );
-    size_t last = m.name.find_last_of( '/' );
+    size_t first = name().find_first_of( '/' );
+    size_t last = name().find_last_of( '/' );
     if( first == std::string::npos || last == std::string::npos )
-        return m.name;
-    return m.name.substr( first + 1, last - 1 );
+        return name();
+    return name().substr( first + 1, last - 1 );
 }
 
 std::string MemberName::modifiers() const
 {
-    size_t last = m.name.find_last_of( '/' );
+    size_t last = name().find_last_of( '/' );
     if( last == std::string::npos )
         return "";
-    return m.name.substr( last + 1 );
+    return name().substr( last + 1 );
 }
 
 std::ostream & operator << ( std::ostream & r_os, const MemberName & r_mn )
@@ -4114,21 +6078,21 @@ std::ostream & operator << ( std::ostream & r_os, const MemberName & r_mn )
 
 std::string ValueConstraint::as_pattern() const
 {
-    assert( m.form == Members::string_form );
-    size_t first = m.string_value.find_first_of( '/' );
-    size_t last = m.string_value.find_last_of( '/' );
+    const std::string & r_string_value( as_string() );
+    size_t first = r_string_value.find_first_of( '/' );
+    size_t last = r_string_value.find_last_of( '/' );
     if( first == std::string::npos || last == std::string::npos )
-        return m.string_value;
-    return m.string_value.substr( first + 1, last - 1 );
+        return r_string_value;
+    return r_string_value.substr( first + 1, last - 1 );
 }
 
 std::string ValueConstraint::as_modifiers() const
 {
-    assert( m.form == Members::string_form );
-    size_t last = m.string_value.find_last_of( '/' );
+    const std::string & r_string_value( as_string() );
+    size_t last = r_string_value.find_last_of( '/' );
     if( last == std::string::npos )
         return "";
-    return m.string_value.substr( last + 1 );
+    return r_string_value.substr( last + 1 );
 }
 
 //----------------------------------------------------------------------------
@@ -4191,4 +6155,160 @@ const Rule * Rule::find_target_rule() const
     return 0;
 }
 
+//----------------------------------------------------------------------------
+//                           class Grammar
+//----------------------------------------------------------------------------
+
+void Grammar::index_new_rules() const
+{
+    for( ; n_indexed_rules < rules.size(); ++n_indexed_rules )
+    {
+        const Rule & r_rule = rules[n_indexed_rules];
+        if( ! r_rule.rule_name.empty() )    // Unnamed rules can't be found.  Of any duplicates, only the first is found
+            rule_index.insert( rule_index_t::value_type( r_rule.rule_name.id(), &r_rule ) );
+    }
+}
+
+const Rule * Grammar::find_rule( const std::string & r_sought_rule_name ) const
+{
+    const SymbolTable & r_symbols( p_grammar_set->symbols() );
+    if( ! r_symbols.is_interned( r_sought_rule_name ) )
+        return 0;   // No rule can have a name that hasn't been interned
+    return find_rule( r_symbols.find( r_sought_rule_name ) );
+}
+
+//----------------------------------------------------------------------------
+//                           class GrammarSet
+//----------------------------------------------------------------------------
+
+namespace { // Anonymous namespace for detail
+
+class SymbolRemapper
+{
+    // Maps the Symbols of one SymbolTable to the same names in another
+private:
+    std::vector< Symbol > to_symbols;    // Indexed by the from Symbol's id
+
+public:
+    SymbolRemapper( const SymbolTable & r_from, SymbolTable & r_to )
+    {
+        to_symbols.reserve( r_from.size() );
+        to_symbols.push_back( Symbol() );
+        for( size_t i=1; i<r_from.size(); ++i )
+            to_symbols.push_back( r_to.intern( r_from[static_cast< uint32 >( i )].str() ) );
+    }
+
+    void remap( Symbol * p_symbol ) const { *p_symbol = to_symbols[p_symbol->id()]; }
+    void remap( TargetRule * p_target_rule ) const
+    {
+        remap( &p_target_rule->ruleset_id );
+        remap( &p_target_rule->rule_name );
+    }
+    void remap( MemberName * p_member_name ) const
+    {
+        Symbol name = p_member_name->name_symbol();
+        remap( &name );
+        if( p_member_name->is_literal() )
+            p_member_name->set_literal( name );
+        else if( p_member_name->is_regex() )
+            p_member_name->set_regex( name );
+    }
+    void remap( Rule * p_rule ) const
+    {
+        remap( &p_rule->rule_name );
+        remap( &p_rule->member_name );
+        remap( &p_rule->target_rule );
+        if( ! p_rule->annotations.augments().empty() )
+        {
+            std::vector< TargetRule > augments( p_rule->annotations.augments() );
+            for( size_t i=0; i<augments.size(); ++i )
+                remap( &augments[i] );
+            p_rule->annotations.set_augments( augments );
+        }
+        for( size_t i=0; i<p_rule->children.size(); ++i )
+            remap( &p_rule->children[i] );
+    }
+};
+
+} // End of Anonymous namespace
+
+void GrammarSet::splice( GrammarSet & r_other )
+{
+    SymbolRemapper remapper( r_other.m.symbols, m.symbols );
+
+    for( size_t i=0; i<r_other.m.grammars.size(); ++i )
+    {
+        Grammar & r_grammar = r_other.m.grammars[i];
+        r_grammar.p_grammar_set = this;
+        remapper.remap( &r_grammar.ruleset_id );
+        for( size_t j=0; j<r_grammar.rules.size(); ++j )
+            remapper.remap( &r_grammar.rules[j] );
+        r_grammar.reindex_rules();  // The index is keyed on the old Symbol ids
+    }
+
+    m.arena.splice( r_other.m.arena );
+    m.grammars.splice( r_other.m.grammars );
+    m.error_count += r_other.m.error_count;
+    m.warning_count += r_other.m.warning_count;
+    r_other.reset_indexes();
+    r_other.m.error_count = r_other.m.warning_count = 0;
+}
+
+size_t GrammarSet::position( const Grammar * p_grammar ) const
+{
+    for( size_t i=0; i<m.grammars.size(); ++i )
+        if( &m.grammars[i] == p_grammar )
+            return i;
+    return m.grammars.size();
+}
+
+Grammar * GrammarSet::replace( Grammar * p_grammar, Grammar::uniq_ptr pu_replacement )
+{
+    size_t i = position( p_grammar );
+    if( i == m.grammars.size() )
+    {
+        assert( 0 );    // p_grammar is not in the GrammarSet
+        return 0;
+    }
+
+    Grammar::uniq_ptr pu_replaced( m.grammars.replace( i, pu_replacement.get() ) );
+    reset_indexes();    // Rebuilt when next used, which is quicker than patching them
+    return pu_replacement.release();
+}
+
+const GrammarSet::importers_t & GrammarSet::find_importers( const std::string & r_imported_ruleset_id ) const
+{
+    static const importers_t no_importers;
+
+    if( m.n_indexed_grammars != m.grammars.size() )
+        index_new_grammars();
+    importer_index_t::const_iterator i_importers = m.importer_index.find( r_imported_ruleset_id );
+    return i_importers != m.importer_index.end() ? i_importers->second : no_importers;
+}
+
+void GrammarSet::index_new_grammars() const
+{
+    for( ; m.n_indexed_grammars < m.grammars.size(); ++m.n_indexed_grammars )
+    {
+        const Grammar & r_grammar = m.grammars[m.n_indexed_grammars];
+        if( ! r_grammar.ruleset_id.empty() )    // Can't find an unnamed grammar.  Of any duplicates, only the first is found
+            m.grammar_index.insert( grammar_index_t::value_type( r_grammar.ruleset_id.id(), &r_grammar ) );
+
+        for( size_t i=0; i<r_grammar.unaliased_imports.size(); ++i )
+        {
+            importers_t & r_importers = m.importer_index[r_grammar.unaliased_imports[i]];
+            if( r_importers.empty() || r_importers.back() != &r_grammar )   // A Grammar may import a ruleset id more than once
+                r_importers.push_back( &r_grammar );
+        }
+        for( Grammar::aliased_imports_t::const_iterator i_import = r_grammar.aliased_imports.begin();
+                i_import != r_grammar.aliased_imports.end();
+                ++i_import )
+        {
+            importers_t & r_importers = m.importer_index[i_import->second];
+            if( r_importers.empty() || r_importers.back() != &r_grammar )
+                r_importers.push_back( &r_grammar );
+        }
+    }
+}
+
 }   // namespace cljcr
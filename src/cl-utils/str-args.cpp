@@ -41,16 +41,86 @@ namespace clutils {
 
 namespace { // Implementation detail
 
+const char digit_pairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+void append_unsigned( std::string * p_out, unsigned long long value )
+{
+    // Writes the digits backwards, two at a time, so there is only one
+    // division per pair of digits
+    char buffer[20];    // Enough for the 20 digits of 2^64-1
+    char * p_end = buffer + sizeof( buffer );
+    char * p_digits = p_end;
+    while( value >= 100 )
+    {
+        size_t pair_index = static_cast< size_t >( value % 100 ) * 2;
+        value /= 100;
+        *--p_digits = digit_pairs[pair_index + 1];
+        *--p_digits = digit_pairs[pair_index];
+    }
+    if( value >= 10 )
+    {
+        size_t pair_index = static_cast< size_t >( value ) * 2;
+        *--p_digits = digit_pairs[pair_index + 1];
+        *--p_digits = digit_pairs[pair_index];
+    }
+    else
+        *--p_digits = static_cast< char >( '0' + value );
+    p_out->append( p_digits, p_end - p_digits );
+}
+
+void append_signed( std::string * p_out, long long value )
+{
+    if( value >= 0 )
+        append_unsigned( p_out, static_cast< unsigned long long >( value ) );
+    else
+    {
+        p_out->append( 1, '-' );
+        append_unsigned( p_out, 0ULL - static_cast< unsigned long long >( value ) );  // Also correct for the most negative value
+    }
+}
+
+// Give str_args and str_arg_refs a common interface for str_args_detail
+void append_arg( std::string * p_out, const str_args & r_args, size_t i )
+{
+    p_out->append( r_args[i] );
+}
+
+void append_arg( std::string * p_out, const str_arg_refs & r_args, size_t i )
+{
+    r_args[i].append_to( p_out );
+}
+
+bool is_arg_equal( const str_args & r_args, size_t i, const std::string & r_text )
+{
+    return r_args[i] == r_text;
+}
+
+bool is_arg_equal( const str_arg_refs & r_args, size_t i, const std::string & r_text )
+{
+    return r_args[i].is_equal( r_text );
+}
+
+template< typename Targs >
 class str_args_detail
 {
 private:
     size_t i;
     std::string * p_result;
     const char * format;
-    const str_args::args_t & args;
+    const Targs & args;
 
 public:
-    str_args_detail( std::string * p_out, const char * format, const str_args::args_t & args )
+    str_args_detail( std::string * p_out, const char * format, const Targs & args )
         :
         p_result( p_out ),
         format( format ),
@@ -62,7 +132,7 @@ public:
             for( i=0; format[i] != '\0'; safe_advance() )
             {
                 if( format[i] != '%' )
-                    p_result->append( 1, format[i] );
+                    append_literal_text();
                 else
                     process_parameter_decl();
             }
@@ -82,6 +152,23 @@ public:
             ++i;
     }
 
+    void append_literal_text()
+    {
+        // Append up to the next parameter in one go, leaving i at the last
+        // character appended
+        size_t start = i;
+        while( format[i + 1] != '\0' && format[i + 1] != '%' )
+            ++i;
+        p_result->append( format + start, i + 1 - start );
+    }
+
+    void append_parameter( size_t index )
+    {
+        if( index >= args.size() )
+            throw std::out_of_range( "str_args index" );
+        append_arg( p_result, args, index );
+    }
+
     void process_parameter_decl()
     {
         safe_advance();
@@ -90,7 +177,7 @@ public:
         else if( format[i] == '%' )  // %% -> %
             p_result->append( 1, '%' );
         else if( is_numerical_parameter() )
-            p_result->append( args.at( format[i] - '0' ) );
+            append_parameter( format[i] - '0' );
         else if( format[i] == '{' )
             process_long_form_parameter_decl();
         else
@@ -118,7 +205,7 @@ public:
     {
         // Long form %{0:a description}
         size_t index = read_numerical_parameter_index();
-        p_result->append( args.at( index ) );
+        append_parameter( index );
         skip_remainder_of_parameter_decl();
     }
 
@@ -138,11 +225,14 @@ public:
 
     void process_named_long_form_parameter_decl()
     {
-        // Named long form %{var-name}
+        // Named long form %{var-name}, where the value follows the name in the args
         std::string name = read_parameter_name();
-        str_args::args_t::const_iterator key_index = std::find( args.begin(), args.end(), name );
-        if( key_index != args.end() )
-            p_result->append( *(++key_index) );
+        for( size_t key_index = 0; key_index + 1 < args.size(); ++key_index )
+            if( is_arg_equal( args, key_index, name ) )
+            {
+                append_arg( p_result, args, key_index + 1 );
+                break;
+            }
         skip_remainder_of_parameter_decl();
     }
 
@@ -167,7 +257,44 @@ public:
 
 std::string * str_args::expand_append( std::string * p_out, const char * format ) const
 {
-    return str_args_detail( p_out, format, args ).result();
+    return str_args_detail< str_args >( p_out, format, *this ).result();
+}
+
+void str_arg::append_to( std::string * p_out ) const
+{
+    switch( kind )
+    {
+    case TEXT:
+        p_out->append( u.text.p_chars, u.text.size );
+    break;
+    case CHAR:
+        if( u.c != '\0' )  // As str_args, which holds chars as C strings
+            p_out->append( 1, u.c );
+    break;
+    case SIGNED:
+        append_signed( p_out, u.signed_value );
+    break;
+    case UNSIGNED:
+        append_unsigned( p_out, u.unsigned_value );
+    break;
+    case OTHER:
+        u.other.p_appender( p_out, u.other.p_v );
+    break;
+    }
+}
+
+bool str_arg::is_equal( const std::string & r_rhs ) const
+{
+    if( kind == TEXT )
+        return r_rhs.size() == u.text.size && r_rhs.compare( 0, u.text.size, u.text.p_chars, u.text.size ) == 0;
+    std::string text;
+    append_to( &text );
+    return text == r_rhs;
+}
+
+std::string * str_arg_refs::expand_append( std::string * p_out, const char * format ) const
+{
+    return str_args_detail< str_arg_refs >( p_out, format, *this ).result();
 }
 
 }   // namespace clutils
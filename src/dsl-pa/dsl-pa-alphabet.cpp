@@ -40,6 +40,18 @@
 
 #include "dsl-pa/dsl-pa-reader.h"
 
+#if defined( __AVX2__ )
+    #include <immintrin.h>
+    #define CL_DSL_PA_SIMD_WIDTH 32
+#elif defined( __SSE2__ ) || defined( _M_X64 ) || (defined( _M_IX86_FP ) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define CL_DSL_PA_SIMD_WIDTH 16
+#endif
+
+#if defined( _MSC_VER ) && defined( CL_DSL_PA_SIMD_WIDTH )
+    #include <intrin.h>
+#endif
+
 namespace cl {
 
 using namespace cl::alphabet_helpers;
@@ -95,9 +107,133 @@ void char_map::merge( const char_map & r_rhs )
         index[i] |= r_rhs.index[i];
 }
 
-bool char_map::is_set( char c ) const
+void char_ranges::set( const char_map & r_map )
+{
+    n_ranges = 0;
+    is_vectorisable = true;
+
+    for( size_t i = 0; i < 256; )
+    {
+        if( ! r_map.is_set( static_cast< char >( i ) ) )
+        {
+            ++i;
+            continue;
+        }
+
+        size_t start = i;
+        while( i < 256 && r_map.is_set( static_cast< char >( i ) ) )
+            ++i;
+
+        if( n_ranges == max_ranges )
+        {
+            is_vectorisable = false;
+            return;
+        }
+        range_starts[n_ranges] = static_cast< unsigned char >( start );
+        range_lengths[n_ranges] = static_cast< unsigned char >( i - start - 1 );
+        ++n_ranges;
+    }
+}
+
+#if defined( CL_DSL_PA_SIMD_WIDTH )
+
+namespace {
+
+inline size_t count_trailing_zeros( unsigned int bits )   // bits must be non-zero
+{
+#if defined( _MSC_VER )
+    unsigned long index;
+    _BitScanForward( &index, bits );
+    return index;
+#else
+    return __builtin_ctz( bits );
+#endif
+}
+
+// Returns a bit mask with a bit set for each of the CL_DSL_PA_SIMD_WIDTH
+// chars at p that is in one of the ranges.  A char c is in the range
+// [start, start + length] if the unsigned value (c - start) <= length,
+// which is tested as min( c - start, length ) == c - start.
+#if CL_DSL_PA_SIMD_WIDTH == 32
+inline unsigned int in_ranges_mask( const char * p,
+                                    const unsigned char * p_starts,
+                                    const unsigned char * p_lengths,
+                                    size_t n_ranges )
 {
-    return index[ char_to_size_t( c ) ] != 0;
+    __m256i chars = _mm256_loadu_si256( reinterpret_cast< const __m256i * >( p ) );
+    __m256i in_ranges = _mm256_setzero_si256();
+    for( size_t i = 0; i < n_ranges; ++i )
+    {
+        __m256i offset = _mm256_sub_epi8( chars, _mm256_set1_epi8( static_cast< char >( p_starts[i] ) ) );
+        __m256i in_range = _mm256_cmpeq_epi8( _mm256_min_epu8( offset, _mm256_set1_epi8( static_cast< char >( p_lengths[i] ) ) ), offset );
+        in_ranges = _mm256_or_si256( in_ranges, in_range );
+    }
+    return static_cast< unsigned int >( _mm256_movemask_epi8( in_ranges ) );
+}
+const unsigned int all_chars_mask = 0xffffffff;
+#else
+inline unsigned int in_ranges_mask( const char * p,
+                                    const unsigned char * p_starts,
+                                    const unsigned char * p_lengths,
+                                    size_t n_ranges )
+{
+    __m128i chars = _mm_loadu_si128( reinterpret_cast< const __m128i * >( p ) );
+    __m128i in_ranges = _mm_setzero_si128();
+    for( size_t i = 0; i < n_ranges; ++i )
+    {
+        __m128i offset = _mm_sub_epi8( chars, _mm_set1_epi8( static_cast< char >( p_starts[i] ) ) );
+        __m128i in_range = _mm_cmpeq_epi8( _mm_min_epu8( offset, _mm_set1_epi8( static_cast< char >( p_lengths[i] ) ) ), offset );
+        in_ranges = _mm_or_si128( in_ranges, in_range );
+    }
+    return static_cast< unsigned int >( _mm_movemask_epi8( in_ranges ) );
+}
+const unsigned int all_chars_mask = 0xffff;
+#endif
+
+} // End of Anonymous namespace
+
+#endif
+
+size_t char_ranges::span( const char_map & r_map, const char * p_begin, const char * p_end ) const
+{
+    const char * p = p_begin;
+
+#if defined( CL_DSL_PA_SIMD_WIDTH )
+    if( is_vectorisable )
+    {
+        for( ; p_end - p >= CL_DSL_PA_SIMD_WIDTH; p += CL_DSL_PA_SIMD_WIDTH )
+        {
+            unsigned int not_in_ranges = ~in_ranges_mask( p, range_starts, range_lengths, n_ranges ) & all_chars_mask;
+            if( not_in_ranges != 0 )
+                return (p - p_begin) + count_trailing_zeros( not_in_ranges );
+        }
+    }
+#endif
+
+    while( p != p_end && r_map.is_set( *p ) )
+        ++p;
+    return p - p_begin;
+}
+
+size_t char_ranges::cspan( const char_map & r_map, const char * p_begin, const char * p_end ) const
+{
+    const char * p = p_begin;
+
+#if defined( CL_DSL_PA_SIMD_WIDTH )
+    if( is_vectorisable )
+    {
+        for( ; p_end - p >= CL_DSL_PA_SIMD_WIDTH; p += CL_DSL_PA_SIMD_WIDTH )
+        {
+            unsigned int in_ranges = in_ranges_mask( p, range_starts, range_lengths, n_ranges );
+            if( in_ranges != 0 )
+                return (p - p_begin) + count_trailing_zeros( in_ranges );
+        }
+    }
+#endif
+
+    while( p != p_end && ! r_map.is_set( *p ) )
+        ++p;
+    return p - p_begin;
 }
 
 char_map_w::char_map_w()
@@ -124,6 +260,12 @@ char_map_l::char_map_l()
 }
 
 alphabet_char_class::alphabet_char_class( const char * p_spec )
+{
+    parse( p_spec );
+    wanted_ranges.set( wanted_chars );
+}
+
+void alphabet_char_class::parse( const char * p_spec )
 {
     bool is_inverted = false;
 
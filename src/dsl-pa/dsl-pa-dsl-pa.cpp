@@ -39,6 +39,7 @@
 #include "dsl-pa/dsl-pa-dsl-pa.h"
 
 #include <sstream>
+#include <cstring>
 
 namespace cl {
 
@@ -629,21 +630,28 @@ size_t dsl_pa::get( std::string * p_output, mutator & r_mutator )
 struct writer_read_mode
 {
     static void handle_char( std::string * p_output, char c ) { p_output->push_back( c ); }
+    static void handle_chars( std::string * p_output, const char * p, size_t n ) { p_output->append( p, n ); }
     static void handle_string( std::string * p_output, const char * p_new ) { p_output->append( p_new ); }
 };
 
 struct writer_skip_mode
 {
     static void handle_char( std::string * /*p_output*/, char /*c*/ ) {}
+    static void handle_chars( std::string * /*p_output*/, const char * /*p*/, size_t /*n*/ ) {}
     static void handle_string( std::string * /*p_output*/, const char * /*p_new*/ ) {}
 };
 
 template< typename Twriter >
 size_t dsl_pa::read_or_skip_handler( std::string * p_output, const alphabet & r_alphabet, size_t max_chars )
 {
-    size_t n_chars;
+    // Take the run of sought chars in the reader's input in one go.  The
+    // char by char loop then handles the char that ends the run.
+    const char * p_run = r_reader.input_current();
+    size_t n_chars = r_alphabet.span( p_run, bulk_input_end( max_chars ) );
+    Twriter::handle_chars( p_output, p_run, n_chars );
+    r_reader.skip_ahead( n_chars );
 
-    for( n_chars = 0; n_chars < max_chars; ++n_chars )
+    for( ; n_chars < max_chars; ++n_chars )
     {
         if( ! r_alphabet.is_sought( get() ) )
             break;
@@ -661,10 +669,23 @@ size_t dsl_pa::read_or_skip_handler( std::string * p_output, const alphabet & r_
 template< typename Twriter >
 size_t dsl_pa::read_or_skip_until_handler( std::string * p_output, const alphabet & r_alphabet, char escape_char, size_t max_chars )
 {
-    size_t n_chars;
     bool is_escaped = false;
 
-    for( n_chars = 0; n_chars < max_chars; ++n_chars )
+    // Take the run of unsought chars in the reader's input in one go, up to
+    // any escape char or embedded EOI char.  The char by char loop then
+    // handles the rest.
+    const char * p_run = r_reader.input_current();
+    size_t n_chars = r_alphabet.cspan( p_run, bulk_input_end( max_chars ) );
+    if( n_chars > 0 )
+        if( const void * p_eoi = memchr( p_run, reader::R_EOI, n_chars ) )
+            n_chars = static_cast< const char * >( p_eoi ) - p_run;
+    if( n_chars > 0 && escape_char != '\0' )
+        if( const void * p_escape = memchr( p_run, escape_char, n_chars ) )
+            n_chars = static_cast< const char * >( p_escape ) - p_run;
+    Twriter::handle_chars( p_output, p_run, n_chars );
+    r_reader.skip_ahead( n_chars );
+
+    for( ; n_chars < max_chars; ++n_chars )
     {
         if( get() == reader::R_EOI )
             return n_chars;
@@ -787,6 +808,23 @@ size_t dsl_pa::skip( mutator & r_mutator )
     return read_or_skip_handler< writer_skip_mode >( 0, r_mutator );
 }
 
+size_t dsl_pa::skip_run( const alphabet & r_alphabet )
+{
+    size_t n_chars = r_alphabet.span( r_reader.input_current(), r_reader.input_end() );
+    r_reader.skip_ahead( n_chars );
+    return n_chars;
+}
+
+size_t dsl_pa::accumulate_run( const alphabet & r_alphabet )
+{
+    const char * p_run = r_reader.input_current();
+    size_t n_chars = r_alphabet.span( p_run, r_reader.input_end() );
+    if( p_accumulator )
+        p_accumulator->append_input( p_run, n_chars );
+    r_reader.skip_ahead( n_chars );
+    return n_chars;
+}
+
 bool dsl_pa::fixed( const char * p_seeking )
 {
     return get_fixed( 0, p_seeking );
@@ -865,12 +903,29 @@ bool dsl_pa::read_ifixed( std::string * p_output, const char * p_seeking )
     return read_fixed_or_ifixed< compare_ifixed >( p_output, p_seeking );
 }
 
+bool dsl_pa::is_fixed_ahead( const char * p_seeking ) const
+{
+    size_t length = strlen( p_seeking );
+    return r_reader.is_available( length ) &&
+            memcmp( r_reader.input_current(), p_seeking, length ) == 0;
+}
+
+void dsl_pa::accumulate_current()
+{
+    if( p_accumulator )
+    {
+        if( const char * p_input = r_reader.current_input() )
+            p_accumulator->append_input( p_input, 1 );
+        else
+            p_accumulator->append( current() );
+    }
+}
+
 bool dsl_pa::accumulate( char c )
 {
     if( is_get_char( c ) )
     {
-        if( p_accumulator )
-            p_accumulator->append( c );
+        accumulate_current();
         return true;
     }
     return false;
@@ -880,8 +935,7 @@ bool dsl_pa::accumulate( const alphabet & r_alphabet )
 {
     if( r_alphabet.is_sought( get() ) )
     {
-        if( p_accumulator )
-            p_accumulator->append( current() );
+        accumulate_current();
         return true;
     }
     unget();
@@ -890,7 +944,7 @@ bool dsl_pa::accumulate( const alphabet & r_alphabet )
 
 size_t dsl_pa::accumulate_all( const alphabet & r_alphabet )
 {
-    size_t num = 0;
+    size_t num = accumulate_run( r_alphabet );
     while( accumulate( r_alphabet ) )
         ++num;
     return num;
@@ -920,7 +974,7 @@ bool dsl_pa::accumulator_append( const std::string & r_s )
 bool dsl_pa::accumulator_append( const accumulator_deferred & r_a )
 {
     if( p_accumulator )
-        p_accumulator->append( r_a.get() );
+        p_accumulator->append( r_a );
     return true;
 }
 
@@ -951,14 +1005,14 @@ bool dsl_pa::accumulate_atomic( bool is_valid )
 int64 accumulator_deferred::to_int64() const
 {
     int64 v;
-    std::istringstream( my_accumulator ) >> v;
+    std::istringstream( get() ) >> v;
     return v;
 }
 
 uint64 accumulator_deferred::to_uint64() const
 {
     uint64 v;
-    std::istringstream( my_accumulator ) >> v;
+    std::istringstream( get() ) >> v;
     return v;
 }
 
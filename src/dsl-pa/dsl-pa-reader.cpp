@@ -36,56 +36,291 @@
 // more information.
 //----------------------------------------------------------------------------
 
-//----------------------------------------------------------------------------
-// Note:    Blank_line_counting: If the last character was a newline (as well
-//          as the current one), then we want to count any following newline
-//          as a genuine newline, and not suppress it.  Setting
-//          current.last_nl_char to '\0' will achieve this.
-//----------------------------------------------------------------------------
-
 #include "dsl-pa/dsl-pa-reader.h"
 
+#include <iterator>
+
+#if defined( _WIN32 )
+    #include <windows.h>
+#else
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
 namespace cl {
 
-void line_counter_with_stack::got_char( char c )
+void line_index::index()
+{
+    // A newline character that follows a different newline character that
+    // itself started a new line is the second half of a '\r\n' or '\n\r'
+    // pair, and so doesn't start another line.
+    for( const char * p = p_begin + (indexed_offset - begin_offset); p != p_end; ++p )
+    {
+        if( *p == '\r' || *p == '\n' )
+        {
+            size_t next_offset = begin_offset + (p - p_begin) + 1;
+            if( pair_start_char == '\0' || pair_start_char == *p )
+            {
+                newline nl;
+                nl.line_increment_offset = nl.line_start_offset = next_offset;
+                newlines.push_back( nl );
+            }
+            else
+            {
+                newlines.back().line_start_offset = next_offset;
+            }
+
+            pair_start_char = (pair_start_char == '\0') ? *p : '\0';
+        }
+        else
+        {
+            pair_start_char = '\0';
+        }
+    }
+    indexed_offset = begin_offset + (p_end - p_begin);
+}
+
+void line_index::release( size_t offset )
 {
-    int line_number = get_line_number();
-    int column_number = get_column_number();
+    index();
 
-    if( c == '\r' || c == '\n' )
+    // Keep the last newline at or before offset, as it gives the line of
+    // offset, and those after it
+    size_t n_releasable = 0;
+    while( n_releasable + 1 < newlines.size() && newlines[n_releasable + 1].line_increment_offset <= offset )
+        ++n_releasable;
+    newlines.erase( newlines.begin(), newlines.begin() + n_releasable );
+    n_released_newlines += n_releasable;
+}
+
+const line_index::newline * line_index::find( size_t offset )
+{
+    if( indexed_offset != begin_offset + static_cast< size_t >( p_end - p_begin ) )
+        index();
+
+    // Binary search for the first newline after offset
+    size_t low = 0, high = newlines.size();
+    while( low < high )
     {
-        column_number = 0;
-        if( current.last_nl_char == '\0' || current.last_nl_char == c )
-            ++line_number;
-
-         if( current.last_nl_char != '\0' )    // See Blank_line_counting
-            current.last_nl_char = '\0';
-         else
-            current.last_nl_char = c;
+        size_t mid = low + (high - low) / 2;
+        if( newlines[mid].line_increment_offset <= offset )
+            low = mid + 1;
+        else
+            high = mid;
     }
-    else
+    return low == 0 ? 0 : &newlines[low - 1];
+}
+
+int line_index::get_line_number( size_t offset )
+{
+    const newline * p_newline = find( offset );
+    return static_cast< int >( n_released_newlines + (p_newline ? (p_newline - &newlines[0]) + 2 : 1) );
+}
+
+int line_index::get_column_number( size_t offset )
+{
+    const newline * p_newline = find( offset );
+    if( ! p_newline )
+        return static_cast< int >( offset );
+    if( offset < p_newline->line_start_offset )    // Between the chars of a '\r\n' pair
+        return 0;
+    return static_cast< int >( offset - p_newline->line_start_offset );
+}
+
+bool reader::get_more_input()
+{
+    // more_input() may move the input, so the current location is kept as
+    // an offset
+    size_t current_offset = offset();
+    while( is_more_input_possible )
     {
-        ++column_number;
+        if( ! more_input() )
+            is_more_input_possible = false;
+        set_offset( current_offset );
+        if( p_current != p_end )
+            return true;
+    }
+    return false;
+}
+
+size_t reader::release_input()
+{
+    size_t earliest_offset = offset();
+    for( size_t i = 0; i < locations.size(); ++i )
+        if( locations[i] < earliest_offset )
+            earliest_offset = locations[i];
+    lines.release( earliest_offset );
+    return earliest_offset;
+}
+
+bool reader_incremental::more_input()
+{
+    size_t release_offset = release_input();
+    buffer.erase( buffer.begin(), buffer.begin() + (release_offset - buffer_offset) );
+    buffer_offset = release_offset;
+    bool is_more = read_chunk( &buffer );
+    move_input( buffer.empty() ? 0 : &buffer[0], buffer.size(), buffer_offset );
+    return is_more;
+}
 
-        current.last_nl_char = '\0';
+reader_file::reader_file( const char * p_input_in )
+    :
+    is_opened( false )
+{
+    std::ifstream fin( p_input_in, std::ios::binary );
+    if( fin.is_open() )
+    {
+        is_opened = true;
+        contents.assign( std::istreambuf_iterator< char >( fin ),
+                            std::istreambuf_iterator< char >() );
+        if( ! contents.empty() )
+            set_input( &contents[0], contents.size() );
     }
+}
 
-    set_position( line_number, column_number );
+mapped_file::mapped_file( const char * p_file_name )
+    :
+    p_data( "" ),
+    data_size( 0 ),
+    is_opened( false ),
+    is_mapped( false )
+#if defined( _WIN32 )
+    , h_file( INVALID_HANDLE_VALUE ),
+    h_mapping( 0 )
+#endif
+{
+    if( ! map( p_file_name ) )
+        read( p_file_name );
 }
 
-char reader::get()
+mapped_file::~mapped_file()
 {
-    if( ! unget_buffer.empty() )
+    unmap();
+}
+
+#if defined( _WIN32 )
+
+bool mapped_file::map( const char * p_file_name )
+{
+    h_file = CreateFileA( p_file_name, GENERIC_READ, FILE_SHARE_READ, 0,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0 );
+    if( h_file == INVALID_HANDLE_VALUE )
+        return false;
+
+    LARGE_INTEGER file_size;
+    if( GetFileType( h_file ) != FILE_TYPE_DISK ||
+            ! GetFileSizeEx( h_file, &file_size ) ||
+            file_size.HighPart != 0 )
+    {
+        unmap();
+        return false;
+    }
+
+    is_opened = true;
+
+    if( file_size.LowPart == 0 )    // Can't map zero length files
+        return true;
+
+    h_mapping = CreateFileMappingA( h_file, 0, PAGE_READONLY, 0, 0, 0 );
+    if( h_mapping )
     {
-        current_char = unget_buffer.reget();
-        line_counter.retrieved_ungot_char( current_char );
+        const void * p_view = MapViewOfFile( h_mapping, FILE_MAP_READ, 0, 0, 0 );
+        if( p_view )
+        {
+            p_data = static_cast< const char * >( p_view );
+            data_size = file_size.LowPart;
+            is_mapped = true;
+            return true;
+        }
     }
-    else
+
+    unmap();
+    return false;
+}
+
+void mapped_file::unmap()
+{
+    if( is_mapped )
+        UnmapViewOfFile( p_data );
+    if( h_mapping )
+        CloseHandle( h_mapping );
+    if( h_file != INVALID_HANDLE_VALUE )
+        CloseHandle( h_file );
+    h_mapping = 0;
+    h_file = INVALID_HANDLE_VALUE;
+    p_data = "";
+    data_size = 0;
+    is_opened = is_mapped = false;
+}
+
+#else
+
+bool mapped_file::map( const char * p_file_name )
+{
+    int fd = open( p_file_name, O_RDONLY );
+    if( fd < 0 )
+        return false;
+
+    struct stat file_stat;
+    if( fstat( fd, &file_stat ) != 0 || ! S_ISREG( file_stat.st_mode ) )
+    {
+        close( fd );
+        return false;
+    }
+
+    is_opened = true;
+
+    if( file_stat.st_size > 0 )     // Can't map zero length files
+    {
+        void * p_view = mmap( 0, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( p_view != MAP_FAILED )
+        {
+            #if defined( MADV_SEQUENTIAL )
+                madvise( p_view, file_stat.st_size, MADV_SEQUENTIAL );
+            #endif
+            p_data = static_cast< const char * >( p_view );
+            data_size = file_stat.st_size;
+            is_mapped = true;
+        }
+        else
+        {
+            is_opened = false;
+        }
+    }
+
+    close( fd );    // The mapping remains valid after the descriptor is closed
+
+    return is_opened;
+}
+
+void mapped_file::unmap()
+{
+    if( is_mapped )
+        munmap( const_cast< char * >( p_data ), data_size );
+    p_data = "";
+    data_size = 0;
+    is_opened = is_mapped = false;
+}
+
+#endif
+
+void mapped_file::read( const char * p_file_name )
+{
+    std::ifstream fin( p_file_name, std::ios::binary );
+    if( ! fin.is_open() )
+        return;
+
+    is_opened = true;
+    fallback_buffer.assign( std::istreambuf_iterator< char >( fin ),
+                            std::istreambuf_iterator< char >() );
+    if( ! fallback_buffer.empty() )
     {
-        current_char = get_next_input();
-        line_counter.got_char( current_char );
+        p_data = &fallback_buffer[0];
+        data_size = fallback_buffer.size();
     }
-    return current_char;
 }
 
 } // End of namespace cl
@@ -34,6 +34,13 @@
 #include "clunit.h"
 
 #include "cl-jcr-parser/parser.h"
+#include "cl-jcr-parser/compiled-grammar.h"
+#include "cl-utils/str-args.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 
 using namespace cljcr;
 
@@ -50,7 +57,7 @@ public:
     Grammar * grammar() { return p_grammar; }
     operator Grammar * () { return grammar(); }
 
-    GrammarModifier & ruleset_id( const char * p_name ) { p_grammar->ruleset_id = p_name; return *this; }
+    GrammarModifier & ruleset_id( const char * p_name ) { p_grammar->ruleset_id = p_grammar->intern( p_name ); return *this; }
     GrammarModifier & unaliased_import( const char * p_name ) { p_grammar->add_unaliased_import( p_name ); return *this; }
 };
 
@@ -75,10 +82,10 @@ public:
     Rule * rule() { return p_rule; }
     operator Rule * () { return rule(); }
 
-    RuleModifier & rule_name( const char * p_name ) { p_rule->rule_name = p_name; return *this; }
-    RuleModifier & member_name( const char * p_name ) { p_rule->member_name.set_literal( p_name ); return *this; }
-    RuleModifier & target_rule_name( const char * p_name ) { p_rule->target_rule.rule_name = p_name; return *this; }
-    RuleModifier & target_ruleset_id( const char * p_name ) { p_rule->target_rule.ruleset_id = p_name; return *this; }
+    RuleModifier & rule_name( const char * p_name ) { p_rule->rule_name = p_rule->p_grammar->intern( p_name ); return *this; }
+    RuleModifier & member_name( const char * p_name ) { p_rule->member_name.set_literal( p_rule->p_grammar->intern( p_name ) ); return *this; }
+    RuleModifier & target_rule_name( const char * p_name ) { p_rule->target_rule.rule_name = p_rule->p_grammar->intern( p_name ); return *this; }
+    RuleModifier & target_ruleset_id( const char * p_name ) { p_rule->target_rule.ruleset_id = p_rule->p_grammar->intern( p_name ); return *this; }
 };
 
 class RuleMaker : public RuleModifier // To facilitate making rules for testing
@@ -112,18 +119,18 @@ TFEATURE( "Linking Rule::find_target_rule()" )
     Rule * p_g4r2 = RuleMaker( p_g4 ).rule_name( "g4r2" );
 
     // Test no imports case
-    TSETUP( p_g1r1->target_rule.rule_name = "g1r2" );
+    TSETUP( p_g1r1->target_rule.rule_name = p_g1->intern( "g1r2" ) );
     TTEST( p_g1r1->find_target_rule() == p_g1r2 );
     TTEST( p_g1r1->target_rule.p_rule == p_g1r2 );  // Check also stores result in target_rule.p_rule
 
     // Test unaliased imports case
-    TSETUP( p_g2r1->target_rule.rule_name = "g3r2" );
+    TSETUP( p_g2r1->target_rule.rule_name = p_g2->intern( "g3r2" ) );
     TTEST( p_g2r1->find_target_rule() == p_g3r2 );
     TTEST( p_g2r1->target_rule.p_rule == p_g3r2 );  // Check also stores result in target_rule.p_rule
 
     // Test aliased imports case
-    TSETUP( p_g3r1->target_rule.rule_name = "g4r2" );
-    TSETUP( p_g3r1->target_rule.ruleset_id = "g4" );
+    TSETUP( p_g3r1->target_rule.rule_name = p_g3->intern( "g4r2" ) );
+    TSETUP( p_g3r1->target_rule.ruleset_id = p_g3->intern( "g4" ) );
     TTEST( p_g3r1->find_target_rule() == p_g4r2 );
     TTEST( p_g3r1->target_rule.p_rule == p_g4r2 );  // Check also stores result in target_rule.p_rule
 
@@ -132,7 +139,7 @@ TFEATURE( "Linking Rule::find_target_rule()" )
     TTEST( p_g3r2->target_rule.p_rule == p_g3r2 );  // Check also stores result in target_rule.p_rule
 
     // Test const case
-    TSETUP( p_g1r2->target_rule.rule_name = "g1r1" );
+    TSETUP( p_g1r2->target_rule.rule_name = p_g1->intern( "g1r1" ) );
     const Rule * p_const_g1r2 = p_g1r2;
     TTEST( p_const_g1r2->find_target_rule() == p_g1r1 );
     TTEST( p_const_g1r2->target_rule.p_rule == 0 ); // Const instance can't set target_rule.p_rule
@@ -540,6 +547,61 @@ TFEATURE( "Global linking - Local ruleset - with illegal loops" )
     }
 }
 
+TFEATURE( "Global linking - Local ruleset - long chains" )
+{
+    {
+    TDOC( "Chain of type rule aliases" );
+    GrammarSet gs;
+
+    Grammar * p_g1 = GrammarMaker( gs );
+    std::vector< Rule * > rules;
+    for( size_t i=0; i<200; ++i )
+        rules.push_back( RuleMaker( p_g1 ).rule_name( clutils::expand( "r%0", i ).c_str() ).target_rule_name( clutils::expand( "r%0", i + 1 ).c_str() ) );
+    Rule * p_end = RuleMaker( p_g1 ).rule_name( "r200" );
+
+    JCRParser jp( &gs );
+
+    TCRITICALTEST( jp.link( p_g1 ) == JCRParser::S_OK );
+    for( size_t i=0; i<rules.size(); ++i )
+    {
+        TTEST( rules[i]->p_rule == rules[i] );
+        TTEST( rules[i]->p_type == p_end );
+    }
+    }
+    {
+    TDOC( "Chain of type rule aliases ending in a member rule" );
+    GrammarSet gs;
+
+    Grammar * p_g1 = GrammarMaker( gs );
+    std::vector< Rule * > rules;
+    for( size_t i=0; i<200; ++i )
+        rules.push_back( RuleMaker( p_g1 ).rule_name( clutils::expand( "r%0", i ).c_str() ).target_rule_name( clutils::expand( "r%0", i + 1 ).c_str() ) );
+    Rule * p_end = RuleMaker( p_g1 ).rule_name( "r200" ).member_name( "m" );
+
+    JCRParser jp( &gs );
+
+    TCRITICALTEST( jp.link( p_g1 ) == JCRParser::S_OK );
+    for( size_t i=0; i<rules.size(); ++i )
+    {
+        TTEST( rules[i]->p_rule == p_end );
+        TTEST( rules[i]->p_type == p_end );
+    }
+    }
+    {
+    TDOC( "Chain of type rule aliases leading to a loop" );
+    GrammarSet gs;
+
+    Grammar * p_g1 = GrammarMaker( gs );
+    for( size_t i=0; i<200; ++i )
+        RuleMaker( p_g1 ).rule_name( clutils::expand( "r%0", i ).c_str() ).target_rule_name( clutils::expand( "r%0", i + 1 ).c_str() );
+    RuleMaker( p_g1 ).rule_name( "r200" ).target_rule_name( "r199" );
+
+    JCRParser jp( &gs );
+
+    TCRITICALTEST( jp.link( p_g1 ) != JCRParser::S_OK );
+    }
+}
+
 TFEATURE( "Global link - to undefined rule names" )
 {
     {
@@ -665,6 +727,64 @@ TFEATURE( "Multiple grammar linking - Check for duplicately (or multiply) named
     }
 }
 
+class LinkReportRecorder : public JCRParser
+{
+private:
+    std::string reports;
+
+public:
+    LinkReportRecorder( GrammarSet * p_grammar_set ) : JCRParser( p_grammar_set ) {}
+    virtual void report( const std::string &, size_t line, size_t, Severity, const char * p_message )
+    {
+        if( line != ~0U )
+            clutils::expand_append( &reports, "%0:", line );
+        clutils::expand_append( &reports, "%0\n", p_message );
+    }
+    const std::string & get_reports() const { return reports; }
+};
+
+TFEATURE( "Global linking - Each duplicate is reported in order" )
+{
+    {
+    TDOC( "Duplicate rule names" );
+    GrammarSet gs;
+
+    Grammar * p_g1 = GrammarMaker( gs );
+    RuleMaker( p_g1 ).rule_name( "r1" ).rule()->line_number = 1;
+    RuleMaker( p_g1 ).rule_name( "r2" ).rule()->line_number = 2;
+    RuleMaker( p_g1 ).rule_name( "r1" ).rule()->line_number = 3;
+    RuleMaker( p_g1 ).rule_name( "r2" ).rule()->line_number = 4;
+    RuleMaker( p_g1 ).rule_name( "r1" ).rule()->line_number = 5;
+
+    LinkReportRecorder jp( &gs );
+
+    TCRITICALTEST( jp.link( p_g1 ) != JCRParser::S_OK );
+    TTEST( jp.get_reports() ==
+            "1:Duplicate <rule-name> '$r1' found at (line: '3', char: '0')\n"
+            "1:Duplicate <rule-name> '$r1' found at (line: '5', char: '0')\n"
+            "2:Duplicate <rule-name> '$r2' found at (line: '4', char: '0')\n"
+            "3:Duplicate <rule-name> '$r1' found at (line: '5', char: '0')\n" );
+    }
+    {
+    TDOC( "Duplicate ruleset ids" );
+    GrammarSet gs;
+
+    GrammarMaker( gs ).ruleset_id( "g1" ).grammar()->jcr_source = "s1";
+    GrammarMaker( gs ).grammar()->jcr_source = "s2";
+    GrammarMaker( gs ).ruleset_id( "g1" ).grammar()->jcr_source = "s3";
+    GrammarMaker( gs ).grammar()->jcr_source = "s4";
+    GrammarMaker( gs ).ruleset_id( "g1" ).grammar()->jcr_source = "s5";
+
+    LinkReportRecorder jp( &gs );
+
+    TCRITICALTEST( jp.link() != JCRParser::S_OK );
+    TTEST( jp.get_reports() ==
+            "Duplicate <ruleset-id> 'g1' found in source 's3'\n"
+            "Duplicate <ruleset-id> 'g1' found in source 's5'\n"
+            "Duplicate <ruleset-id> 'g1' found in source 's5'\n" );
+    }
+}
+
 TFEATURE( "Multiple grammar linking - global rule linking" )
 {
     {
@@ -982,3 +1102,542 @@ TFEATURE( "Child linking - multiple grammars" )
     TTEST( p_g1r1c1c1->p_type == p_g2r2 );
     }
 }
+
+void list_rules( std::vector< const Rule * > * p_rules, const Rule & r_rule )
+{
+    p_rules->push_back( &r_rule );
+    for( size_t i = 0; i < r_rule.children.size(); ++i )
+        list_rules( p_rules, r_rule.children[i] );
+}
+
+std::vector< const Rule * > list_rules( const GrammarSet & r_grammar_set )
+{
+    std::vector< const Rule * > rules;
+    for( size_t i = 0; i < r_grammar_set.size(); ++i )
+        for( size_t j = 0; j < r_grammar_set[i].rules.size(); ++j )
+            list_rules( &rules, r_grammar_set[i].rules[j] );
+    return rules;
+}
+
+size_t position_of( const std::vector< const Rule * > & r_rules, const Rule * p_rule )
+{
+    return std::find( r_rules.begin(), r_rules.end(), p_rule ) - r_rules.begin();
+}
+
+void test_link_in_parallel( const char * const * p_jcrs, size_t n_jcrs )
+{
+    GrammarSet sequential_gs;
+    LinkReportRecorder sequential_parser( &sequential_gs );
+    GrammarSet parallel_gs;
+    LinkReportRecorder parallel_parser( &parallel_gs );
+    for( size_t i = 0; i < n_jcrs; ++i )
+    {
+        TDOC( p_jcrs[i] );
+        TCRITICALTEST( sequential_parser.add_grammar( std::string( p_jcrs[i] ) ) == JCRParser::S_OK );
+        TCRITICALTEST( parallel_parser.add_grammar( std::string( p_jcrs[i] ) ) == JCRParser::S_OK );
+    }
+
+    TTEST( parallel_parser.link_in_parallel( 4 ) == sequential_parser.link() );
+    TTEST( parallel_parser.get_reports() == sequential_parser.get_reports() );
+
+    std::vector< const Rule * > sequential_rules( list_rules( sequential_gs ) );
+    std::vector< const Rule * > parallel_rules( list_rules( parallel_gs ) );
+    TCRITICALTEST( parallel_rules.size() == sequential_rules.size() );
+    for( size_t i = 0; i < sequential_rules.size(); ++i )
+    {
+        TTEST( position_of( parallel_rules, parallel_rules[i]->p_rule ) == position_of( sequential_rules, sequential_rules[i]->p_rule ) );
+        TTEST( position_of( parallel_rules, parallel_rules[i]->p_type ) == position_of( sequential_rules, sequential_rules[i]->p_type ) );
+    }
+}
+
+TFEATURE( "JCRParser::link_in_parallel()" )
+{
+    {
+    TDOC( "Independent grammars" );
+    const char * const p_jcrs[] = {
+            "#ruleset-id g1\n$a = $b\n$b = $c\n$c = { \"m\" : integer }\n",
+            "#ruleset-id g2\n$a = \"m\" : $b\n$b = [ $c * ]\n$c = string\n",
+            "#ruleset-id g3\n$a = $missing\n$b = $a\n" };
+    TCALL( test_link_in_parallel( p_jcrs, sizeof( p_jcrs ) / sizeof( p_jcrs[0] ) ) );
+    }
+    {
+    TDOC( "Grammars that refer to earlier and later grammars" );
+    const char * const p_jcrs[] = {
+            "#ruleset-id g1\n#import g2 as g2\n$a = $g2.a\n$b = \"m\" : $g2.b\n$c = { \"x\" : $g2.c }\n",
+            "#ruleset-id g2\n#import g1 as g1\n#import g3\n$a = $c\n$b = $g1.c\n$c = \"n\" : $d\n",
+            "#ruleset-id g3\n#import g1 as g1\n#import g2 as g2\n$d = $g2.b\n$e = [ $g1.b, $g2.a ]\n$f = $g1.a\n" };
+    TCALL( test_link_in_parallel( p_jcrs, sizeof( p_jcrs ) / sizeof( p_jcrs[0] ) ) );
+    }
+    {
+    TDOC( "Grammars with errors" );
+    const char * const p_jcrs[] = {
+            "#ruleset-id g1\n#import g2 as g2\n$a = $b\n$b = $a\n$c = $g2.a\n",
+            "#ruleset-id g2\n#import g1 as g1\n$a = \"m\" : $g1.c\n$a = integer\n",
+            "#ruleset-id g2\n$a = \"m\" : $b\n$b = \"n\" : string\n" };
+    TCALL( test_link_in_parallel( p_jcrs, sizeof( p_jcrs ) / sizeof( p_jcrs[0] ) ) );
+    }
+}
+
+TFEATURE( "Linking - names hidden by other names" )
+{
+    const char * const p_jcrs[] = {
+            "#ruleset-id g1\n#import g2\n#import g3\n#import g3 as x\n$a = $b\n$b = integer\n$c = $d\n$e = $x.d\n$f = $y\n",
+            "#ruleset-id g2\n$d = string\n$b = float\n$y = $b\n",
+            "#ruleset-id g3\n$d = boolean\n$y = $d\n" };
+    const size_t n_jcrs = sizeof( p_jcrs ) / sizeof( p_jcrs[0] );
+
+    GrammarSet gs;
+    JCRParser jcr_parser( &gs );
+    for( size_t i = 0; i < n_jcrs; ++i )
+        TCRITICALTEST( jcr_parser.add_grammar( std::string( p_jcrs[i] ) ) == JCRParser::S_OK );
+    TCRITICALTEST( jcr_parser.link() == JCRParser::S_OK );
+
+    TDOC( "A grammar's own rule hides that of an import" );
+    TTEST( gs[0].rules[0].target_rule.p_rule == &gs[0].rules[1] );
+    TTEST( gs[0].rules[0].p_type == &gs[0].rules[1] );
+    TDOC( "An earlier import's rule hides that of a later import" );
+    TTEST( gs[0].rules[2].target_rule.p_rule == &gs[1].rules[0] );
+    TDOC( "An aliased name refers to the aliased import's rule" );
+    TTEST( gs[0].rules[3].target_rule.p_rule == &gs[2].rules[0] );
+    TDOC( "The target of an imported rule is found in the import's scope" );
+    TTEST( gs[0].rules[4].target_rule.p_rule == &gs[1].rules[2] );
+    TTEST( gs[0].rules[4].p_type == &gs[1].rules[1] );
+    TTEST( gs[2].rules[1].target_rule.p_rule == &gs[2].rules[0] );
+
+    TCALL( test_link_in_parallel( p_jcrs, n_jcrs ) );
+}
+
+class SourceReportRecorder : public JCRParser
+{
+private:
+    std::string reports;
+
+public:
+    SourceReportRecorder( GrammarSet * p_grammar_set ) : JCRParser( p_grammar_set ) {}
+    virtual void report( const std::string & source, size_t line, size_t, Severity, const char * p_message )
+    {
+        clutils::expand_append( &reports, "%0:%1:%2\n", clutils::str_args( source ) << line << p_message );
+    }
+    const std::string & get_reports() const { return reports; }
+};
+
+std::string reports_for( const std::string & r_reports, const std::vector< std::string > & r_sources )
+{
+    // The reports from the given sources, along with all the duplicate ruleset id reports
+    std::string selected;
+    std::istringstream reports( r_reports );
+    for( std::string line; std::getline( reports, line ); )
+        if( line.find( "Duplicate <ruleset-id>" ) != std::string::npos ||
+                std::find( r_sources.begin(), r_sources.end(), line.substr( 0, line.find( ':' ) ) ) != r_sources.end() )
+            selected += line + "\n";
+    return selected;
+}
+
+void write_jcr( const std::string & r_file_name, const char * p_jcr )
+{
+    std::ofstream fout( r_file_name.c_str(), std::ios::binary );
+    fout << p_jcr;
+}
+
+struct ReplaceCase
+{
+    const char * p_replacement;     // The new contents of the first file
+    const char * p_relinked;        // The files expected to be relinked, as a string of digits, given the previous cases
+};
+
+void test_replace_grammar( const char * const * p_jcrs, size_t n_jcrs, const ReplaceCase * p_cases, size_t n_cases )
+{
+    std::vector< std::string > file_names;
+    for( size_t i = 0; i < n_jcrs; ++i )
+    {
+        file_names.push_back( clutils::expand( "test-replace-grammar-%0.jcr", i ) );
+        write_jcr( file_names[i], p_jcrs[i] );
+    }
+
+    GrammarSet gs;
+    JCRParser initial_parser( &gs );
+    for( size_t i = 0; i < n_jcrs; ++i )
+        initial_parser.add_grammar( file_names[i].c_str() );
+    initial_parser.link();
+
+    for( size_t i = 0; i < n_cases; ++i )
+    {
+        TDOC( p_cases[i].p_replacement );
+        write_jcr( file_names[0], p_cases[i].p_replacement );
+
+        std::vector< std::string > relinked_sources;
+        for( const char * p_relinked = p_cases[i].p_relinked; *p_relinked; ++p_relinked )
+            relinked_sources.push_back( file_names[*p_relinked - '0'] );
+
+        // The rules of the Grammars that aren't relinked keep their links
+        std::vector< const Rule * > kept_rules;
+        std::vector< std::pair< const Rule *, const Rule * > > kept_links;
+        std::vector< const Rule * > rules( list_rules( gs ) );
+        for( size_t j = 0; j < rules.size(); ++j )
+            if( std::find( relinked_sources.begin(), relinked_sources.end(), rules[j]->p_grammar->jcr_source ) == relinked_sources.end() )
+            {
+                kept_rules.push_back( rules[j] );
+                kept_links.push_back( std::make_pair( rules[j]->p_rule, rules[j]->p_type ) );
+            }
+
+        SourceReportRecorder replacing_parser( &gs );
+        JCRParser::Status replacing_status = replacing_parser.replace_grammar( file_names[0].c_str() );
+
+        TCRITICALTEST( gs.size() == n_jcrs );
+        std::vector< const Rule * > replaced_rules( list_rules( gs ) );
+        std::vector< const Rule * > still_kept_rules;
+        for( size_t j = 0; j < replaced_rules.size(); ++j )
+            if( std::find( relinked_sources.begin(), relinked_sources.end(), replaced_rules[j]->p_grammar->jcr_source ) == relinked_sources.end() )
+                still_kept_rules.push_back( replaced_rules[j] );
+        TCRITICALTEST( still_kept_rules == kept_rules );
+        for( size_t j = 0; j < kept_rules.size(); ++j )
+        {
+            TTEST( kept_rules[j]->p_rule == kept_links[j].first );
+            TTEST( kept_rules[j]->p_type == kept_links[j].second );
+        }
+
+        // The outcome is that of parsing and linking all the files afresh
+        GrammarSet fresh_gs;
+        JCRParser fresh_parser( &fresh_gs );
+        JCRParser::Status fresh_parse_status = JCRParser::S_OK;
+        for( size_t j = 0; j < n_jcrs; ++j )
+        {
+            JCRParser::Status status = fresh_parser.add_grammar( file_names[j].c_str() );
+            if( j == 0 )
+                fresh_parse_status = status;
+        }
+        SourceReportRecorder fresh_linker( &fresh_gs );
+        JCRParser::Status fresh_link_status = fresh_linker.link();
+
+        if( fresh_parse_status != JCRParser::S_OK )
+        {
+            TTEST( replacing_status == fresh_parse_status );
+        }
+        else
+        {
+            TTEST( (replacing_status == JCRParser::S_OK) == reports_for( fresh_linker.get_reports(), relinked_sources ).empty() );
+        }
+        TTEST( fresh_link_status == JCRParser::S_ERROR || replacing_status != JCRParser::S_ERROR );
+        std::string replacing_link_reports( replacing_parser.get_reports() );
+        if( fresh_parse_status != JCRParser::S_OK )     // Skip the messages from parsing
+            replacing_link_reports = replacing_link_reports.substr( replacing_link_reports.find( '\n' ) + 1 );
+        TTEST( replacing_link_reports == reports_for( fresh_linker.get_reports(), relinked_sources ) );
+
+        std::vector< const Rule * > fresh_rules( list_rules( fresh_gs ) );
+        TCRITICALTEST( fresh_rules.size() == replaced_rules.size() );
+        for( size_t j = 0; j < fresh_rules.size(); ++j )
+        {
+            TTEST( position_of( replaced_rules, replaced_rules[j]->p_rule ) == position_of( fresh_rules, fresh_rules[j]->p_rule ) );
+            TTEST( position_of( replaced_rules, replaced_rules[j]->p_type ) == position_of( fresh_rules, fresh_rules[j]->p_type ) );
+        }
+    }
+
+    for( size_t i = 0; i < n_jcrs; ++i )
+        remove( file_names[i].c_str() );
+}
+
+TFEATURE( "JCRParser::replace_grammar()" )
+{
+    {
+    TDOC( "Grammars that import the replaced grammar, directly and indirectly" );
+    const char * const p_jcrs[] = {
+            "#ruleset-id a\n$x = integer\n$m = \"m\" : string\n$n = $x\n",
+            "#ruleset-id b\n#import a\n#import a as a\n$y = $x\n$z = $a.m\n$o = { $z, \"p\" : $a.n }\n",
+            "#ruleset-id c\n#import b as b\n$w = $b.y\n$v = [ $b.o, $b.z ]\n",
+            "#ruleset-id d\n$u = $t\n$t = string\n",
+            "#import c as c\n#import d as d\n$q = $c.w\n$r = $d.u\n",
+            "#ruleset-id e\n#import a2 as a2\n$s = $a2.x\n" };
+    const ReplaceCase cases[] = {
+            { "#ruleset-id a\n$x = integer\n$m = \"m\" : string\n$n = $x\n", "0124" },
+            { "#ruleset-id a\n$x = \"x\" : integer\n$n = [ $x ]\n", "0124" },
+            { "#ruleset-id a\n$x = 0..10\n$m = \"m\" : $n\n$n = \"n\" : $x\n", "0124" },
+            { "#ruleset-id a2\n$x = 0..10\n", "01245" },
+            { "#ruleset-id a\n$x = 0..10\n$m = \"m\" : { $x\n", "01245" },
+            { "#ruleset-id d\n$x = integer\n", "0124" },
+            { "#ruleset-id a\n$x = $y\n$y = $x\n$m = \"m\" : string\n$n = $m\n", "0124" } };
+    TCALL( test_replace_grammar( p_jcrs, sizeof( p_jcrs ) / sizeof( p_jcrs[0] ), cases, sizeof( cases ) / sizeof( cases[0] ) ) );
+    }
+    {
+    TDOC( "Grammars that refer to earlier and later grammars" );
+    const char * const p_jcrs[] = {
+            "#ruleset-id g1\n#import g2 as g2\n$a = $g2.a\n$b = \"m\" : $g2.b\n$c = { \"x\" : $g2.c }\n",
+            "#ruleset-id g2\n#import g1 as g1\n#import g3\n$a = $c\n$b = $g1.c\n$c = \"n\" : $d\n",
+            "#ruleset-id g3\n#import g1 as g1\n#import g2 as g2\n$d = $g2.b\n$e = [ $g1.b, $g2.a ]\n$f = $g1.a\n",
+            "#ruleset-id g4\n$g = integer\n" };
+    const ReplaceCase cases[] = {
+            { "#ruleset-id g1\n#import g2 as g2\n$a = $g2.a\n$b = \"m\" : $g2.b\n$c = { \"x\" : $g2.c }\n", "012" },
+            { "#ruleset-id g1\n#import g2 as g2\n$a = \"k\" : $g2.a\n$b = $g2.b\n$c = $a\n", "012" },
+            { "#ruleset-id g1\n$a = string\n", "012" } };
+    TCALL( test_replace_grammar( p_jcrs, sizeof( p_jcrs ) / sizeof( p_jcrs[0] ), cases, sizeof( cases ) / sizeof( cases[0] ) ) );
+    }
+    {
+    TDOC( "Adding, replacing from memory and unopenable files" );
+    GrammarSet gs;
+    JCRParser jp( &gs );
+    const char * p_importer = "#ruleset-id b\n#import a as a\n$y = $a.x\n";
+    TCRITICALTEST( jp.add_grammar( p_importer, strlen( p_importer ) ) == JCRParser::S_OK );
+    TTEST( jp.link() == JCRParser::S_ERROR );
+
+    write_jcr( "test-replace-grammar-new.jcr", "#ruleset-id a\n$x = \"x\" : integer\n" );
+    TTEST( jp.replace_grammar( "test-replace-grammar-new.jcr" ) == JCRParser::S_OK );    // Appended
+    remove( "test-replace-grammar-new.jcr" );
+    TCRITICALTEST( gs.size() == 2 );
+    TTEST( gs[1].jcr_source == "test-replace-grammar-new.jcr" );
+    TTEST( gs[0].rules[0].p_rule == &gs[1].rules[0] );
+    TTEST( gs.find_importers( "a" ).size() == 1 );
+    TTEST( gs.find_importers( "a" )[0] == &gs[0] );
+    TTEST( gs.find_importers( "b" ).empty() );
+
+    const char * p_replacement = "#ruleset-id a\n$x = string\n";
+    TTEST( jp.replace_grammar( &gs[1], p_replacement, strlen( p_replacement ) ) == JCRParser::S_OK );
+    TCRITICALTEST( gs.size() == 2 );
+    TTEST( gs[1].jcr_source == "test-replace-grammar-new.jcr" );
+    TTEST( gs[0].rules[0].p_rule == &gs[0].rules[0] );
+    TTEST( gs[0].rules[0].p_type == &gs[1].rules[0] );
+    TTEST( gs[0].rules[0].get_type() == Rule::STRING_TYPE );
+    TTEST( gs.find_grammar( "a" ) == &gs[1] );
+
+    size_t n_errors = gs.error_count();
+    TTEST( jp.replace_grammar( "test-replace-grammar-that-does-not-exist.jcr" ) == JCRParser::S_UNABLE_TO_OPEN_FILE );
+    TTEST( gs.size() == 2 );
+    TTEST( gs.error_count() == n_errors + 1 );
+
+    TTEST( jp.replace_grammar( 0, p_replacement, strlen( p_replacement ) ) == JCRParser::S_ERROR );
+    GrammarSet other_gs;
+    Grammar * p_other = other_gs.append_grammar( "<other>" );
+    TTEST( jp.replace_grammar( p_other, p_replacement, strlen( p_replacement ) ) == JCRParser::S_ERROR );
+    Grammar non_member( &gs, "<not appended>" );     // Refers to the GrammarSet, but isn't in it
+    TTEST( gs.position( &non_member ) == gs.size() );
+    TTEST( gs.position( &gs[1] ) == 1 );
+    TTEST( jp.replace_grammar( &non_member, p_replacement, strlen( p_replacement ) ) == JCRParser::S_ERROR );
+    TTEST( gs.size() == 2 );
+    TTEST( other_gs.size() == 1 );
+    TTEST( gs.error_count() == n_errors + 4 );
+    TTEST( gs[0].rules[0].p_type == &gs[1].rules[0] );
+    }
+    {
+    TDOC( "The memory of replaced Grammars is released" );
+    GrammarSet gs;
+    JCRParser jp( &gs );
+    std::string base( "#ruleset-id a\n" );
+    for( size_t i = 0; i < 1000; ++i )
+        clutils::expand_append( &base, "$x%0 = { \"m\" : integer, \"n\" : [ string * ] }\n", i );
+    const char * p_importer = "#ruleset-id b\n#import a\n$y = [ $x0, $x999 ]\n";
+    TCRITICALTEST( jp.add_grammar( base.data(), base.size() ) == JCRParser::S_OK );
+    TCRITICALTEST( jp.add_grammar( p_importer, strlen( p_importer ) ) == JCRParser::S_OK );
+    TCRITICALTEST( jp.link() == JCRParser::S_OK );
+
+    size_t n_set_bytes = gs.arena().bytes_allocated();
+    size_t n_grammar_bytes = gs[0].arena.bytes_allocated();
+    size_t n_symbols = gs.symbols().size();
+    TTEST( n_grammar_bytes > 1000 * sizeof( Rule ) );
+    for( size_t i = 0; i < 20; ++i )
+    {
+        TCRITICALTEST( jp.replace_grammar( &gs[0], base.data(), base.size() ) == JCRParser::S_OK );
+        TCRITICALTEST( jp.replace_grammar( &gs[1], p_importer, strlen( p_importer ) ) == JCRParser::S_OK );
+    }
+    TCRITICALTEST( gs.size() == 2 );
+    TTEST( gs.arena().bytes_allocated() == n_set_bytes );
+    TTEST( gs[0].arena.bytes_allocated() == n_grammar_bytes );
+    TTEST( gs.symbols().size() == n_symbols );
+    TTEST( gs[1].rules[0].children[1].p_type == &gs[0].rules[999] );
+    }
+}
+
+void test_compiled_node( const CompiledGrammar & r_compiled, CompiledGrammar::Node node, const Rule & r_rule, int depth )
+{
+    TTEST( r_compiled.type( node ) == r_rule.get_type() );
+    TTEST( r_compiled.child_combiner( node ) == r_rule.get_child_combiner() );
+    TTEST( r_compiled.repetition( node ).min == r_rule.get_repetition().min );
+    TTEST( r_compiled.repetition( node ).max == r_rule.get_repetition().max );
+    TTEST( r_compiled.repetition( node ).step == r_rule.get_repetition().step );
+    TTEST( r_compiled.is_not( node ) == r_rule.get_annotations().is_not );
+    TTEST( r_compiled.is_unordered( node ) == r_rule.get_annotations().is_unordered );
+    TTEST( r_compiled.is_root( node ) == r_rule.get_annotations().is_root );
+    TTEST( r_compiled.default_value( node ) == r_rule.get_annotations().default_value() );
+    TTEST( r_compiled.format( node ) == r_rule.get_annotations().format() );
+    TTEST( r_compiled.augment_count( node ) == r_rule.get_annotations().augments().size() );
+    TTEST( r_compiled.is_member_rule( node ) == r_rule.is_member_rule() );
+    TTEST( r_compiled.member_name( node ) == r_rule.get_member_name().name() );
+    TTEST( r_compiled.rule_name( node ) == r_rule.rule_name.str() );
+    TTEST( r_compiled.line_number( node ) == r_rule.line_number );
+    TTEST( r_compiled.column_number( node ) == r_rule.column_number );
+    TTEST( r_compiled.line_number( r_compiled.type_node( node ) ) == r_rule.p_type->line_number );
+    TTEST( r_compiled.line_number( r_compiled.rule_node( node ) ) == r_rule.p_rule->line_number );
+
+    const CompiledGrammar::Constraint & r_min = r_compiled.min( node );
+    TTEST( r_min.is_set() == r_rule.get_min().is_set() );
+    if( r_min.is_int() && r_rule.get_min().is_int() )
+        TTEST( r_min.as_int() == r_rule.get_min().as_int() );
+    if( r_min.is_float() && r_rule.get_min().is_float() )
+        TTEST( r_min.as_float() == r_rule.get_min().as_float() );
+    const CompiledGrammar::Constraint & r_max = r_compiled.max( node );
+    TTEST( r_max.is_set() == r_rule.get_max().is_set() );
+    if( r_max.is_string() && r_rule.get_max().is_string() )
+        TTEST( r_compiled.str( r_max.string_value ) == r_rule.get_max().as_string() );
+
+    TCRITICALTEST( r_compiled.child_count( node ) == r_rule.get_children().size() );
+    if( depth > 0 )     // Recursive rules are only followed so far
+        for( size_t i = 0; i < r_rule.get_children().size(); ++i )
+            test_compiled_node( r_compiled, r_compiled.first_child( node ) + i, r_rule.get_children()[i], depth - 1 );
+}
+
+TFEATURE( "CompiledGrammar" )
+{
+    const char * const p_jcrs[] = {
+            "#ruleset-id g1\n#import g2 as g2\n"
+                "@{root} $top = { $name, \"age\" : @{not} 0..120, $g2.address ?, \"tags\" : [ string * ] }\n"
+                "$name = \"name\" : /^[A-Z]/\n"
+                "$tree = [ integer, $tree *2..5 ]\n"
+                "$choice = ( $name | \"id\" : 1.5..9.5 )\n",
+            "#ruleset-id g2\n#import g1\n"
+                "$address = \"address\" : $street\n"
+                "$street = @{unordered} { \"line\" : string, \"number\" : ..99 }\n"
+                "$alias = $alias_2\n$alias_2 = $top\n"
+                "$note = @{format date} @{default \"x\"} string\n" };
+
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    for( size_t i = 0; i < sizeof( p_jcrs ) / sizeof( p_jcrs[0] ); ++i )
+        TCRITICALTEST( jcr_parser.add_grammar( std::string( p_jcrs[i] ) ) == JCRParser::S_OK );
+    TCRITICALTEST( jcr_parser.link() == JCRParser::S_OK );
+
+    CompiledGrammar compiled( grammar_set );
+    TTEST( compiled.size() == list_rules( grammar_set ).size() );
+    TCRITICALTEST( compiled.grammar_count() == 2 );
+    for( size_t i = 0; i < grammar_set.size(); ++i )
+    {
+        const CompiledGrammar::GrammarEntry & r_entry = compiled.grammar( i );
+        TTEST( compiled.str( r_entry.ruleset_id ) == grammar_set[i].ruleset_id.str() );
+        TTEST( compiled.str( r_entry.jcr_source ) == grammar_set[i].jcr_source );
+        TCRITICALTEST( r_entry.n_rules == grammar_set[i].rules.size() );
+        for( size_t j = 0; j < grammar_set[i].rules.size(); ++j )
+        {
+            TTEST( compiled.grammar_of( r_entry.first_rule + j ) == i );
+            TCALL( test_compiled_node( compiled, r_entry.first_rule + j, grammar_set[i].rules[j], 4 ) );
+        }
+    }
+
+    // Links are resolved, so $alias has the children of $top
+    CompiledGrammar::Node alias = compiled.grammar( 1 ).first_rule + 2;
+    TTEST( compiled.rule_name( alias ) == std::string( "alias" ) );
+    TTEST( compiled.type( alias ) == Rule::OBJECT );
+    TTEST( compiled.type_node( alias ) == compiled.grammar( 0 ).first_rule );
+    TTEST( compiled.first_child( alias ) == compiled.first_child( compiled.grammar( 0 ).first_rule ) );
+    TTEST( compiled.child_count( alias ) == 4 );
+
+    // The children of each rule are consecutive
+    CompiledGrammar::Node tree = compiled.grammar( 0 ).first_rule + 2;
+    TCRITICALTEST( compiled.child_count( tree ) == 2 );
+    TTEST( compiled.type( compiled.first_child( tree ) ) == Rule::INTEGER );
+    TTEST( compiled.type( compiled.first_child( tree ) + 1 ) == Rule::ARRAY );
+    TTEST( compiled.first_child( compiled.first_child( tree ) + 1 ) == compiled.first_child( tree ) );
+    TTEST( compiled.repetition( compiled.first_child( tree ) + 1 ).min == 2 );
+    TTEST( compiled.repetition( compiled.first_child( tree ) + 1 ).max == 5 );
+
+    // The compiled form doesn't depend on the GrammarSet
+    GrammarSet empty_grammar_set;
+    CompiledGrammar recompiled( grammar_set );
+    recompiled.compile( empty_grammar_set );
+    TTEST( recompiled.empty() );
+    TTEST( recompiled.grammar_count() == 0 );
+    recompiled.compile( grammar_set );
+    TTEST( recompiled.size() == compiled.size() );
+    TTEST( recompiled.bytes_used() == compiled.bytes_used() );
+}
+
+void test_same_compiled( const CompiledGrammar & r_lhs, const CompiledGrammar & r_rhs )
+{
+    TCRITICALTEST( r_lhs.size() == r_rhs.size() );
+    TCRITICALTEST( r_lhs.grammar_count() == r_rhs.grammar_count() );
+    for( size_t i = 0; i < r_lhs.grammar_count(); ++i )
+    {
+        TTEST( std::string( r_lhs.str( r_lhs.grammar( i ).ruleset_id ) ) == r_rhs.str( r_rhs.grammar( i ).ruleset_id ) );
+        TTEST( std::string( r_lhs.str( r_lhs.grammar( i ).jcr_source ) ) == r_rhs.str( r_rhs.grammar( i ).jcr_source ) );
+        TTEST( r_lhs.grammar( i ).first_rule == r_rhs.grammar( i ).first_rule );
+        TTEST( r_lhs.grammar( i ).n_rules == r_rhs.grammar( i ).n_rules );
+    }
+    for( CompiledGrammar::Node node = 0; node < r_lhs.size(); ++node )
+    {
+        TTEST( r_lhs.type( node ) == r_rhs.type( node ) );
+        TTEST( r_lhs.child_combiner( node ) == r_rhs.child_combiner( node ) );
+        TTEST( r_lhs.flags( node ) == r_rhs.flags( node ) );
+        TTEST( r_lhs.repetition( node ).min == r_rhs.repetition( node ).min );
+        TTEST( r_lhs.repetition( node ).max == r_rhs.repetition( node ).max );
+        TTEST( r_lhs.first_child( node ) == r_rhs.first_child( node ) );
+        TTEST( r_lhs.child_count( node ) == r_rhs.child_count( node ) );
+        TTEST( r_lhs.rule_node( node ) == r_rhs.rule_node( node ) );
+        TTEST( r_lhs.type_node( node ) == r_rhs.type_node( node ) );
+        TTEST( std::string( r_lhs.rule_name( node ) ) == r_rhs.rule_name( node ) );
+        TTEST( std::string( r_lhs.member_name( node ) ) == r_rhs.member_name( node ) );
+        TTEST( r_lhs.min( node ).form == r_rhs.min( node ).form );
+        TTEST( r_lhs.max( node ).uint_value == r_rhs.max( node ).uint_value );
+        TTEST( std::string( r_lhs.format( node ) ) == r_rhs.format( node ) );
+        TTEST( r_lhs.grammar_of( node ) == r_rhs.grammar_of( node ) );
+        TTEST( r_lhs.line_number( node ) == r_rhs.line_number( node ) );
+    }
+}
+
+void modify_file( const char * p_file_name, size_t offset, char c )
+{
+    std::fstream file( p_file_name, std::ios::in | std::ios::out | std::ios::binary );
+    file.seekp( offset );
+    file.put( c );
+}
+
+TFEATURE( "CompiledGrammar::save() and load()" )
+{
+    const char * p_jcr =
+            "#ruleset-id g1\n"
+            "@{root} $top = { $name, \"age\" : @{not} 0..120, \"tags\" : [ string * ] }\n"
+            "$name = \"name\" : /^[A-Z]/\n"
+            "$tree = [ integer, $tree *2..5 ]\n"
+            "$note = @{format date} string\n";
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    TCRITICALTEST( jcr_parser.add_grammar( std::string( p_jcr ) ) == JCRParser::S_OK );
+    TCRITICALTEST( jcr_parser.link() == JCRParser::S_OK );
+    CompiledGrammar compiled( grammar_set );
+
+    const char * p_file_name = "test-compiled-grammar.jcrb";
+    TCRITICALTEST( compiled.save( p_file_name ) == CompiledGrammar::S_OK );
+
+    {
+    TDOC( "Loading gives the same CompiledGrammar, held in the mapped file" );
+    CompiledGrammar loaded;
+    TCRITICALTEST( loaded.load( p_file_name ) == CompiledGrammar::S_OK );
+    TTEST( loaded.is_memory_mapped() );
+    TTEST( ! compiled.is_memory_mapped() );
+    TTEST( loaded.bytes_used() == compiled.bytes_used() );
+    TCALL( test_same_compiled( loaded, compiled ) );
+    TCRITICALTEST( loaded.load( p_file_name, true ) == CompiledGrammar::S_OK );
+    TCALL( test_same_compiled( loaded, compiled ) );
+    }
+    {
+    TDOC( "Files that can't be loaded leave the CompiledGrammar empty" );
+    CompiledGrammar loaded;
+    TTEST( loaded.load( "test-compiled-grammar-that-does-not-exist.jcrb" ) == CompiledGrammar::S_UNABLE_TO_OPEN_FILE );
+    TTEST( loaded.empty() );
+    TTEST( ! loaded.is_memory_mapped() );
+
+    std::string jcr_file_name( "test-compiled-grammar.jcr" );
+    std::ofstream( jcr_file_name.c_str(), std::ios::binary ) << p_jcr;
+    TTEST( loaded.load( jcr_file_name.c_str() ) == CompiledGrammar::S_WRONG_FORMAT );
+    TTEST( loaded.empty() );
+    remove( jcr_file_name.c_str() );
+
+    TCRITICALTEST( loaded.load( p_file_name ) == CompiledGrammar::S_OK );
+    modify_file( p_file_name, 30, '\x7f' );     // In the header
+    TTEST( loaded.load( p_file_name ) == CompiledGrammar::S_CORRUPTED );
+    TTEST( loaded.empty() );
+    TTEST( loaded.grammar_count() == 0 );
+
+    TCRITICALTEST( compiled.save( p_file_name ) == CompiledGrammar::S_OK );
+    modify_file( p_file_name, 100, '\x7f' );    // In the block
+    TTEST( loaded.load( p_file_name ) == CompiledGrammar::S_OK );   // The block is only checked on request
+    TTEST( loaded.load( p_file_name, true ) == CompiledGrammar::S_CORRUPTED );
+    TTEST( loaded.empty() );
+    }
+
+    remove( p_file_name );
+}
@@ -34,6 +34,7 @@
 #include "clunit.h"
 
 #include "cl-jcr-parser/parser.h"
+#include "cl-utils/str-args.h"
 
 using namespace cljcr;
 
@@ -146,8 +147,76 @@ TFEATURE( "ValueConstraint" )
     TTEST( vc.is_float() == false );
 }
 
+TFEATURE( "ValueConstraint - copying" )
+{
+    ValueConstraint vc_string;
+    vc_string = "/regex/";
+    ValueConstraint vc_int;
+    vc_int = int64( -5 );
+
+    ValueConstraint vc_copy( vc_string );
+    TTEST( vc_copy.is_string() == true );
+    TTEST( vc_copy.as_string() == "/regex/" );
+    TSETUP( vc_string = "/other/" );
+    TTEST( vc_copy.as_string() == "/regex/" );    // Copy has its own string
+
+    TSETUP( vc_copy = vc_int );
+    TTEST( vc_copy.is_int() == true );
+    TTEST( vc_copy.as_int() == -5 );
+
+    TSETUP( vc_copy = vc_string );
+    TTEST( vc_copy.is_string() == true );
+    TTEST( vc_copy.as_string() == "/other/" );
+
+    TSETUP( vc_copy = vc_copy );
+    TTEST( vc_copy.as_string() == "/other/" );
+
+    TSETUP( vc_copy.clear() );
+    TTEST( vc_copy.is_set() == false );
+}
+
+TFEATURE( "Annotations" )
+{
+    Annotations a;
+    TTEST( a.is_not == false );
+    TTEST( a.is_defaulted == false );
+    TTEST( a.default_value() == "" );
+    TTEST( a.format() == "" );
+    TTEST( a.augments().empty() );
+
+    TSETUP( a.is_not = true );
+    TSETUP( a.set_default_value( "10" ) );
+    TSETUP( a.set_format( "date-time" ) );
+    SymbolTable symbols;
+    TargetRule tr;
+    tr.rule_name = symbols.intern( "r1" );
+    TSETUP( a.add_augments( tr ) );
+
+    Annotations a_copy( a );
+    TTEST( a_copy.is_not == true );
+    TTEST( a_copy.default_value() == "10" );
+    TTEST( a_copy.format() == "date-time" );
+    TTEST( a_copy.augments().size() == 1 );
+    TSETUP( a.set_default_value( "20" ) );
+    TTEST( a_copy.default_value() == "10" );  // Copy has its own detail
+
+    Annotations a_merged;
+    a_merged.is_defaulted = true;
+    a_merged.set_default_value( "30" );
+    TSETUP( a_merged.merge( a_copy ) );
+    TTEST( a_merged.is_not == true );
+    TTEST( a_merged.default_value() == "30" );    // a_copy isn't defaulted
+    TTEST( a_merged.format() == "date-time" );
+    TTEST( a_merged.augments().size() == 1 );
+
+    TSETUP( a_copy = Annotations() );
+    TTEST( a_copy.is_not == false );
+    TTEST( a_copy.default_value() == "" );
+}
+
 TFEATURE( "MemberName" )
 {
+    SymbolTable symbols;
     MemberName mn;
 
     TTEST( mn.is_absent() == true );
@@ -155,13 +224,13 @@ TFEATURE( "MemberName" )
     TTEST( mn.is_regex() == false );
     TTEST( mn.name() == "" );
 
-    TSETUP( mn.set_literal( "foo" ) );
+    TSETUP( mn.set_literal( symbols.intern( "foo" ) ) );
     TTEST( mn.is_absent() == false );
     TTEST( mn.is_literal() == true );
     TTEST( mn.is_regex() == false );
     TTEST( mn.name() == "foo" );
 
-    TSETUP( mn.set_regex( "/name*/i" ) );
+    TSETUP( mn.set_regex( symbols.intern( "/name*/i" ) ) );
     TTEST( mn.is_absent() == false );
     TTEST( mn.is_literal() == false );
     TTEST( mn.is_regex() == true );
@@ -169,7 +238,7 @@ TFEATURE( "MemberName" )
     TTEST( mn.pattern() == "name*" );
     TTEST( mn.modifiers() == "i" );
 
-    TSETUP( mn.set_regex( "//" ) );
+    TSETUP( mn.set_regex( symbols.intern( "//" ) ) );
     TTEST( mn.pattern() == "" );
     TTEST( mn.modifiers() == "" );
 
@@ -179,7 +248,7 @@ TFEATURE( "MemberName" )
     TTEST( mn.is_regex() == false );
     TTEST( mn.name() == "" );
 
-    TSETUP( mn.set_literal( "foo" ) );
+    TSETUP( mn.set_literal( symbols.intern( "foo" ) ) );
     TTEST( mn.is_literal() == true );
     TSETUP( mn.clear() );
     TTEST( mn.is_absent() == true );
@@ -193,6 +262,53 @@ TFEATURE( "TargetRule" )
     TargetRule tr;
 
     TTEST( ! tr.p_rule );
+    TTEST( tr.rule_name.empty() );
+    TTEST( tr.ruleset_id.empty() );
+
+    SymbolTable symbols;
+    TSETUP( tr.rule_name = symbols.intern( "r1" ) );
+    TSETUP( tr.ruleset_id = symbols.intern( "g1" ) );
+    TSETUP( tr.clear() );
+    TTEST( tr.rule_name.empty() );
+    TTEST( tr.ruleset_id.empty() );
+}
+
+TFEATURE( "SymbolTable" )
+{
+    SymbolTable symbols;
+    TTEST( symbols.size() == 1 );   // The empty identifier is always present
+
+    Symbol empty( symbols.intern( "" ) );
+    TTEST( empty == Symbol() );
+    TTEST( empty.id() == 0 );
+    TTEST( empty.empty() );
+    TTEST( empty == "" );
+
+    Symbol foo( symbols.intern( "foo" ) );
+    Symbol bar( symbols.intern( std::string( "bar" ) ) );
+    TTEST( symbols.size() == 3 );
+    TTEST( foo.id() == 1 );
+    TTEST( bar.id() == 2 );
+    TTEST( ! foo.empty() );
+    TTEST( foo == "foo" );
+    TTEST( foo != "bar" );
+    TTEST( foo.str() == "foo" );
+    TTEST( std::string( foo.c_str() ) == "foo" );
+    TTEST( foo != bar );
+
+    // Each distinct identifier is stored once
+    TTEST( symbols.intern( "foo" ) == foo );
+    TTEST( symbols.intern( "foox", 3 ) == foo );
+    TTEST( symbols.size() == 3 );
+
+    TTEST( symbols[1] == foo );
+    TTEST( symbols[2] == bar );
+
+    TTEST( symbols.find( "bar" ) == bar );
+    TTEST( symbols.find( "baz" ) == Symbol() );
+    TTEST( symbols.is_interned( "bar" ) );
+    TTEST( ! symbols.is_interned( "baz" ) );
+    TTEST( symbols.size() == 3 );
 }
 
 TFEATURE( "Rule" )
@@ -227,24 +343,24 @@ TFEATURE( "Post-link Rule" )
     GrammarSet gs;
     Grammar * p_g = gs.append_grammar( "<local>" );
     Rule def( p_g, 100, 102 );  // Can use a local rule here (rather than heap allocated) because we don't assign it to a Grammar's ownership
-    def.rule_name = "def";
+    def.rule_name = p_g->intern( "def" );
     def.repetition.min = 100;
     def.repetition.max = 101;
     def.annotations.is_root = true;
     def.type = Rule::TARGET_RULE;
     def.child_combiner = Rule::None;
-    def.target_rule.rule_name = "rule";
+    def.target_rule.rule_name = p_g->intern( "rule" );
 
     Rule rule( p_g, 300, 502 );
-    rule.rule_name = "rule";
+    rule.rule_name = p_g->intern( "rule" );
     rule.annotations.is_not = true;
-    rule.member_name.set_literal( "rule" );
+    rule.member_name.set_literal( p_g->intern( "rule" ) );
     rule.type = Rule::TARGET_RULE;
     rule.child_combiner = Rule::None;
-    rule.target_rule.rule_name = "type";
+    rule.target_rule.rule_name = p_g->intern( "type" );
 
     Rule type( p_g, 400, 602 );
-    type.rule_name = "type";
+    type.rule_name = p_g->intern( "type" );
     type.annotations.is_unordered = true;
     type.type = Rule::OBJECT;
     type.min = "min";   // Inconsistent with "type = Rule::OBJECT" to aid testing
@@ -342,10 +458,10 @@ TFEATURE( "Grammar::find_rule()" )
     GrammarSet gs;
     Grammar * p_g = gs.append_grammar( "<local>" );
     Rule::uniq_ptr pu_r1( new Rule( p_g, 0, 0 ) );
-    pu_r1->rule_name = "r1";
+    pu_r1->rule_name = p_g->intern( "r1" );
     Rule * p_r1 = p_g->append_rule( pu_r1 ); // pu_r1 releases ownership here
     Rule::uniq_ptr pu_r2( new Rule( p_g, 0, 0 ) );
-    pu_r2->rule_name = "r2";
+    pu_r2->rule_name = p_g->intern( "r2" );
     Rule * p_r2 = p_g->append_rule( pu_r2 ); // pu_r2 releases ownership here
 
     TTEST( p_g->find_rule( "r1" ) == p_r1 );
@@ -362,9 +478,9 @@ TFEATURE( "GrammarSet::find_grammar()" )
 {
     GrammarSet gs;
     Grammar * p_g1 = gs.append_grammar( "<local>" );
-    p_g1->ruleset_id = "g1";
+    p_g1->ruleset_id = p_g1->intern( "g1" );
     Grammar * p_g2 = gs.append_grammar( "<local>" );
-    p_g2->ruleset_id = "g2";
+    p_g2->ruleset_id = p_g2->intern( "g2" );
 
     TTEST( gs.find_grammar( "g1" ) == p_g1 );
     TTEST( gs.find_grammar( "g2" ) == p_g2 );
@@ -376,4 +492,315 @@ TFEATURE( "GrammarSet::find_grammar()" )
     TTEST( r_const_gs.find_grammar( "g3" ) == 0 );
 }
 
+TFEATURE( "MonotonicArena" )
+{
+    MonotonicArena arena;
+    TTEST( arena.block_count() == 0 );
+    TTEST( arena.bytes_allocated() == 0 );
+
+    char * p_1 = static_cast< char * >( arena.allocate( 1 ) );
+    char * p_2 = static_cast< char * >( arena.allocate( 3 ) );
+    TTEST( arena.block_count() == 1 );
+    TTEST( p_2 > p_1 );
+    TTEST( reinterpret_cast< size_t >( p_2 ) % sizeof( double ) == 0 );
+
+    void * p_big = arena.allocate( 1024 * 1024 * 4 );
+    TTEST( p_big != 0 );
+    TTEST( arena.block_count() == 2 );
+
+    // An oversized request gets a block of its own, and the current block
+    // continues to be used
+    char * p_3 = static_cast< char * >( arena.allocate( 8 ) );
+    TTEST( arena.block_count() == 2 );
+    TTEST( p_3 > p_2 );
+    TTEST( p_3 < p_1 + 16 * 1024 );
+
+    MonotonicArena other_arena;
+    other_arena.allocate( 10 );
+    size_t n_bytes = arena.bytes_allocated() + other_arena.bytes_allocated();
+    arena.splice( other_arena );
+    TTEST( arena.block_count() == 3 );
+    TTEST( arena.bytes_allocated() == n_bytes );
+    TTEST( other_arena.block_count() == 0 );
+    TTEST( other_arena.bytes_allocated() == 0 );
+}
+
+TFEATURE( "MonotonicArena - first block size" )
+{
+    MonotonicArena arena( 256 );
+    arena.allocate( 200 );
+    TTEST( arena.block_count() == 1 );
+    arena.allocate( 200 );
+    TTEST( arena.block_count() == 2 );
+    arena.allocate( 200 );      // The second block is twice the size of the first
+    TTEST( arena.block_count() == 2 );
+
+    // An oversized request doesn't double the size of later blocks
+    arena.allocate( 2000 );
+    TTEST( arena.block_count() == 3 );
+    arena.allocate( 200 );      // A new block of 1024 bytes, the next size after 512
+    TTEST( arena.block_count() == 4 );
+    arena.allocate( 1000 );     // Would fit had the block been 2048 bytes
+    TTEST( arena.block_count() == 5 );
+
+    // Without a current block, an oversized block is kept until released
+    MonotonicArena empty_arena( 256 );
+    empty_arena.allocate( 1000 );
+    TTEST( empty_arena.block_count() == 1 );
+    empty_arena.allocate( 8 );
+    TTEST( empty_arena.block_count() == 2 );
+    empty_arena.allocate( 8 );
+    TTEST( empty_arena.block_count() == 2 );
+}
+
+TFEATURE( "GrammarSet arena allocation" )
+{
+    GrammarSet gs;
+    Grammar * p_g = gs.append_grammar( "<local>" );
+    TTEST( gs.arena().block_count() == 0 );     // Grammars are allocated from the heap
+    TTEST( p_g->arena.block_count() == 0 );
+    size_t n_bytes = gs.arena().bytes_allocated();
+
+    // Heap and arena allocated Rules can be mixed in the same Grammar
+    Rule::uniq_ptr pu_r1( new Rule( p_g, 0, 0 ) );
+    pu_r1->rule_name = p_g->intern( "r1" );
+    p_g->append_rule( pu_r1 );
+    TTEST( gs.arena().bytes_allocated() == n_bytes );
+    Rule::uniq_ptr pu_r2( new( gs.arena() ) Rule( p_g, 0, 0 ) );
+    pu_r2->rule_name = p_g->intern( "r2" );
+    Rule * p_r2 = p_g->append_rule( pu_r2 );
+    TTEST( gs.arena().bytes_allocated() > n_bytes );
+    TTEST( p_g->find_rule( "r2" ) == p_r2 );
+
+    // Deleting an arena allocated object runs its destructor only
+    Rule::uniq_ptr pu_r3( new( gs.arena() ) Rule( p_g, 0, 0 ) );
+    pu_r3.reset();
+    TTEST( gs.arena().block_count() == 1 );
+}
+
+TFEATURE( "Grammar::find_rule() - index" )
+{
+    GrammarSet gs;
+    Grammar * p_g = gs.append_grammar( "<local>" );
+    Rule::uniq_ptr pu_r1( new Rule( p_g, 0, 0 ) );
+    pu_r1->rule_name = p_g->intern( "r1" );
+    Rule * p_r1 = p_g->append_rule( pu_r1 );
+
+    TTEST( p_g->find_rule( "r1" ) == p_r1 );
+    TTEST( p_g->find_rule( "r2" ) == 0 );
+    TTEST( p_g->find_rule( "" ) == 0 );   // Can't find an unnamed rule
+
+    // Rules appended after a look up are found by later look ups
+    Rule::uniq_ptr pu_r2( new Rule( p_g, 0, 0 ) );
+    pu_r2->rule_name = p_g->intern( "r2" );
+    Rule * p_r2 = p_g->append_rule( pu_r2 );
+    TTEST( p_g->find_rule( "r2" ) == p_r2 );
+    TTEST( p_g->find_rule( p_g->intern( "r2" ) ) == p_r2 );
+
+    // Only the first of duplicate rule names is found
+    Rule::uniq_ptr pu_r2_duplicate( new Rule( p_g, 0, 0 ) );
+    pu_r2_duplicate->rule_name = p_g->intern( "r2" );
+    p_g->append_rule( pu_r2_duplicate );
+    TTEST( p_g->find_rule( "r2" ) == p_r2 );
+
+    // Renaming rules after they have been looked up requires a reindex
+    TSETUP( p_r1->rule_name = p_g->intern( "r3" ) );
+    TSETUP( p_g->reindex_rules() );
+    TTEST( p_g->find_rule( "r1" ) == 0 );
+    TTEST( p_g->find_rule( "r3" ) == p_r1 );
+}
+
+TFEATURE( "GrammarSet::find_grammar() - index" )
+{
+    GrammarSet gs;
+    Grammar * p_g1 = gs.append_grammar( "<local>" );
+    p_g1->ruleset_id = p_g1->intern( "g1" );
+    Grammar * p_unnamed = gs.append_grammar( "<local>" );
+
+    TTEST( gs.find_grammar( "g1" ) == p_g1 );
+    TTEST( gs.find_grammar( "g2" ) == 0 );
+    TTEST( gs.find_grammar( "" ) == 0 );  // Can't find an unnamed grammar
+
+    // Grammars appended after a look up are found by later look ups
+    Grammar * p_g2 = gs.append_grammar( "<local>" );
+    p_g2->ruleset_id = p_g2->intern( "g2" );
+    TTEST( gs.find_grammar( "g2" ) == p_g2 );
+    TTEST( gs.find_grammar( gs.intern( "g2" ) ) == p_g2 );
+
+    // Only the first of duplicate ruleset ids is found
+    Grammar * p_g2_duplicate = gs.append_grammar( "<local>" );
+    p_g2_duplicate->ruleset_id = p_g2_duplicate->intern( "g2" );
+    TTEST( gs.find_grammar( "g2" ) == p_g2 );
+
+    // Naming grammars after they have been looked up requires a reindex
+    TSETUP( p_unnamed->ruleset_id = p_unnamed->intern( "g3" ) );
+    TSETUP( gs.reindex_grammars() );
+    TTEST( gs.find_grammar( "g3" ) == p_unnamed );
+}
+
+TFEATURE( "GrammarSet::splice()" )
+{
+    GrammarSet gs;
+    Grammar * p_g1 = gs.append_grammar( "<g1>" );
+    p_g1->ruleset_id = p_g1->intern( "g1" );
+
+    GrammarSet other_gs;
+    Grammar * p_g2 = other_gs.append_grammar( "<g2>" );
+    p_g2->ruleset_id = p_g2->intern( "g2" );
+    Rule::uniq_ptr pu_r1( new( other_gs.arena() ) Rule( p_g2, 0, 0 ) );
+    pu_r1->rule_name = p_g2->intern( "r1" );
+    pu_r1->member_name.set_literal( p_g2->intern( "m1" ) );
+    Rule::uniq_ptr pu_child( new( other_gs.arena() ) Rule( p_g2, 0, 0 ) );
+    pu_child->target_rule.ruleset_id = p_g2->intern( "g1" );
+    pu_child->target_rule.rule_name = p_g2->intern( "r0" );
+    Rule * p_child = pu_r1->append_child_rule( pu_child );
+    Rule * p_r1 = p_g2->append_rule( pu_r1 );
+    TTEST( p_g2->find_rule( "r1" ) == p_r1 );
+    other_gs.inc_warning_count();
+
+    TSETUP( gs.splice( other_gs ) );
+
+    TCRITICALTEST( gs.size() == 2 );
+    TTEST( &gs[1] == p_g2 );
+    TTEST( p_g2->p_grammar_set == &gs );
+    TTEST( other_gs.size() == 0 );
+    TTEST( other_gs.arena().block_count() == 0 );
+    TTEST( gs.warning_count() == 1 );
+
+    // Names now refer to the SymbolTable of the GrammarSet spliced into
+    TTEST( p_g2->ruleset_id == gs.symbols().find( "g2" ) );
+    TTEST( p_r1->rule_name == gs.symbols().find( "r1" ) );
+    TTEST( p_r1->member_name.is_literal() );
+    TTEST( p_r1->member_name.name_symbol() == gs.symbols().find( "m1" ) );
+    TTEST( p_child->target_rule.ruleset_id == p_g1->ruleset_id );
+    TTEST( p_child->target_rule.rule_name == gs.symbols().find( "r0" ) );
+    TTEST( gs.symbols().size() == 6 );   // "", "g1", "g2", "r1", "m1", "r0"
+
+    TTEST( gs.find_grammar( "g2" ) == p_g2 );
+    TTEST( p_g2->find_rule( "r1" ) == p_r1 );
+}
+
+TFEATURE( "clutils::str_arg_refs" )
+{
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( 0 ) ) == "0" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( 9 ) ) == "9" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( 10 ) ) == "10" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( 99 ) ) == "99" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( 100 ) ) == "100" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( 12345 ) ) == "12345" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( -1 ) ) == "-1" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( -987 ) ) == "-987" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( 4294967295U ) ) == "4294967295" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( -9223372036854775807LL - 1 ) ) == "-9223372036854775808" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( 18446744073709551615ULL ) ) == "18446744073709551615" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( size_t( 42 ) ) ) == "42" );
+
+    std::string text( "text" );
+    SymbolTable symbols;
+    Symbol symbol = symbols.intern( "r1" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( text ) ) == "text" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( "chars" ) ) == "chars" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( clutils::str_arg( "chars", 3 ) ) ) == "cha" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( 'c' ) ) == "c" );
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( symbol ) ) == "r1" );     // Using str_arg_append()
+    TTEST( clutils::expand( "%0", clutils::str_arg_refs( 1.5 ) ) == "1.5" );       // Using operator <<()
+
+    TDOC( "Formats are expanded as for str_args" );
+    const char * formats[] = {
+            "No parameters",
+            "%0 at (%1, %2)",
+            "%1%0%1",
+            "100%% %0",
+            "Long form %{1:second} %{0:first}",
+            "Named %{line} %{name}",
+            "Standalone %x and trailing %" };
+    for( size_t i=0; i<sizeof( formats ) / sizeof( formats[0] ); ++i )
+    {
+        std::string expected = clutils::expand( formats[i], clutils::str_args( text ) << 3 << -7 << "name" << symbol << "line" << 12 );
+        TTEST( clutils::expand( formats[i], clutils::str_arg_refs( text ) << 3 << -7 << "name" << symbol << "line" << 12 ) == expected );
+    }
+    TTEST( clutils::expand( "%0 at (%1, %2)", clutils::str_arg_refs( text ) << 3 << -7 ) == "text at (3, -7)" );
+    TTEST( clutils::expand( "Named %{line} %{name}", clutils::str_arg_refs( "name" ) << symbol << "line" << 12 ) == "Named 12 r1" );
+
+    TDOC( "Expanding into a reused buffer" );
+    std::string buffer( "Error: " );
+    TTEST( clutils::expand_append( &buffer, "'%0' at %1", clutils::str_arg_refs( text ) << 12 ) == "Error: 'text' at 12" );
+    buffer.clear();
+    TTEST( clutils::expand_append( &buffer, "%0", clutils::str_arg_refs( 7 ) ) == "7" );
+
+    TDOC( "Too many arguments" );
+    clutils::str_arg_refs args;
+    for( size_t i=0; i<clutils::str_arg_refs::max_size; ++i )
+        args << i;
+    TTEST( args.size() == clutils::str_arg_refs::max_size );
+    bool is_thrown = false;
+    try { args << 10; }
+    catch( clutils::str_argsOutOfRangeException & ) { is_thrown = true; }
+    TTEST( is_thrown );
+}
+
+TFEATURE( "Diagnostics" )
+{
+    {
+    Diagnostics diagnostics;
+    TTEST( diagnostics.empty() );
+
+    const char * p_format = "Unable to find Target rule '%0' for global rule '$%1'";
+    TTEST( diagnostics.add( "a.jcr", 3, 7, Severity::ERROR, p_format, clutils::str_arg_refs( "$r2" ) << "r1" ) );
+    TTEST( diagnostics.add( "a.jcr", 5, 1, Severity::WARNING, "Plain message" ) );
+    TTEST( diagnostics.add_text( "b.jcr", ~0U, ~0U, Severity::ERROR, "Formatted message" ) );
+    TCRITICALTEST( diagnostics.size() == 3 );
+
+    const Diagnostic & r_first = diagnostics[0];
+    TTEST( r_first.p_code == p_format );
+    TTEST( diagnostics.source( r_first ) == "a.jcr" );
+    TTEST( r_first.line == 3 );
+    TTEST( r_first.column == 7 );
+    TTEST( r_first.severity == Severity::ERROR );
+    TCRITICALTEST( r_first.n_args == 2 );
+    TTEST( diagnostics.arg( r_first, 0 ) == "$r2" );
+    TTEST( diagnostics.arg( r_first, 1 ) == "r1" );
+    TTEST( diagnostics.message( r_first ) == "Unable to find Target rule '$r2' for global rule '$r1'" );
+
+    const Diagnostic & r_second = diagnostics[1];
+    TTEST( r_second.source_id == r_first.source_id );
+    TTEST( r_second.n_args == 0 );
+    TTEST( diagnostics.message( r_second ) == "Plain message" );
+
+    const Diagnostic & r_third = diagnostics[2];
+    TTEST( r_third.source_id != r_first.source_id );
+    TTEST( diagnostics.source( r_third ) == "b.jcr" );
+    TTEST( r_third.line == ~0U );
+    TTEST( r_third.column == ~0U );
+    TTEST( diagnostics.message( r_third ) == "Formatted message" );
+
+    // Duplicates are not recorded again
+    TTEST( ! diagnostics.add( "a.jcr", 3, 7, Severity::ERROR, p_format, clutils::str_arg_refs( "$r2" ) << "r1" ) );
+    TTEST( ! diagnostics.add( "a.jcr", 5, 1, Severity::WARNING, "Plain message" ) );
+    TTEST( ! diagnostics.add_text( "b.jcr", ~0U, ~0U, Severity::ERROR, "Formatted message" ) );
+    TTEST( diagnostics.size() == 3 );
+    TTEST( diagnostics.arg( diagnostics[0], 1 ) == "r1" );
+
+    // Messages that differ in any part are recorded
+    TTEST( diagnostics.add( "a.jcr", 3, 7, Severity::ERROR, p_format, clutils::str_arg_refs( "$r2" ) << "r3" ) );
+    TTEST( diagnostics.add( "a.jcr", 3, 7, Severity::ERROR, p_format, clutils::str_arg_refs( "$r" ) << "2r1" ) );
+    TTEST( diagnostics.add( "a.jcr", 3, 8, Severity::ERROR, p_format, clutils::str_arg_refs( "$r2" ) << "r1" ) );
+    TTEST( diagnostics.add( "b.jcr", 3, 7, Severity::ERROR, p_format, clutils::str_arg_refs( "$r2" ) << "r1" ) );
+    TTEST( diagnostics.add( "a.jcr", 5, 1, Severity::ERROR, "Plain message" ) );
+    TTEST( diagnostics.size() == 8 );
+    TTEST( diagnostics.message( diagnostics[4] ) == "Unable to find Target rule '$r' for global rule '$2r1'" );
+
+    TSETUP( diagnostics.clear() );
+    TTEST( diagnostics.empty() );
+    TTEST( diagnostics.add( "a.jcr", 5, 1, Severity::WARNING, "Plain message" ) );
+    }
+    {
+    TDOC( "Keeping duplicates" );
+    Diagnostics diagnostics( true );
+    TTEST( diagnostics.add( "a.jcr", 5, 1, Severity::WARNING, "Plain message" ) );
+    TTEST( diagnostics.add( "a.jcr", 5, 1, Severity::WARNING, "Plain message" ) );
+    TTEST( diagnostics.size() == 2 );
+    }
+}
+
 TFEATURETODO( "Test low level GrammarSet class" );
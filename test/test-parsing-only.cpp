@@ -34,11 +34,19 @@
 #include "clunit.h"
 
 #include "cl-jcr-parser/parser.h"
+#include "dsl-pa/dsl-pa-reader.h"
+#include "cl-utils/str-args.h"
 
 using namespace cljcr;
 
 #include "test-parser-harness.h"
 
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <set>
+#include <sstream>
+
 void test_parsing_only( const char * p_jcr )
 {
     TDOC( p_jcr );
@@ -2727,7 +2735,7 @@ TFEATURE( "GrammarParser - Syntax parsing - annotations" )
         TCRITICALTEST( ph.status() == JCRParser::S_OK );
         TCRITICALTEST( ph.grammar().rules.size() == 1 );
         TTEST( ph.grammar().rules[0].annotations.is_defaulted );
-        TTEST( ph.grammar().rules[0].annotations.default_value == "false" );
+        TTEST( ph.grammar().rules[0].annotations.default_value() == "false" );
     }
 
     {
@@ -2735,7 +2743,7 @@ TFEATURE( "GrammarParser - Syntax parsing - annotations" )
         TCRITICALTEST( ph.status() == JCRParser::S_OK );
         TCRITICALTEST( ph.grammar().rules.size() == 1 );
         TTEST( ph.grammar().rules[0].annotations.is_defaulted );
-        TTEST( ph.grammar().rules[0].annotations.default_value == "null" );
+        TTEST( ph.grammar().rules[0].annotations.default_value() == "null" );
     }
 
     {
@@ -2743,7 +2751,7 @@ TFEATURE( "GrammarParser - Syntax parsing - annotations" )
         TCRITICALTEST( ph.status() == JCRParser::S_OK );
         TCRITICALTEST( ph.grammar().rules.size() == 1 );
         TTEST( ph.grammar().rules[0].annotations.is_defaulted );
-        TTEST( ph.grammar().rules[0].annotations.default_value == "true" );
+        TTEST( ph.grammar().rules[0].annotations.default_value() == "true" );
     }
 
     {
@@ -2751,7 +2759,7 @@ TFEATURE( "GrammarParser - Syntax parsing - annotations" )
         TCRITICALTEST( ph.status() == JCRParser::S_OK );
         TCRITICALTEST( ph.grammar().rules.size() == 1 );
         TTEST( ph.grammar().rules[0].annotations.is_defaulted );
-        TTEST( ph.grammar().rules[0].annotations.default_value == "10" );
+        TTEST( ph.grammar().rules[0].annotations.default_value() == "10" );
     }
 
     {
@@ -2759,7 +2767,7 @@ TFEATURE( "GrammarParser - Syntax parsing - annotations" )
         TCRITICALTEST( ph.status() == JCRParser::S_OK );
         TCRITICALTEST( ph.grammar().rules.size() == 1 );
         TTEST( ph.grammar().rules[0].annotations.is_defaulted );
-        TTEST( ph.grammar().rules[0].annotations.default_value == "10.1" );
+        TTEST( ph.grammar().rules[0].annotations.default_value() == "10.1" );
     }
 
     {
@@ -2767,9 +2775,597 @@ TFEATURE( "GrammarParser - Syntax parsing - annotations" )
         TCRITICALTEST( ph.status() == JCRParser::S_OK );
         TCRITICALTEST( ph.grammar().rules.size() == 1 );
         TTEST( ph.grammar().rules[0].annotations.is_defaulted );
-        TTEST( ph.grammar().rules[0].annotations.default_value == "\"open\"" );
+        TTEST( ph.grammar().rules[0].annotations.default_value() == "\"open\"" );
     }
 
     TCALL( test_parsing_bad_input(
                         "$my_rule=[@{unknown}string,float ]\n" ) );
 }
+
+void test_parsing_file( const char * p_jcr )
+{
+    TDOC( p_jcr );
+    const char * p_file_name = "test-parsing-file.jcr";
+    {
+    std::ofstream fout( p_file_name, std::ios::binary );
+    fout << p_jcr;
+    }
+
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    JCRParser::Status status = jcr_parser.add_grammar( p_file_name );
+    remove( p_file_name );
+
+    TCRITICALTEST( status == JCRParser::S_OK );
+    TTEST( grammar_set.size() == 1 );
+    TTEST( grammar_set[0].jcr_source == p_file_name );
+}
+
+TFEATURE( "GrammarParser - Names are interned in the GrammarSet's SymbolTable" )
+{
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    const char * p_jcr = "#ruleset-id rs\n$r1 = { \"name\" : string }\n$r2 = { \"name\" : $r1 }\n";
+    TCRITICALTEST( jcr_parser.add_grammar( p_jcr, strlen( p_jcr ) ) == JCRParser::S_OK );
+
+    const Grammar & r_grammar = grammar_set[0];
+    TCRITICALTEST( r_grammar.rules.size() == 2 );
+    TCRITICALTEST( r_grammar.rules[0].children.size() == 1 );
+    TCRITICALTEST( r_grammar.rules[1].children.size() == 1 );
+    const Rule & r_r1_child = r_grammar.rules[0].children[0];
+    const Rule & r_r2_child = r_grammar.rules[1].children[0];
+
+    TTEST( r_grammar.ruleset_id == grammar_set.symbols().find( "rs" ) );
+    TTEST( r_grammar.rules[0].rule_name == grammar_set.symbols().find( "r1" ) );
+    TTEST( r_r1_child.member_name.name_symbol() == r_r2_child.member_name.name_symbol() );
+    TTEST( r_r1_child.member_name.name_symbol() == grammar_set.symbols().find( "name" ) );
+    TTEST( r_r2_child.target_rule.rule_name == r_grammar.rules[0].rule_name );
+    TTEST( grammar_set.symbols().size() == 5 );     // "", "rs", "r1", "name", "r2"
+}
+
+TFEATURE( "JCRParser::add_grammar() - from file" )
+{
+    TCALL( test_parsing_file( "" ) );
+    TCALL( test_parsing_file( "; Hello World\n" ) );
+    TCALL( test_parsing_file(
+                        "#ruleset-id my_rules\n"
+                        "$my_rule=[ integer, string ]\n" ) );
+
+    {
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    TTEST( jcr_parser.add_grammar( "test-parsing-file-that-does-not-exist.jcr" ) == JCRParser::S_UNABLE_TO_OPEN_FILE );
+    }
+}
+
+TFEATURE( "JCRParser::add_grammar() - from reader" )
+{
+    const char * p_jcr = "$my_rule = uint32\n";
+    cl::reader_string reader( p_jcr );
+
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    TCRITICALTEST( jcr_parser.add_grammar( reader, "my-source" ) == JCRParser::S_OK );
+    TCRITICALTEST( grammar_set.size() == 1 );
+    TTEST( grammar_set[0].jcr_source == "my-source" );
+    TCRITICALTEST( grammar_set[0].rules.size() == 1 );
+    TTEST( grammar_set[0].rules[0].rule_name == "my_rule" );
+    TTEST( grammar_set[0].rules[0].type == Rule::UINTEGER );
+}
+
+void test_same_constraint( const ValueConstraint & r_lhs, const ValueConstraint & r_rhs )
+{
+    TTEST( r_lhs.is_set() == r_rhs.is_set() );
+    TTEST( r_lhs.is_string() == r_rhs.is_string() );
+    TTEST( r_lhs.is_bool() == r_rhs.is_bool() );
+    TTEST( r_lhs.is_int() == r_rhs.is_int() );
+    TTEST( r_lhs.is_uint() == r_rhs.is_uint() );
+    TTEST( r_lhs.is_float() == r_rhs.is_float() );
+    if( r_rhs.is_string() && r_lhs.is_string() )
+        TTEST( r_lhs.as_string() == r_rhs.as_string() );
+    if( r_rhs.is_bool() && r_lhs.is_bool() )
+        TTEST( r_lhs.as_bool() == r_rhs.as_bool() );
+    if( r_rhs.is_int() && r_lhs.is_int() )
+        TTEST( r_lhs.as_int() == r_rhs.as_int() );
+    if( r_rhs.is_uint() && r_lhs.is_uint() )
+        TTEST( r_lhs.as_uint() == r_rhs.as_uint() );
+    if( r_rhs.is_float() && r_lhs.is_float() )
+        TTEST( r_lhs.as_float() == r_rhs.as_float() );
+}
+
+void test_same_rule( const Rule & r_lhs, const Rule & r_rhs )
+{
+    TTEST( r_lhs.type == r_rhs.type );
+    TTEST( r_lhs.child_combiner == r_rhs.child_combiner );
+    TTEST( r_lhs.repetition.min == r_rhs.repetition.min );
+    TTEST( r_lhs.repetition.max == r_rhs.repetition.max );
+    TTEST( r_lhs.repetition.step == r_rhs.repetition.step );
+    TTEST( r_lhs.annotations.is_not == r_rhs.annotations.is_not );
+    TTEST( r_lhs.annotations.is_unordered == r_rhs.annotations.is_unordered );
+    TTEST( r_lhs.annotations.is_root == r_rhs.annotations.is_root );
+    TTEST( r_lhs.annotations.is_exclude_min == r_rhs.annotations.is_exclude_min );
+    TTEST( r_lhs.annotations.is_exclude_max == r_rhs.annotations.is_exclude_max );
+    TTEST( r_lhs.annotations.is_defaulted == r_rhs.annotations.is_defaulted );
+    TTEST( r_lhs.annotations.is_choice == r_rhs.annotations.is_choice );
+    TTEST( r_lhs.annotations.default_value() == r_rhs.annotations.default_value() );
+    TTEST( r_lhs.annotations.format() == r_rhs.annotations.format() );
+    TCRITICALTEST( r_lhs.annotations.augments().size() == r_rhs.annotations.augments().size() );
+    for( size_t i = 0; i < r_rhs.annotations.augments().size(); ++i )
+    {
+        TTEST( r_lhs.annotations.augments()[i].ruleset_id.str() == r_rhs.annotations.augments()[i].ruleset_id.str() );
+        TTEST( r_lhs.annotations.augments()[i].rule_name.str() == r_rhs.annotations.augments()[i].rule_name.str() );
+    }
+    TCALL( test_same_constraint( r_lhs.min, r_rhs.min ) );
+    TCALL( test_same_constraint( r_lhs.max, r_rhs.max ) );
+    TTEST( r_lhs.rule_name.str() == r_rhs.rule_name.str() );
+    TTEST( r_lhs.member_name.is_absent() == r_rhs.member_name.is_absent() );
+    TTEST( r_lhs.member_name.is_literal() == r_rhs.member_name.is_literal() );
+    TTEST( r_lhs.member_name.is_regex() == r_rhs.member_name.is_regex() );
+    TTEST( r_lhs.member_name.name() == r_rhs.member_name.name() );
+    TTEST( r_lhs.target_rule.ruleset_id.str() == r_rhs.target_rule.ruleset_id.str() );
+    TTEST( r_lhs.target_rule.rule_name.str() == r_rhs.target_rule.rule_name.str() );
+    TTEST( r_lhs.line_number == r_rhs.line_number );
+    TTEST( r_lhs.column_number == r_rhs.column_number );
+    TCRITICALTEST( r_lhs.children.size() == r_rhs.children.size() );
+    for( size_t i = 0; i < r_rhs.children.size(); ++i )
+    {
+        TTEST( r_lhs.children[i].p_parent == &r_lhs );
+        TCALL( test_same_rule( r_lhs.children[i], r_rhs.children[i] ) );
+    }
+}
+
+class ReportRecorder : public JCRParser
+{
+private:
+    std::string reports;
+
+public:
+    ReportRecorder( GrammarSet * p_grammar_set, bool is_exception_free ) : JCRParser( p_grammar_set )
+    {
+        set_exception_free( is_exception_free );
+    }
+    virtual void report( const std::string &, size_t line, size_t column, Severity severity, const char * p_message )
+    {
+        clutils::expand_append( &reports, "%0:%1:%2:%3\n", clutils::str_args( line ) << column << (severity == Severity::FATAL ? "F" : "E") << p_message );
+    }
+    const std::string & get_reports() const { return reports; }
+};
+
+void test_exception_free( const char * p_jcr )
+{
+    TDOC( p_jcr );
+
+    GrammarSet throwing_grammar_set;
+    ReportRecorder throwing_parser( &throwing_grammar_set, false );
+    TTEST( ! throwing_parser.is_exception_free() );
+    JCRParser::Status throwing_status = throwing_parser.add_grammar( p_jcr, strlen( p_jcr ) );
+
+    GrammarSet exception_free_grammar_set;
+    ReportRecorder exception_free_parser( &exception_free_grammar_set, true );
+    TTEST( exception_free_parser.is_exception_free() );
+    JCRParser::Status exception_free_status = exception_free_parser.add_grammar( p_jcr, strlen( p_jcr ) );
+
+    TTEST( throwing_status == JCRParser::S_ERROR );
+    TTEST( exception_free_status == throwing_status );
+    TTEST( ! throwing_parser.get_reports().empty() );
+    TTEST( exception_free_parser.get_reports() == throwing_parser.get_reports() );
+
+    // Rules that were being parsed when the fatal error occurred are discarded
+    TCRITICALTEST( exception_free_grammar_set.size() == throwing_grammar_set.size() );
+    for( size_t i = 0; i < throwing_grammar_set.size(); ++i )
+    {
+        const Grammar & r_throwing = throwing_grammar_set[i];
+        const Grammar & r_exception_free = exception_free_grammar_set[i];
+        TCRITICALTEST( r_exception_free.rules.size() == r_throwing.rules.size() );
+        for( size_t j = 0; j < r_throwing.rules.size(); ++j )
+            TCALL( test_same_rule( r_exception_free.rules[j], r_throwing.rules[j] ) );
+    }
+}
+
+TFEATURE( "JCRParser::set_exception_free()" )
+{
+    TCALL( test_exception_free( "$my_rule = " ) );
+    TCALL( test_exception_free( "$my_rule = [ integer, string" ) );
+    TCALL( test_exception_free( "$my_rule = { \"a\" : integer, \"b\" string }\n$other = integer\n" ) );
+    TCALL( test_exception_free( "$my_rule = ( integer | string\n; Comment\n$other = 01\n" ) );
+    TCALL( test_exception_free( "#jcr-version 0\n$my_rule = integer\n" ) );
+    TCALL( test_exception_free( "$my_rule = /abc\n" ) );
+    TCALL( test_exception_free( "$my_rule = \"abc\n" ) );
+    TCALL( test_exception_free( "$my_rule = : integer\n$my_rule = @{bad} integer\n" ) );
+    TCALL( test_exception_free( "$a = { \"x\" : integer, \"y\" : [ integer, @{not}" ) );
+    TCALL( test_exception_free( "$r = {...}\n$s = ( \"b\" : string | \"c\" : @{" ) );
+    TCALL( test_exception_free( "$r = integer\n[ $r, ( string | @{" ) );
+}
+
+void test_memoising( const char * p_jcr )
+{
+    TDOC( p_jcr );
+
+    GrammarSet plain_grammar_set;
+    JCRParser plain_parser( &plain_grammar_set );
+    TTEST( ! plain_parser.is_memoising() );
+    TCRITICALTEST( plain_parser.add_grammar( p_jcr, strlen( p_jcr ) ) == JCRParser::S_OK );
+
+    GrammarSet memoised_grammar_set;
+    JCRParser memoised_parser( &memoised_grammar_set );
+    memoised_parser.set_memoising( true );
+    TTEST( memoised_parser.is_memoising() );
+    TCRITICALTEST( memoised_parser.add_grammar( p_jcr, strlen( p_jcr ) ) == JCRParser::S_OK );
+
+    const Grammar & r_plain = plain_grammar_set[0];
+    const Grammar & r_memoised = memoised_grammar_set[0];
+    TCRITICALTEST( r_memoised.rules.size() == r_plain.rules.size() );
+    for( size_t i = 0; i < r_plain.rules.size(); ++i )
+    {
+        const Rule & r_plain_rule = r_plain.rules[i];
+        const Rule & r_memoised_rule = r_memoised.rules[i];
+        TTEST( r_memoised_rule.type == r_plain_rule.type );
+        TTEST( r_memoised_rule.column_number == r_plain_rule.column_number );
+        TTEST( r_memoised_rule.children.size() == r_plain_rule.children.size() );
+        TTEST( r_memoised_rule.annotations.is_not == r_plain_rule.annotations.is_not );
+        TTEST( r_memoised_rule.annotations.is_unordered == r_plain_rule.annotations.is_unordered );
+        TTEST( r_memoised_rule.annotations.is_root == r_plain_rule.annotations.is_root );
+        TTEST( r_memoised_rule.annotations.default_value() == r_plain_rule.annotations.default_value() );
+        TTEST( r_memoised_rule.annotations.augments().size() == r_plain_rule.annotations.augments().size() );
+    }
+}
+
+TFEATURE( "JCRParser::set_memoising()" )
+{
+    TCALL( test_memoising( "$my_rule = @{not} integer\n" ) );
+    TCALL( test_memoising( "$my_rule = @{not} @{unordered} [ integer, string ]\n" ) );
+    TCALL( test_memoising( "$my_rule = @{unordered} @{default 12} { \"a\" : @{not} string }\n" ) );
+    TCALL( test_memoising( "$my_rule = @{not} @{augments $other} ( $other | @{root} ( string | integer ) )\n$other = @{root} $my_rule\n" ) );
+    TCALL( test_memoising( "@{root} [ @{not} $my_rule * ]\n$my_rule = @{not}\n@{format date}\nstring\n" ) );
+}
+
+void write_file( const char * p_file_name, const char * p_jcr )
+{
+    std::ofstream fout( p_file_name, std::ios::binary );
+    fout << p_jcr;
+}
+
+TFEATURE( "JCRParser::add_grammars()" )
+{
+    const char * p_file_names[] = {
+            "test-parsing-files-1.jcr",
+            "test-parsing-files-2.jcr",
+            "test-parsing-file-that-does-not-exist.jcr",
+            "test-parsing-files-3.jcr" };
+    write_file( p_file_names[0], "#ruleset-id rs1\n$r1 = { \"name\" : string }\n" );
+    write_file( p_file_names[1], "#ruleset-id rs2\n#import rs1\n$r2 = [ $rs1.r1, $r3 ]\n$r2 = : integer\n" );
+    write_file( p_file_names[3], "$r3 = { \"name\" : $r2 }\n$r4 = @{bad} integer\n" );
+    std::vector< std::string > file_names( p_file_names, p_file_names + 4 );
+
+    GrammarSet sequential_grammar_set;
+    ReportRecorder sequential_parser( &sequential_grammar_set, false );
+    std::vector< JCRParser::Status > sequential_statuses;
+    JCRParser::Status sequential_status = sequential_parser.add_grammars( file_names, 1, &sequential_statuses );
+
+    GrammarSet threaded_grammar_set;
+    ReportRecorder threaded_parser( &threaded_grammar_set, false );
+    std::vector< JCRParser::Status > threaded_statuses;
+    JCRParser::Status threaded_status = threaded_parser.add_grammars( file_names, 4, &threaded_statuses );
+
+    for( size_t i = 0; i < file_names.size(); ++i )
+        remove( file_names[i].c_str() );
+
+    TTEST( sequential_status == JCRParser::S_ERROR );
+    TCRITICALTEST( sequential_statuses.size() == 4 );
+    TTEST( sequential_statuses[0] == JCRParser::S_OK );
+    TTEST( sequential_statuses[1] == JCRParser::S_ERROR );
+    TTEST( sequential_statuses[2] == JCRParser::S_UNABLE_TO_OPEN_FILE );
+    TTEST( sequential_statuses[3] == JCRParser::S_ERROR );
+    TTEST( sequential_grammar_set.error_count() == 1 );
+    TTEST( ! sequential_parser.get_reports().empty() );
+
+    // The outcome is the same whatever the number of threads
+    TTEST( threaded_status == sequential_status );
+    TTEST( threaded_statuses == sequential_statuses );
+    TTEST( threaded_parser.get_reports() == sequential_parser.get_reports() );
+    TTEST( threaded_grammar_set.error_count() == sequential_grammar_set.error_count() );
+    TTEST( threaded_grammar_set.symbols().size() == sequential_grammar_set.symbols().size() );
+    for( size_t i = 1; i < sequential_grammar_set.symbols().size(); ++i )
+        TTEST( threaded_grammar_set.symbols()[i] == sequential_grammar_set.symbols()[i].str() );
+    TCRITICALTEST( threaded_grammar_set.size() == 3 );
+    TCRITICALTEST( sequential_grammar_set.size() == 3 );
+    for( size_t i = 0; i < sequential_grammar_set.size(); ++i )
+    {
+        const Grammar & r_sequential = sequential_grammar_set[i];
+        const Grammar & r_threaded = threaded_grammar_set[i];
+        TTEST( r_threaded.jcr_source == r_sequential.jcr_source );
+        TTEST( r_threaded.p_grammar_set == &threaded_grammar_set );
+        TTEST( r_threaded.ruleset_id.id() == r_sequential.ruleset_id.id() );
+        TCRITICALTEST( r_threaded.rules.size() == r_sequential.rules.size() );
+        for( size_t j = 0; j < r_sequential.rules.size(); ++j )
+            TTEST( r_threaded.rules[j].rule_name.id() == r_sequential.rules[j].rule_name.id() );
+    }
+    TTEST( threaded_grammar_set[0].rules[0].children[0].member_name.name_symbol() ==
+            threaded_grammar_set[2].rules[0].children[0].member_name.name_symbol() );
+    TTEST( threaded_grammar_set.find_grammar( "rs2" ) == &threaded_grammar_set[1] );
+    TTEST( threaded_grammar_set[2].find_rule( "r3" ) == &threaded_grammar_set[2].rules[0] );
+
+    TTEST( threaded_parser.link() == sequential_parser.link() );
+    TTEST( threaded_parser.get_reports() == sequential_parser.get_reports() );
+}
+
+void test_feed( const char * p_jcr, size_t chunk_size )
+{
+    TDOC( p_jcr );
+    TDOC( clutils::expand( "Chunk size: %0", chunk_size ).c_str() );
+
+    GrammarSet whole_grammar_set;
+    ReportRecorder whole_parser( &whole_grammar_set, false );
+    JCRParser::Status whole_status = whole_parser.add_grammar( p_jcr, strlen( p_jcr ) );
+
+    GrammarSet fed_grammar_set;
+    ReportRecorder fed_parser( &fed_grammar_set, false );
+    fed_parser.begin_grammar( "<fed>" );
+    for( size_t i = 0; i < strlen( p_jcr ); i += chunk_size )
+        fed_parser.feed( p_jcr + i, std::min( chunk_size, strlen( p_jcr ) - i ) );
+    JCRParser::Status fed_status = fed_parser.end_grammar();
+
+    TTEST( fed_status == whole_status );
+    TTEST( fed_parser.get_reports() == whole_parser.get_reports() );
+    TTEST( fed_grammar_set.error_count() == whole_grammar_set.error_count() );
+    TCRITICALTEST( fed_grammar_set.size() == whole_grammar_set.size() );
+    TCRITICALTEST( fed_grammar_set.size() == 1 );
+    TTEST( fed_grammar_set[0].jcr_source == "<fed>" );
+    TCRITICALTEST( fed_grammar_set[0].rules.size() == whole_grammar_set[0].rules.size() );
+    for( size_t i = 0; i < whole_grammar_set[0].rules.size(); ++i )
+    {
+        const Rule & r_whole_rule = whole_grammar_set[0].rules[i];
+        const Rule & r_fed_rule = fed_grammar_set[0].rules[i];
+        TTEST( r_fed_rule.rule_name.id() == r_whole_rule.rule_name.id() );
+        TTEST( r_fed_rule.type == r_whole_rule.type );
+        TTEST( r_fed_rule.line_number == r_whole_rule.line_number );
+        TTEST( r_fed_rule.column_number == r_whole_rule.column_number );
+        TTEST( r_fed_rule.children.size() == r_whole_rule.children.size() );
+    }
+}
+
+TFEATURE( "JCRParser::begin_grammar(), feed() and end_grammar()" )
+{
+    const char * p_jcrs[] = {
+            "#ruleset-id rs1\n$r1 = { \"name\" : string, \"age\" : 0..120 }\n",
+            "; A comment\r\n$r1 = [ integer, $r2 * ]\r\n$r2 = \"a string\"\r\n@{root} { /^p[a-z]+$/ : $r1 }\r\n",
+            "$r1 = @{bad} integer\n$r2 = : integer\n$r3 = 0x12..0x1F\n",
+            "$r1 = { \"name\" : string\n" };
+    const size_t chunk_sizes[] = { 1, 7, 4096 };
+    for( size_t i = 0; i < sizeof( p_jcrs ) / sizeof( p_jcrs[0] ); ++i )
+        for( size_t j = 0; j < sizeof( chunk_sizes ) / sizeof( chunk_sizes[0] ); ++j )
+            TCALL( test_feed( p_jcrs[i], chunk_sizes[j] ) );
+
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    jcr_parser.begin_grammar( "<empty>" );
+    TTEST( jcr_parser.end_grammar() == JCRParser::S_OK );
+    TTEST( grammar_set.size() == 1 );
+}
+
+class ChunkedReader : public cl::reader_incremental
+{
+private:
+    const std::string & r_input;
+    size_t chunk_size;
+    size_t position;
+    size_t max_buffer_size;
+
+    virtual bool read_chunk( std::vector< char > * p_buffer )
+    {
+        max_buffer_size = std::max( max_buffer_size, buffer_size() );
+        if( position >= r_input.size() )
+            return false;
+        size_t size = std::min( chunk_size, r_input.size() - position );
+        p_buffer->insert( p_buffer->end(), r_input.begin() + position, r_input.begin() + position + size );
+        position += size;
+        return true;
+    }
+
+public:
+    ChunkedReader( const std::string & r_input_in, size_t chunk_size_in )
+        : r_input( r_input_in ), chunk_size( chunk_size_in ), position( 0 ), max_buffer_size( 0 )
+    {}
+    size_t get_max_buffer_size() const { return max_buffer_size; }
+};
+
+TFEATURE( "cl::reader_incremental" )
+{
+    std::string jcr( "#ruleset-id rs1\n" );
+    for( size_t i = 0; i < 5000; ++i )
+        clutils::expand_append( &jcr, "$rule_%0 = { \"name\" : string, \"value\" : $rule_%1 ? }\n", clutils::str_args( i ) << i + 1 );
+
+    GrammarSet grammar_set;
+    JCRParser jcr_parser( &grammar_set );
+    ChunkedReader reader( jcr, 64 );
+    TCRITICALTEST( jcr_parser.add_grammar( reader, "<chunked>" ) == JCRParser::S_OK );
+    TCRITICALTEST( grammar_set.size() == 1 );
+    TTEST( grammar_set[0].rules.size() == 5000 );
+    TTEST( grammar_set[0].rules[4999].line_number == 5001 );
+    TTEST( reader.get_max_buffer_size() < 1024 );   // Input the parser can no longer rewind to is released
+}
+
+TFEATURE( "JCRParserWithDiagnostics" )
+{
+    GrammarSet grammar_set;
+    JCRParserWithDiagnostics jcr_parser( &grammar_set );
+    const char * p_jcr = "$r1 = @{bad} integer\n$r2 = : integer\n$r1 = $r3\n";
+    TCRITICALTEST( jcr_parser.add_grammar( p_jcr, strlen( p_jcr ) ) == JCRParser::S_ERROR );
+    size_t n_parse_diagnostics = jcr_parser.diagnostics().size();
+    TTEST( n_parse_diagnostics > 0 );
+    TTEST( jcr_parser.link() == JCRParser::S_ERROR );
+    TCRITICALTEST( jcr_parser.diagnostics().size() > n_parse_diagnostics );
+    TTEST( grammar_set.error_count() + grammar_set.warning_count() == jcr_parser.diagnostics().size() );
+
+    // The messages are those that are reported as text, less any duplicates
+    GrammarSet text_grammar_set;
+    ReportRecorder text_parser( &text_grammar_set, false );
+    TCRITICALTEST( text_parser.add_grammar( p_jcr, strlen( p_jcr ) ) == JCRParser::S_ERROR );
+    text_parser.link();
+    std::string unique_text_reports;
+    std::set< std::string > seen_text_reports;
+    std::istringstream text_reports( text_parser.get_reports() );
+    for( std::string line; std::getline( text_reports, line ); )
+        if( seen_text_reports.insert( line ).second )
+            unique_text_reports += line + "\n";
+    std::string reports;
+    for( size_t i = 0; i < jcr_parser.diagnostics().size(); ++i )
+    {
+        const Diagnostic & r_diagnostic = jcr_parser.diagnostics()[i];
+        clutils::expand_append( &reports, "%0:%1:%2:%3\n", clutils::str_args( r_diagnostic.line ) << r_diagnostic.column <<
+                (r_diagnostic.severity == Severity::FATAL ? "F" : "E") << jcr_parser.diagnostics().message( r_diagnostic ) );
+    }
+    TTEST( reports == unique_text_reports );
+
+    // Linking again reports the same messages, which are not recorded again
+    size_t n_diagnostics = jcr_parser.diagnostics().size();
+    jcr_parser.link();
+    TTEST( jcr_parser.diagnostics().size() == n_diagnostics );
+}
+
+void test_parse_cache( ParseCache * p_parse_cache, const char * p_jcr )
+{
+    TDOC( p_jcr );
+
+    size_t n_hits = p_parse_cache->hits();
+    size_t n_misses = p_parse_cache->misses();
+
+    GrammarSet parsed_grammar_set;
+    ReportRecorder parsed_parser( &parsed_grammar_set, false );
+    parsed_parser.set_parse_cache( p_parse_cache );
+    TCRITICALTEST( parsed_parser.add_grammar( p_jcr, strlen( p_jcr ) ) == JCRParser::S_OK );
+    TTEST( p_parse_cache->hits() == n_hits );
+    TTEST( p_parse_cache->misses() == n_misses + 1 );
+
+    GrammarSet cached_grammar_set;
+    ReportRecorder cached_parser( &cached_grammar_set, false );
+    cached_parser.set_parse_cache( p_parse_cache );
+    TCRITICALTEST( cached_parser.add_grammar( p_jcr, strlen( p_jcr ) ) == JCRParser::S_OK );
+    TTEST( p_parse_cache->hits() == n_hits + 1 );
+    TTEST( p_parse_cache->misses() == n_misses + 1 );
+
+    TCRITICALTEST( cached_grammar_set.size() == 1 );
+    const Grammar & r_parsed = parsed_grammar_set[0];
+    const Grammar & r_cached = cached_grammar_set[0];
+    TTEST( r_cached.p_grammar_set == &cached_grammar_set );
+    TTEST( r_cached.jcr_source == r_parsed.jcr_source );
+    TTEST( r_cached.ruleset_id.str() == r_parsed.ruleset_id.str() );
+    TTEST( r_cached.unaliased_imports == r_parsed.unaliased_imports );
+    TTEST( r_cached.aliased_imports == r_parsed.aliased_imports );
+    TCRITICALTEST( r_cached.rules.size() == r_parsed.rules.size() );
+    for( size_t i = 0; i < r_parsed.rules.size(); ++i )
+    {
+        TTEST( r_cached.rules[i].p_grammar == &r_cached );
+        TCALL( test_same_rule( r_cached.rules[i], r_parsed.rules[i] ) );
+    }
+
+    // The cached Grammar links as the parsed one does
+    TTEST( cached_parser.link() == parsed_parser.link() );
+    TTEST( cached_parser.get_reports() == parsed_parser.get_reports() );
+}
+
+TFEATURE( "ParseCache" )
+{
+    const char * p_directory = "test-parse-cache";
+    ParseCache parse_cache( p_directory );
+    TTEST( parse_cache.hits() == 0 );
+    TTEST( parse_cache.misses() == 0 );
+
+    const char * p_jcrs[] = {
+            "$r1 = integer\n",
+            "#ruleset-id rs1\n#import rs2\n#import rs3 as r3\n$r1 = { \"name\" : string, \"age\" : 0..120 }\n",
+            "; A comment\r\n$r1 = [ integer, $r2 * ]\r\n$r2 = \"a string\"\r\n@{root} { /^p[a-z]+$/ : $r1 }\r\n",
+            "$r1 = @{not} @{unordered} [ 2..4, string *3..%2 ]\n$r2 = @{exclude-min} @{exclude-max} -1.5..2.25\n",
+            "$r1 = @{default 12} @{format date} @{augments $r2 $r3} 0..\n$r2 = { \"a\" : $r3 | \"b\" : true }\n$r3 = 18..31\n$r4 = 10000000000000000000\n",
+            "$r1 = ( integer | string | ( float, null ) )\n$r2 = /^[a-z]+$/\n$r3 = false\n$r4 = @{root} $r1\n" };
+    std::vector< std::string > file_names;
+    for( size_t i = 0; i < sizeof( p_jcrs ) / sizeof( p_jcrs[0] ); ++i )
+    {
+        TCALL( test_parse_cache( &parse_cache, p_jcrs[i] ) );
+        file_names.push_back( parse_cache.file_name( p_jcrs[i], strlen( p_jcrs[i] ) ) );
+    }
+
+    // The entries are named by the source's bytes
+    TTEST( file_names[0] != file_names[1] );
+    TTEST( file_names[0] == parse_cache.file_name( p_jcrs[0], strlen( p_jcrs[0] ) ) );
+    TTEST( file_names[0].find( p_directory ) == 0 );
+
+    // Grammars with warnings or errors aren't cached, so their messages are always reported
+    const char * p_bad_jcrs[] = {
+            "$r1 = @{bad} integer\n",
+            "$r1 = { \"name\" : string\n" };
+    for( size_t i = 0; i < sizeof( p_bad_jcrs ) / sizeof( p_bad_jcrs[0] ); ++i )
+    {
+        TDOC( p_bad_jcrs[i] );
+        std::string first_reports;
+        for( size_t j = 0; j < 2; ++j )
+        {
+            size_t n_hits = parse_cache.hits();
+            GrammarSet grammar_set;
+            ReportRecorder jcr_parser( &grammar_set, false );
+            jcr_parser.set_parse_cache( &parse_cache );
+            jcr_parser.add_grammar( p_bad_jcrs[i], strlen( p_bad_jcrs[i] ) );
+            TTEST( parse_cache.hits() == n_hits );
+            TTEST( ! jcr_parser.get_reports().empty() );
+            if( j == 0 )
+                first_reports = jcr_parser.get_reports();
+            else
+                TTEST( jcr_parser.get_reports() == first_reports );
+        }
+        file_names.push_back( parse_cache.file_name( p_bad_jcrs[i], strlen( p_bad_jcrs[i] ) ) );
+        TTEST( ! std::ifstream( file_names.back().c_str() ).good() );
+    }
+
+    // A damaged entry is a miss, and is replaced
+    {
+        std::ofstream fout( file_names[1].c_str(), std::ios::binary | std::ios::in | std::ios::out );
+        fout.seekp( 100 );
+        fout.put( '\xff' );
+    }
+    std::ofstream( file_names[2].c_str(), std::ios::binary ) << "JCRC";
+    for( size_t i = 1; i <= 2; ++i )
+    {
+        size_t n_misses = parse_cache.misses();
+        GrammarSet grammar_set;
+        JCRParser jcr_parser( &grammar_set );
+        jcr_parser.set_parse_cache( &parse_cache );
+        TTEST( jcr_parser.add_grammar( p_jcrs[i], strlen( p_jcrs[i] ) ) == JCRParser::S_OK );
+        TTEST( parse_cache.misses() == n_misses + 1 );
+        TTEST( grammar_set.size() == 1 );
+
+        size_t n_hits = parse_cache.hits();
+        GrammarSet replaced_grammar_set;
+        JCRParser replaced_parser( &replaced_grammar_set );
+        replaced_parser.set_parse_cache( &parse_cache );
+        TTEST( replaced_parser.add_grammar( p_jcrs[i], strlen( p_jcrs[i] ) ) == JCRParser::S_OK );
+        TTEST( parse_cache.hits() == n_hits + 1 );
+        TCRITICALTEST( replaced_grammar_set.size() == 1 );
+        TTEST( replaced_grammar_set[0].rules.size() == grammar_set[0].rules.size() );
+    }
+
+    // The ParseCache is shared by the threads of add_grammars()
+    write_file( "test-parse-cache-1.jcr", p_jcrs[4] );
+    write_file( "test-parse-cache-2.jcr", p_jcrs[5] );
+    std::vector< std::string > jcr_files;
+    jcr_files.push_back( "test-parse-cache-1.jcr" );
+    jcr_files.push_back( "test-parse-cache-2.jcr" );
+    for( size_t i = 0; i < 2; ++i )
+    {
+        size_t n_hits = parse_cache.hits();
+        GrammarSet grammar_set;
+        JCRParser jcr_parser( &grammar_set );
+        jcr_parser.set_parse_cache( &parse_cache );
+        TTEST( jcr_parser.add_grammars( jcr_files, 2 ) == JCRParser::S_OK );
+        TTEST( parse_cache.hits() == n_hits + 2 );
+        TCRITICALTEST( grammar_set.size() == 2 );
+        TTEST( grammar_set[0].jcr_source == "test-parse-cache-1.jcr" );
+        TTEST( grammar_set[1].rules.size() == 4 );
+        TTEST( jcr_parser.link() == JCRParser::S_OK );
+    }
+    remove( "test-parse-cache-1.jcr" );
+    remove( "test-parse-cache-2.jcr" );
+
+    for( size_t i = 0; i < file_names.size(); ++i )
+        remove( file_names[i].c_str() );
+    remove( p_directory );
+}